@@ -0,0 +1,249 @@
+/*
+* A minimal microbenchmark harness in the style of Google Benchmark, without the dependency.
+*
+* Each benchmark is a function taking a BenchState and looping while keep_running() returns
+* true; anything before the loop is setup and isn't timed, pause_timing()/resume_timing() leave
+* out work inside the loop. The iteration count grows until a run takes at least the minimum
+* time. Results are printed as a table and optionally written as JSON in the same layout
+* Google Benchmark uses (so its compare.py works on two runs).
+*
+* flags: --filter=substring --min-time=seconds --json=path (- for stdout)
+*/
+
+#ifndef BENCHHARNESS_H
+#define BENCHHARNESS_H
+
+#include <nlohmann/json.hpp>
+#include<algorithm>
+#include<chrono>
+#include<cstdint>
+#include<ctime>
+#include<fstream>
+#include<functional>
+#include<iomanip>
+#include<iostream>
+#include<string>
+#include<thread>
+#include<vector>
+
+#include<unistd.h>
+
+/*generated on every build by the fondue_git_commit target*/
+#ifdef FONDUE_GIT_COMMIT_HEADER
+#include "FondueGitCommit.h"
+#endif
+#ifndef FONDUE_GIT_COMMIT
+#define FONDUE_GIT_COMMIT ""
+#endif
+
+#define BENCH_DEFAULT_MIN_TIME_SECONDS 0.5
+#define BENCH_MAX_ITERATIONS 1000000000
+
+class BenchState
+{
+    private:
+        uint64_t m_iterations;
+        uint64_t m_remaining;
+        uint64_t m_items_processed {};
+        bool m_started {false};
+        bool m_paused {false};
+        std::chrono::steady_clock::time_point m_real_start {};
+        std::chrono::duration<double> m_real_elapsed {};
+        double m_cpu_start {};
+        double m_cpu_elapsed {};
+        std::string m_error {};
+
+        static double thread_cpu_seconds()
+        {
+            struct timespec now {};
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+            return now.tv_sec + now.tv_nsec / 1e9;
+        }
+
+    public:
+        explicit BenchState(uint64_t iterations):
+            m_iterations {iterations},
+            m_remaining {iterations}
+        {
+        }
+
+        /*true once per iteration, starts the clock on the first call and stops it after the last*/
+        bool keep_running()
+        {
+            if (!m_started)
+            {
+                m_started = true;
+                resume_timing();
+            }
+            if (m_remaining > 0 && m_error.empty())
+            {
+                m_remaining--;
+                return true;
+            }
+            if (!m_paused)
+                pause_timing();
+            return false;
+        }
+
+        void pause_timing()
+        {
+            m_real_elapsed += std::chrono::steady_clock::now() - m_real_start;
+            m_cpu_elapsed += thread_cpu_seconds() - m_cpu_start;
+            m_paused = true;
+        }
+
+        void resume_timing()
+        {
+            m_paused = false;
+            m_cpu_start = thread_cpu_seconds();
+            m_real_start = std::chrono::steady_clock::now();
+        }
+
+        /*e.g. samples, reported as items per second*/
+        void set_items_processed(uint64_t items) {m_items_processed = items;}
+
+        /*stops the benchmark and reports the error instead of a time*/
+        void skip_with_error(const std::string& error) {m_error = error;}
+
+        uint64_t iterations() const {return m_iterations;}
+        uint64_t items_processed() const {return m_items_processed;}
+        double real_seconds() const {return m_real_elapsed.count();}
+        double cpu_seconds() const {return m_cpu_elapsed;}
+        const std::string& error() const {return m_error;}
+};
+
+class BenchRunner
+{
+    public:
+        using BenchFunction = std::function<void(BenchState&)>;
+
+    private:
+        struct Benchmark
+        {
+            std::string name;
+            BenchFunction function;
+        };
+
+        std::vector<Benchmark> m_benchmarks {};
+
+    public:
+        void add(const std::string& name, BenchFunction function)
+        {
+            m_benchmarks.push_back({name, std::move(function)});
+        }
+
+        /*runs every benchmark matching the filter, returns the process exit code*/
+        int run(int argc, char* argv[])
+        {
+            std::string filter {}, json_path {};
+            double min_time {BENCH_DEFAULT_MIN_TIME_SECONDS};
+            for (int i = 1; i < argc; i++)
+            {
+                std::string arg {argv[i]};
+                if (arg.rfind("--filter=", 0) == 0)
+                    filter = arg.substr(9);
+                else if (arg.rfind("--min-time=", 0) == 0)
+                    min_time = std::stod(arg.substr(11));
+                else if (arg.rfind("--json=", 0) == 0)
+                    json_path = arg.substr(7);
+                else
+                {
+                    std::cerr << "usage: " << argv[0] << " [--filter=substring] [--min-time=seconds] [--json=path]\n";
+                    return 1;
+                }
+            }
+
+            char host_name[256] {};
+            gethostname(host_name, sizeof(host_name) - 1);
+            nlohmann::json results = {{"context", {{"date", current_date()}, {"host_name", host_name},
+                                                   {"executable", argv[0]}, {"num_cpus", std::thread::hardware_concurrency()},
+                                                   {"git_commit", FONDUE_GIT_COMMIT},
+#ifdef NDEBUG
+                                                   {"library_build_type", "release"}
+#else
+                                                   {"library_build_type", "debug"}
+#endif
+                                                  }},
+                                      {"benchmarks", nlohmann::json::array()}};
+
+            std::ostream& table = json_path == "-" ? std::cerr : std::cout;
+            table << std::left << std::setw(40) << "benchmark" << std::right << std::setw(14) << "real ns"
+                  << std::setw(14) << "cpu ns" << std::setw(14) << "iterations" << std::setw(16) << "items/s" << '\n';
+            int failures {};
+
+            for (const Benchmark& benchmark : m_benchmarks)
+            {
+                if (!filter.empty() && benchmark.name.find(filter) == std::string::npos)
+                    continue;
+
+                /*grow the iteration count until one run is long enough to time*/
+                uint64_t iterations {1};
+                while (true)
+                {
+                    BenchState state {iterations};
+                    benchmark.function(state);
+
+                    if (!state.error().empty())
+                    {
+                        table << std::left << std::setw(40) << benchmark.name << " error: " << state.error() << '\n';
+                        results["benchmarks"].push_back({{"name", benchmark.name}, {"error_occurred", true},
+                                                         {"error_message", state.error()}});
+                        failures++;
+                        break;
+                    }
+
+                    if (state.real_seconds() >= min_time || iterations >= BENCH_MAX_ITERATIONS)
+                    {
+                        double real_ns = state.real_seconds() * 1e9 / iterations;
+                        double cpu_ns = state.cpu_seconds() * 1e9 / iterations;
+                        nlohmann::json result = {{"name", benchmark.name}, {"run_name", benchmark.name},
+                                                 {"run_type", "iteration"}, {"iterations", iterations},
+                                                 {"real_time", real_ns}, {"cpu_time", cpu_ns}, {"time_unit", "ns"}};
+                        table << std::left << std::setw(40) << benchmark.name << std::right << std::fixed
+                              << std::setprecision(1) << std::setw(14) << real_ns << std::setw(14) << cpu_ns
+                              << std::setw(14) << iterations;
+                        if (state.items_processed() && state.cpu_seconds() > 0)
+                        {
+                            result["items_per_second"] = state.items_processed() / state.cpu_seconds();
+                            table << std::setw(16) << std::setprecision(0) << state.items_processed() / state.cpu_seconds();
+                        }
+                        table << '\n';
+                        results["benchmarks"].push_back(result);
+                        break;
+                    }
+
+                    /*aim a little past the minimum time, never more than 100 times longer per step*/
+                    double multiplier = state.real_seconds() > 0 ? 1.4 * min_time / state.real_seconds() : 100;
+                    iterations = std::min<uint64_t>(BENCH_MAX_ITERATIONS,
+                                                    std::max<uint64_t>(iterations + 1, iterations * std::min(multiplier, 100.0)));
+                }
+            }
+
+            if (json_path == "-")
+            {
+                std::cout << results.dump(2) << '\n';
+            }
+            else if (!json_path.empty())
+            {
+                std::ofstream file {json_path};
+                file << results.dump(2) << '\n';
+                if (!file)
+                {
+                    std::cerr << "could not write " << json_path << '\n';
+                    return 1;
+                }
+            }
+            return failures ? 1 : 0;
+        }
+
+    private:
+        static std::string current_date()
+        {
+            std::time_t now = std::time(nullptr);
+            char date[64] {};
+            std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", std::localtime(&now));
+            return date;
+        }
+};
+
+#endif
@@ -0,0 +1,133 @@
+/*
+* Measures round trip latency of the control socket under load.
+*
+* usage: fondue_control_bench [socket path] [clients] [requests per client] [command]
+*
+* Every client connects to the running fondue's control socket and sends its requests one
+* after another, waiting for each response. The default command is "ping" which measures the
+* server alone, use e.g. "active-source" to include the cost of the command itself.
+*/
+
+#include <nlohmann/json.hpp>
+#include<algorithm>
+#include<chrono>
+#include<cstring>
+#include<iomanip>
+#include<iostream>
+#include<mutex>
+#include<string>
+#include<thread>
+#include<vector>
+
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<unistd.h>
+
+using json = nlohmann::json;
+
+int connect_to_socket(const std::string& socket_path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+    if (fd < 0 || connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*sends requests one at a time, appending each round trip time to latencies*/
+bool run_client(const std::string& socket_path, int requests, const std::string& command,
+                std::vector<double>& latencies)
+{
+    int fd = connect_to_socket(socket_path);
+    if (fd < 0)
+        return false;
+
+    std::string buffer {};
+    char chunk[4096];
+
+    for (int i = 0; i < requests; i++)
+    {
+        std::string request {json {{"id", i}, {"command", command}}.dump() + "\n"};
+        auto start = std::chrono::steady_clock::now();
+
+        if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size()))
+        {
+            close(fd);
+            return false;
+        }
+
+        while (buffer.find('\n') == std::string::npos)
+        {
+            ssize_t nread = read(fd, chunk, sizeof(chunk));
+            if (nread <= 0)
+            {
+                close(fd);
+                return false;
+            }
+            buffer.append(chunk, nread);
+        }
+        buffer.erase(0, buffer.find('\n') + 1);
+
+        std::chrono::duration<double, std::micro> latency = std::chrono::steady_clock::now() - start;
+        latencies.push_back(latency.count());
+    }
+
+    close(fd);
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string socket_path {argc > 1 ? argv[1] : "/tmp/fondue.sock"};
+    int clients {argc > 2 ? std::stoi(argv[2]) : 16};
+    int requests {argc > 3 ? std::stoi(argv[3]) : 1000};
+    std::string command {argc > 4 ? argv[4] : "ping"};
+
+    std::vector<std::vector<double>> latencies (clients);
+    std::vector<std::thread> threads {};
+    std::mutex failures_mtx;
+    int failures {};
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < clients; i++)
+    {
+        threads.emplace_back([&, i]
+        {
+            if (!run_client(socket_path, requests, command, latencies[i]))
+            {
+                std::lock_guard<std::mutex> lock (failures_mtx);
+                failures++;
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    std::chrono::duration<double> wall_time = std::chrono::steady_clock::now() - start;
+
+    std::vector<double> all {};
+    for (const auto& client : latencies)
+        all.insert(all.end(), client.begin(), client.end());
+
+    if (all.empty())
+    {
+        std::cout << "no responses received, is fondue running with its control socket at " << socket_path << "?\n";
+        return 1;
+    }
+
+    std::sort(all.begin(), all.end());
+    auto percentile = [&all](double p){return all[std::min(all.size() - 1, static_cast<std::size_t>(p / 100.0 * all.size()))];};
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << clients << " clients x " << requests << " \"" << command << "\" requests, "
+              << failures << " clients failed\n";
+    std::cout << "throughput: " << all.size() / wall_time.count() << " requests/s\n";
+    std::cout << "round trip (us): p50 " << percentile(50) << ", p90 " << percentile(90)
+              << ", p99 " << percentile(99) << ", p99.9 " << percentile(99.9) << ", max " << all.back() << '\n';
+    return failures ? 1 : 0;
+}
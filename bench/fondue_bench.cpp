@@ -0,0 +1,553 @@
+/*
+* Microbenchmarks of the audio hot path.
+*
+* usage: fondue_bench [--filter=substring] [--min-time=seconds] [--json=path]
+*
+* Everything runs against an mp3 sink writing to /dev/null, with SourceTimingModes::freetime so
+* nothing sleeps. The file source benchmarks decode mp3s of white noise which are written to
+* /tmp first, one at the sink's rate and one at 48 kHz which every source opened from it resamples. Write the results as json with --json and compare two commits with Google
+* Benchmark's tools/compare.py, the commit the binary was built from is in the json context.
+*/
+
+#include "BenchHarness.h"
+#include "Fonduempeg.h"
+#include "AudioChannel.h"
+#include "ConfigStore.h"
+
+#include<cstring>
+#include<memory>
+#include<random>
+#include<vector>
+
+#define BENCH_SINK_PROMPT "-f mp3 /dev/null"
+#define BENCH_NULL_SINK_PROMPT "-f null -"
+#define BENCH_SOURCE_FILE "/tmp/fondue_bench_source.mp3"
+#define BENCH_48K_SOURCE_FILE "/tmp/fondue_bench_source_48k.mp3"
+#define BENCH_SOURCE_SECONDS 30
+/*the size of an mp3 frame, which is what the decoder hands the resampler*/
+#define BENCH_DECODED_FRAME_SAMPLES 1152
+#define BENCH_CONFIG_FILE "/tmp/fondue_bench_config.json"
+/*sources in the config the descriptor benchmarks load and look up*/
+#define BENCH_CONFIG_SOURCES 5000
+
+using json = nlohmann::json;
+
+/*writes white noise through an mp3 sink so the file source benchmarks have something to decode, at the
+* sink's rate if sample_rate is 0*/
+void write_source_file(const std::string& path, int sample_rate = 0)
+{
+    FFMPEGString prompt {"-f mp3 " + (sample_rate ? "-ar " + std::to_string(sample_rate) + " " : std::string{}) + path};
+    OutputStream file_sink {prompt};
+    InputStream noise {file_sink.get_output_codec_context(), DefaultSourceModes::white_noise, SourceTimingModes::freetime};
+    const int64_t samples = static_cast<int64_t>(BENCH_SOURCE_SECONDS) * file_sink.get_output_codec_context().sample_rate;
+
+    while (file_sink.get_samples_written() < samples)
+    {
+        noise.get_one_output_frame();
+        file_sink.write_frame(noise);
+    }
+    file_sink.finish_streaming();
+}
+
+std::unique_ptr<InputStream> open_source_file(const AVCodecContext& output_codec_ctx, bool resampled = false)
+{
+    static const SourceDescriptor descriptor {std::string{"-i "} + BENCH_SOURCE_FILE};
+    static const SourceDescriptor resampled_descriptor {std::string{"-i "} + BENCH_48K_SOURCE_FILE};
+    return std::make_unique<InputStream>(resampled ? resampled_descriptor : descriptor, output_codec_ctx,
+                                         SourceTimingModes::freetime, DefaultSourceModes::silence);
+}
+
+/*prompts of the shapes found in real configs, files, streams with options and raw inputs with quoted urls*/
+std::vector<std::string> bench_source_prompts()
+{
+    std::vector<std::string> prompts {};
+    for (int i = 0; i < BENCH_CONFIG_SOURCES; i++)
+    {
+        switch (i % 3)
+        {
+            case 0:
+                prompts.push_back("-i /srv/audio/source_" + std::to_string(i) + ".mp3");
+                break;
+            case 1:
+                prompts.push_back("-reconnect 1 -reconnect_delay_max 5 -probesize 32768 -f mp3 -i http://radio.example/stream_"
+                                  + std::to_string(i));
+                break;
+            default:
+                prompts.push_back("-f s16le -ar 48000 -ac 2 -i '/srv/audio/raw captures/" + std::to_string(i) + ".pcm'");
+                break;
+        }
+    }
+    return prompts;
+}
+
+void fill_with_noise(float* samples, int nb_samples)
+{
+    std::mt19937 generator {1};
+    std::uniform_real_distribution<float> distribution {-0.5f, 0.5f};
+    for (int i = 0; i < nb_samples; i++)
+        samples[i] = distribution(generator);
+}
+
+/*a fixed size planar float ring, the simplest possible replacement for av_audio_fifo*/
+class PlanarRing
+{
+    private:
+        std::vector<std::vector<float>> m_planes;
+        std::size_t m_mask;
+        std::size_t m_read {};
+        std::size_t m_write {};
+
+    public:
+        /*capacity is rounded up to a power of two*/
+        PlanarRing(int channels, std::size_t capacity):
+            m_planes(channels)
+        {
+            std::size_t size {1};
+            while (size < capacity)
+                size <<= 1;
+            m_mask = size - 1;
+            for (auto& plane : m_planes)
+                plane.resize(size);
+        }
+
+        bool write(float* const* data, std::size_t nb_samples)
+        {
+            if (m_write - m_read + nb_samples > m_mask + 1)
+                return false;
+            std::size_t start = m_write & m_mask;
+            std::size_t first = std::min(nb_samples, m_mask + 1 - start);
+            for (std::size_t channel = 0; channel < m_planes.size(); channel++)
+            {
+                std::memcpy(m_planes[channel].data() + start, data[channel], first * sizeof(float));
+                std::memcpy(m_planes[channel].data(), data[channel] + first, (nb_samples - first) * sizeof(float));
+            }
+            m_write += nb_samples;
+            return true;
+        }
+
+        bool read(float** data, std::size_t nb_samples)
+        {
+            if (m_write - m_read < nb_samples)
+                return false;
+            std::size_t start = m_read & m_mask;
+            std::size_t first = std::min(nb_samples, m_mask + 1 - start);
+            for (std::size_t channel = 0; channel < m_planes.size(); channel++)
+            {
+                std::memcpy(data[channel], m_planes[channel].data() + start, first * sizeof(float));
+                std::memcpy(data[channel] + first, m_planes[channel].data(), (nb_samples - first) * sizeof(float));
+            }
+            m_read += nb_samples;
+            return true;
+        }
+};
+
+/*the swr_convert at the heart of InputStream::resample_one_input_frame: one decoded stereo FLTP
+* frame at input_rate into the sink's format and rate, with the profile's resampler from the cache*/
+BenchRunner::BenchFunction resample_benchmark(const AVCodecContext& output_codec_ctx, int input_rate,
+                                              ResamplerProfiles profile = ResamplerProfiles::standard)
+{
+    return [&output_codec_ctx, input_rate, profile](BenchState& state)
+    {
+        AVChannelLayout stereo = AV_CHANNEL_LAYOUT_STEREO;
+        CachedResampler swr_ctx {};
+        try
+        {
+            swr_ctx = resampler_cache.acquire(stereo, input_rate, AV_SAMPLE_FMT_FLTP, output_codec_ctx.ch_layout,
+                                              output_codec_ctx.sample_rate, output_codec_ctx.sample_fmt,
+                                              resampler_profile_options(profile));
+        }
+        catch (const char* exception)
+        {
+            state.skip_with_error(exception);
+            return;
+        }
+
+        std::vector<float> left(BENCH_DECODED_FRAME_SAMPLES), right(BENCH_DECODED_FRAME_SAMPLES);
+        fill_with_noise(left.data(), BENCH_DECODED_FRAME_SAMPLES);
+        fill_with_noise(right.data(), BENCH_DECODED_FRAME_SAMPLES);
+        const uint8_t* input[2] {reinterpret_cast<const uint8_t*>(left.data()), reinterpret_cast<const uint8_t*>(right.data())};
+
+        uint8_t** output {};
+        int output_capacity = swr_get_out_samples(swr_ctx.get(), BENCH_DECODED_FRAME_SAMPLES) + 64;
+        av_samples_alloc_array_and_samples(&output, NULL, output_codec_ctx.ch_layout.nb_channels, output_capacity,
+                                           output_codec_ctx.sample_fmt, 0);
+
+        while (state.keep_running())
+        {
+            if (swr_convert(swr_ctx.get(), output, output_capacity, input, BENCH_DECODED_FRAME_SAMPLES) < 0)
+                state.skip_with_error("swr_convert failed");
+        }
+        state.set_items_processed(state.iterations() * BENCH_DECODED_FRAME_SAMPLES);
+
+        av_freep(&output[0]);
+        av_freep(&output);
+    };
+}
+
+BenchRunner::BenchFunction synthetic_source_benchmark(const AVCodecContext& output_codec_ctx, DefaultSourceModes mode)
+{
+    return [&output_codec_ctx, mode](BenchState& state)
+    {
+        InputStream source {output_codec_ctx, mode, SourceTimingModes::freetime};
+        while (state.keep_running())
+            source.get_one_output_frame();
+        state.set_items_processed(state.iterations() * source.get_frame()->nb_samples);
+    };
+}
+
+/*OutputStream::write_frame (gain, level meter, encode and mux) of one synthetic frame per iteration*/
+BenchRunner::BenchFunction write_frame_benchmark(const std::string& sink_prompt)
+{
+    return [sink_prompt](BenchState& state)
+    {
+        FFMPEGString prompt {sink_prompt};
+        OutputStream sink {prompt};
+        InputStream source {sink.get_output_codec_context(), DefaultSourceModes::white_noise, SourceTimingModes::freetime};
+        source.get_one_output_frame();
+
+        while (state.keep_running())
+        {
+            if (sink.write_frame(source) < 0)
+                state.skip_with_error("write_frame failed");
+        }
+        state.set_items_processed(state.iterations() * source.get_frame()->nb_samples);
+    };
+}
+
+int main(int argc, char* argv[])
+{
+    av_log_set_level(AV_LOG_ERROR);
+    BenchRunner runner {};
+
+    FFMPEGString sink_prompt {BENCH_SINK_PROMPT};
+    OutputStream sink {sink_prompt};
+    const AVCodecContext& output_codec_ctx {sink.get_output_codec_context()};
+    const int frame_size {output_codec_ctx.frame_size > 0 ? output_codec_ctx.frame_size : DEFAULT_FRAME_SIZE};
+
+    try
+    {
+        write_source_file(BENCH_SOURCE_FILE);
+        write_source_file(BENCH_48K_SOURCE_FILE, 48000);
+    }
+    catch (const char* exception)
+    {
+        std::cerr << exception << ": file source benchmarks will fail\n";
+    }
+
+    runner.add("get_one_output_frame/mp3_file", [&](BenchState& state)
+    {
+        std::unique_ptr<InputStream> source {};
+        try
+        {
+            source = open_source_file(output_codec_ctx);
+        }
+        catch (const char* exception)
+        {
+            state.skip_with_error(exception);
+            return;
+        }
+
+        while (state.keep_running())
+        {
+            try
+            {
+                source->get_one_output_frame();
+            }
+            /*start the file again when it runs out, without counting the time to open it*/
+            catch (const char*)
+            {
+                state.pause_timing();
+                source = open_source_file(output_codec_ctx);
+                source->get_one_output_frame();
+                state.resume_timing();
+            }
+        }
+        state.set_items_processed(state.iterations() * frame_size);
+    });
+
+    runner.add("get_one_output_frame/white_noise", synthetic_source_benchmark(output_codec_ctx, DefaultSourceModes::white_noise));
+    runner.add("get_one_output_frame/silence", synthetic_source_benchmark(output_codec_ctx, DefaultSourceModes::silence));
+
+    runner.add("resample_one_input_frame/48000_fltp", resample_benchmark(output_codec_ctx, 48000));
+    for (ResamplerProfiles profile : {ResamplerProfiles::fast, ResamplerProfiles::high, ResamplerProfiles::soxr})
+        runner.add(std::string{"resample_one_input_frame/48000_fltp_"} + resampler_profile_name(profile),
+                   resample_benchmark(output_codec_ctx, 48000, profile));
+    runner.add("resample_one_input_frame/same_rate_fltp", resample_benchmark(output_codec_ctx, output_codec_ctx.sample_rate));
+
+    /*one frame in and one frame out of a queue sized the way InputStream sizes its own*/
+    runner.add("queue/av_audio_fifo", [&](BenchState& state)
+    {
+        AVAudioFifo* fifo = av_audio_fifo_alloc(AV_SAMPLE_FMT_FLTP, 2, DEFAULT_QUEUE_CAPACITY_FRAMES * frame_size);
+        std::vector<float> left(frame_size), right(frame_size);
+        fill_with_noise(left.data(), frame_size);
+        void* planes[2] {left.data(), right.data()};
+
+        while (state.keep_running())
+        {
+            av_audio_fifo_write(fifo, planes, frame_size);
+            av_audio_fifo_read(fifo, planes, frame_size);
+        }
+        state.set_items_processed(state.iterations() * frame_size);
+        av_audio_fifo_free(fifo);
+    });
+
+    runner.add("queue/planar_ring", [&](BenchState& state)
+    {
+        PlanarRing ring {2, static_cast<std::size_t>(DEFAULT_QUEUE_CAPACITY_FRAMES * frame_size)};
+        std::vector<float> left(frame_size), right(frame_size);
+        fill_with_noise(left.data(), frame_size);
+        float* planes[2] {left.data(), right.data()};
+
+        while (state.keep_running())
+        {
+            ring.write(planes, frame_size);
+            ring.read(planes, frame_size);
+        }
+        state.set_items_processed(state.iterations() * frame_size);
+    });
+
+    /*a fade long enough never to finish, between two synthetic sources*/
+    runner.add("crossfade_frame", [&](BenchState& state)
+    {
+        InputStream source {output_codec_ctx, DefaultSourceModes::white_noise, SourceTimingModes::freetime};
+        InputStream new_source {output_codec_ctx, DefaultSourceModes::white_noise, SourceTimingModes::freetime};
+        const int fade_samples {1 << 30};
+        int fade_samples_remaining {fade_samples};
+        int64_t start_delay {};
+
+        while (state.keep_running())
+        {
+            new_source.get_one_output_frame();
+            source.crossfade_frame(new_source.get_frame(), fade_samples_remaining, fade_samples, start_delay);
+        }
+        state.set_items_processed(state.iterations() * frame_size);
+    });
+
+    /*the same between two 48 kHz files, so each frame of the fade also decodes and resamples both sources, the
+    * cost of a real switch between two sources at another rate than the output*/
+    runner.add("crossfade_frame/mp3_48k_files", [&](BenchState& state)
+    {
+        std::unique_ptr<InputStream> source {}, new_source {};
+        const int fade_samples {1 << 30};
+        int fade_samples_remaining {fade_samples};
+        int64_t start_delay {};
+        try
+        {
+            source = open_source_file(output_codec_ctx, true);
+            new_source = open_source_file(output_codec_ctx, true);
+        }
+        catch (const char* exception)
+        {
+            state.skip_with_error(exception);
+            return;
+        }
+
+        while (state.keep_running())
+        {
+            try
+            {
+                new_source->get_one_output_frame();
+                source->crossfade_frame(new_source->get_frame(), fade_samples_remaining, fade_samples, start_delay);
+            }
+            /*start both files again when one runs out, without counting the time to open them*/
+            catch (const char*)
+            {
+                state.pause_timing();
+                source = open_source_file(output_codec_ctx, true);
+                new_source = open_source_file(output_codec_ctx, true);
+                state.resume_timing();
+            }
+        }
+        state.set_items_processed(state.iterations() * frame_size);
+    });
+
+    /*compiling one source prompt (tokenizing, finding the format and decoder, building the options) as a config
+    * load does*/
+    const std::vector<std::string> source_prompts {bench_source_prompts()};
+    runner.add("source_descriptor/compile", [&](BenchState& state)
+    {
+        std::size_t next {};
+        while (state.keep_running())
+        {
+            SourceDescriptorPtr descriptor {compile_source_descriptor(source_prompts[next])};
+            if (!descriptor->valid())
+                state.skip_with_error(descriptor->error());
+            next = (next + 1) % source_prompts.size();
+        }
+        state.set_items_processed(state.iterations());
+    });
+
+    /*loading (and compiling) a config with BENCH_CONFIG_SOURCES sources, then looking its sources up by name*/
+    json bench_config {{"sources", json::object()}};
+    for (std::size_t i = 0; i < source_prompts.size(); i++)
+        bench_config["sources"]["source " + std::to_string(i)] = source_prompts[i];
+    write_config_file(bench_config, BENCH_CONFIG_FILE);
+
+    runner.add("source_descriptor/config_load", [&](BenchState& state)
+    {
+        while (state.keep_running())
+        {
+            ConfigStore config_store {BENCH_CONFIG_FILE};
+            /*stopping its writer thread is part of closing the config, not loading it*/
+            state.pause_timing();
+            if (config_store.number_of_sources() != source_prompts.size())
+                state.skip_with_error("config lost sources");
+            state.resume_timing();
+        }
+        state.set_items_processed(state.iterations() * source_prompts.size());
+    });
+
+    runner.add("source_descriptor/lookup", [&](BenchState& state)
+    {
+        ConfigStore config_store {BENCH_CONFIG_FILE};
+        std::vector<std::string> names {};
+        for (std::size_t i = 0; i < source_prompts.size(); i++)
+            names.push_back("source " + std::to_string((i * 7919) % source_prompts.size()));
+
+        std::size_t next {};
+        while (state.keep_running())
+        {
+            if (!config_store.find_descriptor(names[next]))
+                state.skip_with_error("source not found");
+            next = (next + 1) % names.size();
+        }
+        state.set_items_processed(state.iterations());
+    });
+
+    /*constructing a synthetic source: its output frame, three resamplers (one of them the crossfade's) and the
+    * mixing frames, with the resampler cache warm (the usual case) and emptied before every source*/
+    runner.add("source_open/synthetic", [&](BenchState& state)
+    {
+        while (state.keep_running())
+        {
+            auto source = std::make_unique<InputStream>(output_codec_ctx, DefaultSourceModes::silence, SourceTimingModes::freetime);
+            /*handing the resamplers back to the cache is part of closing a source, not opening one*/
+            state.pause_timing();
+            source.reset();
+            state.resume_timing();
+        }
+        state.set_items_processed(state.iterations());
+    });
+
+    runner.add("source_open/synthetic_uncached", [&](BenchState& state)
+    {
+        resampler_cache.clear();
+        while (state.keep_running())
+        {
+            auto source = std::make_unique<InputStream>(output_codec_ctx, DefaultSourceModes::silence, SourceTimingModes::freetime);
+            state.pause_timing();
+            source.reset();
+            resampler_cache.clear();
+            state.resume_timing();
+        }
+        state.set_items_processed(state.iterations());
+    });
+
+    /*a repeated switch to the same file source, from opening it to its first output frame, with the decoder pool
+    * warm (the decoder from the last switch is flushed and reused) and emptied before every switch*/
+    auto file_open_benchmark = [&](bool pooled)
+    {
+        return [&, pooled](BenchState& state)
+        {
+            decoder_pool.clear();
+            while (state.keep_running())
+            {
+                try
+                {
+                    std::unique_ptr<InputStream> source {open_source_file(output_codec_ctx)};
+                    source->get_one_output_frame();
+                    state.pause_timing();
+                    source.reset();
+                    if (!pooled)
+                        decoder_pool.clear();
+                    state.resume_timing();
+                }
+                catch (const char* exception)
+                {
+                    state.skip_with_error(exception);
+                    return;
+                }
+            }
+            state.set_items_processed(state.iterations());
+        };
+    };
+    runner.add("source_open/mp3_file", file_open_benchmark(true));
+    runner.add("source_open/mp3_file_unpooled", file_open_benchmark(false));
+
+    /*a repeated switch to a 48 kHz file, which the 44.1 kHz sink makes resample, with the resampler cache warm
+    * (the context from the last switch is reset and reused, its filter bank kept) and emptied before every
+    * switch. the decoder pool stays warm in both so the difference is building the resamplers*/
+    auto resampled_open_benchmark = [&](bool cached)
+    {
+        return [&, cached](BenchState& state)
+        {
+            resampler_cache.clear();
+            while (state.keep_running())
+            {
+                try
+                {
+                    std::unique_ptr<InputStream> source {open_source_file(output_codec_ctx, true)};
+                    source->get_one_output_frame();
+                    state.pause_timing();
+                    source.reset();
+                    if (!cached)
+                        resampler_cache.clear();
+                    state.resume_timing();
+                }
+                catch (const char* exception)
+                {
+                    state.skip_with_error(exception);
+                    return;
+                }
+            }
+            state.set_items_processed(state.iterations());
+        };
+    };
+    runner.add("source_open/mp3_48k_file", resampled_open_benchmark(true));
+    runner.add("source_open/mp3_48k_file_uncached", resampled_open_benchmark(false));
+
+    /*the audio thread's side of a switch once the fade is done: take the waiting source, swap it in and hand the
+    * old one back. opening sources and destroying retired ones happen on the control side and aren't timed*/
+    runner.add("source_handoff", [&](BenchState& state)
+    {
+        AudioChannel channel {};
+        std::unique_ptr<InputStream> source {std::make_unique<InputStream>(output_codec_ctx, DefaultSourceModes::silence,
+                                                                           SourceTimingModes::freetime)};
+
+        while (state.keep_running())
+        {
+            state.pause_timing();
+            channel.switch_source(std::make_unique<InputStream>(output_codec_ctx, DefaultSourceModes::silence,
+                                                                SourceTimingModes::freetime), "bench");
+            state.resume_timing();
+
+            channel.service(sink);
+            uint64_t switch_id {};
+            int64_t start_sample {};
+            std::unique_ptr<InputStream> new_source {channel.take_pending(switch_id, start_sample)};
+            source.swap(new_source);
+            channel.finish_switch(switch_id, true, std::move(new_source), start_sample);
+
+            state.pause_timing();
+            channel.collect_events();
+            state.resume_timing();
+        }
+        state.set_items_processed(state.iterations());
+    });
+
+    runner.add("meter_frame", [&](BenchState& state)
+    {
+        InputStream source {output_codec_ctx, DefaultSourceModes::white_noise, SourceTimingModes::freetime};
+        source.get_one_output_frame();
+        LevelMeter meter {};
+
+        while (state.keep_running())
+            meter_frame(meter, source.get_frame());
+        state.set_items_processed(state.iterations() * source.get_frame()->nb_samples);
+    });
+
+    runner.add("write_frame/null_muxer", write_frame_benchmark(BENCH_NULL_SINK_PROMPT));
+    runner.add("write_frame/mp3_dev_null", write_frame_benchmark(BENCH_SINK_PROMPT));
+
+    return runner.run(argc, argv);
+}
@@ -0,0 +1,146 @@
+/*
+* Measures the cost of the level meter per million samples.
+*
+* usage: fondue_level_bench [million samples per run]
+*
+* Times the scalar and vectorised kernels on one contiguous channel of each sample format, then
+* a whole LevelMeter measuring stereo planar frames of 1152 samples (an mp3 frame) with and
+* without true peak, the way the audio thread uses it, and the loudness meter on the same frames.
+*/
+
+#include "../src/LevelMeter.h"
+#include "../src/Loudness.h"
+
+#include<chrono>
+#include<cmath>
+#include<cstdint>
+#include<cstdlib>
+#include<functional>
+#include<iomanip>
+#include<iostream>
+#include<string>
+#include<vector>
+
+const int frame_size = 1152;
+
+/*a sine with a little noise so nothing is constant, full scale is 1*/
+std::vector<float> test_signal(std::size_t samples)
+{
+    std::vector<float> signal(samples);
+    uint32_t noise = 12345;
+    for (std::size_t i = 0; i < samples; i++)
+    {
+        noise = noise * 1664525 + 1013904223;
+        signal[i] = 0.7f * std::sin(i * 0.0627f) + 0.2f * (static_cast<float>(noise >> 8) / (1 << 24) - 0.5f);
+    }
+    return signal;
+}
+
+/*runs the measurement, best of a few runs, returns milliseconds per million samples*/
+double time_per_million(std::size_t samples, const std::function<float()>& run)
+{
+    volatile float sink {};
+    double best_ms {};
+    for (int attempt = 0; attempt < 5; attempt++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        sink = sink + run();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        if (attempt == 0 || elapsed.count() < best_ms)
+            best_ms = elapsed.count();
+    }
+    return best_ms * 1e6 / samples;
+}
+
+void report(const std::string& name, double ms_per_million)
+{
+    std::cout << std::left << std::setw(34) << name << std::right << std::setw(9) << ms_per_million
+              << " ms per million samples (" << ms_per_million << " ns per sample)\n";
+}
+
+int main(int argc, char* argv[])
+{
+    std::size_t samples = 1000000 * static_cast<std::size_t>(argc > 1 ? std::max(1, std::atoi(argv[1])) : 16);
+    samples -= samples % (2 * frame_size);
+
+    std::vector<float> flt {test_signal(samples)};
+    std::vector<int16_t> s16(samples);
+    std::vector<int32_t> s32(samples);
+    for (std::size_t i = 0; i < samples; i++)
+    {
+        s16[i] = static_cast<int16_t>(std::lrint(flt[i] * 32767));
+        s32[i] = static_cast<int32_t>(std::llrint(flt[i] * 2147483647.0));
+    }
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << samples << " samples per run, " << level_kernels::instruction_set() << " kernels\n";
+
+    report("float scalar", time_per_million(samples, [&]
+    {
+        return level_kernels::measure_float_scalar(flt.data(), static_cast<int>(samples), 1).peak;
+    }));
+    report("float " + std::string{level_kernels::instruction_set()}, time_per_million(samples, [&]
+    {
+        return level_kernels::measure_float(flt.data(), static_cast<int>(samples)).peak;
+    }));
+    report("s16 scalar", time_per_million(samples, [&]
+    {
+        return level_kernels::measure_s16_scalar(s16.data(), static_cast<int>(samples), 1).peak;
+    }));
+    report("s16 " + std::string{level_kernels::instruction_set()}, time_per_million(samples, [&]
+    {
+        return level_kernels::measure_s16(s16.data(), static_cast<int>(samples)).peak;
+    }));
+    report("s32 scalar", time_per_million(samples, [&]
+    {
+        return level_kernels::measure_s32_scalar(s32.data(), static_cast<int>(samples), 1).peak;
+    }));
+    report("s32 " + std::string{level_kernels::instruction_set()}, time_per_million(samples, [&]
+    {
+        return level_kernels::measure_s32(s32.data(), static_cast<int>(samples)).peak;
+    }));
+
+    /*the two halves of the signal as the left and right planes*/
+    std::size_t frames = samples / (2 * frame_size);
+    for (bool true_peak : {false, true})
+    {
+        LevelMeter meter {};
+        meter.set_true_peak(true_peak);
+        report(std::string{"stereo fltp meter"} + (true_peak ? " + true peak" : ""), time_per_million(samples, [&]
+        {
+            for (std::size_t frame = 0; frame < frames; frame++)
+            {
+                const uint8_t* planes[2] {reinterpret_cast<const uint8_t*>(flt.data() + frame * frame_size),
+                                          reinterpret_cast<const uint8_t*>(flt.data() + samples / 2 + frame * frame_size)};
+                meter.measure(planes, 2, frame_size, MeterSampleFormats::flt, true);
+            }
+            return meter.snapshot().peak[0];
+        }));
+    }
+
+    {
+        LoudnessMeter loudness {};
+        loudness.configure(48000, 2, {1, 1});
+        report("stereo fltp loudness (k-weighted)", time_per_million(samples, [&]
+        {
+            for (std::size_t frame = 0; frame < frames; frame++)
+            {
+                const uint8_t* planes[2] {reinterpret_cast<const uint8_t*>(flt.data() + frame * frame_size),
+                                          reinterpret_cast<const uint8_t*>(flt.data() + samples / 2 + frame * frame_size)};
+                loudness.measure(planes, 2, frame_size, MeterSampleFormats::flt, true);
+            }
+            return static_cast<float>(loudness.integrated());
+        }));
+        std::cout << "integrated loudness of the test signal " << loudness.integrated() << " LUFS\n";
+    }
+
+    LevelSnapshot snapshot {};
+    LevelMeter meter {};
+    meter.set_true_peak(true);
+    const uint8_t* planes[2] {reinterpret_cast<const uint8_t*>(flt.data()), reinterpret_cast<const uint8_t*>(flt.data() + frame_size)};
+    meter.measure(planes, 2, frame_size, MeterSampleFormats::flt, true);
+    snapshot = meter.snapshot();
+    std::cout << "first frame: peak " << level_to_dbfs(snapshot.peak[0]) << " dBFS, rms " << level_to_dbfs(snapshot.rms[0])
+              << " dBFS, true peak " << level_to_dbfs(snapshot.true_peak[0]) << " dBTP\n";
+    return 0;
+}
@@ -0,0 +1,281 @@
+/*
+* Measures the cost of the output limiter and checks it never lets a sample over the ceiling.
+*
+* usage: fondue_limiter_bench [million samples per run]
+*
+* Times the required gain and delay line kernels alone, then the whole Limiter on stereo planar
+* frames of 1152 samples (an mp3 frame) as the sink uses it, on a signal that never reaches the
+* ceiling and on one that is limited all the time, and on packed frames.
+*
+* Then runs stress fixtures through it in frames of awkward sizes: two full scale sines summed
+* as an unnormalised crossfade would, noise 12dB over full scale, square waves switching on and
+* off, isolated spikes, a low sine and a boosted programme-like signal. Every output sample has to
+* be under the ceiling and a signal below it has to come out untouched, only delayed by the
+* latency. Exits 1 if either check fails.
+*/
+
+#include "../src/Limiter.h"
+
+#include<algorithm>
+#include<chrono>
+#include<cmath>
+#include<cstdint>
+#include<cstdlib>
+#include<functional>
+#include<iomanip>
+#include<iostream>
+#include<string>
+#include<vector>
+
+const int frame_size = 1152;
+const int sample_rate = 48000;
+
+/*a sine with a little noise so nothing is constant, full scale is 1*/
+std::vector<float> test_signal(std::size_t samples, float scale)
+{
+    std::vector<float> signal(samples);
+    uint32_t noise = 12345;
+    for (std::size_t i = 0; i < samples; i++)
+    {
+        noise = noise * 1664525 + 1013904223;
+        signal[i] = scale * (0.7f * std::sin(i * 0.0627f) + 0.2f * (static_cast<float>(noise >> 8) / (1 << 24) - 0.5f));
+    }
+    return signal;
+}
+
+/*runs the measurement, best of a few runs, returns milliseconds per million samples*/
+double time_per_million(std::size_t samples, const std::function<float()>& run)
+{
+    volatile float sink {};
+    double best_ms {};
+    for (int attempt = 0; attempt < 5; attempt++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        sink = sink + run();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        if (attempt == 0 || elapsed.count() < best_ms)
+            best_ms = elapsed.count();
+    }
+    return best_ms * 1e6 / samples;
+}
+
+void report(const std::string& name, double ms_per_million)
+{
+    std::cout << std::left << std::setw(34) << name << std::right << std::setw(9) << ms_per_million
+              << " ms per million samples (" << ms_per_million << " ns per sample)\n";
+}
+
+/*one stereo fixture, left and right*/
+struct Fixture
+{
+    std::string name;
+    std::vector<float> left;
+    std::vector<float> right;
+};
+
+std::vector<Fixture> stress_fixtures(std::size_t samples)
+{
+    const double pi = 3.14159265358979323846;
+    std::vector<Fixture> fixtures {};
+
+    Fixture summed {"summed full scale sines", std::vector<float>(samples), std::vector<float>(samples)};
+    for (std::size_t i = 0; i < samples; i++)
+    {
+        summed.left[i] = static_cast<float>(std::sin(2 * pi * 1000 * i / sample_rate) + std::sin(2 * pi * 1003 * i / sample_rate));
+        summed.right[i] = static_cast<float>(2 * std::sin(2 * pi * 440 * i / sample_rate));
+    }
+    fixtures.push_back(summed);
+
+    Fixture noise {"noise +12dB", std::vector<float>(samples), std::vector<float>(samples)};
+    uint32_t state = 987654321;
+    for (std::size_t i = 0; i < samples; i++)
+    {
+        state = state * 1664525 + 1013904223;
+        noise.left[i] = 8.0f * (static_cast<float>(state >> 8) / (1 << 24) - 0.5f);
+        state = state * 1664525 + 1013904223;
+        noise.right[i] = 8.0f * (static_cast<float>(state >> 8) / (1 << 24) - 0.5f);
+    }
+    fixtures.push_back(noise);
+
+    /*50Hz square at 3x full scale for 100ms in every 250ms*/
+    Fixture square {"gated square", std::vector<float>(samples), std::vector<float>(samples)};
+    for (std::size_t i = 0; i < samples; i++)
+    {
+        bool on = (i % (sample_rate / 4)) < static_cast<std::size_t>(sample_rate / 10);
+        float value = (i % (sample_rate / 50)) < static_cast<std::size_t>(sample_rate / 100) ? 3.0f : -3.0f;
+        square.left[i] = on ? value : 0;
+        square.right[i] = on ? -value : 0;
+    }
+    fixtures.push_back(square);
+
+    Fixture spikes {"isolated spikes", std::vector<float>(samples), std::vector<float>(samples)};
+    for (std::size_t i = 0; i < samples; i += 997)
+        ((i / 997) % 2 ? spikes.left : spikes.right)[i] = (i / 997) % 3 ? 10.0f : -10.0f;
+    fixtures.push_back(spikes);
+
+    Fixture low {"20Hz sine +6dB", std::vector<float>(samples), std::vector<float>(samples)};
+    for (std::size_t i = 0; i < samples; i++)
+        low.left[i] = low.right[i] = static_cast<float>(2 * std::sin(2 * pi * 20 * i / sample_rate));
+    fixtures.push_back(low);
+
+    std::vector<float> programme {test_signal(2 * samples, 4.0f)};
+    fixtures.push_back({"programme +12dB", std::vector<float>(programme.begin(), programme.begin() + samples),
+                        std::vector<float>(programme.begin() + samples, programme.end())});
+    return fixtures;
+}
+
+/*limits the fixture in frames of varying size, planar or packed, returns the output peak*/
+float run_fixture(Limiter& limiter, const Fixture& fixture, bool packed, std::vector<float>& left, std::vector<float>& right)
+{
+    const int frame_sizes[] {1152, 1024, 441, 2 * LIMITER_CHUNK_SAMPLES + 7, 1, 960};
+    left = fixture.left;
+    right = fixture.right;
+    std::vector<float> interleaved(2 * left.size());
+    for (std::size_t i = 0; i < left.size(); i++)
+    {
+        interleaved[2 * i] = left[i];
+        interleaved[2 * i + 1] = right[i];
+    }
+
+    std::size_t done {};
+    for (int frame = 0; done < left.size(); frame++)
+    {
+        int length = static_cast<int>(std::min<std::size_t>(frame_sizes[frame % 6], left.size() - done));
+        if (packed)
+        {
+            float* channels[2] {interleaved.data() + 2 * done, interleaved.data() + 2 * done + 1};
+            limiter.process(channels, 2, length, 2);
+        }
+        else
+        {
+            float* channels[2] {left.data() + done, right.data() + done};
+            limiter.process(channels, 2, length, 1);
+        }
+        done += length;
+    }
+
+    if (packed)
+    {
+        for (std::size_t i = 0; i < left.size(); i++)
+        {
+            left[i] = interleaved[2 * i];
+            right[i] = interleaved[2 * i + 1];
+        }
+    }
+
+    float peak {};
+    for (std::size_t i = 0; i < left.size(); i++)
+        peak = std::max(peak, std::max(std::fabs(left[i]), std::fabs(right[i])));
+    return peak;
+}
+
+int main(int argc, char* argv[])
+{
+    std::size_t samples = 1000000 * static_cast<std::size_t>(argc > 1 ? std::max(1, std::atoi(argv[1])) : 16);
+    samples -= samples % (2 * frame_size);
+
+    LimiterSettings settings {};
+    const float ceiling = static_cast<float>(std::pow(10.0, settings.ceiling_dbfs / 20));
+    std::vector<float> quiet {test_signal(samples, 0.5f)};
+    std::vector<float> loud {test_signal(samples, 4.0f)};
+    std::vector<float> gains(LIMITER_CHUNK_SAMPLES);
+    std::vector<float> delay_line(LIMITER_CHUNK_SAMPLES);
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << samples << " samples per run, " << limiter_kernels::instruction_set() << " kernels, "
+              << settings.lookahead_ms << " ms lookahead, ceiling " << settings.ceiling_dbfs << " dBFS\n";
+
+    /*the two halves of the signal as the left and right planes*/
+    const std::size_t half = samples / 2;
+    report("required gains scalar", time_per_million(samples, [&]
+    {
+        for (std::size_t done = 0; done + LIMITER_CHUNK_SAMPLES <= half; done += LIMITER_CHUNK_SAMPLES)
+        {
+            const float* channels[2] {loud.data() + done, loud.data() + half + done};
+            limiter_kernels::required_gains_scalar(channels, 2, LIMITER_CHUNK_SAMPLES, 1, ceiling, gains.data());
+        }
+        return gains[0];
+    }));
+    report("required gains " + std::string{limiter_kernels::instruction_set()}, time_per_million(samples, [&]
+    {
+        for (std::size_t done = 0; done + LIMITER_CHUNK_SAMPLES <= half; done += LIMITER_CHUNK_SAMPLES)
+        {
+            const float* channels[2] {loud.data() + done, loud.data() + half + done};
+            limiter_kernels::required_gains(channels, 2, LIMITER_CHUNK_SAMPLES, ceiling, gains.data());
+        }
+        return gains[0];
+    }));
+    report("delay and scale scalar", time_per_million(samples, [&]
+    {
+        for (std::size_t done = 0; done + LIMITER_CHUNK_SAMPLES <= samples; done += LIMITER_CHUNK_SAMPLES)
+            limiter_kernels::delay_and_scale_scalar(quiet.data() + done, delay_line.data(), gains.data(), LIMITER_CHUNK_SAMPLES, 1);
+        return quiet[0];
+    }));
+    report("delay and scale " + std::string{limiter_kernels::instruction_set()}, time_per_million(samples, [&]
+    {
+        for (std::size_t done = 0; done + LIMITER_CHUNK_SAMPLES <= samples; done += LIMITER_CHUNK_SAMPLES)
+            limiter_kernels::delay_and_scale(quiet.data() + done, delay_line.data(), gains.data(), LIMITER_CHUNK_SAMPLES);
+        return quiet[0];
+    }));
+
+    for (auto signal : {&quiet, &loud})
+    {
+        Limiter limiter {};
+        limiter.configure(settings, sample_rate, 2);
+        report(std::string{"stereo fltp limiter, "} + (signal == &quiet ? "quiet" : "loud"), time_per_million(samples, [&]
+        {
+            for (std::size_t frame = 0; frame < half / frame_size; frame++)
+            {
+                float* planes[2] {signal->data() + frame * frame_size, signal->data() + half + frame * frame_size};
+                limiter.process(planes, 2, frame_size, 1);
+            }
+            return (*signal)[0];
+        }));
+    }
+    {
+        Limiter limiter {};
+        limiter.configure(settings, sample_rate, 2);
+        report("stereo flt (packed) limiter, loud", time_per_million(samples, [&]
+        {
+            for (std::size_t frame = 0; frame < samples / (2 * frame_size); frame++)
+            {
+                float* channels[2] {loud.data() + 2 * frame * frame_size, loud.data() + 2 * frame * frame_size + 1};
+                limiter.process(channels, 2, frame_size, 2);
+            }
+            return loud[0];
+        }));
+    }
+
+    /*the stress fixtures are a few seconds each whatever the run length*/
+    bool failed = false;
+    std::vector<float> left {}, right {};
+    for (const Fixture& fixture : stress_fixtures(10 * sample_rate))
+    {
+        for (bool packed : {false, true})
+        {
+            Limiter limiter {};
+            limiter.configure(settings, sample_rate, 2);
+            float peak = run_fixture(limiter, fixture, packed, left, right);
+            bool over = peak > ceiling;
+            failed |= over;
+            std::cout << std::left << std::setw(34) << fixture.name + (packed ? " (packed)" : "") << std::right
+                      << " peak " << std::setw(8) << 20 * std::log10(peak) << " dBFS, " << limiter.limited_samples()
+                      << " samples limited" << (over ? ", OVER THE CEILING\n" : "\n");
+        }
+    }
+
+    /*below the ceiling the output is the input, latency samples later*/
+    Fixture below {"below the ceiling", test_signal(sample_rate, 0.8f), test_signal(sample_rate, -0.8f)};
+    Limiter limiter {};
+    limiter.configure(settings, sample_rate, 2);
+    run_fixture(limiter, below, false, left, right);
+    const std::size_t latency = static_cast<std::size_t>(limiter.latency_samples());
+    bool untouched = limiter.limited_samples() == 0;
+    for (std::size_t i = latency; i < left.size() && untouched; i++)
+        untouched = left[i] == below.left[i - latency] && right[i] == below.right[i - latency];
+    failed |= !untouched;
+    std::cout << "signal below the ceiling " << (untouched ? "passes through unchanged" : "WAS CHANGED") << ", latency "
+              << latency << " samples (" << 1000.0 * latency / sample_rate << " ms)\n";
+
+    return failed ? 1 : 0;
+}
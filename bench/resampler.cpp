@@ -0,0 +1,208 @@
+/*
+* Measures the cost and the distortion of each resampler profile on common conversions.
+*
+* usage: fondue_resampler_bench [seconds of audio per run]
+*
+* For 48k to 44.1k, 32k to 44.1k and 44.1k to 48k stereo, and 48k mono to stereo, converts a sine
+* through the resampler cache with each profile's options in decoded sized frames (1152 samples, an
+* mp3 frame) the way a source does, planar float in and out. Prints the share of one core a stream
+* would take in real time and the time per output sample (best of a few runs), then THD+N at 997Hz
+* and 10kHz: a sine and a constant are fitted to the output by least squares at the tone's frequency
+* and whatever the fit leaves is the distortion and noise, relative to the fitted sine. The start
+* and end of the output, where the filter is filling and emptying, are left out.
+*/
+
+#include "ResamplerCache.h"
+#include "ResamplerProfiles.h"
+
+extern "C"
+{
+#include <libavutil/log.h>
+}
+
+#include<algorithm>
+#include<chrono>
+#include<cmath>
+#include<cstdint>
+#include<cstdlib>
+#include<iomanip>
+#include<iostream>
+#include<string>
+#include<vector>
+
+const int frame_size = 1152;
+const double pi = 3.14159265358979323846;
+
+struct Conversion
+{
+    std::string name;
+    int in_rate;
+    int in_channels;
+    int out_rate;
+    int out_channels;
+};
+
+/*a sine at half scale, the same on every channel*/
+std::vector<float> sine(double frequency, int sample_rate, std::size_t samples)
+{
+    std::vector<float> signal(samples);
+    for (std::size_t i = 0; i < samples; i++)
+        signal[i] = static_cast<float>(0.5 * std::sin(2 * pi * frequency * i / sample_rate));
+    return signal;
+}
+
+/*runs the input through the resampler frame by frame and flushes it, returns the samples written to each output plane*/
+std::size_t convert(SwrContext* swr_ctx, const std::vector<float>& input, int in_channels, std::vector<std::vector<float>>& output)
+{
+    std::vector<const uint8_t*> in_planes(in_channels);
+    std::vector<uint8_t*> out_planes(output.size());
+    std::size_t written {};
+    for (std::size_t done = 0; ; done += frame_size)
+    {
+        const std::size_t start = std::min(done, input.size());
+        const int length = static_cast<int>(std::min<std::size_t>(frame_size, input.size() - start));
+        for (const uint8_t*& plane : in_planes)
+            plane = reinterpret_cast<const uint8_t*>(input.data() + start);
+        for (std::size_t channel = 0; channel < output.size(); channel++)
+            out_planes[channel] = reinterpret_cast<uint8_t*>(output[channel].data() + written);
+
+        /*no input flushes what the filter still holds*/
+        const int converted = swr_convert(swr_ctx, out_planes.data(), static_cast<int>(output[0].size() - written),
+                                          length ? in_planes.data() : NULL, length);
+        if (converted < 0)
+            throw "swr_convert failed";
+        written += converted;
+        if (!length)
+            return written;
+    }
+}
+
+CachedResampler acquire(const Conversion& conversion, ResamplerProfiles profile)
+{
+    AVChannelLayout in_layout {}, out_layout {};
+    av_channel_layout_default(&in_layout, conversion.in_channels);
+    av_channel_layout_default(&out_layout, conversion.out_channels);
+    return resampler_cache.acquire(in_layout, conversion.in_rate, AV_SAMPLE_FMT_FLTP, out_layout, conversion.out_rate,
+                                   AV_SAMPLE_FMT_FLTP, resampler_profile_options(profile));
+}
+
+std::vector<std::vector<float>> output_planes(const Conversion& conversion, std::size_t input_samples)
+{
+    const std::size_t capacity = input_samples * conversion.out_rate / conversion.in_rate + 4096;
+    return std::vector<std::vector<float>>(conversion.out_channels, std::vector<float>(capacity));
+}
+
+/*the least squares fit of a sin + b cos + c at the frequency to the middle of the signal, returns the
+* residual's energy against the fitted sine's in dB*/
+double thd_plus_n_db(const std::vector<float>& signal, std::size_t length, double frequency, int sample_rate)
+{
+    const std::size_t start = length / 10;
+    const std::size_t end = length - length / 10;
+
+    /*the normal equations of the fit, symmetric 3x3*/
+    double m[3][3] {}, v[3] {};
+    for (std::size_t i = start; i < end; i++)
+    {
+        const double basis[3] {std::sin(2 * pi * frequency * i / sample_rate), std::cos(2 * pi * frequency * i / sample_rate), 1};
+        for (int row = 0; row < 3; row++)
+        {
+            v[row] += basis[row] * signal[i];
+            for (int column = 0; column < 3; column++)
+                m[row][column] += basis[row] * basis[column];
+        }
+    }
+    auto determinant = [](const double a[3][3])
+    {
+        return a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1]) - a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+             + a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+    };
+    double coefficients[3] {};
+    const double whole = determinant(m);
+    for (int column = 0; column < 3; column++)
+    {
+        double replaced[3][3] {};
+        for (int row = 0; row < 3; row++)
+            for (int other = 0; other < 3; other++)
+                replaced[row][other] = other == column ? v[row] : m[row][other];
+        coefficients[column] = determinant(replaced) / whole;
+    }
+
+    double fitted_energy {}, residual_energy {};
+    for (std::size_t i = start; i < end; i++)
+    {
+        const double fitted = coefficients[0] * std::sin(2 * pi * frequency * i / sample_rate)
+                            + coefficients[1] * std::cos(2 * pi * frequency * i / sample_rate);
+        const double residual = signal[i] - fitted - coefficients[2];
+        fitted_energy += fitted * fitted;
+        residual_energy += residual * residual;
+    }
+    return 10 * std::log10(std::max(residual_energy, 1e-30) / fitted_energy);
+}
+
+int main(int argc, char* argv[])
+{
+    av_log_set_level(AV_LOG_ERROR);
+    const int seconds = argc > 1 ? std::max(1, std::atoi(argv[1])) : 10;
+
+    const std::vector<Conversion> conversions
+    {
+        {"48k -> 44.1k stereo", 48000, 2, 44100, 2},
+        {"32k -> 44.1k stereo", 32000, 2, 44100, 2},
+        {"44.1k -> 48k stereo", 44100, 2, 48000, 2},
+        {"48k mono -> stereo", 48000, 1, 48000, 2}
+    };
+    const double tones[] {997, 10000};
+
+    std::cout << std::fixed << std::setprecision(2) << seconds << " s of audio per run, soxr "
+              << (soxr_available() ? "available" : "unavailable, its profile is high") << "\n\n";
+    std::cout << std::left << std::setw(22) << "conversion" << std::setw(10) << "profile" << std::right
+              << std::setw(14) << "% of a core" << std::setw(14) << "ns/sample" << std::setw(16) << "THD+N 997Hz"
+              << std::setw(16) << "THD+N 10kHz" << '\n';
+
+    for (const Conversion& conversion : conversions)
+    {
+        const std::vector<float> input {sine(tones[0], conversion.in_rate, static_cast<std::size_t>(seconds) * conversion.in_rate)};
+        std::vector<std::vector<float>> output {output_planes(conversion, input.size())};
+
+        for (int p = 0; p < +ResamplerProfiles::number_of_profiles; p++)
+        {
+            const ResamplerProfiles profile = static_cast<ResamplerProfiles>(p);
+            double best_seconds {};
+            std::size_t written {};
+            try
+            {
+                for (int attempt = 0; attempt < 5; attempt++)
+                {
+                    /*from the cache after the first run, handed back (and reset) at the end of each*/
+                    CachedResampler swr_ctx {acquire(conversion, profile)};
+                    const auto start = std::chrono::steady_clock::now();
+                    written = convert(swr_ctx.get(), input, conversion.in_channels, output);
+                    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                    if (attempt == 0 || elapsed.count() < best_seconds)
+                        best_seconds = elapsed.count();
+                }
+
+                std::cout << std::left << std::setw(22) << conversion.name << std::setw(10) << resampler_profile_name(profile)
+                          << std::right << std::setw(14) << 100 * best_seconds / seconds
+                          << std::setw(14) << 1e9 * best_seconds / written;
+
+                /*two seconds of each tone is plenty for the fit*/
+                for (double tone : tones)
+                {
+                    const std::vector<float> tone_input {sine(tone, conversion.in_rate, 2 * static_cast<std::size_t>(conversion.in_rate))};
+                    std::vector<std::vector<float>> tone_output {output_planes(conversion, tone_input.size())};
+                    CachedResampler swr_ctx {acquire(conversion, profile)};
+                    const std::size_t length = convert(swr_ctx.get(), tone_input, conversion.in_channels, tone_output);
+                    std::cout << std::setw(12) << thd_plus_n_db(tone_output[0], length, tone, conversion.out_rate) << " dB ";
+                }
+                std::cout << '\n';
+            }
+            catch (const char* exception)
+            {
+                std::cout << std::left << std::setw(22) << conversion.name << std::setw(10) << resampler_profile_name(profile)
+                          << exception << '\n';
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,10 @@
+# run at build time by the fondue_git_commit target: writes the short commit of the source tree to OUTPUT as
+# FONDUE_GIT_COMMIT, touching it only when the commit changed so the benchmarks rebuild just then
+execute_process(COMMAND git rev-parse --short HEAD
+                WORKING_DIRECTORY ${SOURCE_DIR}
+                OUTPUT_VARIABLE FONDUE_GIT_COMMIT
+                OUTPUT_STRIP_TRAILING_WHITESPACE
+                ERROR_QUIET)
+file(WRITE ${OUTPUT}.tmp "#define FONDUE_GIT_COMMIT \"${FONDUE_GIT_COMMIT}\"\n")
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different ${OUTPUT}.tmp ${OUTPUT})
+file(REMOVE ${OUTPUT}.tmp)
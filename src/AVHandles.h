@@ -0,0 +1,83 @@
+/*
+* Owning handles for FFmpeg objects: std::unique_ptr with a deleter that calls the matching FFmpeg
+* free function. An object held in a handle is freed exactly once, when its owner is destroyed or
+* the handle is reset, including when a constructor throws part way through. Moving a handle
+* hands over the object and leaves null behind, which is never passed to a deleter.
+*
+* Pass the raw pointer to FFmpeg with get(). For FFmpeg functions which allocate through a pointer
+* to a pointer (e.g. avformat_open_input) fill a local raw pointer and reset() the handle with it.
+*/
+
+#ifndef AVHANDLES_H
+#define AVHANDLES_H
+
+extern "C"{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswresample/swresample.h>
+#include <libavutil/audio_fifo.h>
+#include <libavutil/dict.h>
+#include <libavutil/frame.h>
+#include <libavfilter/avfilter.h>
+}
+
+#include<memory>
+
+struct FormatContextDeleter
+{
+    /*input contexts only, output contexts are closed by OutputStream*/
+    void operator()(AVFormatContext* format_ctx) const {avformat_close_input(&format_ctx);}
+};
+
+struct CodecContextDeleter
+{
+    void operator()(AVCodecContext* codec_ctx) const {avcodec_free_context(&codec_ctx);}
+};
+
+struct FrameDeleter
+{
+    void operator()(AVFrame* frame) const {av_frame_free(&frame);}
+};
+
+struct PacketDeleter
+{
+    void operator()(AVPacket* pkt) const {av_packet_free(&pkt);}
+};
+
+struct ResamplerDeleter
+{
+    void operator()(SwrContext* swr_ctx) const {swr_free(&swr_ctx);}
+};
+
+struct AudioFifoDeleter
+{
+    void operator()(AVAudioFifo* fifo) const {av_audio_fifo_free(fifo);}
+};
+
+struct DictionaryDeleter
+{
+    void operator()(AVDictionary* dictionary) const {av_dict_free(&dictionary);}
+};
+
+struct FilterGraphDeleter
+{
+    /*frees every filter in the graph too*/
+    void operator()(AVFilterGraph* graph) const {avfilter_graph_free(&graph);}
+};
+
+struct FilterInOutDeleter
+{
+    void operator()(AVFilterInOut* inout) const {avfilter_inout_free(&inout);}
+};
+
+using FormatContextHandle = std::unique_ptr<AVFormatContext, FormatContextDeleter>;
+using CodecContextHandle = std::unique_ptr<AVCodecContext, CodecContextDeleter>;
+using FrameHandle = std::unique_ptr<AVFrame, FrameDeleter>;
+using PacketHandle = std::unique_ptr<AVPacket, PacketDeleter>;
+using ResamplerHandle = std::unique_ptr<SwrContext, ResamplerDeleter>;
+using AudioFifoHandle = std::unique_ptr<AVAudioFifo, AudioFifoDeleter>;
+using DictionaryHandle = std::unique_ptr<AVDictionary, DictionaryDeleter>;
+using FilterGraphHandle = std::unique_ptr<AVFilterGraph, FilterGraphDeleter>;
+using FilterInOutHandle = std::unique_ptr<AVFilterInOut, FilterInOutDeleter>;
+
+#endif
@@ -0,0 +1,239 @@
+#include "AllocAccounting.h"
+
+#include<algorithm>
+#include<iomanip>
+
+AllocAccounting alloc_accounting {};
+
+namespace
+{
+    /*initial-exec so reading them from inside malloc never itself allocates*/
+    thread_local ThreadAllocCounter* thread_counter __attribute__((tls_model("initial-exec"))) {};
+    thread_local AllocScopes thread_scope __attribute__((tls_model("initial-exec"))) {AllocScopes::fondue};
+}
+
+#if defined(FONDUE_ENABLE_ALLOC_ACCOUNTING) && defined(__GLIBC__)
+
+#include<cerrno>
+#include<cstdlib>
+
+/*glibc's own allocator, the replacements below count the call and hand it on*/
+extern "C"
+{
+    void* __libc_malloc(std::size_t size);
+    void* __libc_calloc(std::size_t count, std::size_t size);
+    void* __libc_realloc(void* pointer, std::size_t size);
+    void* __libc_memalign(std::size_t alignment, std::size_t size);
+}
+
+namespace
+{
+    inline void count_allocation(std::size_t bytes)
+    {
+        if (thread_counter)
+            thread_counter->record(thread_scope, bytes);
+    }
+}
+
+extern "C"
+{
+    void* malloc(std::size_t size) noexcept
+    {
+        count_allocation(size);
+        return __libc_malloc(size);
+    }
+
+    void* calloc(std::size_t count, std::size_t size) noexcept
+    {
+        count_allocation(count * size);
+        return __libc_calloc(count, size);
+    }
+
+    void* realloc(void* pointer, std::size_t size) noexcept
+    {
+        /*realloc(pointer, 0) frees*/
+        if (size)
+            count_allocation(size);
+        return __libc_realloc(pointer, size);
+    }
+
+    int posix_memalign(void** pointer, std::size_t alignment, std::size_t size) noexcept
+    {
+        if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+            return EINVAL;
+        count_allocation(size);
+        *pointer = __libc_memalign(alignment, size);
+        return *pointer || !size ? 0 : ENOMEM;
+    }
+
+    void* aligned_alloc(std::size_t alignment, std::size_t size) noexcept
+    {
+        count_allocation(size);
+        return __libc_memalign(alignment, size);
+    }
+
+    void* memalign(std::size_t alignment, std::size_t size) noexcept
+    {
+        count_allocation(size);
+        return __libc_memalign(alignment, size);
+    }
+}
+
+#endif
+
+const char* alloc_scope_name(AllocScopes scope)
+{
+    switch (+scope)
+    {
+        case +AllocScopes::fondue:
+            return "fondue";
+        case +AllocScopes::libav:
+            return "libav";
+        case +AllocScopes::setup:
+            return "setup";
+        default:
+            return "unknown";
+    }
+}
+
+void ThreadAllocCounter::end_frame()
+{
+    uint64_t frames = m_frames.load(std::memory_order_relaxed) + 1;
+    m_frames.store(frames, std::memory_order_relaxed);
+
+    std::array<uint64_t, +AllocScopes::number_of_scopes> frame_allocations {};
+    for (int scope = 0; scope < +AllocScopes::number_of_scopes; scope++)
+    {
+        uint64_t allocations = m_allocations[scope].load(std::memory_order_relaxed);
+        frame_allocations[scope] = allocations - m_frame_start[scope];
+        m_frame_start[scope] = allocations;
+    }
+
+    if (frames <= ALLOC_ACCOUNTING_WARMUP_FRAMES)
+        return;
+
+    for (int scope = 0; scope < +AllocScopes::number_of_scopes; scope++)
+    {
+        m_steady_state_allocations[scope].store(m_steady_state_allocations[scope].load(std::memory_order_relaxed)
+                                                + frame_allocations[scope], std::memory_order_relaxed);
+    }
+
+    uint64_t own_allocations = frame_allocations[+AllocScopes::fondue];
+    if (own_allocations)
+    {
+        m_frames_with_allocations.store(m_frames_with_allocations.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (own_allocations > m_max_frame_allocations.load(std::memory_order_relaxed))
+            m_max_frame_allocations.store(own_allocations, std::memory_order_relaxed);
+    }
+}
+
+ThreadAllocStats ThreadAllocCounter::stats() const
+{
+    ThreadAllocStats stats {};
+    stats.thread_name = m_thread_name;
+    stats.frames = m_frames.load(std::memory_order_relaxed);
+    for (int scope = 0; scope < +AllocScopes::number_of_scopes; scope++)
+    {
+        stats.allocations[scope] = m_allocations[scope].load(std::memory_order_relaxed);
+        stats.bytes[scope] = m_bytes[scope].load(std::memory_order_relaxed);
+        stats.steady_state_allocations[scope] = m_steady_state_allocations[scope].load(std::memory_order_relaxed);
+    }
+    stats.steady_state_frames = stats.frames > ALLOC_ACCOUNTING_WARMUP_FRAMES ? stats.frames - ALLOC_ACCOUNTING_WARMUP_FRAMES : 0;
+    stats.frames_with_allocations = m_frames_with_allocations.load(std::memory_order_relaxed);
+    stats.max_frame_allocations = m_max_frame_allocations.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void AllocAccounting::account_this_thread(const std::string& thread_name)
+{
+    if (thread_counter)
+        return;
+
+    auto counter = std::make_shared<ThreadAllocCounter>(thread_name);
+    {
+        std::lock_guard<std::mutex> lock (m_mtx);
+        m_counters.push_back(counter);
+    }
+    /*set last, the allocations above belong to no one*/
+    thread_counter = counter.get();
+}
+
+ThreadAllocCounter* AllocAccounting::this_thread_counter()
+{
+    return thread_counter;
+}
+
+AllocScopes AllocAccounting::exchange_scope(AllocScopes scope)
+{
+    AllocScopes previous = thread_scope;
+    thread_scope = scope;
+    return previous;
+}
+
+void AllocAccounting::end_frame()
+{
+#ifdef FONDUE_ENABLE_ALLOC_ACCOUNTING
+    if (thread_counter)
+        thread_counter->end_frame();
+#endif
+}
+
+std::vector<ThreadAllocStats> AllocAccounting::stats() const
+{
+    std::vector<std::shared_ptr<ThreadAllocCounter>> counters {};
+    {
+        std::lock_guard<std::mutex> lock (m_mtx);
+        counters = m_counters;
+    }
+
+    std::vector<ThreadAllocStats> stats {};
+    for (const auto& counter : counters)
+        stats.push_back(counter->stats());
+    return stats;
+}
+
+uint64_t AllocAccounting::steady_state_allocations() const
+{
+    uint64_t allocations {};
+    for (const ThreadAllocStats& thread : stats())
+        allocations += thread.steady_state_allocations[+AllocScopes::fondue];
+    return allocations;
+}
+
+void AllocAccounting::print_stats(std::ostream& stream) const
+{
+    if (!compiled_in())
+    {
+        stream << "allocation accounting not compiled in, build with -DFONDUE_ALLOC_ACCOUNTING=ON\n";
+        return;
+    }
+
+    std::ios_base::fmtflags stream_flags {stream.flags()};
+    std::streamsize stream_precision {stream.precision()};
+    stream << std::fixed << std::setprecision(2);
+
+    for (const ThreadAllocStats& thread : stats())
+    {
+        stream << thread.thread_name << ": " << thread.frames << " frames";
+        for (int scope = 0; scope < +AllocScopes::number_of_scopes; scope++)
+        {
+            stream << ", " << alloc_scope_name(static_cast<AllocScopes>(scope)) << " " << thread.allocations[scope]
+                   << " allocations (" << thread.bytes[scope] << " bytes)";
+        }
+        stream << '\n';
+
+        if (!thread.steady_state_frames)
+            continue;
+        stream << "    after " << ALLOC_ACCOUNTING_WARMUP_FRAMES << " warmup frames, per frame:";
+        for (int scope = 0; scope < +AllocScopes::number_of_scopes; scope++)
+        {
+            stream << ' ' << alloc_scope_name(static_cast<AllocScopes>(scope)) << " "
+                   << static_cast<double>(thread.steady_state_allocations[scope]) / thread.steady_state_frames;
+        }
+        stream << "\n    fondue allocated in " << thread.frames_with_allocations << " of " << thread.steady_state_frames
+               << " frames, at most " << thread.max_frame_allocations << " in one\n";
+    }
+
+    stream.flags(stream_flags);
+    stream.precision(stream_precision);
+}
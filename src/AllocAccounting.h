@@ -0,0 +1,166 @@
+/*
+* Heap allocation accounting for the audio path.
+*
+* Built with FONDUE_ENABLE_ALLOC_ACCOUNTING (cmake -DFONDUE_ALLOC_ACCOUNTING=ON) malloc and its
+* relatives are replaced (glibc only) with versions which count every call made by a thread that
+* has called AllocAccounting::account_this_thread(). operator new and FFmpeg's av_malloc both end up
+* in malloc/posix_memalign, so C++ and FFmpeg allocations are counted alike without wrapping either.
+*
+* Counts are split by scope. FONDUE_ALLOC_SCOPE(AllocScopes::libav) marks the calls into FFmpeg's
+* decoders, encoders, demuxers and muxers, which allocate small reference structs for every packet
+* and frame whatever the caller does; everything else on the audio thread is fondue's own code,
+* which must not allocate once warmed up. AllocScopes::setup marks work which is allowed to
+* allocate on a thread that is otherwise streaming, e.g. opening a source in the offline render.
+*
+* AllocAccounting::end_frame() closes one output frame of the calling thread (fondue_sleep calls it),
+* after ALLOC_ACCOUNTING_WARMUP_FRAMES frames every allocation fondue's own code makes is counted as
+* a steady state allocation. Without the build option nothing is replaced, the scopes compile to
+* nothing and every count stays zero.
+*/
+
+#ifndef ALLOCACCOUNTING_H
+#define ALLOCACCOUNTING_H
+
+#include<array>
+#include<atomic>
+#include<cstddef>
+#include<cstdint>
+#include<memory>
+#include<mutex>
+#include<ostream>
+#include<string>
+#include<type_traits>
+#include<vector>
+
+/*output frames per thread in which allocations are expected, e.g. buffers growing to their high water mark*/
+#define ALLOC_ACCOUNTING_WARMUP_FRAMES 100
+
+#ifdef FONDUE_ENABLE_ALLOC_ACCOUNTING
+#define FONDUE_ALLOC_CONCAT_(a, b) a##b
+#define FONDUE_ALLOC_CONCAT(a, b) FONDUE_ALLOC_CONCAT_(a, b)
+#define FONDUE_ALLOC_SCOPE(scope) AllocScope FONDUE_ALLOC_CONCAT(alloc_scope_, __LINE__) {scope}
+#else
+#define FONDUE_ALLOC_SCOPE(scope) do {} while (0)
+#endif
+
+enum class AllocScopes {fondue, libav, setup, number_of_scopes};
+
+/*overload the unary + operator to cast the enum class AllocScopes
+* to int for e.g. array indexing*/
+constexpr auto operator+(AllocScopes s) noexcept
+{
+    return static_cast<std::underlying_type_t<AllocScopes>>(s);
+}
+
+const char* alloc_scope_name(AllocScopes scope);
+
+/*a copy of one thread's counts*/
+struct ThreadAllocStats
+{
+    std::string thread_name {};
+    uint64_t frames {};
+    std::array<uint64_t, +AllocScopes::number_of_scopes> allocations {};
+    std::array<uint64_t, +AllocScopes::number_of_scopes> bytes {};
+    /*allocations made after the warmup and the frames they were made in*/
+    std::array<uint64_t, +AllocScopes::number_of_scopes> steady_state_allocations {};
+    uint64_t steady_state_frames {};
+    /*steady state frames in which fondue's own code allocated, and the most it allocated in one*/
+    uint64_t frames_with_allocations {};
+    uint64_t max_frame_allocations {};
+};
+
+/*counts for one thread, written only by that thread and read by anyone*/
+class ThreadAllocCounter
+{
+    private:
+        std::string m_thread_name;
+        std::array<std::atomic<uint64_t>, +AllocScopes::number_of_scopes> m_allocations {};
+        std::array<std::atomic<uint64_t>, +AllocScopes::number_of_scopes> m_bytes {};
+        std::array<std::atomic<uint64_t>, +AllocScopes::number_of_scopes> m_steady_state_allocations {};
+        std::atomic<uint64_t> m_frames {};
+        std::atomic<uint64_t> m_frames_with_allocations {};
+        std::atomic<uint64_t> m_max_frame_allocations {};
+        /*owning thread only, the counts when the current frame started*/
+        std::array<uint64_t, +AllocScopes::number_of_scopes> m_frame_start {};
+
+    public:
+        explicit ThreadAllocCounter(std::string thread_name):
+            m_thread_name {std::move(thread_name)}
+        {
+        }
+
+        /*called from the allocator by the owning thread, must not allocate*/
+        void record(AllocScopes scope, std::size_t bytes)
+        {
+            /*single writer, a load and a store is enough*/
+            m_allocations[+scope].store(m_allocations[+scope].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            m_bytes[+scope].store(m_bytes[+scope].load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+        }
+
+        void end_frame();
+
+        ThreadAllocStats stats() const;
+};
+
+class AllocAccounting
+{
+    private:
+        mutable std::mutex m_mtx;
+        std::vector<std::shared_ptr<ThreadAllocCounter>> m_counters {};
+
+    public:
+        /*true if fondue was built with the allocator replaced, otherwise every count is zero*/
+        static constexpr bool compiled_in()
+        {
+#ifdef FONDUE_ENABLE_ALLOC_ACCOUNTING
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        /*count the calling thread's allocations from now on, call before it starts realtime work*/
+        void account_this_thread(const std::string& thread_name);
+
+        /*the calling thread's counter or null if it isn't counted*/
+        static ThreadAllocCounter* this_thread_counter();
+
+        /*sets the calling thread's scope, returning the previous one, use through FONDUE_ALLOC_SCOPE*/
+        static AllocScopes exchange_scope(AllocScopes scope);
+
+        /*marks the end of one output frame of the calling thread*/
+        static void end_frame();
+
+        std::vector<ThreadAllocStats> stats() const;
+
+        /*steady state allocations by fondue's own code summed over every thread*/
+        uint64_t steady_state_allocations() const;
+
+        /*a table of the counts per thread, per output frame after the warmup*/
+        void print_stats(std::ostream& stream) const;
+};
+
+extern AllocAccounting alloc_accounting;
+
+/*attributes allocations in the enclosing scope, use through FONDUE_ALLOC_SCOPE*/
+class AllocScope
+{
+    private:
+        AllocScopes m_previous;
+
+    public:
+        explicit AllocScope(AllocScopes scope):
+            m_previous {AllocAccounting::exchange_scope(scope)}
+        {
+        }
+
+        ~AllocScope()
+        {
+            AllocAccounting::exchange_scope(m_previous);
+        }
+
+        AllocScope(const AllocScope&) = delete;
+        AllocScope& operator= (const AllocScope&) = delete;
+};
+
+#endif
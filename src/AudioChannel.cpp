@@ -0,0 +1,369 @@
+#include "AudioChannel.h"
+
+AudioChannel::~AudioChannel()
+{
+    AudioCommand command {};
+    while (m_commands.pop(command))
+    {
+        delete command.source;
+        CachedFilterGraph unused {command.filter_graph};
+        CachedResampler unused_resampler {command.resampler, command.resampler_returner};
+    }
+
+    AudioEvent event {};
+    while (m_events.pop(event))
+    {
+        delete event.retired;
+        /*a failed graph isn't handed back to the cache*/
+        if (event.type == AudioEventTypes::filter_graph_failed)
+            delete event.retired_filter_graph;
+        else
+            FilterGraphReturner {}(event.retired_filter_graph);
+        CachedResampler retired_resampler {event.resampler, event.resampler_returner};
+    }
+
+    delete m_silence_fallback.load(std::memory_order_acquire);
+    delete m_noise_fallback.load(std::memory_order_acquire);
+}
+
+void AudioChannel::push_command(const AudioCommand& command)
+{
+    if (!m_commands.push(command))
+        throw "audio command queue is full, try again shortly";
+}
+
+uint64_t AudioChannel::switch_source(std::unique_ptr<InputStream> source, const std::string& name, int64_t start_sample)
+{
+    std::lock_guard<std::mutex> lock (m_control_mtx);
+    if (m_switch_names.size() >= MAX_OUTSTANDING_SOURCE_SWITCHES)
+        throw "too many source switches waiting, try again once the current crossfade has finished";
+
+    AudioCommand command {AudioCommandTypes::switch_source, m_next_id++, source.get(), start_sample};
+    push_command(command);
+    /*the audio thread owns the source from here on*/
+    source.release();
+    m_switch_names[command.id] = name;
+    return command.id;
+}
+
+void AudioChannel::set_gain(float gain)
+{
+    AudioCommand command {};
+    command.type = AudioCommandTypes::set_gain;
+    command.gain = gain;
+    push_command(command);
+}
+
+void AudioChannel::set_output_filter(CachedFilterGraph filter_graph)
+{
+    std::lock_guard<std::mutex> lock (m_control_mtx);
+    if (m_filter_swaps >= MAX_OUTSTANDING_FILTER_SWAPS)
+        throw "too many output filter changes waiting, try again shortly";
+
+    AudioCommand command {};
+    command.type = AudioCommandTypes::set_output_filter;
+    command.filter_graph = filter_graph.get();
+    push_command(command);
+    /*the audio thread owns the graph from here on*/
+    filter_graph.release();
+    m_filter_swaps++;
+}
+
+void AudioChannel::provide_fallbacks(const AVCodecContext& output_codec_ctx, SourceTimingModes timing_mode)
+{
+    std::lock_guard<std::mutex> lock (m_control_mtx);
+    m_fallback_codec_ctx = &output_codec_ctx;
+    m_fallback_timing_mode = timing_mode;
+    replenish_fallbacks();
+}
+
+void AudioChannel::replenish_fallbacks()
+{
+    if (!m_fallback_codec_ctx)
+        return;
+
+    for (DefaultSourceModes mode : {DefaultSourceModes::silence, DefaultSourceModes::white_noise})
+    {
+        /*only the audio thread empties a slot and only this thread fills one*/
+        std::atomic<InputStream*>& slot {fallback_slot(mode)};
+        if (slot.load(std::memory_order_acquire))
+            continue;
+        try
+        {
+            slot.store(new InputStream(*m_fallback_codec_ctx, mode, m_fallback_timing_mode), std::memory_order_release);
+        }
+        catch (const char* exception)
+        {
+            std::cout << exception << ": fallback source not ready\n";
+        }
+    }
+}
+
+std::vector<FinishedSwitch> AudioChannel::collect_events()
+{
+    std::vector<FinishedSwitch> finished {};
+    std::lock_guard<std::mutex> lock (m_control_mtx);
+
+    AudioEvent event {};
+    while (m_events.pop(event))
+    {
+        delete event.retired;
+        if (event.type == AudioEventTypes::filter_graph_failed)
+        {
+            char error[AV_ERROR_MAX_STRING_SIZE] {};
+            av_strerror(event.error, error, sizeof(error));
+            std::cout << "output filter " << event.retired_filter_graph->chain() << " failed (" << error
+                      << "), streaming unfiltered\n";
+            /*not back to the cache, a graph in an error state is rebuilt if the chain is used again*/
+            delete event.retired_filter_graph;
+            continue;
+        }
+        if (event.type == AudioEventTypes::resampler_retired)
+        {
+            CachedResampler swr_ctx {event.resampler, event.resampler_returner};
+            /*reset keeping the filter bank and primed here rather than on the audio thread, a context which
+            * can't be reset goes back to the cache and its source makes no more resampler steps*/
+            if (!event.id || swr_init(swr_ctx.get()) < 0)
+                continue;
+            prime_resampler(swr_ctx.get(), RESAMPLER_PRIME_SAMPLES);
+            AudioCommand command {};
+            command.type = AudioCommandTypes::standby_resampler;
+            command.id = event.id;
+            command.resampler = swr_ctx.get();
+            command.resampler_returner = swr_ctx.get_deleter();
+            if (m_commands.push(command))
+                swr_ctx.release();
+            continue;
+        }
+        if (event.type == AudioEventTypes::filter_graph_retired)
+        {
+            /*back to the cache, off the audio thread*/
+            CachedFilterGraph retired {event.retired_filter_graph};
+            m_filter_swaps--;
+            continue;
+        }
+        auto name = m_switch_names.find(event.id);
+        if (name == m_switch_names.end())
+            continue;
+        finished.push_back({event.type, name->second, event.scheduled, event.error_samples});
+        m_switch_names.erase(name);
+    }
+    replenish_fallbacks();
+    return finished;
+}
+
+void AudioChannel::service(OutputStream& sink)
+{
+    AudioCommand command {};
+    while (m_commands.pop(command))
+    {
+        switch (+command.type)
+        {
+            case +AudioCommandTypes::switch_source:
+                queue_switch(command);
+                break;
+
+            case +AudioCommandTypes::set_gain:
+                sink.set_gain(command.gain);
+                break;
+
+            case +AudioCommandTypes::set_output_filter:
+            {
+                CachedFilterGraph previous {sink.set_filter_graph(CachedFilterGraph {command.filter_graph})};
+                AudioEvent event {};
+                event.type = AudioEventTypes::filter_graph_retired;
+                event.retired_filter_graph = previous.get();
+                /*if the event queue is ever full the graph is rebuilt and goes back to the cache from here rather than leaking*/
+                if (m_events.push(event))
+                    previous.release();
+                break;
+            }
+
+            case +AudioCommandTypes::standby_resampler:
+            {
+                CachedResampler swr_ctx {command.resampler, command.resampler_returner};
+                /*kept until service_resamplers() sees its source, if every slot is taken the first goes back*/
+                std::size_t slot {};
+                while (slot < m_standby_resamplers.size() && m_standby_resamplers[slot])
+                    slot++;
+                if (slot == m_standby_resamplers.size())
+                {
+                    slot = 0;
+                    return_resampler(std::move(m_standby_resamplers[slot]), 0);
+                }
+                m_standby_resamplers[slot] = std::move(swr_ctx);
+                m_standby_resampler_sources[slot] = command.id;
+                break;
+            }
+        }
+    }
+
+    AudioEvent failed {};
+    failed.type = AudioEventTypes::filter_graph_failed;
+    CachedFilterGraph failed_graph {sink.take_failed_filter_graph(failed.error)};
+    failed.retired_filter_graph = failed_graph.get();
+    /*if the event queue is ever full the graph is destroyed here, it can't go back to the cache*/
+    if (failed_graph && !m_events.push(failed))
+        delete failed_graph.get();
+    failed_graph.release();
+}
+
+void AudioChannel::queue_switch(const AudioCommand& command)
+{
+    PendingSwitch request {std::unique_ptr<InputStream> {command.source}, command.id, command.start_sample};
+    /*the newest request for straight away wins, one still waiting is never played*/
+    if (request.start_sample < 0)
+    {
+        if (m_pending.source)
+            retire(AudioEventTypes::switch_superseded, m_pending.id, std::move(m_pending.source));
+        m_pending = std::move(request);
+        return;
+    }
+
+    /*a scheduled switch only supersedes one for the same start sample*/
+    PendingSwitch* slot {};
+    for (PendingSwitch& scheduled : m_scheduled)
+    {
+        if (scheduled.source && scheduled.start_sample == request.start_sample)
+        {
+            slot = &scheduled;
+            break;
+        }
+        if (!scheduled.source && !slot)
+            slot = &scheduled;
+    }
+    if (!slot)
+    {
+        retire(AudioEventTypes::switch_superseded, request.id, std::move(request.source));
+        return;
+    }
+    if (slot->source)
+        retire(AudioEventTypes::switch_superseded, slot->id, std::move(slot->source));
+    *slot = std::move(request);
+}
+
+std::size_t AudioChannel::next_scheduled() const
+{
+    std::size_t next {MAX_SCHEDULED_SWITCHES};
+    for (std::size_t slot = 0; slot < m_scheduled.size(); slot++)
+    {
+        if (m_scheduled[slot].source && (next == MAX_SCHEDULED_SWITCHES || m_scheduled[slot].start_sample < m_scheduled[next].start_sample))
+            next = slot;
+    }
+    return next;
+}
+
+bool AudioChannel::switch_due(int64_t before_sample) const
+{
+    if (m_pending.source)
+        return true;
+    const std::size_t next {next_scheduled()};
+    return next < MAX_SCHEDULED_SWITCHES && m_scheduled[next].start_sample < before_sample;
+}
+
+void AudioChannel::pre_roll(PendingSwitch& waiting)
+{
+    if (!waiting.source || !waiting.source->is_live())
+        return;
+
+    try
+    {
+        waiting.source->get_one_output_frame();
+    }
+    catch (const char* exception)
+    {
+        std::cout << "waiting source: " << exception << ": switch abandoned\n";
+        retire(AudioEventTypes::switch_failed, waiting.id, std::move(waiting.source));
+    }
+}
+
+void AudioChannel::pre_roll()
+{
+    pre_roll(m_pending);
+    for (PendingSwitch& scheduled : m_scheduled)
+        pre_roll(scheduled);
+}
+
+std::unique_ptr<InputStream> AudioChannel::take_pending(uint64_t& id, int64_t& start_sample)
+{
+    PendingSwitch* taken {&m_pending};
+    if (!m_pending.source)
+    {
+        const std::size_t next {next_scheduled()};
+        if (next == MAX_SCHEDULED_SWITCHES)
+            return nullptr;
+        taken = &m_scheduled[next];
+    }
+    id = taken->id;
+    start_sample = taken->start_sample;
+    return std::move(taken->source);
+}
+
+void AudioChannel::finish_switch(uint64_t id, bool success, std::unique_ptr<InputStream> retired, 
+                                 int64_t start_sample, int64_t actual_start_sample)
+{
+    bool scheduled = start_sample >= 0 && actual_start_sample >= 0;
+    retire(success ? AudioEventTypes::switch_complete : AudioEventTypes::switch_failed, id, std::move(retired),
+           scheduled, scheduled ? actual_start_sample - start_sample : 0);
+}
+
+std::unique_ptr<InputStream> AudioChannel::take_fallback(DefaultSourceModes mode, const AVCodecContext& output_codec_ctx,
+                                                         SourceTimingModes timing_mode)
+{
+    std::unique_ptr<InputStream> fallback {fallback_slot(mode).exchange(nullptr, std::memory_order_acq_rel)};
+    if (!fallback)
+        fallback = std::make_unique<InputStream>(output_codec_ctx, mode, timing_mode);
+    return fallback;
+}
+
+void AudioChannel::retire_failed(std::unique_ptr<InputStream> failed)
+{
+    retire(AudioEventTypes::source_failed, 0, std::move(failed));
+}
+
+void AudioChannel::service_resamplers(InputStream& source)
+{
+    CachedResampler retired {source.take_retired_resampler()};
+    if (retired)
+        return_resampler(std::move(retired), source.id());
+
+    for (std::size_t slot = 0; slot < m_standby_resamplers.size(); slot++)
+    {
+        if (m_standby_resamplers[slot] && m_standby_resampler_sources[slot] == source.id())
+            source.set_standby_resampler(std::move(m_standby_resamplers[slot]));
+    }
+}
+
+void AudioChannel::return_resampler(CachedResampler swr_ctx, uint64_t source_id)
+{
+    AudioEvent event {};
+    event.type = AudioEventTypes::resampler_retired;
+    event.id = source_id;
+    event.resampler = swr_ctx.get();
+    event.resampler_returner = swr_ctx.get_deleter();
+    /*if the event queue is ever full the context goes back to the cache from here rather than leaking*/
+    if (m_events.push(event))
+        swr_ctx.release();
+}
+
+void AudioChannel::drop_standby_resamplers(uint64_t source_id)
+{
+    for (std::size_t slot = 0; slot < m_standby_resamplers.size(); slot++)
+    {
+        if (m_standby_resamplers[slot] && m_standby_resampler_sources[slot] == source_id)
+            return_resampler(std::move(m_standby_resamplers[slot]), 0);
+    }
+}
+
+void AudioChannel::retire(AudioEventTypes type, uint64_t id, std::unique_ptr<InputStream> source, 
+                          bool scheduled, int64_t error_samples)
+{
+    /*a resampler still being reset for the source has nowhere to go*/
+    if (source)
+        drop_standby_resamplers(source->id());
+    AudioEvent event {type, id, source.get(), scheduled, error_samples};
+    /*can't fail while switches are limited to MAX_OUTSTANDING_SOURCE_SWITCHES,
+    * if it ever does the source is destroyed here rather than leaked*/
+    if (m_events.push(event))
+        source.release();
+}
@@ -0,0 +1,252 @@
+/*
+* Lock-free channel between the control side (stdin, the control socket's command executor)
+* and the audio thread.
+*
+* Commands (switch source, change gain) go to the audio thread through a bounded lock-free
+* queue which the audio thread drains once per output frame, so it never waits on a lock
+* held by a command that is opening a source or rewriting the config. Sources are opened
+* off the audio thread and handed over as heap objects: ownership passes with the command
+* and the queue's release/acquire ordering publishes the fully constructed object. Sources
+* the audio thread has finished with come back through a second queue and are destroyed
+* on the control side, so freeing decoders and buffers never happens on the audio thread.
+*
+* Resamplers the quality governor swaps out of a source are reset and primed on the control side too,
+* then handed back to the source they came from to stand by for the next step (see
+* InputStream::follow_quality_governor).
+*
+* A source which fails while playing is replaced by a silent or white noise fallback the control
+* side built beforehand, and goes back the same way; the control side then builds the next fallback.
+*
+* The output filter graph is handed over the same way: built off the audio thread, swapped in
+* between two frames and the one it replaces sent back to go back to the filter graph cache. One which
+* fails while playing is taken out of the path by the sink and sent back the same way to be destroyed.
+*
+* Switches requested while a crossfade is in progress are queued: the crossfade in progress
+* always completes, then the audio thread crossfades to the most recent request. A request
+* which is still waiting when a newer one arrives is superseded and never played.
+*
+* A switch may carry a start sample on the output clock (see OutputStream::get_samples_written),
+* the crossfade then starts at exactly that sample and the difference between the requested
+* and actual start is reported back. Scheduled switches wait in slots of their own, keyed by their
+* start sample, so a switch requested for straight away (use-source, failover) doesn't supersede a
+* timed one waiting out its lead time: it plays first and the scheduled one follows at its sample.
+* Only a scheduled switch for the same start sample supersedes another, or one arriving with every
+* slot taken. Live sources waiting for their start sample are read and discarded every frame so
+* they are at the live edge when the crossfade starts.
+*/
+
+#ifndef AUDIOCHANNEL_H
+#define AUDIOCHANNEL_H
+
+#include "Fonduempeg.h"
+#include "LockFreeQueue.h"
+#include<array>
+#include<atomic>
+#include<cstdint>
+#include<memory>
+#include<mutex>
+#include<string>
+#include<type_traits>
+#include<unordered_map>
+#include<utility>
+#include<vector>
+
+#define AUDIO_CHANNEL_CAPACITY 64
+/*switches submitted but not yet reported back, bounds the number of events the audio thread can produce*/
+#define MAX_OUTSTANDING_SOURCE_SWITCHES 16
+/*output filter graphs handed over but whose predecessor hasn't come back yet*/
+#define MAX_OUTSTANDING_FILTER_SWAPS 4
+/*reset resamplers waiting for their source to be serviced, two sources step at once during a crossfade*/
+#define MAX_STANDBY_RESAMPLERS 4
+/*scheduled switches waiting for their start sample at once*/
+#define MAX_SCHEDULED_SWITCHES 4
+
+enum class AudioCommandTypes {switch_source, set_gain, set_output_filter, standby_resampler};
+
+/*overload the unary + operator to cast the enum class AudioCommandTypes
+* to int for e.g. switch statements*/
+constexpr auto operator+(AudioCommandTypes t) noexcept
+{
+    return static_cast<std::underlying_type_t<AudioCommandTypes>>(t);
+}
+
+enum class AudioEventTypes {switch_complete, switch_failed, switch_superseded, filter_graph_retired, source_failed,
+                            filter_graph_failed, resampler_retired};
+
+/*overload the unary + operator to cast the enum class AudioEventTypes
+* to int for e.g. switch statements*/
+constexpr auto operator+(AudioEventTypes t) noexcept
+{
+    return static_cast<std::underlying_type_t<AudioEventTypes>>(t);
+}
+
+struct AudioCommand
+{
+    AudioCommandTypes type {AudioCommandTypes::switch_source};
+    uint64_t id {};
+    /*owned by whoever currently holds the command*/
+    InputStream* source {};
+    /*output sample to start the crossfade at, negative to start as soon as possible*/
+    int64_t start_sample {-1};
+    float gain {1};
+    /*owned by whoever currently holds the command, null to remove the output filters*/
+    FilterGraph* filter_graph {};
+    /*a reset resampler for the source whose InputStream::id() is id, owned by whoever holds the command*/
+    SwrContext* resampler {};
+    ResamplerReturner resampler_returner {};
+};
+
+struct AudioEvent
+{
+    AudioEventTypes type {AudioEventTypes::switch_complete};
+    /*the switch the event reports on*/
+    uint64_t id {};
+    /*a source the audio thread has finished with, to be destroyed by the control side*/
+    InputStream* retired {};
+    bool scheduled {false};
+    /*actual minus requested start sample of a scheduled switch*/
+    int64_t error_samples {};
+    /*an output filter graph the audio thread has replaced, to be handed back to the cache by the control side*/
+    FilterGraph* retired_filter_graph {};
+    /*the FFmpeg error a failed filter graph returned*/
+    int error {};
+    /*a resampler to reset for the source whose InputStream::id() is id, or with id 0 to go back to the cache*/
+    SwrContext* resampler {};
+    ResamplerReturner resampler_returner {};
+};
+
+/*a switch the audio thread has finished with, as reported by collect_events()*/
+struct FinishedSwitch
+{
+    AudioEventTypes result {};
+    std::string name {};
+    bool scheduled {false};
+    int64_t error_samples {};
+};
+
+/*a source handed to the audio thread and waiting for its crossfade*/
+struct PendingSwitch
+{
+    std::unique_ptr<InputStream> source {};
+    uint64_t id {};
+    /*negative for as soon as possible*/
+    int64_t start_sample {-1};
+};
+
+class AudioChannel
+{
+    private:
+        LockFreeQueue<AudioCommand, AUDIO_CHANNEL_CAPACITY> m_commands {};
+        LockFreeQueue<AudioEvent, AUDIO_CHANNEL_CAPACITY> m_events {};
+        std::atomic<bool> m_stop {false};
+
+        /*control side only, serialises the producers' bookkeeping, never taken by the audio thread*/
+        std::mutex m_control_mtx;
+        uint64_t m_next_id {1};
+        int m_filter_swaps {};
+        std::unordered_map<uint64_t, std::string> m_switch_names {};
+        /*set before the audio thread starts, null if no fallbacks are provided*/
+        const AVCodecContext* m_fallback_codec_ctx {};
+        SourceTimingModes m_fallback_timing_mode {SourceTimingModes::realtime};
+
+        /*built by the control side, taken (left null) by the audio thread*/
+        std::atomic<InputStream*> m_silence_fallback {};
+        std::atomic<InputStream*> m_noise_fallback {};
+
+        /*audio thread only*/
+        PendingSwitch m_pending {};
+        std::array<PendingSwitch, MAX_SCHEDULED_SWITCHES> m_scheduled {};
+        std::array<CachedResampler, MAX_STANDBY_RESAMPLERS> m_standby_resamplers {};
+        std::array<uint64_t, MAX_STANDBY_RESAMPLERS> m_standby_resampler_sources {};
+
+        void push_command(const AudioCommand& command);
+        void retire(AudioEventTypes type, uint64_t id, std::unique_ptr<InputStream> source, 
+                    bool scheduled = false, int64_t error_samples = 0);
+        std::atomic<InputStream*>& fallback_slot(DefaultSourceModes mode)
+            {return mode == DefaultSourceModes::silence ? m_silence_fallback : m_noise_fallback;}
+        void replenish_fallbacks();
+        void return_resampler(CachedResampler swr_ctx, uint64_t source_id);
+        void drop_standby_resamplers(uint64_t source_id);
+        void queue_switch(const AudioCommand& command);
+        /*the slot of the scheduled switch starting first, MAX_SCHEDULED_SWITCHES if none is waiting*/
+        std::size_t next_scheduled() const;
+        void pre_roll(PendingSwitch& waiting);
+
+    public:
+        AudioChannel() = default;
+
+        /*destroys any sources still in flight, call once the audio thread has stopped*/
+        ~AudioChannel();
+
+        AudioChannel(const AudioChannel&) = delete;
+        AudioChannel& operator= (const AudioChannel&) = delete;
+
+        /*CONTROL SIDE
+        *
+        *
+        */
+
+        /*hands an opened source to the audio thread to crossfade to at start_sample (or straight away if negative),
+        * returns the switch id. throws a const char* exception (and destroys the source) if too many switches are waiting*/
+        uint64_t switch_source(std::unique_ptr<InputStream> source, const std::string& name, int64_t start_sample = -1);
+
+        /*linear output gain, ramped over one frame by the sink*/
+        void set_gain(float gain);
+
+        /*hands a filter graph built by output_filter_graph() (null for none) to the audio thread, which puts it in
+        * place of the sink's current one between two frames. throws a const char* exception (and hands the graph
+        * back to the cache) if too many are waiting*/
+        void set_output_filter(CachedFilterGraph filter_graph);
+
+        /*builds a silent and a white noise source to stand in for sources which fail, each rebuilt by collect_events()
+        * once the audio thread has taken it. call before the audio thread starts*/
+        void provide_fallbacks(const AVCodecContext& output_codec_ctx, SourceTimingModes timing_mode);
+
+        void stop() {m_stop.store(true, std::memory_order_release);}
+
+        bool stopping() const {return m_stop.load(std::memory_order_acquire);}
+
+        /*destroys the sources and filter graphs the audio thread has retired, replaces the fallbacks it has taken
+        * and returns the switches it has finished*/
+        std::vector<FinishedSwitch> collect_events();
+
+        /*AUDIO THREAD SIDE
+        *
+        *
+        */
+
+        /*drains the command queue without blocking and sends back an output filter graph which has failed,
+        * call once per output frame*/
+        void service(OutputStream& sink);
+
+        bool switch_pending() const {return m_pending.source || next_scheduled() < MAX_SCHEDULED_SWITCHES;}
+
+        /*true if a switch is waiting which should start before the given output sample*/
+        bool switch_due(int64_t before_sample) const;
+
+        /*reads and discards one frame from each waiting live source, a source which fails is reported as a failed switch*/
+        void pre_roll();
+
+        /*takes the source most recently requested for straight away or, without one, the scheduled switch starting
+        * first, and its start sample (negative for as soon as possible). the caller owns the source until finish_switch()*/
+        std::unique_ptr<InputStream> take_pending(uint64_t& id, int64_t& start_sample);
+
+        /*reports a switch as complete (retired is the previous source) or failed (retired is the new source)
+        * along with the sample the crossfade actually started at*/
+        void finish_switch(uint64_t id, bool success, std::unique_ptr<InputStream> retired, 
+                           int64_t start_sample = -1, int64_t actual_start_sample = -1);
+
+        /*the fallback source to play in place of one which has failed. only if the control side hasn't yet
+        * replaced the last one taken (or provided none) is one built here, for the output and timing mode given*/
+        std::unique_ptr<InputStream> take_fallback(DefaultSourceModes mode, const AVCodecContext& output_codec_ctx,
+                                                   SourceTimingModes timing_mode);
+
+        /*hands a source which has failed back to the control side to be destroyed*/
+        void retire_failed(std::unique_ptr<InputStream> failed);
+
+        /*sends a resampler the source's quality step swapped out to the control side to be reset, and gives
+        * the source the one reset for it if it has come back. call once per frame for every source playing*/
+        void service_resamplers(InputStream& source);
+};
+
+#endif
@@ -0,0 +1,445 @@
+#include "ConfigStore.h"
+
+#include<cerrno>
+#include<cstdio>
+#include<cstring>
+#include<fstream>
+#include<iostream>
+#include<sstream>
+
+#include<fcntl.h>
+#include<poll.h>
+#include<sys/eventfd.h>
+#include<sys/inotify.h>
+#include<unistd.h>
+
+using json = nlohmann::json;
+
+namespace
+{
+    std::string directory_of(const std::string& path)
+    {
+        std::size_t position = path.find_last_of('/');
+        if (position == std::string::npos)
+            return ".";
+        if (position == 0)
+            return "/";
+        return path.substr(0, position);
+    }
+
+    std::string filename_of(const std::string& path)
+    {
+        std::size_t position = path.find_last_of('/');
+        return position == std::string::npos ? path : path.substr(position + 1);
+    }
+
+    /*throws what, followed by the reason for error (an errno captured when the call failed, before any
+    * cleanup could overwrite it), as a const char* exception valid until the thread's next failure*/
+    [[noreturn]] void throw_with_errno(const char* what, int error)
+    {
+        static thread_local char message[256] {};
+        std::snprintf(message, sizeof(message), "%s: %s", what, std::strerror(error));
+        throw static_cast<const char*>(message);
+    }
+
+    std::string read_file(const std::string& path)
+    {
+        std::ifstream file {path};
+        std::stringstream contents {};
+        contents << file.rdbuf();
+        return contents.str();
+    }
+
+    /*write the contents to a temp file, fsync it and rename it over file_path*/
+    void write_file_atomically(const std::string& contents, const std::string& file_path)
+    {
+        std::string temp_path {file_path + ".tmp"};
+
+        int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            throw_with_errno("Config: could not create temporary config file", errno);
+        }
+
+        std::size_t written {};
+        while (written < contents.size())
+        {
+            ssize_t ret = write(fd, contents.data() + written, contents.size() - written);
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret < 0)
+            {
+                const int error {errno};
+                close(fd);
+                unlink(temp_path.c_str());
+                throw_with_errno("Config: could not write temporary config file", error);
+            }
+            written += ret;
+        }
+
+        /*the data must be on disk before the rename makes it the config*/
+        if (fsync(fd) < 0)
+        {
+            const int error {errno};
+            close(fd);
+            unlink(temp_path.c_str());
+            throw_with_errno("Config: could not sync temporary config file", error);
+        }
+        if (close(fd) < 0)
+        {
+            const int error {errno};
+            unlink(temp_path.c_str());
+            throw_with_errno("Config: could not sync temporary config file", error);
+        }
+
+        if (rename(temp_path.c_str(), file_path.c_str()) < 0)
+        {
+            const int error {errno};
+            unlink(temp_path.c_str());
+            throw_with_errno("Config: could not replace config file", error);
+        }
+
+        /*make the rename itself durable*/
+        int directory_fd = open(directory_of(file_path).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (directory_fd >= 0)
+        {
+            fsync(directory_fd);
+            close(directory_fd);
+        }
+    }
+}
+
+/*open the config file and parse it as a json object*/
+json open_config_file(const std::string& file_path)
+{
+    std::ifstream file {file_path};
+    json config = json::object();
+    config = json::parse(file);
+    return config;
+}
+
+void write_config_file(const json& config, const std::string& file_path)
+{
+    write_file_atomically(config.dump(1, '\t'), file_path);
+}
+
+ConfigStore::ConfigStore(std::string path):
+    m_path {std::move(path)}
+{
+    try
+    {
+        m_config = open_config_file(m_path);
+    }
+    catch (const json::exception& exception)
+    {
+        std::cerr << "Config: " << exception.what() << '\n';
+        throw "Config: could not parse config file";
+    }
+
+    if (!m_config.contains("sources"))
+        m_config["sources"] = json::object();
+    index_sources();
+
+    m_writer_thread = std::thread {&ConfigStore::writer, this};
+}
+
+ConfigStore::~ConfigStore()
+{
+    {
+        std::lock_guard<std::mutex> lock (m_writer_mtx);
+        m_stop = true;
+    }
+    m_writer_cv.notify_all();
+
+    if (m_wake_fd >= 0)
+    {
+        uint64_t one = 1;
+        ssize_t ret = write(m_wake_fd, &one, sizeof(one));
+        (void)ret;
+    }
+
+    if (m_watch_thread.joinable())
+        m_watch_thread.join();
+    if (m_writer_thread.joinable())
+        m_writer_thread.join();
+
+    if (m_inotify_fd >= 0)
+        close(m_inotify_fd);
+    if (m_wake_fd >= 0)
+        close(m_wake_fd);
+}
+
+void ConfigStore::index_sources()
+{
+    m_sources.clear();
+    m_sources.reserve(m_config["sources"].size());
+    for (auto item = m_config["sources"].begin(); item != m_config["sources"].end(); ++item)
+    {
+        if (item.value().is_string())
+        {
+            std::string prompt {item.value().get<std::string>()};
+            SourceDescriptorPtr descriptor {compile_source_descriptor(prompt)};
+            m_sources.emplace(item.key(), SourceEntry {std::move(prompt), std::move(descriptor)});
+        }
+    }
+}
+
+void ConfigStore::set_on_sources_changed(SourcesChangedCallback callback)
+{
+    std::unique_lock<std::shared_mutex> lock (m_mtx);
+    m_on_sources_changed = std::move(callback);
+}
+
+json ConfigStore::snapshot() const
+{
+    std::shared_lock<std::shared_mutex> lock (m_mtx);
+    return m_config;
+}
+
+json ConfigStore::section(const std::string& name) const
+{
+    std::shared_lock<std::shared_mutex> lock (m_mtx);
+    if (!m_config.contains(name))
+        return json::object();
+    return m_config[name];
+}
+
+bool ConfigStore::find_source(const std::string& name, std::string& prompt) const
+{
+    std::shared_lock<std::shared_mutex> lock (m_mtx);
+    auto source = m_sources.find(name);
+    if (source == m_sources.end())
+        return false;
+    prompt = source->second.prompt;
+    return true;
+}
+
+SourceDescriptorPtr ConfigStore::find_descriptor(const std::string& name) const
+{
+    std::shared_lock<std::shared_mutex> lock (m_mtx);
+    auto source = m_sources.find(name);
+    if (source == m_sources.end())
+        return nullptr;
+    return source->second.descriptor;
+}
+
+bool ConfigStore::contains_source(const std::string& name) const
+{
+    std::shared_lock<std::shared_mutex> lock (m_mtx);
+    return m_sources.count(name) > 0;
+}
+
+std::size_t ConfigStore::number_of_sources() const
+{
+    std::shared_lock<std::shared_mutex> lock (m_mtx);
+    return m_sources.size();
+}
+
+json ConfigStore::sources() const
+{
+    std::shared_lock<std::shared_mutex> lock (m_mtx);
+    return m_config["sources"];
+}
+
+void ConfigStore::set_source(const std::string& name, const std::string& prompt)
+{
+    /*compiled outside the lock, av_find_input_format and friends walk FFmpeg's lists*/
+    SourceDescriptorPtr descriptor {compile_source_descriptor(prompt)};
+    {
+        std::unique_lock<std::shared_mutex> lock (m_mtx);
+        m_config["sources"][name] = prompt;
+        m_sources[name] = SourceEntry {prompt, std::move(descriptor)};
+    }
+    mark_dirty();
+}
+
+bool ConfigStore::erase_source(const std::string& name)
+{
+    {
+        std::unique_lock<std::shared_mutex> lock (m_mtx);
+        if (!m_sources.erase(name))
+            return false;
+        m_config["sources"].erase(name);
+    }
+    mark_dirty();
+    return true;
+}
+
+std::string ConfigStore::active_source() const
+{
+    std::shared_lock<std::shared_mutex> lock (m_mtx);
+    if (!m_config.contains("stream settings"))
+        return "";
+    return m_config["stream settings"].value("active source", std::string{});
+}
+
+void ConfigStore::set_active_source(const std::string& name)
+{
+    {
+        std::unique_lock<std::shared_mutex> lock (m_mtx);
+        m_config["stream settings"]["active source"] = name;
+    }
+    mark_dirty();
+}
+
+void ConfigStore::mark_dirty()
+{
+    {
+        std::lock_guard<std::mutex> lock (m_writer_mtx);
+        m_version++;
+    }
+    m_writer_cv.notify_all();
+}
+
+void ConfigStore::flush()
+{
+    std::unique_lock<std::mutex> lock (m_writer_mtx);
+    uint64_t version = m_version;
+    m_writer_cv.wait(lock, [this, version]{return m_stop || m_written_version >= version;});
+}
+
+void ConfigStore::writer()
+{
+    std::unique_lock<std::mutex> lock (m_writer_mtx);
+    while (true)
+    {
+        m_writer_cv.wait(lock, [this]{return m_stop || m_version != m_written_version;});
+        if (m_version == m_written_version)
+            return;
+
+        /*several edits made while the last write was in progress are coalesced into one write*/
+        uint64_t version = m_version;
+        lock.unlock();
+
+        std::string contents {snapshot().dump(1, '\t')};
+
+        /*recorded before writing so the inotify event for this write is recognised as our own*/
+        lock.lock();
+        m_last_written = contents;
+        lock.unlock();
+
+        try
+        {
+            write_file_atomically(contents, m_path);
+        }
+        catch (const char* exception)
+        {
+            std::cerr << exception << '\n';
+        }
+
+        lock.lock();
+        m_written_version = version;
+        m_writer_cv.notify_all();
+    }
+}
+
+void ConfigStore::watch()
+{
+    m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    /*watch the directory rather than the file: editors (and write_config_file) replace the file by renaming over it*/
+    if (m_inotify_fd < 0 || m_wake_fd < 0 ||
+        inotify_add_watch(m_inotify_fd, directory_of(m_path).c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        std::cerr << "Config: could not watch the config file for changes: " << std::strerror(errno) << '\n';
+        return;
+    }
+
+    m_watch_thread = std::thread {&ConfigStore::watcher, this};
+}
+
+void ConfigStore::watcher()
+{
+    const std::string filename {filename_of(m_path)};
+    alignas(struct inotify_event) char buffer[4096];
+
+    while (true)
+    {
+        struct pollfd fds[2] {{m_inotify_fd, POLLIN, 0}, {m_wake_fd, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        if (fds[1].revents)
+            return;
+
+        bool config_changed = false;
+        ssize_t length {};
+        while ((length = read(m_inotify_fd, buffer, sizeof(buffer))) > 0)
+        {
+            for (char* position = buffer; position < buffer + length; )
+            {
+                const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(position);
+                if (event->len && filename == event->name)
+                    config_changed = true;
+                position += sizeof(struct inotify_event) + event->len;
+            }
+        }
+
+        if (config_changed)
+            reload();
+    }
+}
+
+void ConfigStore::reload()
+{
+    std::string contents {read_file(m_path)};
+    {
+        /*ignore the notification caused by our own write*/
+        std::lock_guard<std::mutex> lock (m_writer_mtx);
+        if (contents == m_last_written)
+            return;
+    }
+
+    json config = json::parse(contents, nullptr, false);
+    if (config.is_discarded() || !config.is_object())
+    {
+        std::cerr << "Config: config file changed but couldn't be parsed, keeping the previous config\n";
+        return;
+    }
+    if (!config.contains("sources"))
+        config["sources"] = json::object();
+
+    std::vector<std::string> changed {};
+    SourcesChangedCallback callback {};
+    {
+        std::unique_lock<std::shared_mutex> lock (m_mtx);
+
+        /*merge the sources one by one rather than re-indexing all of them*/
+        for (auto item = config["sources"].begin(); item != config["sources"].end(); ++item)
+        {
+            if (!item.value().is_string())
+                continue;
+            auto source = m_sources.find(item.key());
+            if (source == m_sources.end() || source->second.prompt != item.value().get<std::string>())
+            {
+                std::string prompt {item.value().get<std::string>()};
+                SourceDescriptorPtr descriptor {compile_source_descriptor(prompt)};
+                m_sources[item.key()] = SourceEntry {std::move(prompt), std::move(descriptor)};
+                changed.push_back(item.key());
+            }
+        }
+        for (auto source = m_sources.begin(); source != m_sources.end(); )
+        {
+            if (!config["sources"].contains(source->first))
+            {
+                changed.push_back(source->first);
+                source = m_sources.erase(source);
+            }
+            else
+            {
+                ++source;
+            }
+        }
+
+        m_config = std::move(config);
+        callback = m_on_sources_changed;
+    }
+
+    std::cout << "config reloaded, " << changed.size() << " source(s) changed\n";
+    if (callback && !changed.empty())
+        callback(changed);
+}
@@ -0,0 +1,119 @@
+/*
+* In-memory copy of the config file.
+*
+* The config is parsed once and kept in memory, with the sources also indexed by name in a hash
+* map so lookups stay O(1) with thousands of sources. Every source's prompt is compiled into a
+* SourceDescriptor when it's loaded or set, so switching to a source never parses its prompt. Edits are applied in memory immediately and
+* persisted by a writer thread (temp file + fsync + rename, so a crash mid-write can never leave a
+* truncated config). An inotify watch on the config's directory picks up edits made by hand and
+* merges them in source by source, notifying a listener of exactly which sources changed.
+*/
+
+#ifndef CONFIGSTORE_H
+#define CONFIGSTORE_H
+
+#include <nlohmann/json.hpp>
+#include<atomic>
+#include<condition_variable>
+#include<functional>
+#include<mutex>
+#include<shared_mutex>
+#include<string>
+#include<thread>
+#include<unordered_map>
+#include<vector>
+
+#include "SourceDescriptor.h"
+
+/*open the config file and parse it as a json object*/
+nlohmann::json open_config_file(const std::string& file_path);
+
+/*atomically replace the config file: write a temp file, fsync it, rename it over the old one*/
+void write_config_file(const nlohmann::json& config, const std::string& file_path);
+
+class ConfigStore
+{
+    public:
+        /*called (from the watcher thread) with the names of sources added, changed or removed by a reload*/
+        using SourcesChangedCallback = std::function<void(const std::vector<std::string>&)>;
+
+    private:
+        std::string m_path;
+        mutable std::shared_mutex m_mtx;
+        nlohmann::json m_config {};
+        struct SourceEntry
+        {
+            std::string prompt;
+            SourceDescriptorPtr descriptor;
+        };
+
+        std::unordered_map<std::string, SourceEntry> m_sources {};
+        SourcesChangedCallback m_on_sources_changed {};
+
+        /*persistence*/
+        std::mutex m_writer_mtx;
+        std::condition_variable m_writer_cv;
+        uint64_t m_version {};
+        uint64_t m_written_version {};
+        std::string m_last_written {};
+        bool m_stop {false};
+        std::thread m_writer_thread;
+
+        /*reloading*/
+        int m_inotify_fd {-1};
+        int m_wake_fd {-1};
+        std::thread m_watch_thread;
+
+        void writer();
+        void watcher();
+        void reload();
+        void mark_dirty();
+        void index_sources();
+
+    public:
+        /*loads and indexes the config, throws a const char* exception if it can't be parsed*/
+        explicit ConfigStore(std::string path);
+
+        ~ConfigStore();
+
+        ConfigStore(const ConfigStore&) = delete;
+        ConfigStore& operator= (const ConfigStore&) = delete;
+
+        /*start reloading the config whenever the file is changed by something else*/
+        void watch();
+
+        void set_on_sources_changed(SourcesChangedCallback callback);
+
+        /*copy of the whole config*/
+        nlohmann::json snapshot() const;
+
+        /*copy of one top level section, an empty object if it doesn't exist*/
+        nlohmann::json section(const std::string& name) const;
+
+        /*O(1) lookup of a source's input prompt, returns false if there is no such source*/
+        bool find_source(const std::string& name, std::string& prompt) const;
+
+        /*O(1) lookup of a source's compiled prompt, null if there is no such source*/
+        SourceDescriptorPtr find_descriptor(const std::string& name) const;
+
+        bool contains_source(const std::string& name) const;
+
+        std::size_t number_of_sources() const;
+
+        /*all sources as a json object of name : prompt*/
+        nlohmann::json sources() const;
+
+        void set_source(const std::string& name, const std::string& prompt);
+
+        /*returns false if there was no such source*/
+        bool erase_source(const std::string& name);
+
+        std::string active_source() const;
+
+        void set_active_source(const std::string& name);
+
+        /*blocks until every edit made so far is on disk*/
+        void flush();
+};
+
+#endif
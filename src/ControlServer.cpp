@@ -0,0 +1,442 @@
+#include "ControlServer.h"
+
+#include<cerrno>
+#include<cstring>
+#include<future>
+#include<iostream>
+
+#include<arpa/inet.h>
+#include<fcntl.h>
+#include<netinet/in.h>
+#include<netinet/tcp.h>
+#include<sys/epoll.h>
+#include<sys/eventfd.h>
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<unistd.h>
+
+using json = nlohmann::json;
+
+CommandExecutor::CommandExecutor(Handler handler):
+    m_handler {std::move(handler)},
+    m_thread {&CommandExecutor::run, this}
+{
+}
+
+CommandExecutor::~CommandExecutor()
+{
+    stop();
+}
+
+void CommandExecutor::run()
+{
+    while (true)
+    {
+        std::pair<json, Callback> request {};
+        {
+            std::unique_lock<std::mutex> lock (m_mtx);
+            m_cv.wait(lock, [this]{return m_stop || !m_requests.empty();});
+            if (m_requests.empty())
+                return;
+            request = std::move(m_requests.front());
+            m_requests.pop_front();
+        }
+
+        json response {};
+        try
+        {
+            response = m_handler(request.first);
+        }
+        catch (const char* exception)
+        {
+            response = {{"ok", false}, {"message", exception}};
+        }
+        catch (const json::exception& exception)
+        {
+            response = {{"ok", false}, {"message", exception.what()}};
+        }
+
+        if (request.first.contains("id"))
+            response["id"] = request.first["id"];
+
+        if (request.second)
+            request.second(std::move(response));
+    }
+}
+
+void CommandExecutor::submit(json request, Callback on_done)
+{
+    {
+        std::lock_guard<std::mutex> lock (m_mtx);
+        if (m_stop)
+        {
+            if (on_done)
+                on_done(json {{"ok", false}, {"message", "control is shutting down"}});
+            return;
+        }
+        m_requests.emplace_back(std::move(request), std::move(on_done));
+    }
+    m_cv.notify_one();
+}
+
+json CommandExecutor::execute(const json& request)
+{
+    auto response = std::make_shared<std::promise<json>>();
+    std::future<json> future = response->get_future();
+    submit(request, [response](json result){response->set_value(std::move(result));});
+    return future.get();
+}
+
+void CommandExecutor::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock (m_mtx);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable() && m_thread.get_id() != std::this_thread::get_id())
+        m_thread.join();
+}
+
+
+ControlServer::ControlServer(const ControlServerSettings& settings, CommandExecutor& executor):
+    m_settings {settings},
+    m_executor {executor}
+{
+    m_epoll_fd.reset(epoll_create1(EPOLL_CLOEXEC));
+    m_wake_fd.reset(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+    if (m_epoll_fd.get() < 0 || m_wake_fd.get() < 0)
+    {
+        throw "Control: could not create epoll instance";
+    }
+
+    /*unix domain socket, remove a stale socket file left by a previous run*/
+    m_unix_fd.reset(socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+    struct sockaddr_un unix_address {};
+    unix_address.sun_family = AF_UNIX;
+    if (m_settings.socket_path.size() >= sizeof(unix_address.sun_path))
+    {
+        throw "Control: socket path too long";
+    }
+    std::strncpy(unix_address.sun_path, m_settings.socket_path.c_str(), sizeof(unix_address.sun_path) - 1);
+    unlink(m_settings.socket_path.c_str());
+
+    if (m_unix_fd.get() < 0 || bind(m_unix_fd.get(), reinterpret_cast<struct sockaddr*>(&unix_address), sizeof(unix_address)) < 0
+        || listen(m_unix_fd.get(), SOMAXCONN) < 0)
+    {
+        throw "Control: could not listen on the control socket";
+    }
+
+    /*optional loopback tcp listener*/
+    if (m_settings.tcp_port > 0)
+    {
+        m_tcp_fd.reset(socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+        int reuse = 1;
+        setsockopt(m_tcp_fd.get(), SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        struct sockaddr_in tcp_address {};
+        tcp_address.sin_family = AF_INET;
+        tcp_address.sin_port = htons(static_cast<uint16_t>(m_settings.tcp_port));
+        tcp_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (m_tcp_fd.get() < 0 || bind(m_tcp_fd.get(), reinterpret_cast<struct sockaddr*>(&tcp_address), sizeof(tcp_address)) < 0
+            || listen(m_tcp_fd.get(), SOMAXCONN) < 0)
+        {
+            /*the descriptors close themselves, the socket file doesn't*/
+            unlink(m_settings.socket_path.c_str());
+            throw "Control: could not listen on the loopback tcp port";
+        }
+    }
+
+    for (int fd : {m_unix_fd.get(), m_tcp_fd.get(), m_wake_fd.get()})
+    {
+        if (fd < 0)
+            continue;
+        struct epoll_event event {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(m_epoll_fd.get(), EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+ControlServer::~ControlServer()
+{
+    stop();
+    for (auto& item : m_clients)
+        close(item.second.fd);
+    unlink(m_settings.socket_path.c_str());
+}
+
+void ControlServer::start()
+{
+    m_thread = std::thread {&ControlServer::run, this};
+}
+
+void ControlServer::stop()
+{
+    m_stop = true;
+    uint64_t one = 1;
+    ssize_t written = write(m_wake_fd.get(), &one, sizeof(one));
+    (void)written;
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void ControlServer::run()
+{
+    constexpr int max_events = 64;
+    struct epoll_event events[max_events];
+
+    while (!m_stop)
+    {
+        int count = epoll_wait(m_epoll_fd.get(), events, max_events, -1);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "Control: epoll_wait failed: " << std::strerror(errno) << '\n';
+            return;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            int fd = events[i].data.fd;
+
+            if (fd == m_wake_fd.get())
+            {
+                uint64_t value {};
+                ssize_t nread = read(m_wake_fd.get(), &value, sizeof(value));
+                (void)nread;
+                deliver_completed();
+                continue;
+            }
+
+            if (fd == m_unix_fd.get() || fd == m_tcp_fd.get())
+            {
+                accept_clients(fd);
+                continue;
+            }
+
+            auto id = m_client_ids.find(fd);
+            if (id == m_client_ids.end())
+                continue;
+            uint64_t client_id = id->second;
+
+            if (events[i].events & (EPOLLHUP | EPOLLERR))
+            {
+                close_client(client_id);
+                continue;
+            }
+            if (events[i].events & EPOLLIN)
+                read_client(client_id);
+            if (m_clients.count(client_id) && (events[i].events & EPOLLOUT))
+                write_client(client_id);
+        }
+    }
+}
+
+void ControlServer::accept_clients(int listen_fd)
+{
+    while (true)
+    {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                std::cerr << "Control: accept failed: " << std::strerror(errno) << '\n';
+            return;
+        }
+
+        if (listen_fd == m_tcp_fd.get())
+        {
+            int no_delay = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+        }
+
+        uint64_t client_id = m_next_client_id++;
+        Client& client = m_clients[client_id];
+        client.fd = fd;
+        m_client_ids[fd] = client_id;
+
+        struct epoll_event event {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(m_epoll_fd.get(), EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+void ControlServer::read_client(uint64_t client_id)
+{
+    std::vector<std::string> lines {};
+    {
+        Client& client = m_clients[client_id];
+        char buffer[4096];
+
+        while (true)
+        {
+            ssize_t nread = read(client.fd, buffer, sizeof(buffer));
+            if (nread > 0)
+            {
+                client.in_buffer.append(buffer, nread);
+                continue;
+            }
+            if (nread < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if (nread < 0 && errno == EINTR)
+                continue;
+            if (nread < 0)
+            {
+                close_client(client_id);
+                return;
+            }
+
+            /*peer shut down its side, answer what it already sent then close*/
+            client.read_closed = true;
+            update_events(client);
+            break;
+        }
+
+        /*split off every complete line, keep any partial request for the next read*/
+        std::size_t position {};
+        while ((position = client.in_buffer.find('\n')) != std::string::npos)
+        {
+            std::string line {client.in_buffer.substr(0, position)};
+            client.in_buffer.erase(0, position + 1);
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (!line.empty())
+                lines.push_back(std::move(line));
+        }
+
+        if (client.in_buffer.size() > CONTROL_MAX_REQUEST_BYTES)
+        {
+            client.in_buffer.clear();
+            lines.push_back("");
+        }
+    }
+
+    for (const std::string& line : lines)
+    {
+        if (!m_clients.count(client_id))
+            return;
+        if (line.empty())
+            queue_response(client_id, json {{"ok", false}, {"message", "request too long"}}.dump());
+        else
+            handle_line(client_id, line);
+    }
+
+    close_if_finished(client_id);
+}
+
+void ControlServer::handle_line(uint64_t client_id, const std::string& line)
+{
+    json request = json::parse(line, nullptr, false);
+    if (request.is_discarded() || !request.is_object() || !request.contains("command"))
+    {
+        queue_response(client_id, json {{"ok", false}, {"message", "expected a json object with a \"command\""}}.dump());
+        return;
+    }
+
+    /*the response is produced on the executor thread, hand it back to the epoll thread*/
+    m_clients[client_id].pending++;
+    m_executor.submit(std::move(request), [this, client_id](json response)
+    {
+        {
+            std::lock_guard<std::mutex> lock (m_completed_mtx);
+            m_completed.emplace_back(client_id, response.dump());
+        }
+        uint64_t one = 1;
+        ssize_t written = write(m_wake_fd.get(), &one, sizeof(one));
+        (void)written;
+    });
+}
+
+void ControlServer::deliver_completed()
+{
+    std::vector<std::pair<uint64_t, std::string>> completed {};
+    {
+        std::lock_guard<std::mutex> lock (m_completed_mtx);
+        completed.swap(m_completed);
+    }
+
+    for (const auto& [client_id, response] : completed)
+    {
+        /*the client may have disconnected while its command was running*/
+        if (!m_clients.count(client_id))
+            continue;
+        m_clients[client_id].pending--;
+        queue_response(client_id, response);
+    }
+}
+
+void ControlServer::queue_response(uint64_t client_id, const std::string& response)
+{
+    Client& client = m_clients[client_id];
+    client.out_buffer.append(response);
+    client.out_buffer.push_back('\n');
+    write_client(client_id);
+}
+
+void ControlServer::write_client(uint64_t client_id)
+{
+    Client& client = m_clients[client_id];
+
+    while (!client.out_buffer.empty())
+    {
+        ssize_t written = send(client.fd, client.out_buffer.data(), client.out_buffer.size(), MSG_NOSIGNAL);
+        if (written > 0)
+        {
+            client.out_buffer.erase(0, written);
+            continue;
+        }
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        close_client(client_id);
+        return;
+    }
+
+    /*only ask for EPOLLOUT while there is something left to send*/
+    bool want_write = !client.out_buffer.empty();
+    if (want_write != client.want_write)
+    {
+        client.want_write = want_write;
+        update_events(client);
+    }
+
+    close_if_finished(client_id);
+}
+
+void ControlServer::update_events(Client& client)
+{
+    struct epoll_event event {};
+    event.events = (client.read_closed ? 0 : EPOLLIN) | (client.want_write ? EPOLLOUT : 0);
+    event.data.fd = client.fd;
+    epoll_ctl(m_epoll_fd.get(), EPOLL_CTL_MOD, client.fd, &event);
+}
+
+bool ControlServer::close_if_finished(uint64_t client_id)
+{
+    auto client = m_clients.find(client_id);
+    if (client == m_clients.end())
+        return true;
+    if (client->second.read_closed && client->second.pending == 0 && client->second.out_buffer.empty())
+    {
+        close_client(client_id);
+        return true;
+    }
+    return false;
+}
+
+void ControlServer::close_client(uint64_t client_id)
+{
+    auto client = m_clients.find(client_id);
+    if (client == m_clients.end())
+        return;
+
+    epoll_ctl(m_epoll_fd.get(), EPOLL_CTL_DEL, client->second.fd, NULL);
+    close(client->second.fd);
+    m_client_ids.erase(client->second.fd);
+    m_clients.erase(client);
+}
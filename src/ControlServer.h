@@ -0,0 +1,136 @@
+/*
+* Non-blocking control API.
+*
+* ControlServer runs an epoll loop on a Unix domain socket (and optionally a loopback TCP port)
+* accepting any number of concurrent clients. Each client sends newline delimited JSON requests
+* e.g. {"id": 1, "command": "use-source", "source": "usb soundcard"} and receives one JSON
+* response line per request, with the request's "id" copied across.
+*
+* The epoll thread only does socket IO: requests are handed to a CommandExecutor which runs them
+* one at a time on its own thread (some commands, such as opening a source, take seconds), and
+* the responses are passed back to the epoll thread through an eventfd.
+*/
+
+#ifndef CONTROLSERVER_H
+#define CONTROLSERVER_H
+
+#include <nlohmann/json.hpp>
+#include<atomic>
+#include<condition_variable>
+#include<cstdint>
+#include<deque>
+#include<functional>
+#include<mutex>
+#include<string>
+#include<thread>
+#include<unordered_map>
+#include<utility>
+#include<vector>
+
+#include "FileDescriptor.h"
+
+#define DEFAULT_CONTROL_SOCKET_PATH "/tmp/fondue.sock"
+#define CONTROL_MAX_REQUEST_BYTES 65536
+
+/*runs control commands one at a time on a dedicated thread, in the order they were submitted*/
+class CommandExecutor
+{
+    public:
+        using Handler = std::function<nlohmann::json(const nlohmann::json&)>;
+        using Callback = std::function<void(nlohmann::json)>;
+
+    private:
+        Handler m_handler;
+        std::mutex m_mtx;
+        std::condition_variable m_cv;
+        std::deque<std::pair<nlohmann::json, Callback>> m_requests {};
+        bool m_stop {false};
+        std::thread m_thread;
+
+        void run();
+
+    public:
+        explicit CommandExecutor(Handler handler);
+
+        ~CommandExecutor();
+
+        CommandExecutor(const CommandExecutor&) = delete;
+        CommandExecutor& operator= (const CommandExecutor&) = delete;
+
+        /*queue a request, on_done is called from the executor thread with the response*/
+        void submit(nlohmann::json request, Callback on_done);
+
+        /*queue a request and wait for its response*/
+        nlohmann::json execute(const nlohmann::json& request);
+
+        void stop();
+};
+
+struct ControlServerSettings
+{
+    std::string socket_path {DEFAULT_CONTROL_SOCKET_PATH};
+    /*0 disables the loopback TCP listener*/
+    int tcp_port {0};
+};
+
+class ControlServer
+{
+    private:
+        struct Client
+        {
+            int fd {-1};
+            std::string in_buffer {};
+            std::string out_buffer {};
+            bool want_write {false};
+            /*the peer has shut down its side, close once all responses are sent*/
+            bool read_closed {false};
+            /*requests submitted to the executor and not yet answered*/
+            int pending {0};
+        };
+
+        ControlServerSettings m_settings;
+        CommandExecutor& m_executor;
+        FileDescriptor m_epoll_fd {};
+        FileDescriptor m_unix_fd {};
+        FileDescriptor m_tcp_fd {};
+        FileDescriptor m_wake_fd {};
+        std::atomic<bool> m_stop {false};
+        std::thread m_thread;
+
+        /*clients are keyed by a never reused id so a late response can't reach a new client on a recycled fd*/
+        std::unordered_map<uint64_t, Client> m_clients {};
+        std::unordered_map<int, uint64_t> m_client_ids {};
+        uint64_t m_next_client_id {1};
+
+        /*responses produced by the executor waiting to be queued on their client*/
+        std::mutex m_completed_mtx;
+        std::vector<std::pair<uint64_t, std::string>> m_completed {};
+
+        void run();
+        void accept_clients(int listen_fd);
+        void read_client(uint64_t client_id);
+        void write_client(uint64_t client_id);
+        void close_client(uint64_t client_id);
+        void handle_line(uint64_t client_id, const std::string& line);
+        void queue_response(uint64_t client_id, const std::string& response);
+        void deliver_completed();
+        void update_events(Client& client);
+        /*closes the client if it has hung up and has nothing left to receive, returns true if closed*/
+        bool close_if_finished(uint64_t client_id);
+
+    public:
+        /*opens the listening sockets, throws a const char* exception on failure*/
+        ControlServer(const ControlServerSettings& settings, CommandExecutor& executor);
+
+        ~ControlServer();
+
+        ControlServer(const ControlServer&) = delete;
+        ControlServer& operator= (const ControlServer&) = delete;
+
+        /*start serving on a new thread*/
+        void start();
+
+        void stop();
+};
+
+#endif
@@ -0,0 +1,81 @@
+#include "DeadAirDetector.h"
+
+#include<algorithm>
+#include<cmath>
+
+DeadAirDetector dead_air_detector {};
+
+void DeadAirDetector::configure(const DeadAirSettings& settings, int sample_rate, int frame_size)
+{
+    m_settings = settings;
+    m_sample_rate = std::max(1, sample_rate);
+    const std::size_t window_frames = std::max<std::size_t>(1, static_cast<std::size_t>(
+                                        std::ceil(settings.window_seconds * m_sample_rate / std::max(1, frame_size))));
+    m_window.assign(window_frames, 0);
+    m_frame_samples.assign(window_frames, 0);
+    m_silence_power = std::pow(10.0, settings.threshold_dbfs / 10);
+    m_recovery_power = std::pow(10.0, (settings.threshold_dbfs + settings.hysteresis_db) / 10);
+    m_trigger_samples = std::llround(settings.trigger_seconds * m_sample_rate);
+    m_detections.store(0, std::memory_order_relaxed);
+    reset();
+}
+
+void DeadAirDetector::reset()
+{
+    std::fill(m_window.begin(), m_window.end(), 0);
+    std::fill(m_frame_samples.begin(), m_frame_samples.end(), 0);
+    m_position = 0;
+    m_frames_in_window = 0;
+    m_window_energy = 0;
+    m_window_samples = 0;
+    m_silent_samples = 0;
+    m_dead_air.store(false, std::memory_order_relaxed);
+    m_window_rms.store(0, std::memory_order_relaxed);
+    m_silent_ms.store(0, std::memory_order_relaxed);
+}
+
+bool DeadAirDetector::process(const LevelSnapshot& levels, int nb_samples)
+{
+    if (m_window.empty() || nb_samples <= 0)
+        return dead_air();
+
+    /*mean power over the channels, a single live channel in a stereo pair isn't dead air*/
+    double power {};
+    const int channels = std::max(1, levels.channels);
+    for (int channel = 0; channel < levels.channels; channel++)
+        power += static_cast<double>(levels.rms[channel]) * levels.rms[channel];
+    power /= channels;
+
+    m_window_energy += power * nb_samples - m_window[m_position];
+    m_window_samples += nb_samples - m_frame_samples[m_position];
+    m_window[m_position] = power * nb_samples;
+    m_frame_samples[m_position] = nb_samples;
+    if (++m_position == m_window.size())
+    {
+        m_position = 0;
+        /*resum once per window so rounding in the running sum can't build up*/
+        m_window_energy = 0;
+        for (double energy : m_window)
+            m_window_energy += energy;
+    }
+    if (m_frames_in_window < m_window.size())
+        m_frames_in_window++;
+
+    const double window_power = m_window_samples > 0 ? std::max(0.0, m_window_energy) / m_window_samples : 0;
+    m_window_rms.store(static_cast<float>(std::sqrt(window_power)), std::memory_order_relaxed);
+    /*a partly filled window (just after a switch) neither starts nor ends a silence*/
+    if (m_frames_in_window < m_window.size())
+        return dead_air();
+
+    if (window_power < m_silence_power)
+        m_silent_samples += nb_samples;
+    else if (window_power >= m_recovery_power)
+        m_silent_samples = 0;
+
+    const bool dead_air_now = m_silent_samples >= m_trigger_samples;
+    if (dead_air_now && !m_dead_air.load(std::memory_order_relaxed))
+        m_detections.store(m_detections.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    m_dead_air.store(dead_air_now, std::memory_order_relaxed);
+    m_silent_ms.store(m_silent_samples * 1000 / m_sample_rate, std::memory_order_relaxed);
+    return dead_air_now;
+}
@@ -0,0 +1,90 @@
+/*
+* Dead air detection: a source which keeps delivering audio but carries silence or close to it,
+* e.g. a studio desk left faded down.
+*
+* The detector is fed the per channel RMS of every frame the playing source delivers, as measured
+* by its LevelMeter (so the vectorised kernels do the work once for both), and keeps the mean
+* power of the last window_seconds of frames in a preallocated ring. Once the window is full, a
+* windowed RMS below threshold_dbfs counts towards the silence, one at or above
+* threshold_dbfs + hysteresis_db ends it, anything between leaves it as it was so a source
+* hovering around the threshold doesn't toggle. Dead air is declared after trigger_seconds of
+* silence, i.e. at best trigger_seconds (plus the window) after the audio went quiet.
+*
+* Like LevelMeter it is written by one thread (the audio thread, which also resets it whenever the
+* playing source changes) and read by any, it never allocates or locks once configured, and it
+* doesn't depend on FFmpeg so recorded fixtures can be run through it offline (fondue analyse).
+*/
+
+#ifndef DEADAIRDETECTOR_H
+#define DEADAIRDETECTOR_H
+
+#include "LevelMeter.h"
+#include<atomic>
+#include<cstdint>
+#include<vector>
+
+#define DEFAULT_DEAD_AIR_THRESHOLD_DBFS -50.0
+#define DEFAULT_DEAD_AIR_HYSTERESIS_DB 6.0
+#define DEFAULT_DEAD_AIR_WINDOW_SECONDS 1.0
+#define DEFAULT_DEAD_AIR_TRIGGER_SECONDS 10.0
+
+struct DeadAirSettings
+{
+    double threshold_dbfs {DEFAULT_DEAD_AIR_THRESHOLD_DBFS};
+    double hysteresis_db {DEFAULT_DEAD_AIR_HYSTERESIS_DB};
+    double window_seconds {DEFAULT_DEAD_AIR_WINDOW_SECONDS};
+    double trigger_seconds {DEFAULT_DEAD_AIR_TRIGGER_SECONDS};
+};
+
+class DeadAirDetector
+{
+    private:
+        /*writer only*/
+        DeadAirSettings m_settings {};
+        int m_sample_rate {1};
+        /*power (mean square over channels) times samples of each frame in the window*/
+        std::vector<double> m_window {};
+        std::size_t m_position {};
+        std::size_t m_frames_in_window {};
+        double m_window_energy {};
+        int64_t m_window_samples {};
+        std::vector<int> m_frame_samples {};
+        double m_silence_power {};
+        double m_recovery_power {};
+        int64_t m_silent_samples {};
+        int64_t m_trigger_samples {};
+
+        /*read by anyone*/
+        std::atomic<bool> m_dead_air {false};
+        std::atomic<float> m_window_rms {};
+        std::atomic<int64_t> m_silent_ms {};
+        std::atomic<uint64_t> m_detections {};
+
+    public:
+        /*sizes the window for frames of frame_size samples at sample_rate, allocates, call before streaming*/
+        void configure(const DeadAirSettings& settings, int sample_rate, int frame_size);
+
+        /*one frame's levels, from the meter which measured it. returns true while there's dead air*/
+        bool process(const LevelSnapshot& levels, int nb_samples);
+
+        /*forget the window and any silence so far, e.g. when the playing source changes. writer only*/
+        void reset();
+
+        bool dead_air() const {return m_dead_air.load(std::memory_order_relaxed);}
+
+        /*RMS over the last window (of the mean power of the channels), linear*/
+        float window_rms() const {return m_window_rms.load(std::memory_order_relaxed);}
+
+        /*how long the audio has been below the threshold*/
+        double silent_seconds() const {return m_silent_ms.load(std::memory_order_relaxed) / 1000.0;}
+
+        /*times dead air has been declared since the detector was configured*/
+        uint64_t detections() const {return m_detections.load(std::memory_order_relaxed);}
+
+        const DeadAirSettings& settings() const {return m_settings;}
+};
+
+/*watches the playing source*/
+extern DeadAirDetector dead_air_detector;
+
+#endif
@@ -0,0 +1,158 @@
+#include "DecoderPool.h"
+
+#include<tuple>
+
+extern "C"
+{
+#include <libavutil/channel_layout.h>
+}
+
+DecoderPool decoder_pool {};
+
+namespace
+{
+    std::string describe_layout(const AVChannelLayout& layout)
+    {
+        char description[128] {};
+        if (av_channel_layout_describe(&layout, description, sizeof(description)) < 0)
+            return std::to_string(layout.nb_channels) + " channels";
+        return description;
+    }
+}
+
+void DecoderReturner::operator()(AVCodecContext* codec_ctx) const
+{
+    if (pool)
+        pool->release(parameters, codec_ctx);
+    else
+        avcodec_free_context(&codec_ctx);
+}
+
+void PacketReturner::operator()(AVPacket* pkt) const
+{
+    if (pool)
+        pool->release(pkt);
+    else
+        av_packet_free(&pkt);
+}
+
+bool DecoderPool::Key::operator< (const Key& other) const
+{
+    return std::tie(decoder, codec_id, format, sample_rate, ch_layout, bits_per_coded_sample, block_align, frame_size, profile, extradata)
+         < std::tie(other.decoder, other.codec_id, other.format, other.sample_rate, other.ch_layout, other.bits_per_coded_sample,
+                    other.block_align, other.frame_size, other.profile, other.extradata);
+}
+
+DecoderPool::DecoderPool()
+{
+    m_idle_packets.reserve(PACKET_POOL_MAX_IDLE);
+}
+
+PooledDecoder DecoderPool::acquire(const AVCodecParameters* codecpar, bool& reused, const AVCodec* decoder)
+{
+    const Key key {decoder ? decoder->name : std::string {}, codecpar->codec_id, codecpar->format, codecpar->sample_rate, describe_layout(codecpar->ch_layout),
+                   codecpar->bits_per_coded_sample, codecpar->block_align, codecpar->frame_size, codecpar->profile,
+                   codecpar->extradata ? std::string(reinterpret_cast<const char*>(codecpar->extradata), codecpar->extradata_size)
+                                       : std::string {}};
+    std::size_t parameters {};
+    CodecContextHandle codec_ctx {};
+    {
+        std::lock_guard<std::mutex> lock (m_mtx);
+        auto found = m_index.find(key);
+        if (found == m_index.end())
+        {
+            parameters = m_idle_decoders.size();
+            m_idle_decoders.emplace_back();
+            m_idle_decoders.back().reserve(DECODER_POOL_MAX_IDLE);
+            m_index.emplace(key, parameters);
+        }
+        else
+        {
+            parameters = found->second;
+        }
+
+        std::vector<CodecContextHandle>& idle = m_idle_decoders[parameters];
+        if (!idle.empty())
+        {
+            codec_ctx = std::move(idle.back());
+            idle.pop_back();
+            m_idle_decoder_count--;
+        }
+    }
+
+    if (codec_ctx)
+    {
+        /*drops anything buffered from the stream it last decoded*/
+        avcodec_flush_buffers(codec_ctx.get());
+        m_hits.fetch_add(1, std::memory_order_relaxed);
+        reused = true;
+        return PooledDecoder {codec_ctx.release(), DecoderReturner {this, parameters}};
+    }
+
+    m_misses.fetch_add(1, std::memory_order_relaxed);
+    reused = false;
+    const AVCodec* dec = decoder ? decoder : avcodec_find_decoder(codecpar->codec_id);
+    if (!dec)
+        return PooledDecoder {};
+
+    codec_ctx.reset(avcodec_alloc_context3(dec));
+    if (!codec_ctx || avcodec_parameters_to_context(codec_ctx.get(), codecpar) < 0
+        || avcodec_open2(codec_ctx.get(), dec, NULL) < 0)
+        return PooledDecoder {};
+
+    return PooledDecoder {codec_ctx.release(), DecoderReturner {this, parameters}};
+}
+
+PooledPacket DecoderPool::acquire_packet()
+{
+    {
+        std::lock_guard<std::mutex> lock (m_mtx);
+        if (!m_idle_packets.empty())
+        {
+            AVPacket* pkt = m_idle_packets.back().release();
+            m_idle_packets.pop_back();
+            return PooledPacket {pkt, PacketReturner {this}};
+        }
+    }
+    return PooledPacket {av_packet_alloc(), PacketReturner {this}};
+}
+
+void DecoderPool::release(std::size_t parameters, AVCodecContext* codec_ctx)
+{
+    CodecContextHandle decoder {codec_ctx};
+    std::lock_guard<std::mutex> lock (m_mtx);
+    if (m_idle_decoder_count >= DECODER_POOL_MAX_IDLE)
+        return;
+    m_idle_decoders[parameters].push_back(std::move(decoder));
+    m_idle_decoder_count++;
+}
+
+void DecoderPool::release(AVPacket* pkt)
+{
+    av_packet_unref(pkt);
+    PacketHandle packet {pkt};
+    std::lock_guard<std::mutex> lock (m_mtx);
+    if (m_idle_packets.size() < PACKET_POOL_MAX_IDLE)
+        m_idle_packets.push_back(std::move(packet));
+}
+
+void DecoderPool::clear()
+{
+    std::lock_guard<std::mutex> lock (m_mtx);
+    for (std::vector<CodecContextHandle>& idle : m_idle_decoders)
+        idle.clear();
+    m_idle_decoder_count = 0;
+    m_idle_packets.clear();
+}
+
+DecoderPoolStats DecoderPool::stats() const
+{
+    DecoderPoolStats stats {};
+    stats.hits = m_hits.load(std::memory_order_relaxed);
+    stats.misses = m_misses.load(std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock (m_mtx);
+    stats.idle_decoders = m_idle_decoder_count;
+    stats.idle_packets = m_idle_packets.size();
+    return stats;
+}
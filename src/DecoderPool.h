@@ -0,0 +1,124 @@
+/*
+* A pool of opened audio decoders, and of packets to feed them with.
+*
+* Opening a source allocates a decoder context, copies the stream's codec parameters into it and
+* opens it, which for some codecs means building tables. Switching back to a source used a few
+* minutes ago would do all of that again. Instead a source borrows a decoder from here: decoders
+* are kept by decoder and codec parameters (sample format, rate, layout, extradata and so on), one
+* handed back is idle until a source with identical parameters asks for it, and it is flushed with
+* avcodec_flush_buffers before being handed out again so nothing from the last stream leaks into
+* the next. Packets are plain AVPacket structs kept for reuse, unreferenced when handed back.
+*
+* acquire() and acquire_packet() return std::unique_ptrs whose deleters hand the object back.
+* At most DECODER_POOL_MAX_IDLE decoders are kept idle in total, any more are freed.
+*/
+
+#ifndef DECODERPOOL_H
+#define DECODERPOOL_H
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+}
+
+#include<atomic>
+#include<cstdint>
+#include<deque>
+#include<map>
+#include<memory>
+#include<mutex>
+#include<string>
+#include<vector>
+
+#include "AVHandles.h"
+
+#define DECODER_POOL_MAX_IDLE 8
+#define PACKET_POOL_MAX_IDLE 16
+
+class DecoderPool;
+
+/*hands a decoder back to the pool it came from*/
+struct DecoderReturner
+{
+    DecoderPool* pool {};
+    std::size_t parameters {};
+
+    void operator()(AVCodecContext* codec_ctx) const;
+};
+
+/*hands a packet back to the pool it came from*/
+struct PacketReturner
+{
+    DecoderPool* pool {};
+
+    void operator()(AVPacket* pkt) const;
+};
+
+using PooledDecoder = std::unique_ptr<AVCodecContext, DecoderReturner>;
+using PooledPacket = std::unique_ptr<AVPacket, PacketReturner>;
+
+struct DecoderPoolStats
+{
+    uint64_t hits {};
+    uint64_t misses {};
+    std::size_t idle_decoders {};
+    std::size_t idle_packets {};
+};
+
+class DecoderPool
+{
+    private:
+        struct Key
+        {
+            /*empty for the codec's default decoder*/
+            std::string decoder;
+            int codec_id;
+            int format;
+            int sample_rate;
+            std::string ch_layout;
+            int bits_per_coded_sample;
+            int block_align;
+            int frame_size;
+            int profile;
+            std::string extradata;
+
+            bool operator< (const Key& other) const;
+        };
+
+        /*indexed by the DecoderReturner's parameters, one per distinct Key*/
+        std::deque<std::vector<CodecContextHandle>> m_idle_decoders {};
+        std::map<Key, std::size_t> m_index {};
+        std::size_t m_idle_decoder_count {};
+        std::vector<PacketHandle> m_idle_packets {};
+        std::atomic<uint64_t> m_hits {};
+        std::atomic<uint64_t> m_misses {};
+        mutable std::mutex m_mtx;
+
+        friend struct DecoderReturner;
+        friend struct PacketReturner;
+        void release(std::size_t parameters, AVCodecContext* codec_ctx);
+        void release(AVPacket* pkt);
+
+    public:
+        DecoderPool();
+
+        DecoderPool(const DecoderPool&) = delete;
+        DecoderPool& operator= (const DecoderPool&) = delete;
+
+        /*an opened decoder for the stream's parameters, reused sets whether it came from the pool. decoder
+        * forces a decoder (e.g. a source prompt's -c:a), otherwise it's FFmpeg's default for the codec.
+        * null if there's no decoder for the codec or it can't be opened*/
+        PooledDecoder acquire(const AVCodecParameters* codecpar, bool& reused, const AVCodec* decoder = nullptr);
+
+        /*an empty packet, null if one couldn't be allocated*/
+        PooledPacket acquire_packet();
+
+        /*frees every idle decoder and packet, those in use are freed when handed back*/
+        void clear();
+
+        DecoderPoolStats stats() const;
+};
+
+extern DecoderPool decoder_pool;
+
+#endif
@@ -3,47 +3,43 @@
 FFMPEGString::FFMPEGString(std::string string):
                 m_string{string}
 {
-    
+    /*split like a shell so quoted urls and option values may contain spaces*/
+    const std::vector<std::string> tokens {tokenize_prompt(m_string)};
+    AVDictionary* options {};
 
-    char *key, *value;
-
-    key = strtok(const_cast<char*>(m_string.c_str()), " ");
-    value = strtok(NULL, " ");
-
-    while (key)
+    for (std::size_t i = 0; i < tokens.size(); i++)
     {
-        /*special case for the input URL*/
-        if (strcmp(key, "-i") == 0)
-        {
-            m_source_url.append(value);            
-        }
-        /*special case for the input format*/
-        if (strcmp(key, "-f") == 0)
+        /*the output url, the one argument which isn't an option or an option's value*/
+        if (!is_prompt_option(tokens[i]))
         {
-            m_input_format = const_cast<AVInputFormat*>(av_find_input_format(value));
-        }
-        /*special case for the output URL since it will be last in the string -> value = NULL*/
-        if (!value)
-        {
-            m_destination_url.append(key);
-            break;
+            if (!m_destination_url.empty())
+            {
+                av_dict_free(&options);
+                throw "Output: more than one url in output prompt";
+            }
+            m_destination_url = tokens[i];
+            continue;
         }
 
+        const std::string key {tokens[i].substr(1)};
+        std::string value {"1"};
+        if (takes_prompt_value(tokens, i, tokens.size()))
+            value = tokens[++i];
+
         /*special case for the audio sample rate*/
-        if (strcmp(key, "-r:a") == 0 || strcmp(key, "-ar") == 0)
+        if (key == "r:a" || key == "ar")
         {
-            m_sample_rate = std::stoi(value);
+            m_sample_rate = std::atoi(value.c_str());
         }
 
         /*special case for the audio bit rate*/
-        if (strcmp(key, "-b:a") == 0 || strcmp(key, "-ab") == 0)
+        if (key == "b:a" || key == "ab")
         {
-            m_bit_rate = std::stoi(value);
+            m_bit_rate = std::atoi(value.c_str());
         }
 
         /*add the key-value pair to the options dictionary*/
-        av_dict_set(&m_options, key + 1, value, 0);
-        key = strtok(NULL, " ");
-        value = strtok(NULL, " ");
+        av_dict_set(&options, key.c_str(), value.c_str(), 0);
     }
+    m_options.reset(options);
 }
@@ -0,0 +1,234 @@
+#include "Failover.h"
+
+#include<algorithm>
+
+using json = nlohmann::json;
+
+FailoverManager::FailoverManager(AudioChannel& channel, ConfigStore& config_store, SourceProber& prober,
+                                 Scheduler::SourceOpener open_source, FailoverSettings settings):
+    m_channel {channel},
+    m_config_store {config_store},
+    m_prober {prober},
+    m_open_source {std::move(open_source)},
+    m_settings {std::move(settings)},
+    m_source_failures_seen {pipeline_metrics.source_failures.value()}
+{
+}
+
+FailoverManager::~FailoverManager()
+{
+    stop();
+}
+
+void FailoverManager::start()
+{
+    if (!m_settings.enabled)
+        return;
+    m_thread = std::thread {&FailoverManager::run, this};
+}
+
+void FailoverManager::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock (m_mtx);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void FailoverManager::run()
+{
+    std::unique_lock<std::mutex> lock (m_mtx);
+    while (!m_stop)
+    {
+        lock.unlock();
+        check();
+        lock.lock();
+        m_cv.wait_for(lock, std::chrono::milliseconds(FAILOVER_CHECK_INTERVAL_MS), [this]{return m_stop;});
+    }
+}
+
+bool FailoverManager::healthy(const std::string& name, SourceHealth& health) const
+{
+    return m_prober.health(name, health) && health.ok && health.consecutive_failures == 0
+           && health.rms_dbfs >= m_settings.dead_air.threshold_dbfs;
+}
+
+bool FailoverManager::worth_trying(const std::string& name, std::chrono::steady_clock::time_point now) const
+{
+    if (m_prober.probes(name))
+        return false;
+    auto failed = m_unprobed_failed_at.find(name);
+    return failed == m_unprobed_failed_at.end()
+           || now - failed->second >= std::chrono::duration<double>(m_settings.recovery_seconds);
+}
+
+bool FailoverManager::switch_to(const std::string& name, const std::string& reason)
+{
+    try
+    {
+        std::unique_ptr<InputStream> source {m_open_source(name)};
+        m_channel.switch_source(std::move(source), name);
+    }
+    catch (const char* exception)
+    {
+        std::cout << "failover: couldn't open " << name << ": " << exception << '\n';
+        return false;
+    }
+
+    std::cout << "failover: " << reason << ", switching to " << name << '\n';
+    std::lock_guard<std::mutex> lock (m_mtx);
+    m_last_event = reason + ", switched to " + name;
+    return true;
+}
+
+void FailoverManager::check()
+{
+    auto now = std::chrono::steady_clock::now();
+    if (now < m_grace_until)
+        return;
+
+    /*the audio thread replaces a failed source with white noise, which plays until the next crossfade*/
+    const uint64_t failures {pipeline_metrics.source_failures.value()};
+    const uint64_t crossfades {pipeline_metrics.crossfades.value()};
+    if (failures != m_source_failures_seen)
+    {
+        m_source_failures_seen = failures;
+        m_playing_fallback = true;
+        m_crossfades_at_failure = crossfades;
+    }
+    if (m_playing_fallback && crossfades != m_crossfades_at_failure)
+        m_playing_fallback = false;
+
+    const std::string active {m_config_store.active_source()};
+    std::vector<std::string> ranked {m_settings.primary};
+    ranked.insert(ranked.end(), m_settings.backups.begin(), m_settings.backups.end());
+    const bool active_ranked {std::find(ranked.begin(), ranked.end(), active) != ranked.end()};
+    /*switched away from the failover's choice by hand, leave the new choice alone*/
+    if (!active_ranked)
+        m_failed_over = false;
+
+    SourceHealth health {};
+    if (dead_air_detector.dead_air() || m_playing_fallback)
+    {
+        /*the source which went quiet or failed isn't probed while it's active, so it's never a candidate*/
+        const std::string reason {(m_playing_fallback ? active + " failed" : "dead air on " + active)};
+        if (!m_prober.probes(active))
+            m_unprobed_failed_at[active] = now;
+        bool attempted {false};
+        for (const std::string& candidate : ranked)
+        {
+            if (candidate == active || !(healthy(candidate, health) || worth_trying(candidate, now)))
+                continue;
+            attempted = true;
+            if (!switch_to(candidate, reason))
+                continue;
+
+            pipeline_metrics.failovers.add();
+            if (candidate != m_settings.primary && !m_failed_over)
+            {
+                m_failed_over = true;
+                m_failed_over_at = std::chrono::system_clock::now();
+                m_primary_healthy_since = {};
+            }
+            else if (candidate == m_settings.primary)
+            {
+                m_failed_over = false;
+            }
+            m_grace_until = std::chrono::steady_clock::now() + std::chrono::seconds(FAILOVER_SWITCH_GRACE_SECONDS);
+            return;
+        }
+        /*every healthy candidate failed to open, don't retry them on every check*/
+        if (attempted)
+            m_grace_until = std::chrono::steady_clock::now() + std::chrono::seconds(FAILOVER_SWITCH_GRACE_SECONDS);
+        return;
+    }
+
+    if (!m_failed_over)
+        return;
+    if (active == m_settings.primary)
+    {
+        m_failed_over = false;
+        return;
+    }
+
+    /*an unprobed primary gets a trial every recovery_seconds, guarded by the dead air detector*/
+    if (!m_prober.probes(m_settings.primary))
+    {
+        std::chrono::duration<double> failed_over_for = std::chrono::system_clock::now() - m_failed_over_at;
+        if (failed_over_for.count() >= m_settings.recovery_seconds && worth_trying(m_settings.primary, now)
+            && switch_to(m_settings.primary, "trying " + m_settings.primary + " again"))
+        {
+            pipeline_metrics.failbacks.add();
+            m_failed_over = false;
+            m_grace_until = std::chrono::steady_clock::now() + std::chrono::seconds(FAILOVER_SWITCH_GRACE_SECONDS);
+        }
+        return;
+    }
+
+    /*a backup is playing, switch back once the primary has been healthy for recovery_seconds*/
+    if (now - m_last_recovery_probe >= std::chrono::seconds(FAILOVER_RECOVERY_PROBE_SECONDS))
+    {
+        m_prober.probe_soon(m_settings.primary);
+        m_last_recovery_probe = now;
+    }
+
+    if (!m_prober.health(m_settings.primary, health) || health.checked_at <= m_failed_over_at)
+        return;
+    if (!healthy(m_settings.primary, health))
+    {
+        m_primary_healthy_since = {};
+        return;
+    }
+    if (m_primary_healthy_since == std::chrono::system_clock::time_point {})
+        m_primary_healthy_since = health.checked_at;
+
+    std::chrono::duration<double> healthy_for = health.checked_at - m_primary_healthy_since;
+    if (healthy_for.count() >= m_settings.recovery_seconds && switch_to(m_settings.primary, m_settings.primary + " recovered"))
+    {
+        pipeline_metrics.failbacks.add();
+        m_failed_over = false;
+        m_grace_until = std::chrono::steady_clock::now() + std::chrono::seconds(FAILOVER_SWITCH_GRACE_SECONDS);
+    }
+}
+
+json FailoverManager::status() const
+{
+    json status = {{"enabled", m_settings.enabled}, {"primary", m_settings.primary}, {"backups", m_settings.backups},
+                   {"dead air", dead_air_detector.dead_air()}, {"silent seconds", dead_air_detector.silent_seconds()},
+                   {"window rms dbfs", level_to_dbfs(dead_air_detector.window_rms())}};
+    std::lock_guard<std::mutex> lock (m_mtx);
+    status["last event"] = m_last_event;
+    return status;
+}
+
+FailoverSettings failover_settings_from_config(const json& config, const std::string& default_source)
+{
+    FailoverSettings settings {};
+    settings.primary = default_source;
+    if (!config.contains("failover"))
+        return settings;
+
+    const json& failover {config["failover"]};
+    try
+    {
+        settings.enabled = failover.value("enabled", true);
+        settings.primary = failover.value("primary", settings.primary);
+        settings.backups = failover.value("backups", settings.backups);
+        settings.recovery_seconds = failover.value("recovery seconds", settings.recovery_seconds);
+        settings.dead_air.threshold_dbfs = failover.value("threshold dbfs", settings.dead_air.threshold_dbfs);
+        settings.dead_air.hysteresis_db = std::max(0.0, failover.value("hysteresis db", settings.dead_air.hysteresis_db));
+        settings.dead_air.window_seconds = std::max(0.01, failover.value("window seconds", settings.dead_air.window_seconds));
+        settings.dead_air.trigger_seconds = std::max(0.0, failover.value("silence seconds", settings.dead_air.trigger_seconds));
+    }
+    catch (const json::exception& exception)
+    {
+        std::cout << "failover: " << exception.what() << ", failover disabled\n";
+        FailoverSettings defaults {};
+        defaults.primary = default_source;
+        return defaults;
+    }
+    return settings;
+}
@@ -0,0 +1,118 @@
+/*
+* Automatic failover to a ranked list of backup sources.
+*
+* A thread checks the playing source a few times a second. When it has dead air (see
+* DeadAirDetector) or has failed and been replaced by the white noise fallback, the first source
+* in the ranked list (the primary, then the backups in order) which isn't playing and whose latest
+* background probe (see SourceProber) found it working and above the dead air threshold is opened
+* and crossfaded to. While a backup plays the primary is probed every few seconds, and once it has
+* been healthy for recovery_seconds the failover switches back to it.
+*
+* Sources the prober never opens (capture devices and excluded sources) have no probe results, so
+* they are tried instead: one is a candidate unless it went quiet or failed in the last
+* recovery_seconds, and with such a primary the failover switches back for a trial every
+* recovery_seconds, the dead air detector failing over again if it is still quiet.
+*
+* Only switches made by the failover are undone: a source chosen by hand which isn't in the ranked
+* list is left alone unless it too goes quiet or fails. Settings come from the optional "failover"
+* section of the config, e.g.
+* {"backups": ["studio 2", "jukebox"], "threshold dbfs": -50, "silence seconds": 10, "recovery seconds": 30}
+* with the primary defaulting to the default source. The dead air settings apply even when failover
+* is disabled, so dead air still shows in source-status and the metrics.
+*/
+
+#ifndef FAILOVER_H
+#define FAILOVER_H
+
+#include "AudioChannel.h"
+#include "ConfigStore.h"
+#include "DeadAirDetector.h"
+#include "Scheduler.h"
+#include "SourceProber.h"
+#include <nlohmann/json.hpp>
+#include<chrono>
+#include<condition_variable>
+#include<mutex>
+#include<string>
+#include<thread>
+#include<unordered_map>
+#include<vector>
+
+#define DEFAULT_FAILOVER_RECOVERY_SECONDS 30.0
+#define FAILOVER_CHECK_INTERVAL_MS 250
+/*how often the primary is probed while a backup plays*/
+#define FAILOVER_RECOVERY_PROBE_SECONDS 5
+/*after requesting a switch, time for it to open and crossfade before the playing source is judged again*/
+#define FAILOVER_SWITCH_GRACE_SECONDS 5
+
+struct FailoverSettings
+{
+    bool enabled {false};
+    std::string primary {};
+    std::vector<std::string> backups {};
+    double recovery_seconds {DEFAULT_FAILOVER_RECOVERY_SECONDS};
+    DeadAirSettings dead_air {};
+};
+
+class FailoverManager
+{
+    private:
+        AudioChannel& m_channel;
+        ConfigStore& m_config_store;
+        SourceProber& m_prober;
+        Scheduler::SourceOpener m_open_source;
+        FailoverSettings m_settings;
+
+        mutable std::mutex m_mtx;
+        std::condition_variable m_cv;
+        bool m_stop {false};
+        std::thread m_thread;
+
+        /*failover thread only, apart from m_last_event which status() reads under m_mtx*/
+        bool m_failed_over {false};
+        std::chrono::system_clock::time_point m_failed_over_at {};
+        std::chrono::system_clock::time_point m_primary_healthy_since {};
+        std::chrono::steady_clock::time_point m_grace_until {};
+        std::chrono::steady_clock::time_point m_last_recovery_probe {};
+        uint64_t m_source_failures_seen {};
+        /*the crossfade count when the playing source failed, the fallback plays until it changes*/
+        bool m_playing_fallback {false};
+        uint64_t m_crossfades_at_failure {};
+        std::string m_last_event {};
+        /*when each unprobed source last went quiet or failed while playing*/
+        std::unordered_map<std::string, std::chrono::steady_clock::time_point> m_unprobed_failed_at {};
+
+        void run();
+        void check();
+
+        /*latest probe worked and was above the dead air threshold*/
+        bool healthy(const std::string& name, SourceHealth& health) const;
+
+        /*an unprobed source which hasn't gone quiet or failed within recovery_seconds, worth a trial*/
+        bool worth_trying(const std::string& name, std::chrono::steady_clock::time_point now) const;
+
+        /*opens a source and hands it to the audio thread, returns false if it couldn't be opened*/
+        bool switch_to(const std::string& name, const std::string& reason);
+
+    public:
+        FailoverManager(AudioChannel& channel, ConfigStore& config_store, SourceProber& prober,
+                        Scheduler::SourceOpener open_source, FailoverSettings settings);
+
+        ~FailoverManager();
+
+        FailoverManager(const FailoverManager&) = delete;
+        FailoverManager& operator= (const FailoverManager&) = delete;
+
+        /*does nothing if failover is disabled*/
+        void start();
+
+        void stop();
+
+        /*the playing source's dead air state and what the failover last did*/
+        nlohmann::json status() const;
+};
+
+/*settings from the optional "failover" section of the config, default_source is the primary unless one is given*/
+FailoverSettings failover_settings_from_config(const nlohmann::json& config, const std::string& default_source);
+
+#endif
@@ -0,0 +1,59 @@
+/*
+* Owning handle for a file descriptor, the counterpart of AVHandles.h for sockets, eventfds and epoll
+* instances: the descriptor is closed exactly once, when its owner is destroyed or the handle is
+* reset, including when a constructor throws part way through. Moving a handle hands over the
+* descriptor and leaves -1 behind, which is never closed.
+*
+* Pass the descriptor to system calls with get().
+*/
+
+#ifndef FILEDESCRIPTOR_H
+#define FILEDESCRIPTOR_H
+
+#include<unistd.h>
+
+class FileDescriptor
+{
+    private:
+        int m_fd {-1};
+
+    public:
+        FileDescriptor() = default;
+
+        /*takes ownership of fd, which may be -1 from a failed call*/
+        explicit FileDescriptor(int fd): m_fd {fd} {}
+
+        ~FileDescriptor() {reset();}
+
+        FileDescriptor(const FileDescriptor&) = delete;
+        FileDescriptor& operator= (const FileDescriptor&) = delete;
+
+        FileDescriptor(FileDescriptor&& other) noexcept: m_fd {other.release()} {}
+
+        FileDescriptor& operator= (FileDescriptor&& other) noexcept
+        {
+            if (this != &other)
+                reset(other.release());
+            return *this;
+        }
+
+        int get() const {return m_fd;}
+
+        /*closes the descriptor held, if any, and takes fd*/
+        void reset(int fd = -1)
+        {
+            if (m_fd >= 0)
+                close(m_fd);
+            m_fd = fd;
+        }
+
+        /*gives up the descriptor without closing it*/
+        int release()
+        {
+            const int fd {m_fd};
+            m_fd = -1;
+            return fd;
+        }
+};
+
+#endif
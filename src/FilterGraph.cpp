@@ -0,0 +1,242 @@
+#include "FilterGraph.h"
+
+#include<algorithm>
+#include<chrono>
+#include<tuple>
+
+extern "C"
+{
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+}
+
+FilterGraphCache filter_graph_cache {};
+
+namespace
+{
+    std::string describe_layout(const AVChannelLayout& layout)
+    {
+        char description[128] {};
+        if (av_channel_layout_describe(&layout, description, sizeof(description)) < 0)
+            return std::to_string(layout.nb_channels) + "c";
+        return description;
+    }
+
+    void account(FilterChainCounters* counters, std::chrono::steady_clock::time_point start, uint64_t frames)
+    {
+        if (!counters)
+            return;
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        counters->processing_ns.fetch_add(static_cast<uint64_t>(elapsed.count()), std::memory_order_relaxed);
+        counters->frames.fetch_add(frames, std::memory_order_relaxed);
+    }
+}
+
+FilterGraph::FilterGraph(const std::string& chain, const AVChannelLayout& layout, int sample_rate, AVSampleFormat format, int frame_size):
+    m_chain {chain},
+    m_frame_size {frame_size}
+{
+    if (chain.empty())
+        throw "Filter graph: empty filter chain";
+
+    const std::string rate {std::to_string(sample_rate)};
+    const std::string format_name {av_get_sample_fmt_name(format) ? av_get_sample_fmt_name(format) : ""};
+    const std::string layout_name {describe_layout(layout)};
+
+    m_source_arguments = "time_base=1/" + rate + ":sample_rate=" + rate + ":sample_fmt=" + format_name
+                         + ":channel_layout=" + layout_name;
+    /*the chain's unlabelled input is fed by the source and its output is converted back to the output format for the sink*/
+    m_description = chain + ",aformat=sample_fmts=" + format_name + ":sample_rates=" + rate + ":channel_layouts=" + layout_name;
+    build();
+}
+
+void FilterGraph::build()
+{
+    m_graph.reset(avfilter_graph_alloc());
+    m_source = nullptr;
+    m_sink = nullptr;
+    m_next_pts = 0;
+    if (!m_graph)
+        throw "Filter graph: could not allocate the graph";
+    /*the filters run on the thread calling receive(), which is the audio thread*/
+    m_graph->nb_threads = 1;
+
+    if (avfilter_graph_create_filter(&m_source, avfilter_get_by_name("abuffer"), "in", m_source_arguments.c_str(), NULL, m_graph.get()) < 0
+        || avfilter_graph_create_filter(&m_sink, avfilter_get_by_name("abuffersink"), "out", NULL, NULL, m_graph.get()) < 0)
+        throw "Filter graph: could not create the buffer source and sink";
+
+    FilterInOutHandle outputs {avfilter_inout_alloc()};
+    FilterInOutHandle inputs {avfilter_inout_alloc()};
+    if (!outputs || !inputs)
+        throw "Filter graph: could not allocate the graph";
+    outputs->name = av_strdup("in");
+    outputs->filter_ctx = m_source;
+    outputs->pad_idx = 0;
+    outputs->next = NULL;
+    inputs->name = av_strdup("out");
+    inputs->filter_ctx = m_sink;
+    inputs->pad_idx = 0;
+    inputs->next = NULL;
+
+    /*parsing takes what it links and leaves the rest for us to free*/
+    AVFilterInOut* unlinked_inputs {inputs.release()};
+    AVFilterInOut* unlinked_outputs {outputs.release()};
+    const int parse_ret = avfilter_graph_parse_ptr(m_graph.get(), m_description.c_str(), &unlinked_inputs, &unlinked_outputs, NULL);
+    inputs.reset(unlinked_inputs);
+    outputs.reset(unlinked_outputs);
+    if (parse_ret < 0)
+        throw "Filter graph: invalid filter chain";
+
+    if (avfilter_graph_config(m_graph.get(), NULL) < 0)
+        throw "Filter graph: could not configure the filter chain";
+
+    if (m_frame_size > 0)
+        av_buffersink_set_frame_size(m_sink, static_cast<unsigned>(m_frame_size));
+}
+
+int FilterGraph::send(AVFrame* frame, bool keep_reference)
+{
+    const auto start = std::chrono::steady_clock::now();
+    frame->pts = m_next_pts;
+    m_next_pts += frame->nb_samples;
+    const int ret = av_buffersrc_add_frame_flags(m_source, frame, keep_reference ? AV_BUFFERSRC_FLAG_KEEP_REF : 0);
+    account(m_counters, start, 0);
+    return ret;
+}
+
+int FilterGraph::receive(AVFrame* frame)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const int ret = av_buffersink_get_frame(m_sink, frame);
+    account(m_counters, start, ret >= 0);
+    return ret;
+}
+
+void FilterGraphReturner::operator()(FilterGraph* graph) const
+{
+    if (graph && graph->m_cache)
+        graph->m_cache->release(graph);
+    else
+        delete graph;
+}
+
+bool FilterGraphCache::Key::operator< (const Key& other) const
+{
+    return std::tie(chain, layout, rate, format, frame_size)
+         < std::tie(other.chain, other.layout, other.rate, other.format, other.frame_size);
+}
+
+CachedFilterGraph FilterGraphCache::acquire(const std::string& chain, const AVChannelLayout& layout, int sample_rate,
+                                            AVSampleFormat format, int frame_size)
+{
+    const Key key {chain, describe_layout(layout), sample_rate, format, frame_size};
+    std::size_t index {};
+    FilterChainCounters* counters {};
+    {
+        std::lock_guard<std::mutex> lock (m_mtx);
+        auto found = m_index.find(key);
+        if (found == m_index.end())
+        {
+            index = m_entries.size();
+            m_entries.emplace_back();
+            m_entries.back().key = key;
+            m_entries.back().idle.reserve(FILTER_GRAPH_CACHE_MAX_IDLE);
+            m_index.emplace(key, index);
+        }
+        else
+        {
+            index = found->second;
+        }
+
+        auto chain_counters = m_chain_counters.find(chain);
+        if (chain_counters == m_chain_counters.end())
+        {
+            m_counters.emplace_back();
+            chain_counters = m_chain_counters.emplace(chain, &m_counters.back()).first;
+        }
+        counters = chain_counters->second;
+
+        Entry& entry = m_entries[index];
+        if (!entry.idle.empty())
+        {
+            entry.reuses++;
+            FilterGraph* graph = entry.idle.back().release();
+            entry.idle.pop_back();
+            return CachedFilterGraph {graph};
+        }
+    }
+
+    /*build a new one outside the lock, this is the slow part*/
+    auto graph = std::make_unique<FilterGraph>(chain, layout, sample_rate, format, frame_size);
+    graph->m_counters = counters;
+    graph->m_cache = this;
+    graph->m_entry = index;
+
+    std::lock_guard<std::mutex> lock (m_mtx);
+    m_entries[index].builds++;
+    return CachedFilterGraph {graph.release()};
+}
+
+void FilterGraphCache::release(FilterGraph* graph)
+{
+    std::unique_ptr<FilterGraph> owned {graph};
+    {
+        std::lock_guard<std::mutex> lock (m_mtx);
+        if (m_entries[owned->m_entry].idle.size() >= FILTER_GRAPH_CACHE_MAX_IDLE)
+            return;
+    }
+
+    /*a used graph still holds the last user's audio: the sink's partial frame of a fixed frame size and
+    * whatever the filters buffer (delays, resamplers, limiter lookahead). flushing it with EOF would leave
+    * it unusable, so it's built again here, off the audio thread, and the next acquire() stays cheap*/
+    const bool used {owned->m_next_pts > 0};
+    if (used)
+    {
+        try
+        {
+            owned->build();
+        }
+        catch (const char*)
+        {
+            return;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock (m_mtx);
+    Entry& entry = m_entries[owned->m_entry];
+    if (used)
+        entry.builds++;
+    if (entry.idle.size() < FILTER_GRAPH_CACHE_MAX_IDLE)
+        entry.idle.push_back(std::move(owned));
+}
+
+void FilterGraphCache::clear()
+{
+    std::lock_guard<std::mutex> lock (m_mtx);
+    for (Entry& entry : m_entries)
+        entry.idle.clear();
+}
+
+std::vector<FilterChainStats> FilterGraphCache::stats() const
+{
+    std::vector<FilterChainStats> stats {};
+    std::lock_guard<std::mutex> lock (m_mtx);
+    for (const Entry& entry : m_entries)
+    {
+        auto chain = std::find_if(stats.begin(), stats.end(), [&](const FilterChainStats& chain_stats)
+        {
+            return chain_stats.chain == entry.key.chain;
+        });
+        if (chain == stats.end())
+        {
+            const FilterChainCounters& counters {*m_chain_counters.at(entry.key.chain)};
+            stats.push_back({entry.key.chain, 0, 0, counters.frames.load(std::memory_order_relaxed),
+                             counters.processing_ns.load(std::memory_order_relaxed), 0});
+            chain = stats.end() - 1;
+        }
+        chain->builds += entry.builds;
+        chain->reuses += entry.reuses;
+        chain->idle += entry.idle.size();
+    }
+    return stats;
+}
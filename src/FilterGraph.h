@@ -0,0 +1,176 @@
+/*
+* libavfilter graphs for the sources and the output bus, and a cache of built graphs.
+*
+* A filter chain is written the way ffmpeg's -af takes it, e.g. "highpass=f=80,acompressor". A
+* source's chain comes from -af in its prompt (see SourceDescriptor), the output bus's from the
+* "output filter" of the stream settings or the output-filter command. Every graph runs at the
+* output's sample rate, channel layout and sample format: the chain is followed by an aformat filter
+* so whatever it does in between, what comes out can go straight into a source's queue or the
+* encoder.
+*
+* Frames go in by reference: send() hands the graph the frame's buffers (moving them, or adding a
+* reference if the caller still needs the frame) and never copies samples, so a filter which works in
+* place gets writable buffers. Frames are timestamped with a continuous count of the samples sent.
+*
+* Parsing and configuring a graph is the expensive part, so graphs are built once and kept by chain
+* and format: a source reopened after a failure or a failover gets the graph its last instance used.
+* acquire() returns a CachedFilterGraph, a std::unique_ptr whose deleter hands it back. A graph which
+* has had frames sent holds audio (a partial frame in the sink, samples delayed in the filters) and
+* state (e.g. a compressor's envelope) and there is no way to reset a configured graph, so handing
+* it back builds it again: dropping a CachedFilterGraph is slow, do it off the audio thread.
+*
+* Each chain's processing time (the time spent in send() and receive() of every graph built from it)
+* and frame count are kept in the cache for the metrics and the filter-stats command.
+*/
+
+#ifndef FILTERGRAPH_H
+#define FILTERGRAPH_H
+
+extern "C"
+{
+#include <libavfilter/avfilter.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/frame.h>
+#include <libavutil/samplefmt.h>
+}
+
+#include<atomic>
+#include<cstdint>
+#include<deque>
+#include<map>
+#include<memory>
+#include<mutex>
+#include<string>
+#include<vector>
+
+#include "AVHandles.h"
+
+/*idle graphs kept per chain and format, a source and its replacement during a crossfade need two*/
+#define FILTER_GRAPH_CACHE_MAX_IDLE 2
+
+class FilterGraphCache;
+
+/*counters shared by every graph built from one chain*/
+struct FilterChainCounters
+{
+    std::atomic<uint64_t> frames {};
+    std::atomic<uint64_t> processing_ns {};
+};
+
+class FilterGraph
+{
+    private:
+        FilterGraphHandle m_graph {};
+        /*owned by the graph*/
+        AVFilterContext* m_source {};
+        AVFilterContext* m_sink {};
+        std::string m_chain;
+        /*what build() configures the graph from*/
+        std::string m_source_arguments {};
+        std::string m_description {};
+        int m_frame_size {};
+        /*0 until a frame has been sent*/
+        int64_t m_next_pts {};
+        /*null for a graph built outside a cache*/
+        FilterChainCounters* m_counters {};
+        FilterGraphCache* m_cache {};
+        std::size_t m_entry {};
+
+        friend class FilterGraphCache;
+        friend struct FilterGraphReturner;
+
+        /*(re)builds and configures the graph from scratch, throws a const char* exception*/
+        void build();
+
+    public:
+        /*builds and configures the graph, frames go in and come out at the given format. frame_size makes
+        * every frame that comes out exactly that many samples, 0 leaves them as the filters make them.
+        * throws a const char* exception if the chain doesn't parse or the graph can't be configured*/
+        FilterGraph(const std::string& chain, const AVChannelLayout& layout, int sample_rate, AVSampleFormat format, int frame_size = 0);
+
+        FilterGraph(const FilterGraph&) = delete;
+        FilterGraph& operator= (const FilterGraph&) = delete;
+
+        /*hands the frame's buffers to the graph. with keep_reference the graph takes a new reference and the
+        * frame is left as it was, otherwise the frame is left blank. returns an FFmpeg error code*/
+        int send(AVFrame* frame, bool keep_reference = false);
+
+        /*the next filtered frame into frame (which should be blank), AVERROR(EAGAIN) if there isn't one yet*/
+        int receive(AVFrame* frame);
+
+        const std::string& chain() const {return m_chain;}
+};
+
+/*hands a graph back to the cache it came from (building it again if it was used), or frees it*/
+struct FilterGraphReturner
+{
+    void operator()(FilterGraph* graph) const;
+};
+
+using CachedFilterGraph = std::unique_ptr<FilterGraph, FilterGraphReturner>;
+
+/*one chain's figures, for every format it has been built at*/
+struct FilterChainStats
+{
+    std::string chain {};
+    uint64_t builds {};
+    uint64_t reuses {};
+    uint64_t frames {};
+    uint64_t processing_ns {};
+    std::size_t idle {};
+};
+
+class FilterGraphCache
+{
+    private:
+        struct Key
+        {
+            std::string chain;
+            std::string layout;
+            int rate;
+            int format;
+            int frame_size;
+
+            bool operator< (const Key& other) const;
+        };
+
+        struct Entry
+        {
+            Key key {};
+            uint64_t builds {};
+            uint64_t reuses {};
+            /*capacity FILTER_GRAPH_CACHE_MAX_IDLE, handing a graph back never allocates*/
+            std::vector<std::unique_ptr<FilterGraph>> idle {};
+        };
+
+        /*deques so the counters and entries graphs point at stay put*/
+        std::deque<Entry> m_entries {};
+        std::map<Key, std::size_t> m_index {};
+        std::map<std::string, FilterChainCounters*> m_chain_counters {};
+        std::deque<FilterChainCounters> m_counters {};
+        mutable std::mutex m_mtx;
+
+        friend struct FilterGraphReturner;
+        void release(FilterGraph* graph);
+
+    public:
+        FilterGraphCache() = default;
+
+        FilterGraphCache(const FilterGraphCache&) = delete;
+        FilterGraphCache& operator= (const FilterGraphCache&) = delete;
+
+        /*a configured graph for the chain at the given format, see FilterGraph's constructor.
+        * slow when nothing is idle, don't call it on the audio thread. throws a const char* exception*/
+        CachedFilterGraph acquire(const std::string& chain, const AVChannelLayout& layout, int sample_rate,
+                                  AVSampleFormat format, int frame_size = 0);
+
+        /*frees every idle graph, the ones in use go back to the cache as usual*/
+        void clear();
+
+        /*one entry per chain, in the order they were first built*/
+        std::vector<FilterChainStats> stats() const;
+};
+
+extern FilterGraphCache filter_graph_cache;
+
+#endif
@@ -41,6 +41,24 @@ extern "C"{
 #include<cstring>
 #include<memory>
 #include<utility>
+#include<atomic>
+#include<algorithm>
+
+#include "LoopTimer.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "LevelMeter.h"
+#include "Loudness.h"
+#include "Limiter.h"
+#include "FilterGraph.h"
+#include "AllocAccounting.h"
+#include "FramePool.h"
+#include "AVHandles.h"
+#include "ResamplerCache.h"
+#include "ResamplerProfiles.h"
+#include "QualityGovernor.h"
+#include "DecoderPool.h"
+#include "SourceDescriptor.h"
 
 #define DEFAULT_BIT_RATE 192000
 #define DEFAULT_SAMPLE_RATE 44100
@@ -48,6 +66,12 @@ extern "C"{
 #define DEFAULT_FADE_MS 2000
 #define DEFAULT_LOOP_TIME_OFFSET_SAMPLES 3
 #define DEFAULT_TIMEOUT 10
+#define DEFAULT_QUEUE_CAPACITY_FRAMES 4
+/*silence run through each resampler when a source is opened so its buffers are allocated up front,
+* covers decoded frames up to this size*/
+#define RESAMPLER_PRIME_SAMPLES 8192
+/*encoded packets up to this size come from a buffer pool rather than a fresh allocation*/
+#define OUTPUT_PACKET_POOL_BYTES 65536
 
 enum class DefaultSourceModes {silence, white_noise};
 
@@ -67,14 +91,31 @@ constexpr auto operator+(SourceTimingModes m) noexcept
     return static_cast<std::underlying_type_t<SourceTimingModes>>(m);
 }
 
-struct ControlFlags
-{
-    bool stop {false};
-    bool normal_streaming {true};
-};
+/*the message for an FFmpeg error code, in a buffer owned by the calling thread which is valid until its next call*/
+char* av_error_to_string(int error_code);
 
+/*scales every sample in the frame, ramping linearly from start_gain to end_gain across the frame*/
+void apply_gain(AVFrame* frame, float start_gain, float end_gain);
 
-char* av_error_to_string(int error_code);
+/*AVCodecContext.get_encoder_buffer handing out packet buffers from the AVBufferPool in the context's opaque,
+* larger packets than the pool's buffers get the default allocation*/
+int pooled_encoder_buffer(AVCodecContext* codec_context, AVPacket* pkt, int flags);
+
+/*updates the meter with the levels of every channel in the frame, u8, 64 bit and double frames aren't measured*/
+void meter_frame(LevelMeter& meter, const AVFrame* frame);
+
+/*adds the frame to the loudness meter, the same formats as meter_frame*/
+void loudness_frame(LoudnessMeter& meter, const AVFrame* frame);
+
+/*BS.1770 weights for the channels of a layout: 1.41 for surrounds, 0 for LFE, 1 otherwise*/
+std::array<double, MAX_METER_CHANNELS> loudness_channel_weights(const AVChannelLayout& layout);
+
+/*a graph for the output filter chain at the encoder's format, every frame out of it one output frame long.
+* builds on the calling thread, which shouldn't be the audio thread. throws a const char* exception*/
+CachedFilterGraph output_filter_graph(const std::string& chain, const AVCodecContext& output_codec_ctx);
+
+/*limits the frame in place, only planar and packed float frames, anything else is left alone*/
+void limit_frame(Limiter& limiter, AVFrame* frame);
 
 struct timespec get_timespec_from_ticks(int ticks);
 
@@ -96,13 +137,34 @@ class OutputStream
         const AVOutputFormat* m_output_format {}; 
         AVCodecContext* m_output_codec_context {};
         AVStream* m_audio_stream {};
-        int m_samples_count {};
+        /*read by the control side to map wall clock times onto the output clock*/
+        std::atomic<int64_t> m_samples_count {};
         int m_ret {};
         int m_nb_samples {};
         AVFrame* m_frame {};
         AVPacket* m_pkt {};
+        /*encoders which let us supply packet buffers get them from here*/
+        AVBufferPool* m_packet_pool {};
         AVDictionary* m_output_options {};
         int m_sample_rate, m_bit_rate;
+        float m_gain {1};
+        float m_applied_gain {1};
+        /*the output filter chain, the first thing a frame goes through, only replaced by the audio thread*/
+        CachedFilterGraph m_filter_graph {};
+        FrameHandle m_filtered_frame {};
+        /*the sink's own frame from the frame pool: silence while the output filters haven't produced a frame yet,
+        * or a writable copy of a filtered frame which still shares the source's buffers*/
+        FrameHandle m_bus_frame {};
+        /*a graph which has failed, waiting for the audio channel to hand it to the control side*/
+        CachedFilterGraph m_failed_filter_graph {};
+        int m_filter_error {};
+        /*after the gain, the last thing before the encoder*/
+        Limiter m_limiter {};
+        uint64_t m_limited_samples {};
+
+        /*the frame to encode in place of frame: what comes out of the output filters, silence until they
+        * produce something, or frame itself once they have failed*/
+        AVFrame* filter_frame(AVFrame* frame);
 
 
     public: 
@@ -121,10 +183,34 @@ class OutputStream
         /*encodes and muxes one frame of audio data*/
         int write_frame (InputStream& source);
 
+        /*sends a frame (or NULL to flush) to the encoder and muxes every packet it returns*/
+        int encode_frame (AVFrame* frame);
+
         /*closes the file and does other end of stream tasks*/
         void finish_streaming ();
 
         int get_frame_length_milliseconds();    
+
+        /*linear gain applied to every frame written, changes are ramped over one frame*/
+        void set_gain(float gain) {m_gain = gain;}
+
+        /*swaps in an output filter graph (see output_filter_graph(), null for none) and returns the previous one.
+        * once streaming only the audio thread calls this, through AudioChannel*/
+        CachedFilterGraph set_filter_graph(CachedFilterGraph filter_graph);
+
+        /*an output filter graph which has failed and been taken out of the path (null if none) and its FFmpeg
+        * error code. audio thread only, through AudioChannel*/
+        CachedFilterGraph take_failed_filter_graph(int& error);
+
+        /*configures the limiter for the encoder's sample rate and channels, call before streaming starts.
+        * only float sample formats are limited, integer ones have already been clipped*/
+        void set_limiter(const LimiterSettings& settings);
+
+        /*the constant delay the limiter adds to the output*/
+        int get_limiter_latency_samples() const {return m_limiter.latency_samples();}
+
+        /*number of samples sent to the encoder so far, i.e. the output clock*/
+        int64_t get_samples_written() const {return m_samples_count.load(std::memory_order_relaxed);}
 };
 
 /*provides methods to demux and decode audio data and provide frames of the correct size, 
@@ -135,26 +221,63 @@ class InputStream
 {
     private:
         std::string m_source_url{};
-        AVFormatContext* m_format_ctx{};
-        AVDictionary* m_options{};
-        AVCodecContext* m_input_codec_ctx{};
-        AVCodecContext m_output_codec_ctx;
-        AVFrame* m_frame{};
-        AVFrame* m_temp_frame{};       
-        AVPacket* m_pkt{};
+        /*the source prompt's -c:a, null for FFmpeg's default decoder for the stream*/
+        const AVCodec* m_decoder{};
+        /*steady clock nanoseconds after which blocking IO is interrupted, 0 for never. declared before
+        * m_format_ctx, whose interrupt callback reads it until the context is closed*/
+        std::atomic<int64_t> m_io_deadline_ns{};
+        FormatContextHandle m_format_ctx{};
+        /*the options avformat_open_input didn't recognise*/
+        DictionaryHandle m_options{};
+        /*from the decoder pool, handed back when the source is destroyed*/
+        PooledDecoder m_input_codec_ctx{};
+        /*a copy of the encoder's parameters (format, layout, rate, frame size), owns nothing*/
+        AVCodecContext m_output_codec_ctx{};
+        FrameHandle m_frame{};
+        FrameHandle m_temp_frame{};       
+        PooledPacket m_pkt{};
+        bool m_decoder_reused = false;
         bool m_got_frame = false;
         int m_ret{};
         int m_stream_index{};
-        struct SwrContext* m_swr_ctx {};
-        struct SwrContext* m_swr_ctx_xfade{};
+        /*from the resampler cache, handed back when the source is destroyed*/
+        CachedResampler m_swr_ctx {};
+        /*the quality of m_swr_ctx, the other resamplers don't change the sample rate*/
+        ResamplerProfiles m_resampler_profile {ResamplerProfiles::standard};
+        /*a primed context for the same conversion at the other profile (fast while m_swr_ctx has the source's
+        * own, the source's own while the quality governor has the resampler step in force), ready to take over
+        * when the step changes. null if the governor can't or the source doesn't resample, and while the
+        * context it comes back as is being reset*/
+        CachedResampler m_swr_ctx_standby {};
+        /*the context the standby last took over from, for the audio channel to have reset off the audio thread*/
+        CachedResampler m_swr_ctx_retired {};
+        bool m_resampler_degraded = false;
+        /*the standby has converted the last input frame and takes over with the next*/
+        bool m_resampler_swap_due = false;
+        /*tells the audio channel which source a reset resampler goes back to*/
+        inline static std::atomic<uint64_t> s_next_id {1};
+        uint64_t m_id {s_next_id.fetch_add(1, std::memory_order_relaxed)};
+        CachedResampler m_swr_ctx_xfade{};
+        /*converts output frames to stereo FLTP for mixing, the reverse of m_swr_ctx_xfade*/
+        CachedResampler m_swr_ctx_mix{};
+        /*preallocated stereo FLTP frames the crossfade is mixed in*/
+        FrameHandle m_mix_frame{};
+        FrameHandle m_incoming_mix_frame{};
         int m_dst_nb_samples{};
         int m_default_frame_size{};
         int m_output_frame_size{};
         int m_actual_nb_samples{};
-        AVAudioFifo* m_queue{};
+        /*the source's -af chain, resampled frames go through it on their way to the queue*/
+        CachedFilterGraph m_filter_graph{};
+        FrameHandle m_filtered_frame{};
+        AudioFifoHandle m_queue{};
         int m_number_buffered_samples{};
         std::chrono::duration<double> m_loop_duration {};
         SourceTimingModes m_timing_mode = SourceTimingModes::realtime;
+        /*the source's loudness before normalisation and the gain normalising it, see Loudness.h*/
+        LoudnessMeter m_loudness_meter{};
+        LoudnessNormaliser m_normaliser{};
+        float m_loudness_gain{1};
         bool m_source_valid = true;
         DefaultSourceModes m_source_mode = DefaultSourceModes::white_noise;
         
@@ -169,33 +292,35 @@ class InputStream
         */
 
         /*normal constructor*/
-        InputStream(std::string source_url, AVInputFormat* format, const AVCodecContext& output_codec_ctx, AVDictionary* options, 
-                        SourceTimingModes timing_mode, DefaultSourceModes source_mode);
-
-        /*alternative constructor from ffmpeg prompt*/
-        InputStream(FFMPEGString &prompt_string, const AVCodecContext& output_codec_ctx, 
-                    SourceTimingModes timing_mode, DefaultSourceModes source_mode);
+        InputStream(std::string source_url, const AVInputFormat* format, const AVCodecContext& output_codec_ctx, 
+                        const AVDictionary* options, SourceTimingModes timing_mode, DefaultSourceModes source_mode,
+                        std::chrono::steady_clock::time_point io_deadline = {},
+                        ResamplerProfiles resampler_profile = default_resampler_profile,
+                        const AVCodec* decoder = nullptr);
+
+        /*alternative constructor from a compiled source, throws the descriptor's error if it isn't valid.
+        * opening the source and reading from it give up at io_deadline, if one is given. resampled with
+        * the descriptor's resampler profile*/
+        InputStream(const SourceDescriptor& descriptor, const AVCodecContext& output_codec_ctx, 
+                    SourceTimingModes timing_mode, DefaultSourceModes source_mode,
+                    std::chrono::steady_clock::time_point io_deadline = {});
 
         /*alternative 'no source' constructor*/
-        InputStream(const AVCodecContext& output_codec_ctx, DefaultSourceModes source_mode);
+        InputStream(const AVCodecContext& output_codec_ctx, DefaultSourceModes source_mode, 
+                    SourceTimingModes timing_mode = SourceTimingModes::realtime);
 
         /*default constructor*/
         InputStream();
 
-        /*destructor*/
-        ~InputStream();
-
-        /*copy constructor*/
-        InputStream(const InputStream& input_stream);
-
-        /*copy assignment operator*/
-        InputStream& operator= (const InputStream& input_stream);
-
-        /*move constructor*/
-        InputStream(InputStream&& input_stream) noexcept;
+        /*destructor, every FFmpeg object is held in a handle which frees it*/
+        ~InputStream() = default;
 
-        /*move assignment operator*/
-        InputStream& operator= (InputStream&& input_stream) noexcept;
+        /*sources are owned through std::unique_ptr<InputStream> and never copied or moved,
+        * handing one over (e.g. switching sources) is a pointer swap*/
+        InputStream(const InputStream& input_stream) = delete;
+        InputStream& operator= (const InputStream& input_stream) = delete;
+        InputStream(InputStream&& input_stream) = delete;
+        InputStream& operator= (InputStream&& input_stream) = delete;
 
         /*METHODS INTENDED FOR API USERS
         *
@@ -208,18 +333,54 @@ class InputStream
         /*buffer up exactly one frame that matches all the requirements of the output stream*/
         bool get_one_output_frame();
 
-        /*crossfades two sources, stores one output sized frame, 
-        * call multiple times to complete the whole crossfade*/
-        bool crossfade_frame(AVFrame* new_input_frame, int& fade_time_remaining, int fade_time);
+        /*crossfades two sources, stores one output sized frame, call multiple times to complete the whole crossfade.
+        * new_input_frame is an output frame of the incoming source, both are mixed as stereo FLTP in preallocated
+        * frames so nothing is allocated during the fade.
+        * the fade is ramped per sample and starts start_delay samples into the frame (start_delay counts down 
+        * across calls) so it can begin at an exact sample of the output clock*/
+        bool crossfade_frame(AVFrame* new_input_frame, int& fade_samples_remaining, int fade_samples, int64_t& start_delay);
 
         /*return a pointer to the output frame*/
-        AVFrame* get_frame() const {return m_frame;}
+        AVFrame* get_frame() const {return m_frame.get();}
+
+        SourceTimingModes get_timing_mode() const {return m_timing_mode;}
+
+        /*blocking reads from the source fail with AVERROR_EXIT after this time, a default constructed
+        * time_point clears the deadline. callable from any thread*/
+        void set_io_deadline(std::chrono::steady_clock::time_point deadline);
+
+        /*true once the IO deadline has passed*/
+        bool io_deadline_passed() const;
+
+        /*the source's own loudness, measured before the normalising gain is applied*/
+        const LoudnessMeter& get_loudness_meter() const {return m_loudness_meter;}
+
+        /*the gain applied to normalise the source's loudness, 0 unless normalisation is enabled*/
+        double get_loudness_gain_db() const {return m_normaliser.gain_db();}
+
+        /*runs the source's audio through a filter chain from the filter graph cache, call before the
+        * first frame. throws a const char* exception if the chain can't be built*/
+        void set_filter_chain(const std::string& chain);
+
+        /*unique to the source for as long as fondue runs*/
+        uint64_t id() const {return m_id;}
 
-        /*configure resamplers for crossfading*/
-        void init_crossfade();
+        /*the resampler the quality governor's last step swapped out, null if there isn't one. it has to be
+        * reset before it can stand by again, which is done off the audio thread (see AudioChannel)*/
+        CachedResampler take_retired_resampler() {return std::move(m_swr_ctx_retired);}
 
-        /*return resamplers to normal streaming settings*/
-        void end_crossfade();
+        /*gives back the context take_retired_resampler() took, reset and primed, to stand by for the next step*/
+        void set_standby_resampler(CachedResampler swr_ctx) {m_swr_ctx_standby = std::move(swr_ctx);}
+
+        /*true if the decoder came from the decoder pool rather than being opened for this source*/
+        bool decoder_reused() const {return m_decoder_reused;}
+
+        /*number of samples waiting in the output sized queue*/
+        int get_queue_size() const {return m_queue ? av_audio_fifo_size(m_queue.get()) : 0;}
+
+        /*true for sources which produce data in realtime (devices, network streams) rather than seekable files,
+        * these have to keep being read while they wait to be crossfaded to*/
+        bool is_live() const;
 
         /*flush the resampler of any buffered samples, write these to the queue and return the number of samples flushed*/
         int flush_resampler();
@@ -231,8 +392,6 @@ class InputStream
         /*clears all samples from the samples queue*/
         void clear_queue();
 
-        void resample_queue(const AVSampleFormat& old_sample_format, const AVSampleFormat& new_sample_fmt);
-
         int get_frame_length_milliseconds();
 
         /*sleeps the thread for the correct amount of time to ensure real time operation*/
@@ -251,8 +410,12 @@ class InputStream
         not contain the correct number of samples for the output encoder*/
         int resample_one_input_frame();
 
-        /*resample with a specific resampling context*/
-        int resample_one_input_frame(SwrContext* swr_ctx);
+        /*writes the output frame's samples to the queue, through the filter graph if the source has one
+        * and the quality governor isn't bypassing filters*/
+        void queue_frame();
+
+        /*swaps the standby resampler in, a frame after the quality governor's resampler step changes*/
+        void follow_quality_governor();
 
         /*UNPLEASANT FFMPEG BOILERPLATE ZONE
         *
@@ -266,56 +429,52 @@ class InputStream
         int open_codec_context(enum AVMediaType type);
 
         /*handles boilerplate to do with allocating a frame*/
-        AVFrame* alloc_frame(AVCodecContext* codec_context);
+        FrameHandle alloc_frame(AVCodecContext* codec_context);
 
-        /*handles boilerplate to do with allocating the resampling context 
-        * to ensure the input stream data is resampled to match the output stream*/
-        struct SwrContext* alloc_resampler (AVCodecContext* input_codec_ctx, AVCodecContext* output_codec_ctx);
-
-        /*allocate a resampling context with default input options for crossfading*/
-        struct SwrContext* alloc_resampler(AVCodecContext* output_codec_ctx);
+        /*allocates a stereo FLTP frame of the output frame size at the output sample rate*/
+        FrameHandle alloc_mix_frame();
 
-        /*set the resampling context options*/
-        void set_resampler_options(SwrContext* swr_ctx, AVCodecContext* input_codec_ctx, AVCodecContext* output_codec_ctx);
+        /*grows the output frame's buffer to hold at least nb_samples (keeping its format and nb_samples),
+        * only needed for sources whose frames resample to more than the output frame size*/
+        void reserve_frame(int nb_samples);
 
-        /*set the resampling context options with default output settings*/
-        void set_resampler_options(SwrContext* swr_ctx);
+        /*measures the output frame's loudness and applies the normalising gain, ramped across the frame*/
+        void normalise_loudness();
 
-        /*set the resampling context output options*/
-        void set_resampler_options(SwrContext* swr_ctx, AVCodecContext* output_codec_ctx);
+        /*allocates the mixing resamplers and frames, primed, called by every constructor of a working source*/
+        void alloc_mixer();
 
-        /*boilerplate for copying resampling contexts*/
-        void deepcopy_swr_context(struct SwrContext** dst, struct SwrContext* src);
-        
-        /*boilerplate for copying audio samples queue*/
-        void deepcopy_audio_fifo(AVAudioFifo* src);
+        /*gets a resampling context with the source's resampler profile from the resampler cache
+        * to ensure the input stream data is resampled to match the output stream*/
+        CachedResampler alloc_resampler (AVCodecContext* input_codec_ctx, AVCodecContext* output_codec_ctx);
 
-        /*boilerplate for copying frames*/
-        void deepcopy_frame(AVFrame* &dst, AVFrame* src);
+        /*gets a resampling context with default input options for crossfading from the resampler cache*/
+        CachedResampler alloc_resampler(AVCodecContext* output_codec_ctx);
 
     
 };
 
-/*class for parsing ffmpeg prompts*/
+/*parses the output prompt, written like the output half of an ffmpeg command line e.g.
+* "-c:a libmp3lame -f mp3 -content_type audio/mpeg icecast://...". it is split and its options read the
+* way source prompts are (see SourceDescriptor.h): an option takes the next argument as its value unless
+* that is another option, and the one argument left is the destination url*/
 class FFMPEGString 
 {
     private:
     std::string m_string;
     std::string m_destination_url {""};
-    std::string m_source_url {""};
-    AVDictionary* m_options = NULL;
-    AVInputFormat* m_input_format = NULL;
+    DictionaryHandle m_options {};
     int m_sample_rate{DEFAULT_SAMPLE_RATE};
     int m_bit_rate{DEFAULT_BIT_RATE};
 
     public:
 
+    /*throws a const char* exception for a prompt which can't be split or has more than one url*/
     FFMPEGString(std::string string);
-    std::string url(){return (m_source_url!="" ? m_source_url:m_destination_url);}
+    std::string url(){return m_destination_url;}
     int sample_rate(){return m_sample_rate;}
     int bit_rate(){return m_bit_rate;}
-    AVDictionary* options(){return m_options;}
-    AVInputFormat* input_format(){return m_input_format;}
+    AVDictionary* options(){return m_options.get();}
 };
 
 #endif
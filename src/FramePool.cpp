@@ -0,0 +1,157 @@
+#include "FramePool.h"
+
+#include<cerrno>
+#include<iomanip>
+
+extern "C"
+{
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+
+FramePool frame_pool {};
+
+FramePool::~FramePool()
+{
+    /*buffers still in use keep their pool alive, it is freed with the last of them*/
+    const std::size_t count {m_pool_count.load(std::memory_order_acquire)};
+    for (std::size_t i = 0; i < count; i++)
+        av_buffer_pool_uninit(&m_pools[i].pool);
+}
+
+AVBufferRef* FramePool::allocate_buffer(void* opaque, size_t size)
+{
+    Pool* pool = static_cast<Pool*>(opaque);
+    uint8_t* data = static_cast<uint8_t*>(av_malloc(size));
+    if (!data)
+        return NULL;
+
+    auto* owner = new BufferOwner {pool->counters, size};
+    AVBufferRef* buffer = av_buffer_create(data, size, free_buffer, owner, 0);
+    if (!buffer)
+    {
+        delete owner;
+        av_free(data);
+        return NULL;
+    }
+
+    pool->counters->misses.fetch_add(1, std::memory_order_relaxed);
+    pool->counters->resident_bytes.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+    pool->counters->resident_buffers.fetch_add(1, std::memory_order_relaxed);
+    return buffer;
+}
+
+void FramePool::free_buffer(void* opaque, uint8_t* data)
+{
+    auto* owner = static_cast<BufferOwner*>(opaque);
+    owner->counters->resident_bytes.fetch_sub(static_cast<int64_t>(owner->size), std::memory_order_relaxed);
+    owner->counters->resident_buffers.fetch_sub(1, std::memory_order_relaxed);
+    delete owner;
+    av_free(data);
+}
+
+FramePool::Pool* FramePool::find_pool(AVSampleFormat format, int channels, int nb_samples)
+{
+    auto matches = [&](const Pool& pool)
+    {
+        return pool.format == format && pool.channels == channels && pool.nb_samples == nb_samples;
+    };
+
+    /*the pools published so far, without a lock*/
+    std::size_t count {m_pool_count.load(std::memory_order_acquire)};
+    for (std::size_t i = 0; i < count; i++)
+    {
+        if (matches(m_pools[i]))
+            return &m_pools[i];
+    }
+
+    std::lock_guard<std::mutex> lock (m_add_mtx);
+    /*another thread may have added it meanwhile*/
+    for (std::size_t i = count; i < m_pool_count.load(std::memory_order_relaxed); i++)
+    {
+        if (matches(m_pools[i]))
+            return &m_pools[i];
+    }
+    count = m_pool_count.load(std::memory_order_relaxed);
+    if (count == m_pools.size())
+        return NULL;
+
+    /*the same plane size av_frame_get_buffer would allocate*/
+    int linesize {};
+    if (av_samples_get_buffer_size(&linesize, channels, nb_samples, format, 0) < 0)
+        return NULL;
+
+    Pool* pool = &m_pools[count];
+    *pool = {m_counters, NULL, linesize, format, channels, nb_samples};
+    pool->pool = av_buffer_pool_init2(linesize, pool, allocate_buffer, NULL);
+    if (!pool->pool)
+    {
+        *pool = {};
+        return NULL;
+    }
+    /*publishes the complete Pool to the lock-free readers*/
+    m_pool_count.store(count + 1, std::memory_order_release);
+    return pool;
+}
+
+int FramePool::get_buffer(AVFrame* frame)
+{
+    const AVSampleFormat format = static_cast<AVSampleFormat>(frame->format);
+    const int channels = frame->ch_layout.nb_channels;
+    if (format == AV_SAMPLE_FMT_NONE || channels <= 0 || frame->nb_samples <= 0)
+        return AVERROR(EINVAL);
+
+    /*planar formats with more channels than AVFrame has inline buffers need extended_buf, leave those to FFmpeg*/
+    const int planes = av_sample_fmt_is_planar(format) ? channels : 1;
+    if (planes > AV_NUM_DATA_POINTERS)
+        return av_frame_get_buffer(frame, 0);
+
+    /*NULL once every shape is taken, such frames are allocated by FFmpeg*/
+    Pool* pool = find_pool(format, channels, frame->nb_samples);
+    if (!pool)
+        return av_frame_get_buffer(frame, 0);
+
+    for (int plane = 0; plane < planes; plane++)
+    {
+        frame->buf[plane] = av_buffer_pool_get(pool->pool);
+        if (!frame->buf[plane])
+        {
+            av_frame_unref(frame);
+            return AVERROR(ENOMEM);
+        }
+        frame->data[plane] = frame->buf[plane]->data;
+    }
+    m_counters->requests.fetch_add(planes, std::memory_order_relaxed);
+
+    frame->extended_data = frame->data;
+    frame->linesize[0] = pool->linesize;
+    return 0;
+}
+
+FramePoolStats FramePool::stats() const
+{
+    FramePoolStats stats {};
+    const uint64_t requests = m_counters->requests.load(std::memory_order_relaxed);
+    stats.misses = m_counters->misses.load(std::memory_order_relaxed);
+    stats.hits = requests > stats.misses ? requests - stats.misses : 0;
+    stats.resident_bytes = m_counters->resident_bytes.load(std::memory_order_relaxed);
+    stats.resident_buffers = m_counters->resident_buffers.load(std::memory_order_relaxed);
+    stats.pools = m_pool_count.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void FramePool::print_stats(std::ostream& stream) const
+{
+    const FramePoolStats pool_stats {stats()};
+
+    std::ios_base::fmtflags stream_flags {stream.flags()};
+    std::streamsize stream_precision {stream.precision()};
+    stream << std::fixed << std::setprecision(1);
+
+    stream << "frame pool: " << pool_stats.pools << " pools, " << pool_stats.hits << " hits, " << pool_stats.misses
+           << " misses (" << 100 * pool_stats.hit_rate() << "% hit rate), " << pool_stats.resident_buffers
+           << " buffers resident (" << pool_stats.resident_bytes << " bytes)\n";
+
+    stream.flags(stream_flags);
+    stream.precision(stream_precision);
+}
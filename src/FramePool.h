@@ -0,0 +1,113 @@
+/*
+* A shared pool of audio frame buffers.
+*
+* InputStream and OutputStream frames draw their sample buffers from here instead of allocating them
+* with av_frame_get_buffer. Buffers are kept in one AVBufferPool per sample format, channel count and
+* frame size, so a frame freed by one stream (e.g. a source which failed) is handed straight to the
+* next stream asking for the same shape, still warm in the cache, without a trip through malloc.
+* Buffers return to their pool when the last reference to them is dropped, av_frame_unref and
+* av_frame_free need no special handling.
+*
+* Finding the pool for a shape never takes a lock: the pools live in a fixed, append-only array
+* published by an atomic count, so the audio thread asking for a buffer never waits on another
+* thread opening a source with a new shape. Only adding a pool is serialised.
+*
+* A hit is a buffer handed out from a pool, a miss is one the pool had to allocate. Resident bytes
+* count every buffer allocated by the pools, in use or idle; the pools only ever grow to the most
+* buffers of each shape in use at once.
+*/
+
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+extern "C"
+{
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/samplefmt.h>
+}
+
+#include<array>
+#include<atomic>
+#include<cstdint>
+#include<memory>
+#include<mutex>
+#include<ostream>
+
+/*sample format, channel count and frame size combinations pooled, requests for any more allocate as usual*/
+#define FRAME_POOL_MAX_SHAPES 64
+
+struct FramePoolStats
+{
+    uint64_t hits {};
+    uint64_t misses {};
+    int64_t resident_bytes {};
+    /*buffers allocated by the pools, in use or idle*/
+    int64_t resident_buffers {};
+    /*one per sample format, channel count and frame size seen*/
+    std::size_t pools {};
+
+    double hit_rate() const {return hits + misses ? static_cast<double>(hits) / (hits + misses) : 0;}
+};
+
+class FramePool
+{
+    private:
+        /*shared with every buffer and pool handed out, a buffer may outlive the FramePool at exit*/
+        struct Counters
+        {
+            std::atomic<uint64_t> requests {};
+            std::atomic<uint64_t> misses {};
+            std::atomic<int64_t> resident_bytes {};
+            std::atomic<int64_t> resident_buffers {};
+        };
+
+        struct Pool
+        {
+            std::shared_ptr<Counters> counters;
+            AVBufferPool* pool {};
+            int linesize {};
+            AVSampleFormat format {AV_SAMPLE_FMT_NONE};
+            int channels {};
+            int nb_samples {};
+        };
+
+        /*one per buffer allocated, frees it and keeps the counters alive until then*/
+        struct BufferOwner
+        {
+            std::shared_ptr<Counters> counters;
+            std::size_t size;
+        };
+
+        std::shared_ptr<Counters> m_counters {std::make_shared<Counters>()};
+        /*a Pool is written once, before m_pool_count is raised past it, and never moves (FFmpeg holds pointers to it)*/
+        std::array<Pool, FRAME_POOL_MAX_SHAPES> m_pools {};
+        std::atomic<std::size_t> m_pool_count {};
+        /*serialises adding pools, finding one never takes it*/
+        std::mutex m_add_mtx;
+
+        Pool* find_pool(AVSampleFormat format, int channels, int nb_samples);
+
+        static AVBufferRef* allocate_buffer(void* opaque, size_t size);
+        static void free_buffer(void* opaque, uint8_t* data);
+
+    public:
+        FramePool() = default;
+
+        ~FramePool();
+
+        FramePool(const FramePool&) = delete;
+        FramePool& operator= (const FramePool&) = delete;
+
+        /*like av_frame_get_buffer(frame, 0): the frame's format, ch_layout and nb_samples must be set,
+        * fills its buffers and data pointers from the pool. returns 0 or a negative AVERROR*/
+        int get_buffer(AVFrame* frame);
+
+        FramePoolStats stats() const;
+
+        void print_stats(std::ostream& stream) const;
+};
+
+extern FramePool frame_pool;
+
+#endif
@@ -1,10 +1,27 @@
 #include "Fonduempeg.h"
 
-InputStream::InputStream(std::string source_url, AVInputFormat* format, const AVCodecContext& output_codec_ctx, AVDictionary* options, 
-                            SourceTimingModes timing_mode, DefaultSourceModes source_mode):
+namespace
+{
+    bool deadline_passed(int64_t deadline_ns)
+    {
+        return deadline_ns && std::chrono::steady_clock::now().time_since_epoch() >= std::chrono::nanoseconds(deadline_ns);
+    }
+
+    /*AVIOInterruptCB callback, opaque is the InputStream's m_io_deadline_ns*/
+    int interrupt_at_deadline(void* opaque)
+    {
+        return deadline_passed(static_cast<const std::atomic<int64_t>*>(opaque)->load(std::memory_order_relaxed));
+    }
+}
+
+InputStream::InputStream(std::string source_url, const AVInputFormat* format, const AVCodecContext& output_codec_ctx, 
+                            const AVDictionary* options, SourceTimingModes timing_mode, DefaultSourceModes source_mode,
+                            std::chrono::steady_clock::time_point io_deadline, ResamplerProfiles resampler_profile,
+                            const AVCodec* decoder):
     m_source_url {source_url},
+    m_decoder {decoder},
     m_output_codec_ctx {output_codec_ctx},
-    m_options {options},
+    m_resampler_profile {resampler_profile},
     m_timing_mode {timing_mode},
     m_source_mode {source_mode}
 {
@@ -16,14 +33,37 @@ InputStream::InputStream(std::string source_url, AVInputFormat* format, const AV
 
     
 
-    /*open input file and deduce the right format context from the file*/
-    if (avformat_open_input(&m_format_ctx, m_source_url.c_str(), format, &m_options) < 0)
+    /*open input file and deduce the right format context from the file. avformat_open_input consumes
+    * the options it's given, so it gets a copy and the caller's dictionary is left alone*/
+    set_io_deadline(io_deadline);
+    AVFormatContext* format_ctx {avformat_alloc_context()};
+    if (!format_ctx)
+    {
+        throw "Input: could not allocate format context";
+    }
+    /*every blocking read, from probing the source onwards, checks the deadline*/
+    format_ctx->interrupt_callback.callback = interrupt_at_deadline;
+    format_ctx->interrupt_callback.opaque = &m_io_deadline_ns;
+    /*a forced decoder also probes the stream, as ffmpeg's -c:a on an input does*/
+    if (m_decoder)
+    {
+        format_ctx->audio_codec_id = m_decoder->id;
+        format_ctx->audio_codec = m_decoder;
+    }
+    AVDictionary* unused_options {};
+    av_dict_copy(&unused_options, options, 0);
+    int open_ret = avformat_open_input(&format_ctx, m_source_url.c_str(), format, &unused_options);
+    m_format_ctx.reset(format_ctx);
+    m_options.reset(unused_options);
+    if (open_ret < 0)
     {
+        if (io_deadline_passed())
+            throw "Input: timed out opening source";
         throw "Input: couldn't open source";
     }
 
     /*retrieve stream information from the format context*/
-    if (avformat_find_stream_info(m_format_ctx, NULL) < 0)
+    if (avformat_find_stream_info(m_format_ctx.get(), NULL) < 0)
     {
         throw "Input: could not find stream information";
     }
@@ -35,47 +75,80 @@ InputStream::InputStream(std::string source_url, AVInputFormat* format, const AV
         throw "Input: could not open codec context";
     }
 
-    av_dump_format(m_format_ctx, 0, m_source_url.c_str(), 0);
+    av_dump_format(m_format_ctx.get(), 0, m_source_url.c_str(), 0);
 
-    m_pkt = av_packet_alloc();
+    m_pkt = decoder_pool.acquire_packet();
     
     if (!m_pkt) 
     {
         throw "Input: could not allocate packet";
     }
 
-    m_temp_frame = alloc_frame(m_input_codec_ctx);
+    m_temp_frame = alloc_frame(m_input_codec_ctx.get());
 
         /* create resampling contexts */
-    m_swr_ctx = alloc_resampler(m_input_codec_ctx, &m_output_codec_ctx);
-
-        /* Create the FIFO buffer based on the specified output sample format. */
-    if (!(m_queue = av_audio_fifo_alloc(m_output_codec_ctx.sample_fmt,
-                                    m_output_codec_ctx.ch_layout.nb_channels, 1))) 
+    m_swr_ctx = alloc_resampler(m_input_codec_ctx.get(), &m_output_codec_ctx);
+
+    /*allocate the resampler's and the output frame's buffers for the largest decoded frame expected now, 
+    * rather than when the first one arrives on the audio thread*/
+    prime_resampler(m_swr_ctx.get(), RESAMPLER_PRIME_SAMPLES);
+    const int largest_resampled_frame = swr_get_out_samples(m_swr_ctx.get(), RESAMPLER_PRIME_SAMPLES);
+    reserve_frame(largest_resampled_frame);
+
+    /*ready now in case the quality governor steps the resampler down while this source plays*/
+    if (quality_governor.configured(QualitySteps::resampler) && m_resampler_profile != ResamplerProfiles::fast
+        && m_input_codec_ctx->sample_rate != m_output_codec_ctx.sample_rate)
+    {
+        m_swr_ctx_standby = resampler_cache.acquire(m_input_codec_ctx->ch_layout, m_input_codec_ctx->sample_rate,
+                                                     m_input_codec_ctx->sample_fmt, m_output_codec_ctx.ch_layout,
+                                                     m_output_codec_ctx.sample_rate, m_output_codec_ctx.sample_fmt,
+                                                     resampler_profile_options(ResamplerProfiles::fast));
+        prime_resampler(m_swr_ctx_standby.get(), RESAMPLER_PRIME_SAMPLES);
+    }
+    alloc_mixer();
+
+        /* Create the FIFO buffer based on the specified output sample format, 
+        * reserving a few frames up front so the queue doesn't grow (and page fault) mid-stream. 
+        * it holds at most one output frame plus one decoded frame*/
+    m_queue.reset(av_audio_fifo_alloc(m_output_codec_ctx.sample_fmt,
+                                    m_output_codec_ctx.ch_layout.nb_channels, 
+                                    std::max(DEFAULT_QUEUE_CAPACITY_FRAMES * m_output_frame_size, 
+                                             m_output_frame_size + largest_resampled_frame)));
+    if (!m_queue) 
     {
     
         throw "Input: failed to allocate audio samples queue";
     }
    
+    m_loudness_meter.configure(m_output_codec_ctx.sample_rate, m_output_codec_ctx.ch_layout.nb_channels,
+                               loudness_channel_weights(m_output_codec_ctx.ch_layout));
+    m_normaliser.configure(loudness_settings);
+
     std::chrono::duration<double> sample_duration (1.0 / m_output_codec_ctx.sample_rate);
     m_loop_duration = (m_output_frame_size - DEFAULT_LOOP_TIME_OFFSET_SAMPLES) * sample_duration;
 }
 
-InputStream::InputStream(FFMPEGString &prompt_string, const AVCodecContext& output_codec_ctx, 
-                        SourceTimingModes timing_mode, DefaultSourceModes source_mode):
+InputStream::InputStream(const SourceDescriptor& descriptor, const AVCodecContext& output_codec_ctx, 
+                        SourceTimingModes timing_mode, DefaultSourceModes source_mode,
+                        std::chrono::steady_clock::time_point io_deadline):
                         
-                        InputStream(prompt_string.url(), prompt_string.input_format(), output_codec_ctx, prompt_string.options(), timing_mode, source_mode)
+                        InputStream(descriptor.valid() ? descriptor.url() : throw descriptor.error(), descriptor.input_format(), 
+                                    output_codec_ctx, descriptor.options(), timing_mode, source_mode, io_deadline,
+                                    descriptor.resampler_profile(), descriptor.decoder())
 {
-    /*uses constructor delegation*/
+    /*uses constructor delegation, then adds the prompt's filters*/
+    if (!descriptor.filters().empty())
+        set_filter_chain(descriptor.filters());
 }
 
    
-InputStream::InputStream(const AVCodecContext& output_codec_ctx, DefaultSourceModes source_mode):
+InputStream::InputStream(const AVCodecContext& output_codec_ctx, DefaultSourceModes source_mode, 
+                        SourceTimingModes timing_mode):
     m_output_codec_ctx {output_codec_ctx},
+    m_timing_mode {timing_mode},
     m_source_mode {source_mode}
 {
     
-    m_timing_mode = SourceTimingModes::realtime;
     m_frame = alloc_frame(&m_output_codec_ctx);
     m_output_frame_size = m_frame->nb_samples;
     m_swr_ctx_xfade = alloc_resampler(&m_output_codec_ctx);
@@ -83,7 +156,11 @@ InputStream::InputStream(const AVCodecContext& output_codec_ctx, DefaultSourceMo
     AVChannelLayout default_channel_layout = AV_CHANNEL_LAYOUT_STEREO;
 
     /*allocate the null input frame*/
-    m_temp_frame = av_frame_alloc();
+    m_temp_frame.reset(av_frame_alloc());
+    if (!m_temp_frame)
+    {
+        throw "Default input: error allocating an audio frame";
+    }
     m_temp_frame->format = AV_SAMPLE_FMT_S16;
     av_channel_layout_copy(&m_temp_frame->ch_layout, &default_channel_layout);
     m_temp_frame->sample_rate = m_output_codec_ctx.sample_rate;
@@ -91,30 +168,17 @@ InputStream::InputStream(const AVCodecContext& output_codec_ctx, DefaultSourceMo
 
     if (m_output_frame_size)
     {
-        if (av_frame_get_buffer(m_temp_frame,0) < 0)
+        if (frame_pool.get_buffer(m_temp_frame.get()) < 0)
         {
             throw "Default input: error allocating a temporary audio buffer";
         }
     }
 
-    /*allocate the resampling context*/
-    m_swr_ctx = swr_alloc();
-    if (!m_swr_ctx) 
-    {
-        throw "Default input: could not allocate a resampler context"; 
-    }
-
-    /*set the resampling options*/
-    av_opt_set_chlayout  (m_swr_ctx, "in_chlayout",       &default_channel_layout,      0);
-    av_opt_set_int       (m_swr_ctx, "in_sample_rate",     m_output_codec_ctx.sample_rate,    0);
-    av_opt_set_sample_fmt(m_swr_ctx, "in_sample_fmt",      AV_SAMPLE_FMT_S16,     0);
-    set_resampler_options(m_swr_ctx, &m_output_codec_ctx);
-
-    /* initialize the resampling context */
-    if ((swr_init(m_swr_ctx)) < 0) 
-    {
-        throw "Default input: failed to initialise the resampler context";
-    }
+    /*the synthesised stereo S16 to the output format*/
+    m_swr_ctx = resampler_cache.acquire(default_channel_layout, m_output_codec_ctx.sample_rate, AV_SAMPLE_FMT_S16,
+                                        m_output_codec_ctx.ch_layout, m_output_codec_ctx.sample_rate, m_output_codec_ctx.sample_fmt);
+    prime_resampler(m_swr_ctx.get(), m_output_frame_size);
+    alloc_mixer();
 
 
     std::chrono::duration<double> sample_duration (1.0 / m_output_codec_ctx.sample_rate);
@@ -126,250 +190,18 @@ InputStream::InputStream()
 {
 }
 
-InputStream::~InputStream()
-{
-    avformat_close_input(&m_format_ctx);
-    avcodec_free_context(&m_input_codec_ctx);
-    av_packet_free(&m_pkt);
-    av_frame_free(&m_frame);
-    av_frame_free(&m_temp_frame);
-    swr_free(&m_swr_ctx);
-    swr_free(&m_swr_ctx_xfade);
-    av_audio_fifo_free(m_queue);
-}
-
-InputStream::InputStream(const InputStream& input_stream):
-    m_source_url {input_stream.m_source_url},
-    m_options {input_stream.m_options}, 
-    m_output_codec_ctx {input_stream.m_output_codec_ctx},
-    m_got_frame {input_stream.m_got_frame},
-    m_ret {input_stream.m_ret},
-    m_dst_nb_samples {input_stream.m_dst_nb_samples},
-    m_default_frame_size {input_stream.m_default_frame_size},
-    m_output_frame_size {input_stream.m_output_frame_size},
-    m_actual_nb_samples {input_stream.m_actual_nb_samples},
-    m_number_buffered_samples {input_stream.m_number_buffered_samples},
-    m_loop_duration {input_stream.m_loop_duration},
-    m_timing_mode {input_stream.m_timing_mode},
-    m_source_valid {input_stream.m_source_valid},
-    m_source_mode {input_stream.m_source_mode}
-
-{
-    if (input_stream.m_format_ctx)
-    {
-        m_format_ctx = avformat_alloc_context();
-        *m_format_ctx = *(input_stream.m_format_ctx);
-    }
-    
-    if (input_stream.m_input_codec_ctx)
-    {
-        const AVCodec* dec = avcodec_find_decoder(m_format_ctx->streams[0]->codecpar->codec_id);
-        m_input_codec_ctx = avcodec_alloc_context3(dec);
-        *m_input_codec_ctx = *(input_stream.m_input_codec_ctx);
-        int ret{avcodec_open2(m_input_codec_ctx, dec, NULL)};
-    }
-
-    if (input_stream.m_pkt)
-    {
-         m_pkt = av_packet_alloc();
-        *m_pkt = *(input_stream.m_pkt);
-    }
-    
-    m_frame = av_frame_alloc();
-    deepcopy_frame(m_frame, input_stream.m_frame);
-    
-    m_temp_frame = av_frame_alloc();
-    deepcopy_frame(m_temp_frame, input_stream.m_temp_frame);
-
-    m_swr_ctx = swr_alloc();
-    m_swr_ctx_xfade = swr_alloc();
-    deepcopy_swr_context(&m_swr_ctx, input_stream.m_swr_ctx);
-    deepcopy_swr_context(&m_swr_ctx_xfade, input_stream.m_swr_ctx_xfade);
-    int ret {swr_init(m_swr_ctx)};
-    ret = swr_init(m_swr_ctx_xfade);
-
-    if (input_stream.m_queue)
-    {
-        m_queue = av_audio_fifo_alloc(m_output_codec_ctx.sample_fmt,
-                                    m_output_codec_ctx.ch_layout.nb_channels, 1);
-        deepcopy_audio_fifo(input_stream.m_queue);
-    }
-   
-
-}
-
-InputStream& InputStream::operator=(const InputStream& input_stream)
-{   
-    if (&input_stream == this)
-        return *this;
-
-    m_source_url = input_stream.m_source_url;
-    m_options = input_stream.m_options; 
-    m_output_codec_ctx = input_stream.m_output_codec_ctx;
-    m_got_frame = input_stream.m_got_frame;
-    m_ret = input_stream.m_ret;
-    m_dst_nb_samples = input_stream.m_dst_nb_samples;
-    m_default_frame_size = input_stream.m_default_frame_size;
-    m_output_frame_size = input_stream.m_output_frame_size;
-    m_actual_nb_samples = input_stream.m_actual_nb_samples;
-    m_number_buffered_samples = input_stream.m_number_buffered_samples;
-    m_loop_duration = input_stream.m_loop_duration;
-    m_timing_mode = input_stream.m_timing_mode;
-    m_source_valid = input_stream.m_source_valid;
-    m_source_mode = input_stream.m_source_mode;
-
-    avformat_close_input(&m_format_ctx);
-    if (input_stream.m_format_ctx)
-    {
-        m_format_ctx = avformat_alloc_context();
-        *m_format_ctx = *(input_stream.m_format_ctx);
-    }
-    
-    avcodec_free_context(&m_input_codec_ctx);
-    if (input_stream.m_input_codec_ctx)
-    {
-        const AVCodec* dec = avcodec_find_decoder(m_format_ctx->streams[0]->codecpar->codec_id);
-        m_input_codec_ctx = avcodec_alloc_context3(dec);
-        *m_input_codec_ctx = *(input_stream.m_input_codec_ctx);
-        int ret{avcodec_open2(m_input_codec_ctx, dec, NULL)};
-    }
-
-    av_packet_free(&m_pkt);
-    if (input_stream.m_pkt)
-    {
-        m_pkt = av_packet_alloc();
-        *m_pkt = *(input_stream.m_pkt);
-    }
-    
-    av_frame_free(&m_frame);
-    m_frame = av_frame_alloc();
-    deepcopy_frame(m_frame, input_stream.m_frame);
-
-    av_frame_free(&m_temp_frame);
-    m_temp_frame = av_frame_alloc();
-    deepcopy_frame(m_temp_frame, input_stream.m_temp_frame);
-
-    swr_free(&m_swr_ctx);
-    swr_free(&m_swr_ctx_xfade);
-    m_swr_ctx = swr_alloc();
-    m_swr_ctx_xfade = swr_alloc();
-    deepcopy_swr_context(&m_swr_ctx, input_stream.m_swr_ctx);
-    deepcopy_swr_context(&m_swr_ctx_xfade, input_stream.m_swr_ctx_xfade);
-    int ret {swr_init(m_swr_ctx)};
-    ret = swr_init(m_swr_ctx_xfade);
-
-    av_audio_fifo_free(m_queue);
-    if (input_stream.m_queue)
-    {
-        m_queue = av_audio_fifo_alloc(m_output_codec_ctx.sample_fmt,
-                                        m_output_codec_ctx.ch_layout.nb_channels, 1);
-        deepcopy_audio_fifo(input_stream.m_queue);
-    }
-
-    
-    return *this;
-
-}
-
-InputStream::InputStream(InputStream&& input_stream) noexcept:
-    m_source_url {input_stream.m_source_url},
-    m_options {input_stream.m_options}, 
-    m_output_codec_ctx {input_stream.m_output_codec_ctx},
-    m_got_frame {input_stream.m_got_frame},
-    m_ret {input_stream.m_ret},
-    m_dst_nb_samples {input_stream.m_dst_nb_samples},
-    m_default_frame_size {input_stream.m_default_frame_size},
-    m_output_frame_size {input_stream.m_output_frame_size},
-    m_actual_nb_samples {input_stream.m_actual_nb_samples},
-    m_number_buffered_samples {input_stream.m_number_buffered_samples},
-    m_loop_duration {input_stream.m_loop_duration},
-    m_timing_mode {input_stream.m_timing_mode},
-    m_source_valid {input_stream.m_source_valid},
-    m_source_mode {input_stream.m_source_mode},
-    m_format_ctx {input_stream.m_format_ctx},
-    m_input_codec_ctx {input_stream.m_input_codec_ctx},
-    m_frame {input_stream.m_frame},
-    m_temp_frame {input_stream.m_temp_frame},
-    m_pkt {input_stream.m_pkt},
-    m_swr_ctx {input_stream.m_swr_ctx},
-    m_swr_ctx_xfade {input_stream.m_swr_ctx_xfade},
-    m_queue {input_stream.m_queue}
-
-{
-    input_stream.m_format_ctx = nullptr;
-    input_stream.m_input_codec_ctx = nullptr;
-    input_stream.m_frame = nullptr;
-    input_stream.m_temp_frame = nullptr;
-    input_stream.m_pkt = nullptr;
-    input_stream.m_swr_ctx = nullptr;
-    input_stream.m_swr_ctx_xfade = nullptr;
-    input_stream.m_queue = nullptr;    
-}
-
-InputStream& InputStream::operator=(InputStream&& input_stream) noexcept
-{
-    if (&input_stream == this)
-        return *this;
-
-    m_source_url = input_stream.m_source_url;
-    m_options = input_stream.m_options; 
-    m_output_codec_ctx = input_stream.m_output_codec_ctx;
-    m_got_frame = input_stream.m_got_frame;
-    m_ret = input_stream.m_ret;
-    m_dst_nb_samples = input_stream.m_dst_nb_samples;
-    m_default_frame_size = input_stream.m_default_frame_size;
-    m_output_frame_size = input_stream.m_output_frame_size;
-    m_actual_nb_samples = input_stream.m_actual_nb_samples;
-    m_number_buffered_samples = input_stream.m_number_buffered_samples;
-    m_loop_duration = input_stream.m_loop_duration;
-    m_timing_mode = input_stream.m_timing_mode;
-    m_source_valid = input_stream.m_source_valid;
-    m_source_mode = input_stream.m_source_mode;
-
-    avformat_close_input(&m_format_ctx);
-    m_format_ctx = input_stream.m_format_ctx;
-    input_stream.m_format_ctx = nullptr;
-
-    avcodec_free_context(&m_input_codec_ctx);
-    m_input_codec_ctx = input_stream.m_input_codec_ctx;
-    input_stream.m_input_codec_ctx = nullptr;
-
-    av_frame_free(&m_frame);
-    m_frame = input_stream.m_frame;
-    input_stream.m_frame = nullptr;
-    
-    av_frame_free(&m_temp_frame);
-    m_temp_frame = input_stream.m_temp_frame;
-    input_stream.m_temp_frame = nullptr;
-
-    av_packet_free(&m_pkt);
-    m_pkt = input_stream.m_pkt;
-    input_stream.m_pkt = nullptr;
-
-    swr_free(&m_swr_ctx);
-    m_swr_ctx = input_stream.m_swr_ctx;
-    input_stream.m_swr_ctx = nullptr;
-
-    swr_free(&m_swr_ctx_xfade);
-    m_swr_ctx_xfade = input_stream.m_swr_ctx_xfade;
-    input_stream.m_swr_ctx_xfade = nullptr;
-
-    av_audio_fifo_free(m_queue);
-    m_queue = input_stream.m_queue;
-    input_stream.m_queue = nullptr;    
-
-    return *this;
-
-}
-
 int InputStream::resample_one_input_frame()
 {
-    m_dst_nb_samples = swr_get_out_samples(m_swr_ctx, m_temp_frame->nb_samples);
+    follow_quality_governor();
+    ScopedStageTimer timer {LoopStages::resample};
+    FONDUE_TRACE_SPAN("swr_convert");
+    m_dst_nb_samples = swr_get_out_samples(m_swr_ctx.get(), m_temp_frame->nb_samples);
     m_frame -> nb_samples = m_dst_nb_samples;
 
     av_assert0(m_dst_nb_samples == m_frame->nb_samples);
-    m_ret=av_frame_make_writable(m_frame);
-    m_ret=swr_convert(m_swr_ctx, m_frame->data, m_dst_nb_samples, 
+    m_ret=av_frame_make_writable(m_frame.get());
+    reserve_frame(m_dst_nb_samples);
+    m_ret=swr_convert(m_swr_ctx.get(), m_frame->data, m_dst_nb_samples, 
                         (const uint8_t **)m_temp_frame->data, m_temp_frame->nb_samples);
     
     if (m_ret < 0)
@@ -378,20 +210,10 @@ int InputStream::resample_one_input_frame()
     }
     m_actual_nb_samples = m_ret;
     m_frame->nb_samples=m_ret;
-    av_frame_unref(m_temp_frame);
-    return m_ret;
-}
-
-int InputStream::resample_one_input_frame(SwrContext* swr_ctx)
-{
-    /*note CANNOT deal with sample rate changes, should only be used with crossfade*/
-    m_ret=swr_convert(swr_ctx, m_frame->data, m_frame->nb_samples, 
-                        (const uint8_t **)m_frame->data, m_frame->nb_samples);
-    
+    av_frame_unref(m_temp_frame.get());
     return m_ret;
 }
 
-
 bool InputStream::get_one_output_frame()
 {
     /*check integrity of InputStream object, if invalid, just do nothing*/
@@ -403,37 +225,45 @@ bool InputStream::get_one_output_frame()
     if (!m_source_valid)
     {
         int i, j, v, fullscale;
-        m_ret = av_frame_make_writable(m_frame);
-        m_ret = av_frame_make_writable(m_temp_frame);
-        int16_t *q = (int16_t*)m_temp_frame->data[0];
-
-        for (j = 0; j < m_temp_frame->nb_samples; j ++)
+        /*the synthesis counts as decode, the resampling below is timed on its own*/
         {
-            switch (+m_source_mode)
+            ScopedStageTimer synthesis_timer {LoopStages::decode};
+            m_ret = av_frame_make_writable(m_frame.get());
+            m_ret = av_frame_make_writable(m_temp_frame.get());
+            int16_t *q = (int16_t*)m_temp_frame->data[0];
+
+            for (j = 0; j < m_temp_frame->nb_samples; j ++)
             {
-                case +DefaultSourceModes::silence:
-                    v = 0;
-                    break;
-                case +DefaultSourceModes::white_noise:
-                /*fullscale = 100 gives quiet white noise*/
-                    fullscale=100;
-                    v = (static_cast<float>(std::rand())/RAND_MAX -0.5)*fullscale;
-                    break;
-                default:
-                    v = 0;
-                    break;
-            }
+                switch (+m_source_mode)
+                {
+                    case +DefaultSourceModes::silence:
+                        v = 0;
+                        break;
+                    case +DefaultSourceModes::white_noise:
+                    /*fullscale = 100 gives quiet white noise*/
+                        fullscale=100;
+                        v = (static_cast<float>(std::rand())/RAND_MAX -0.5)*fullscale;
+                        break;
+                    default:
+                        v = 0;
+                        break;
+                }
             
-            for (i = 0; i < m_temp_frame->ch_layout.nb_channels; i ++)
-            {
-                *q++ = v;
+                for (i = 0; i < m_temp_frame->ch_layout.nb_channels; i ++)
+                {
+                    *q++ = v;
+                }
             }
         }
 
         /*resample to achieve the output sample format and channel configuration*/        
         /*since not changing the sample rate the number of samples shouldn't change*/
-        m_ret = swr_convert(m_swr_ctx, m_frame->data, m_temp_frame->nb_samples,
-                        (const uint8_t **)m_temp_frame->data, m_temp_frame->nb_samples);
+        {
+            ScopedStageTimer resample_timer {LoopStages::resample};
+            FONDUE_TRACE_SPAN("swr_convert");
+            m_ret = swr_convert(m_swr_ctx.get(), m_frame->data, m_temp_frame->nb_samples,
+                            (const uint8_t **)m_temp_frame->data, m_temp_frame->nb_samples);
+        }
 
         if (m_ret < 0)
         {
@@ -444,53 +274,71 @@ bool InputStream::get_one_output_frame()
     }
 
     /*if enough samples are ready, copy one frame's worth to m_frame*/
-    if (av_audio_fifo_size(m_queue) >= m_output_frame_size)
+    if (av_audio_fifo_size(m_queue.get()) >= m_output_frame_size)
     {
         m_frame->nb_samples = m_output_frame_size;
-        m_ret=av_frame_make_writable(m_frame);
+        m_ret=av_frame_make_writable(m_frame.get());
 
         /*insert the correct number of samples from the queue into the output frame*/
-        if (av_audio_fifo_read(m_queue, (void **)m_frame->data, m_frame->nb_samples) < m_frame->nb_samples) 
+        if (av_audio_fifo_read(m_queue.get(), (void **)m_frame->data, m_frame->nb_samples) < m_frame->nb_samples) 
         {
             throw "Could not read data from FIFO";
         }
+        normalise_loudness();
         return true;
     }
 
     else
     {
-        while (av_audio_fifo_size(m_queue) <= m_output_frame_size)
+        while (av_audio_fifo_size(m_queue.get()) <= m_output_frame_size)
         {
-            /*request a new packet from the input*/
-            m_ret = av_read_frame(m_format_ctx, m_pkt);
-            if (m_ret < 0)
             {
-                if (m_ret == AVERROR_EOF)
-                    throw "no more packets, reached end of input";
-                throw "error reading packet";
-            }
+                ScopedStageTimer decode_timer {LoopStages::decode};
 
-            /*skip the packet if it's not an audio packet*/
-            if (m_pkt->stream_index != m_stream_index)
-            {
-                av_packet_unref(m_pkt);
-                continue;
-            }
+                /*request a new packet from the input*/
+                {
+                    FONDUE_TRACE_SPAN("av_read_frame");
+                    FONDUE_ALLOC_SCOPE(AllocScopes::libav);
+                    m_ret = av_read_frame(m_format_ctx.get(), m_pkt.get());
+                }
+                if (m_ret < 0)
+                {
+                    if (m_ret == AVERROR_EOF)
+                        throw "no more packets, reached end of input";
+                    throw "error reading packet";
+                }
 
-            /*send the packet to the decoder*/
-            m_ret = avcodec_send_packet(m_input_codec_ctx, m_pkt);
-            if (m_ret < 0)
-            {
-                throw "error submitting a packet for decoding";
-            }
+                /*skip the packet if it's not an audio packet*/
+                if (m_pkt->stream_index != m_stream_index)
+                {
+                    av_packet_unref(m_pkt.get());
+                    continue;
+                }
 
-            av_packet_unref(m_pkt);
+                /*send the packet to the decoder*/
+                {
+                    FONDUE_TRACE_SPAN("avcodec_send_packet");
+                    FONDUE_ALLOC_SCOPE(AllocScopes::libav);
+                    m_ret = avcodec_send_packet(m_input_codec_ctx.get(), m_pkt.get());
+                }
+                if (m_ret < 0)
+                {
+                    throw "error submitting a packet for decoding";
+                }
+
+                av_packet_unref(m_pkt.get());
+            }
 
             /*get all the raw frames out of the packet. there may be
             * more than one for some codecs*/
            while (m_ret >= 0)
            {
-                m_ret = avcodec_receive_frame(m_input_codec_ctx, m_temp_frame);
+                {
+                    ScopedStageTimer decode_timer {LoopStages::decode};
+                    FONDUE_TRACE_SPAN("avcodec_receive_frame");
+                    FONDUE_ALLOC_SCOPE(AllocScopes::libav);
+                    m_ret = avcodec_receive_frame(m_input_codec_ctx.get(), m_temp_frame.get());
+                }
                 if (m_ret < 0)
                 {
                     //special cases if no frame was available but otherwise no errors
@@ -503,102 +351,204 @@ bool InputStream::get_one_output_frame()
                     throw "could not resample input frame";
                 
                 /*add all samples from the frame to the FIFO*/
-                if (av_audio_fifo_write(m_queue, (void**)m_frame->data, m_frame->nb_samples) < m_frame->nb_samples)
-                    throw "could not write the decoded frame to the fifo";
+                queue_frame();
            }
         }
 
         m_frame->nb_samples = m_output_frame_size;
-        m_ret=av_frame_make_writable(m_frame);
+        m_ret=av_frame_make_writable(m_frame.get());
 
         /*insert the correct number of samples from the queue into the output frame*/
-        if (av_audio_fifo_read(m_queue, (void **)m_frame->data, m_frame->nb_samples) < m_frame->nb_samples) 
+        if (av_audio_fifo_read(m_queue.get(), (void **)m_frame->data, m_frame->nb_samples) < m_frame->nb_samples) 
         {
             throw "Could not read data from FIFO";
         }
+        normalise_loudness();
         return true;
 
     }
   
 }
 
-bool InputStream::crossfade_frame(AVFrame* new_input_frame, int& fade_time_remaining, int fade_time)
+bool InputStream::crossfade_frame(AVFrame* new_input_frame, int& fade_samples_remaining, int fade_samples, int64_t& start_delay)
 {
-    /*uses pointer arithmetic to linearly fade between two frames, requires AV_SAMPLE_FMT_FLTP*/
+    /*uses pointer arithmetic to linearly fade between two frames converted to AV_SAMPLE_FMT_FLTP*/
     int i , j; 
     float *q , *v;
     get_one_output_frame();
+    const int nb_samples = m_frame->nb_samples;
 
-    /*a value between zero and one representing how far through the fade we are currently*/
-    float non_dimensional_fade_time = 1 - static_cast<float>(fade_time_remaining)/fade_time;
+    {
+        ScopedStageTimer resample_timer {LoopStages::resample};
+        FONDUE_TRACE_SPAN("swr_convert crossfade");
+        if (swr_convert(m_swr_ctx_mix.get(), m_mix_frame->data, nb_samples, (const uint8_t**)m_frame->data, nb_samples) < 0
+            || swr_convert(m_swr_ctx_mix.get(), m_incoming_mix_frame->data, nb_samples, (const uint8_t**)new_input_frame->data, nb_samples) < 0)
+            throw "crossfading: could not convert the frames for mixing";
+    }
 
-    float non_dimensional_fade_time_increment = 1 / (static_cast<float>(new_input_frame->sample_rate/1000)*fade_time);
+    /*samples already faded before this frame*/
+    const int fade_position = fade_samples - fade_samples_remaining;
+    /*the first start_delay samples of the frame are the outgoing source alone*/
+    const int first_faded_sample = static_cast<int>(std::min<int64_t>(start_delay, nb_samples));
 
-    for (i = 0; i < m_frame->ch_layout.nb_channels; i++)
     {
-        q = (float*)m_frame->data[i];
-        v = (float*)new_input_frame->data[i];
-
-        for (j = 0; j < m_frame->nb_samples; j++)
+        ScopedStageTimer mix_timer {LoopStages::mix};
+        for (i = 0; i < m_mix_frame->ch_layout.nb_channels; i++)
         {
-            *q = *q *(1-non_dimensional_fade_time) + *v * non_dimensional_fade_time; 
-            q++;
-            v++;
+            q = (float*)m_mix_frame->data[i] + first_faded_sample;
+            v = (float*)m_incoming_mix_frame->data[i] + first_faded_sample;
+
+            for (j = first_faded_sample; j < nb_samples; j++)
+            {
+                /*a value between zero and one representing how far through the fade this sample is*/
+                float non_dimensional_fade_time = std::min(1.0f, static_cast<float>(fade_position + j - first_faded_sample) / fade_samples);
+                *q = *q *(1-non_dimensional_fade_time) + *v * non_dimensional_fade_time; 
+                q++;
+                v++;
+            }
         }
     }
 
-    resample_one_input_frame(m_swr_ctx_xfade); 
-    fade_time_remaining -= get_frame_length_milliseconds();
+    {
+        ScopedStageTimer resample_timer {LoopStages::resample};
+        FONDUE_TRACE_SPAN("swr_convert crossfade");
+        m_ret = swr_convert(m_swr_ctx_xfade.get(), m_frame->data, nb_samples, (const uint8_t**)m_mix_frame->data, nb_samples);
+    }
+    fade_samples_remaining -= nb_samples - first_faded_sample;
+    start_delay -= first_faded_sample;
     return true;
     
 }
 
+void InputStream::set_filter_chain(const std::string& chain)
+{
+    m_filtered_frame.reset(av_frame_alloc());
+    if (!m_filtered_frame)
+        throw "Input: error allocating an audio frame";
+    m_filter_graph = filter_graph_cache.acquire(chain, m_output_codec_ctx.ch_layout, m_output_codec_ctx.sample_rate,
+                                                m_output_codec_ctx.sample_fmt);
+}
+
+void InputStream::queue_frame()
+{
+    if (!m_filter_graph || quality_governor.degraded(QualitySteps::filters))
+    {
+        if (av_audio_fifo_write(m_queue.get(), (void**)m_frame->data, m_frame->nb_samples) < m_frame->nb_samples)
+            throw "could not write the decoded frame to the fifo";
+        return;
+    }
+
+    ScopedStageTimer filter_timer {LoopStages::filter};
+    FONDUE_TRACE_SPAN("filter graph");
+    const int nb_samples = m_frame->nb_samples;
+    /*the graph takes the frame's buffers rather than a copy of the samples, the output frame gets fresh ones from the frame pool*/
+    if (m_filter_graph->send(m_frame.get()) < 0)
+        throw "could not send a frame to the source's filters";
+    m_frame->format = m_output_codec_ctx.sample_fmt;
+    m_frame->sample_rate = m_output_codec_ctx.sample_rate;
+    av_channel_layout_copy(&m_frame->ch_layout, &m_output_codec_ctx.ch_layout);
+    m_frame->nb_samples = std::max(nb_samples, m_output_frame_size);
+    if (frame_pool.get_buffer(m_frame.get()) < 0)
+        throw "Input: error allocating an audio buffer";
+    m_frame->nb_samples = nb_samples;
+
+    while (true)
+    {
+        m_ret = m_filter_graph->receive(m_filtered_frame.get());
+        if (m_ret == AVERROR(EAGAIN))
+            break;
+        if (m_ret < 0)
+            throw "error filtering the source";
+        const int written = av_audio_fifo_write(m_queue.get(), (void**)m_filtered_frame->extended_data, m_filtered_frame->nb_samples);
+        const int filtered_samples = m_filtered_frame->nb_samples;
+        av_frame_unref(m_filtered_frame.get());
+        if (written < filtered_samples)
+            throw "could not write the filtered frame to the fifo";
+    }
+}
+
+void InputStream::follow_quality_governor()
+{
+    /*the standby converted the last input frame too, so it takes over with this source's audio in its
+    * filter. the context it replaces goes to the control side through the audio channel to be reset*/
+    if (m_resampler_swap_due)
+    {
+        m_swr_ctx_retired = std::move(m_swr_ctx);
+        m_swr_ctx = std::move(m_swr_ctx_standby);
+        m_resampler_degraded = !m_resampler_degraded;
+        m_resampler_swap_due = false;
+    }
+
+    /*a step taken while the context the last one replaced is still being reset waits for it to come back*/
+    if (!m_swr_ctx_standby || quality_governor.degraded(QualitySteps::resampler) == m_resampler_degraded)
+        return;
+
+    /*the standby converts the frame the current context is about to and its output is thrown away, rather
+    * than taking over with the silence it was primed with. the switch then moves the output by the
+    * difference between the two filters' delays, a few samples, instead of leaving a gap*/
+    const int nb_samples = swr_get_out_samples(m_swr_ctx_standby.get(), m_temp_frame->nb_samples);
+    m_ret = av_frame_make_writable(m_frame.get());
+    reserve_frame(nb_samples);
+    if (swr_convert(m_swr_ctx_standby.get(), m_frame->data, nb_samples,
+                    (const uint8_t **)m_temp_frame->data, m_temp_frame->nb_samples) < 0)
+        throw "error warming the standby resampler";
+    m_resampler_swap_due = true;
+}
+
+void InputStream::normalise_loudness()
+{
+    ScopedStageTimer timer {LoopStages::loudness};
+    FONDUE_TRACE_SPAN("normalise_loudness");
+    loudness_frame(m_loudness_meter, m_frame.get());
+    if (!m_normaliser.enabled())
+        return;
+
+    const float gain = static_cast<float>(std::pow(10.0, m_normaliser.update(m_loudness_meter, m_frame->nb_samples,
+                                                                             m_output_codec_ctx.sample_rate) / 20));
+    if (gain != 1 || m_loudness_gain != 1)
+        apply_gain(m_frame.get(), m_loudness_gain, gain);
+    m_loudness_gain = gain;
+}
+
+void InputStream::set_io_deadline(std::chrono::steady_clock::time_point deadline)
+{
+    const int64_t deadline_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+    m_io_deadline_ns.store(deadline_ns, std::memory_order_relaxed);
+}
+
+bool InputStream::io_deadline_passed() const
+{
+    return deadline_passed(m_io_deadline_ns.load(std::memory_order_relaxed));
+}
+
 int InputStream::open_codec_context(enum AVMediaType type)
 {
-    int ret;
     AVStream *st{};
-    const AVCodec* dec{};
  
     
         /*determine the stream index of the audio stream*/
-        m_stream_index = av_find_best_stream(m_format_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
-        st = m_format_ctx->streams[m_stream_index];
- 
-        /* find decoder for the stream */
-        dec = avcodec_find_decoder(st->codecpar->codec_id);
-        if (!dec) {
-            fprintf(stderr, "Failed to find %s codec\n",
+        m_stream_index = av_find_best_stream(m_format_ctx.get(), type, -1, -1, NULL, 0);
+        if (m_stream_index < 0) {
+            fprintf(stderr, "Could not find %s stream in input\n",
                     av_get_media_type_string(type));
-            return AVERROR(EINVAL);
+            return m_stream_index;
         }
+        st = m_format_ctx->streams[m_stream_index];
  
-        /* Allocate a codec context for the decoder */
-        m_input_codec_ctx = avcodec_alloc_context3(dec);
+        /* borrow an opened decoder for the stream's codec parameters, a source with the same
+        * parameters handed one back if m_decoder_reused is set, otherwise it's opened here */
+        m_input_codec_ctx = decoder_pool.acquire(st->codecpar, m_decoder_reused, m_decoder);
         if (!m_input_codec_ctx) {
-            fprintf(stderr, "Failed to allocate the %s codec context\n",
-                    av_get_media_type_string(type));
-            return AVERROR(ENOMEM);
-        }
- 
-        /* Copy codec parameters from input stream to codec context */
-        if ((ret = avcodec_parameters_to_context(m_input_codec_ctx, st->codecpar)) < 0) {
-            fprintf(stderr, "Failed to copy %s codec parameters to decoder context\n",
-                    av_get_media_type_string(type));
-            return ret;
-        }
- 
-        /* Init the decoders */
-        if ((ret = avcodec_open2(m_input_codec_ctx, dec, NULL)) < 0) {
             fprintf(stderr, "Failed to open %s codec\n",
                     av_get_media_type_string(type));
-            return ret;
+            return AVERROR(EINVAL);
         }
     return 0;
 }
 
-AVFrame* InputStream::alloc_frame(AVCodecContext* codec_context)
+FrameHandle InputStream::alloc_frame(AVCodecContext* codec_context)
 {
-    AVFrame* frame = av_frame_alloc();
+    FrameHandle frame {av_frame_alloc()};
     int nb_samples;
     if (!frame) 
     {
@@ -619,7 +569,7 @@ AVFrame* InputStream::alloc_frame(AVCodecContext* codec_context)
     frame->nb_samples = nb_samples;
  
     if (nb_samples) {
-        if (av_frame_get_buffer(frame, 0) < 0) 
+        if (frame_pool.get_buffer(frame.get()) < 0) 
         {
             throw "Input: error allocating an audio buffer";
         }
@@ -628,14 +578,77 @@ AVFrame* InputStream::alloc_frame(AVCodecContext* codec_context)
     return frame;
 }
 
+FrameHandle InputStream::alloc_mix_frame()
+{
+    FrameHandle frame {av_frame_alloc()};
+    if (!frame) 
+    {
+        throw "Input: error allocating an audio frame";
+    }
+
+    AVChannelLayout default_channel_layout = AV_CHANNEL_LAYOUT_STEREO;
+    frame->format = AV_SAMPLE_FMT_FLTP;
+    av_channel_layout_copy(&frame->ch_layout, &default_channel_layout);
+    frame->sample_rate = m_output_codec_ctx.sample_rate;
+    frame->nb_samples = m_output_frame_size;
+
+    if (m_output_frame_size && frame_pool.get_buffer(frame.get()) < 0)
+    {
+        throw "Input: error allocating a mixing buffer";
+    }
+    return frame;
+}
+
+void InputStream::reserve_frame(int nb_samples)
+{
+    const AVSampleFormat format = static_cast<AVSampleFormat>(m_frame->format);
+    /*bytes one sample takes up in one plane, every channel's for packed formats*/
+    const int sample_bytes = av_get_bytes_per_sample(format) * (av_sample_fmt_is_planar(format) ? 1 : m_frame->ch_layout.nb_channels);
+    if (!sample_bytes || (m_frame->buf[0] && static_cast<int64_t>(m_frame->buf[0]->size) / sample_bytes >= nb_samples))
+        return;
+
+    /*av_frame_unref clears the frame's properties as well as its buffers*/
+    const int frame_nb_samples = m_frame->nb_samples;
+    const int sample_rate = m_frame->sample_rate;
+    AVChannelLayout ch_layout {};
+    av_channel_layout_copy(&ch_layout, &m_frame->ch_layout);
+    av_frame_unref(m_frame.get());
+
+    m_frame->format = format;
+    m_frame->sample_rate = sample_rate;
+    av_channel_layout_copy(&m_frame->ch_layout, &ch_layout);
+    av_channel_layout_uninit(&ch_layout);
+    m_frame->nb_samples = nb_samples;
+    if (frame_pool.get_buffer(m_frame.get()) < 0) 
+    {
+        throw "Input: error allocating an audio buffer";
+    }
+    m_frame->nb_samples = frame_nb_samples;
+}
+
+void InputStream::alloc_mixer()
+{
+    /*the output format to stereo FLTP at the same rate, m_swr_ctx_xfade converts back*/
+    AVChannelLayout default_channel_layout = AV_CHANNEL_LAYOUT_STEREO;
+    m_swr_ctx_mix = resampler_cache.acquire(m_output_codec_ctx.ch_layout, m_output_codec_ctx.sample_rate, m_output_codec_ctx.sample_fmt,
+                                            default_channel_layout, m_output_codec_ctx.sample_rate, AV_SAMPLE_FMT_FLTP);
+
+    m_mix_frame = alloc_mix_frame();
+    m_incoming_mix_frame = alloc_mix_frame();
+    /*neither changes the sample rate so priming leaves nothing behind*/
+    prime_resampler(m_swr_ctx_mix.get(), m_output_frame_size);
+    prime_resampler(m_swr_ctx_xfade.get(), m_output_frame_size);
+}
+
 int InputStream::flush_resampler()
 {
-    m_dst_nb_samples = swr_get_out_samples(m_swr_ctx, m_temp_frame->nb_samples);
+    m_dst_nb_samples = swr_get_out_samples(m_swr_ctx.get(), m_temp_frame->nb_samples);
     m_frame -> nb_samples = m_dst_nb_samples;
 
     av_assert0(m_dst_nb_samples == m_frame->nb_samples);
-    m_ret=av_frame_make_writable(m_frame);
-    m_ret=swr_convert(m_swr_ctx, m_frame->data, m_dst_nb_samples, 
+    m_ret=av_frame_make_writable(m_frame.get());
+    reserve_frame(m_dst_nb_samples);
+    m_ret=swr_convert(m_swr_ctx.get(), m_frame->data, m_dst_nb_samples, 
                         0, 0);
     
     if (m_ret < 0)
@@ -645,8 +658,7 @@ int InputStream::flush_resampler()
     m_actual_nb_samples = m_ret;
     m_frame->nb_samples=m_ret;
 
-    if (av_audio_fifo_write(m_queue, (void**)m_frame->data, m_frame->nb_samples) < m_frame->nb_samples)
-        throw "could not write the flushed samples to the fifo";
+    queue_frame();
 
     return m_ret;
 }
@@ -654,16 +666,17 @@ int InputStream::flush_resampler()
 bool InputStream::empty_queue()
 {
     /*if enough samples are available, copy one frame's worth to m_frame*/
-    if (av_audio_fifo_size(m_queue) >= m_output_frame_size)
+    if (av_audio_fifo_size(m_queue.get()) >= m_output_frame_size)
     {
         m_frame->nb_samples = m_output_frame_size;
-        m_ret=av_frame_make_writable(m_frame);
+        m_ret=av_frame_make_writable(m_frame.get());
 
         /*insert the correct number of samples from the queue into the output frame*/
-        if (av_audio_fifo_read(m_queue, (void **)m_frame->data, m_frame->nb_samples) < m_frame->nb_samples) 
+        if (av_audio_fifo_read(m_queue.get(), (void **)m_frame->data, m_frame->nb_samples) < m_frame->nb_samples) 
         {
             throw "Could not read data from FIFO";
         }
+        normalise_loudness();
         return true;
     }
     else
@@ -674,171 +687,29 @@ bool InputStream::empty_queue()
 
 void InputStream::clear_queue()
 {
-    av_audio_fifo_reset(m_queue);
-}
-
-void InputStream::resample_queue(const AVSampleFormat& old_sample_fmt, const AVSampleFormat& new_sample_fmt)
-{
-    if (av_audio_fifo_size(m_queue) == 0)
-    {
-        clear_queue();
-        return;
-    }
-
-    AVFrame* temp_frame = av_frame_alloc();
-    temp_frame->format = m_output_codec_ctx.sample_fmt;
-    av_channel_layout_copy(&temp_frame->ch_layout, &m_output_codec_ctx.ch_layout);
-    temp_frame->sample_rate = m_output_codec_ctx.sample_rate;
-    temp_frame->nb_samples = av_audio_fifo_size(m_queue);
- 
-    if (temp_frame->nb_samples) {
-        if (av_frame_get_buffer(temp_frame, 0) < 0) 
-        {
-            throw "Input: error allocating an audio buffer";
-        }
-    }
-
-    if (av_audio_fifo_read(m_queue, (void **)temp_frame->data, temp_frame->nb_samples) < temp_frame->nb_samples) 
-    {
-        throw "Could not read data from FIFO";
-    }
-
-    struct SwrContext* temp_swr_ctx = swr_alloc();
-
-    av_opt_set_chlayout(temp_swr_ctx, "in_chlayout", &temp_frame->ch_layout, 0);
-    av_opt_set_chlayout(temp_swr_ctx, "out_chlayout", &temp_frame->ch_layout, 0);
-    av_opt_set_int(temp_swr_ctx, "in_sample_rate", temp_frame->sample_rate, 0);
-    av_opt_set_int(temp_swr_ctx, "out_sample_rate", temp_frame->sample_rate, 0);
-    av_opt_set_sample_fmt(temp_swr_ctx, "in_sample_fmt", old_sample_fmt, 0);
-    av_opt_set_sample_fmt(temp_swr_ctx, "out_sample_fmt", new_sample_fmt, 0);
-
-    swr_init(temp_swr_ctx);
-
-    swr_convert(temp_swr_ctx, temp_frame->data, temp_frame->nb_samples, 
-                        (const uint8_t **)temp_frame->data, temp_frame->nb_samples);
-
-    int channels {};
-    if (new_sample_fmt == AV_SAMPLE_FMT_FLTP)
-        channels = 2;
-    else
-        channels = m_output_codec_ctx.ch_layout.nb_channels;
-
-    av_audio_fifo_free(m_queue);
-    m_queue = av_audio_fifo_alloc(new_sample_fmt, channels, temp_frame->nb_samples);
-
-    if (av_audio_fifo_write(m_queue, (void**)temp_frame->data, temp_frame->nb_samples) < temp_frame->nb_samples)
-        throw "could not write the resampled samples to the fifo";
-
-    av_frame_free(&temp_frame);
-    swr_free(&temp_swr_ctx);
-}
-
-void InputStream::init_crossfade()
-{
-    if (!m_swr_ctx)
-        throw "Resampling context not allocated";
-        
-    set_resampler_options(m_swr_ctx);
-    /* initialize the resampling context */
-    if ((swr_init(m_swr_ctx)) < 0) 
-    {
-        throw "crossfading: failed to initialise the resampler context";
-    }
-    if (av_audio_fifo_size(m_queue) == 0)
-    {
-        int channels = 2;
-        av_audio_fifo_free(m_queue);
-        m_queue = av_audio_fifo_alloc(AV_SAMPLE_FMT_FLTP, channels, 1);
-    }
-}
-void InputStream::end_crossfade()
-{
-    set_resampler_options(m_swr_ctx, &m_output_codec_ctx);
-    if ((swr_init(m_swr_ctx)) < 0) 
-    {
-        throw "end crossfading: failed to initialise the resampler context";
-    }
-    if (av_audio_fifo_size(m_queue) == 0)
-    {
-        int channels = m_output_codec_ctx.ch_layout.nb_channels;
-        AVSampleFormat fmt = m_output_codec_ctx.sample_fmt;
-        av_audio_fifo_free(m_queue);
-        m_queue = av_audio_fifo_alloc(fmt, channels, 1);
-    }
+    av_audio_fifo_reset(m_queue.get());
 }
 
-void InputStream::set_resampler_options(SwrContext* swr_ctx, AVCodecContext* input_codec_ctx, AVCodecContext* output_codec_ctx)
+CachedResampler InputStream::alloc_resampler (AVCodecContext* input_codec_ctx, AVCodecContext* output_codec_ctx)
 {
-    av_opt_set_chlayout  (swr_ctx, "in_chlayout",       &input_codec_ctx->ch_layout,      0);
-    av_opt_set_int       (swr_ctx, "in_sample_rate",     input_codec_ctx->sample_rate,    0);
-    av_opt_set_sample_fmt(swr_ctx, "in_sample_fmt",      input_codec_ctx->sample_fmt,     0);
-    av_opt_set_chlayout  (swr_ctx, "out_chlayout",      &output_codec_ctx->ch_layout,      0);
-    av_opt_set_int       (swr_ctx, "out_sample_rate",    output_codec_ctx->sample_rate,    0);
-    av_opt_set_sample_fmt(swr_ctx, "out_sample_fmt",     output_codec_ctx->sample_fmt,     0);
+    return resampler_cache.acquire(input_codec_ctx->ch_layout, input_codec_ctx->sample_rate, input_codec_ctx->sample_fmt,
+                                   output_codec_ctx->ch_layout, output_codec_ctx->sample_rate, output_codec_ctx->sample_fmt,
+                                   resampler_profile_options(m_resampler_profile));
 }
 
-void InputStream::set_resampler_options(SwrContext* swr_ctx)
+CachedResampler InputStream::alloc_resampler (AVCodecContext* output_codec_ctx)
 {
     AVChannelLayout default_channel_layout = AV_CHANNEL_LAYOUT_STEREO;
-    av_opt_set_chlayout  (swr_ctx, "out_chlayout",      &default_channel_layout,      0);
-    av_opt_set_sample_fmt(swr_ctx, "out_sample_fmt",     AV_SAMPLE_FMT_FLTP,     0);
-}
-
-void InputStream::set_resampler_options(SwrContext* swr_ctx, AVCodecContext* output_codec_ctx)
-{
-    av_opt_set_chlayout  (swr_ctx, "out_chlayout",      &output_codec_ctx->ch_layout,      0);
-    av_opt_set_int       (swr_ctx, "out_sample_rate",    output_codec_ctx->sample_rate,    0);
-    av_opt_set_sample_fmt(swr_ctx, "out_sample_fmt",     output_codec_ctx->sample_fmt,     0);
-}
-
-
-struct SwrContext* InputStream::alloc_resampler (AVCodecContext* input_codec_ctx, AVCodecContext* output_codec_ctx)
-{
-    /*create the resampling context*/
-    struct SwrContext* swr_ctx = swr_alloc();
-    if (!swr_ctx) {
-        throw "Input: could not allocate a resampler context";
-        
-    }
-
-    
-    set_resampler_options(swr_ctx, input_codec_ctx, output_codec_ctx);
-
-    /* initialize the resampling context */
-    if ((swr_init(swr_ctx)) < 0) 
-    {
-        throw "Input: failed to initialise the resampler context";
-    }
-
-    return swr_ctx;
-
+    return resampler_cache.acquire(default_channel_layout, output_codec_ctx->sample_rate, AV_SAMPLE_FMT_FLTP,
+                                   output_codec_ctx->ch_layout, output_codec_ctx->sample_rate, output_codec_ctx->sample_fmt);
 }
 
-struct SwrContext* InputStream::alloc_resampler (AVCodecContext* output_codec_ctx)
+bool InputStream::is_live() const
 {
-    /*create the resampling context*/
-    struct SwrContext* swr_ctx = swr_alloc();
-    if (!swr_ctx) 
-    {
-        throw "Input: could not allocate a resampler context";       
-    }
-
-    AVChannelLayout default_channel_layout = AV_CHANNEL_LAYOUT_STEREO;
-    av_opt_set_chlayout  (swr_ctx, "in_chlayout",       &default_channel_layout,      0);
-    av_opt_set_int       (swr_ctx, "in_sample_rate",     output_codec_ctx->sample_rate,    0);
-    av_opt_set_sample_fmt(swr_ctx, "in_sample_fmt",      AV_SAMPLE_FMT_FLTP,     0);
-    
-    set_resampler_options(swr_ctx, output_codec_ctx);
-    
-
-    /* initialize the resampling context */
-    if ((swr_init(swr_ctx)) < 0) 
-    {
-        throw "Input: failed to initialise the resampler context";
-    }
-
-    return swr_ctx;
-
+    /*synthesised sources have no format context and nothing to keep up with*/
+    if (!m_format_ctx)
+        return false;
+    return !m_format_ctx->pb || !(m_format_ctx->pb->seekable & AVIO_SEEKABLE_NORMAL);
 }
 
 int InputStream::get_frame_length_milliseconds()
@@ -852,63 +723,3 @@ void InputStream::sleep(std::chrono::_V2::steady_clock::time_point &end_time) co
 {
     fondue_sleep(end_time, m_loop_duration, m_timing_mode);
 }
-
-void InputStream::deepcopy_swr_context(struct SwrContext** dst, struct SwrContext* src)
-{
-    AVChannelLayout in_chlayout{};
-    int64_t in_sample_rate{};
-    AVSampleFormat in_sample_fmt{};
-    AVChannelLayout out_chlayout{};
-    int64_t out_sample_rate{};
-    AVSampleFormat out_sample_fmt{};
-
-    
-    av_opt_get_chlayout(src, "in_chlayout", 0, &in_chlayout);
-    av_opt_get_int(src, "in_sample_rate", 0, &in_sample_rate);
-    av_opt_get_sample_fmt(src, "in_sample_fmt", 0, &in_sample_fmt);
-    av_opt_get_chlayout(src, "out_chlayout", 0, &out_chlayout);
-    av_opt_get_int(src, "out_sample_rate", 0, &out_sample_rate);
-    av_opt_get_sample_fmt(src, "out_sample_fmt", 0, &out_sample_fmt);
-
-    av_opt_set_chlayout  (*dst, "in_chlayout",       &in_chlayout,      0);
-    av_opt_set_int       (*dst, "in_sample_rate",     in_sample_rate,    0);
-    av_opt_set_sample_fmt(*dst, "in_sample_fmt",      in_sample_fmt,     0);
-    av_opt_set_chlayout  (*dst, "out_chlayout",      &out_chlayout,      0);
-    av_opt_set_int       (*dst, "out_sample_rate",    out_sample_rate,    0);
-    av_opt_set_sample_fmt(*dst, "out_sample_fmt",     out_sample_fmt,     0);
-
-}
-
-void InputStream::deepcopy_audio_fifo(AVAudioFifo* src)
-{
-    int queue_length {av_audio_fifo_size(src)};
-    AVFrame* temp_frame = av_frame_alloc();
-    temp_frame->nb_samples = queue_length;
-    temp_frame->sample_rate = m_output_codec_ctx.sample_rate;
-    temp_frame->format = m_output_codec_ctx.sample_fmt;
-    av_frame_get_buffer(temp_frame, 0);
-    av_audio_fifo_peek(src, (void**)temp_frame->data, queue_length);
-    int x {av_audio_fifo_realloc(m_queue, queue_length)};
-    x = av_audio_fifo_write(m_queue, (void**)temp_frame->data, queue_length);
-    av_frame_free(&temp_frame);
-}
-
-void InputStream::deepcopy_frame(AVFrame* &dst, AVFrame* src)
-{
-    av_frame_copy_props(dst, src);
-    dst->nb_samples = src->nb_samples;
-    dst->format = src->format;
-    av_channel_layout_copy(&dst->ch_layout, &src->ch_layout);
-    av_frame_get_buffer(dst, 0);
-    av_frame_copy(dst, src);
-}
-
-
-
-
-
-
-
-
-
-    
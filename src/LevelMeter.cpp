@@ -0,0 +1,434 @@
+#include "LevelMeter.h"
+
+#include<algorithm>
+#include<cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include<emmintrin.h>
+#define LEVEL_METER_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include<arm_neon.h>
+#define LEVEL_METER_NEON
+#endif
+
+LevelMeters level_meters {};
+
+namespace
+{
+    constexpr float s16_scale = 1.0f / 32768.0f;
+    constexpr float s32_scale = 1.0f / 2147483648.0f;
+    constexpr int true_peak_taps = TRUE_PEAK_OVERSAMPLING * TRUE_PEAK_TAPS_PER_PHASE;
+
+    BlockLevels merge(BlockLevels a, const BlockLevels& b)
+    {
+        a.peak = std::max(a.peak, b.peak);
+        a.sum_squares += b.sum_squares;
+        a.clipped += b.clipped;
+        return a;
+    }
+
+    template <typename T>
+    BlockLevels measure_scalar(const T* samples, int nb_samples, int stride, float scale)
+    {
+        BlockLevels levels {};
+        for (int i = 0; i < nb_samples; i++)
+        {
+            float sample = samples[i * stride] * scale;
+            float magnitude = std::fabs(sample);
+            levels.peak = std::max(levels.peak, magnitude);
+            levels.sum_squares += sample * sample;
+            levels.clipped += magnitude >= CLIP_THRESHOLD;
+        }
+        return levels;
+    }
+
+#if defined(LEVEL_METER_SSE2)
+    struct Accumulator
+    {
+        __m128 peak {_mm_setzero_ps()};
+        __m128 sum {_mm_setzero_ps()};
+        __m128i clipped {_mm_setzero_si128()};
+
+        void add(__m128 samples)
+        {
+            __m128 magnitude = _mm_and_ps(samples, _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff)));
+            peak = _mm_max_ps(peak, magnitude);
+            sum = _mm_add_ps(sum, _mm_mul_ps(samples, samples));
+            /*the comparison gives -1 per clipped lane*/
+            clipped = _mm_sub_epi32(clipped, _mm_castps_si128(_mm_cmpge_ps(magnitude, _mm_set1_ps(CLIP_THRESHOLD))));
+        }
+
+        BlockLevels finish() const
+        {
+            alignas(16) float peaks[4];
+            alignas(16) float sums[4];
+            alignas(16) uint32_t clips[4];
+            _mm_store_ps(peaks, peak);
+            _mm_store_ps(sums, sum);
+            _mm_store_si128(reinterpret_cast<__m128i*>(clips), clipped);
+            return {std::max(std::max(peaks[0], peaks[1]), std::max(peaks[2], peaks[3])),
+                    static_cast<double>(sums[0]) + sums[1] + sums[2] + sums[3],
+                    clips[0] + clips[1] + clips[2] + clips[3]};
+        }
+    };
+
+    /*two accumulators to hide the latency of the adds*/
+    BlockLevels measure_float_vector(const float* samples, int nb_samples, int& done)
+    {
+        Accumulator a {}, b {};
+        for (done = 0; done + 8 <= nb_samples; done += 8)
+        {
+            a.add(_mm_loadu_ps(samples + done));
+            b.add(_mm_loadu_ps(samples + done + 4));
+        }
+        return merge(a.finish(), b.finish());
+    }
+
+    BlockLevels measure_s16_vector(const int16_t* samples, int nb_samples, int& done)
+    {
+        Accumulator a {}, b {};
+        const __m128 scale = _mm_set1_ps(s16_scale);
+        for (done = 0; done + 8 <= nb_samples; done += 8)
+        {
+            __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + done));
+            /*sign extend by unpacking into the top half of each lane and shifting down*/
+            __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(packed, packed), 16);
+            __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(packed, packed), 16);
+            a.add(_mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+            b.add(_mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+        }
+        return merge(a.finish(), b.finish());
+    }
+
+    BlockLevels measure_s32_vector(const int32_t* samples, int nb_samples, int& done)
+    {
+        Accumulator a {}, b {};
+        const __m128 scale = _mm_set1_ps(s32_scale);
+        for (done = 0; done + 8 <= nb_samples; done += 8)
+        {
+            a.add(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + done))), scale));
+            b.add(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + done + 4))), scale));
+        }
+        return merge(a.finish(), b.finish());
+    }
+#elif defined(LEVEL_METER_NEON)
+    struct Accumulator
+    {
+        float32x4_t peak {vdupq_n_f32(0)};
+        float32x4_t sum {vdupq_n_f32(0)};
+        uint32x4_t clipped {vdupq_n_u32(0)};
+
+        void add(float32x4_t samples)
+        {
+            float32x4_t magnitude = vabsq_f32(samples);
+            peak = vmaxq_f32(peak, magnitude);
+            sum = vmlaq_f32(sum, samples, samples);
+            /*the comparison gives all ones (-1) per clipped lane*/
+            clipped = vsubq_u32(clipped, vcgeq_f32(magnitude, vdupq_n_f32(CLIP_THRESHOLD)));
+        }
+
+        BlockLevels finish() const
+        {
+            float peaks[4];
+            float sums[4];
+            uint32_t clips[4];
+            vst1q_f32(peaks, peak);
+            vst1q_f32(sums, sum);
+            vst1q_u32(clips, clipped);
+            return {std::max(std::max(peaks[0], peaks[1]), std::max(peaks[2], peaks[3])),
+                    static_cast<double>(sums[0]) + sums[1] + sums[2] + sums[3],
+                    clips[0] + clips[1] + clips[2] + clips[3]};
+        }
+    };
+
+    BlockLevels measure_float_vector(const float* samples, int nb_samples, int& done)
+    {
+        Accumulator a {}, b {};
+        for (done = 0; done + 8 <= nb_samples; done += 8)
+        {
+            a.add(vld1q_f32(samples + done));
+            b.add(vld1q_f32(samples + done + 4));
+        }
+        return merge(a.finish(), b.finish());
+    }
+
+    BlockLevels measure_s16_vector(const int16_t* samples, int nb_samples, int& done)
+    {
+        Accumulator a {}, b {};
+        for (done = 0; done + 8 <= nb_samples; done += 8)
+        {
+            int16x8_t packed = vld1q_s16(samples + done);
+            a.add(vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(packed))), s16_scale));
+            b.add(vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(packed))), s16_scale));
+        }
+        return merge(a.finish(), b.finish());
+    }
+
+    BlockLevels measure_s32_vector(const int32_t* samples, int nb_samples, int& done)
+    {
+        Accumulator a {}, b {};
+        for (done = 0; done + 8 <= nb_samples; done += 8)
+        {
+            a.add(vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(samples + done)), s32_scale));
+            b.add(vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(samples + done + 4)), s32_scale));
+        }
+        return merge(a.finish(), b.finish());
+    }
+#else
+    template <typename T>
+    BlockLevels measure_vector(const T* samples, int nb_samples, int& done, float scale)
+    {
+        done = nb_samples;
+        return measure_scalar(samples, nb_samples, 1, scale);
+    }
+
+    BlockLevels measure_float_vector(const float* samples, int nb_samples, int& done)
+    {
+        return measure_vector(samples, nb_samples, done, 1.0f);
+    }
+
+    BlockLevels measure_s16_vector(const int16_t* samples, int nb_samples, int& done)
+    {
+        return measure_vector(samples, nb_samples, done, s16_scale);
+    }
+
+    BlockLevels measure_s32_vector(const int32_t* samples, int nb_samples, int& done)
+    {
+        return measure_vector(samples, nb_samples, done, s32_scale);
+    }
+#endif
+
+    /*windowed sinc lowpass at the original Nyquist frequency split into phases, each phase normalised
+    * to unity gain at DC. stored tap by tap so all the phases of one tap can be multiplied at once*/
+    std::array<std::array<float, TRUE_PEAK_OVERSAMPLING>, TRUE_PEAK_TAPS_PER_PHASE> make_true_peak_taps()
+    {
+        const double pi = 3.14159265358979323846;
+        std::array<std::array<float, TRUE_PEAK_OVERSAMPLING>, TRUE_PEAK_TAPS_PER_PHASE> taps {};
+
+        for (int phase = 0; phase < TRUE_PEAK_OVERSAMPLING; phase++)
+        {
+            std::array<double, TRUE_PEAK_TAPS_PER_PHASE> coefficients {};
+            double phase_sum {};
+            for (int tap = 0; tap < TRUE_PEAK_TAPS_PER_PHASE; tap++)
+            {
+                int k = tap * TRUE_PEAK_OVERSAMPLING + phase;
+                double t = (k - (true_peak_taps - 1) / 2.0) / TRUE_PEAK_OVERSAMPLING;
+                double sinc = t == 0 ? 1 : std::sin(pi * t) / (pi * t);
+                double window = 0.5 - 0.5 * std::cos(2 * pi * (k + 0.5) / true_peak_taps);
+                coefficients[tap] = sinc * window;
+                phase_sum += coefficients[tap];
+            }
+            for (int tap = 0; tap < TRUE_PEAK_TAPS_PER_PHASE; tap++)
+                taps[tap][phase] = static_cast<float>(coefficients[tap] / phase_sum);
+        }
+        return taps;
+    }
+
+    alignas(16) const auto true_peak_taps_by_phase = make_true_peak_taps();
+
+    /*the largest magnitude of the TRUE_PEAK_OVERSAMPLING interpolated samples, history holds the newest sample first*/
+    float interpolated_peak(const float* history)
+    {
+#if defined(LEVEL_METER_SSE2)
+        __m128 interpolated = _mm_setzero_ps();
+        for (int tap = 0; tap < TRUE_PEAK_TAPS_PER_PHASE; tap++)
+            interpolated = _mm_add_ps(interpolated, _mm_mul_ps(_mm_load_ps(true_peak_taps_by_phase[tap].data()),
+                                                               _mm_set1_ps(history[tap])));
+        alignas(16) float phases[TRUE_PEAK_OVERSAMPLING];
+        _mm_store_ps(phases, _mm_and_ps(interpolated, _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff))));
+#elif defined(LEVEL_METER_NEON)
+        float32x4_t interpolated = vdupq_n_f32(0);
+        for (int tap = 0; tap < TRUE_PEAK_TAPS_PER_PHASE; tap++)
+            interpolated = vmlaq_n_f32(interpolated, vld1q_f32(true_peak_taps_by_phase[tap].data()), history[tap]);
+        float phases[TRUE_PEAK_OVERSAMPLING];
+        vst1q_f32(phases, vabsq_f32(interpolated));
+#else
+        float phases[TRUE_PEAK_OVERSAMPLING] {};
+        for (int tap = 0; tap < TRUE_PEAK_TAPS_PER_PHASE; tap++)
+            for (int phase = 0; phase < TRUE_PEAK_OVERSAMPLING; phase++)
+                phases[phase] += true_peak_taps_by_phase[tap][phase] * history[tap];
+        for (float& phase : phases)
+            phase = std::fabs(phase);
+#endif
+        return std::max(std::max(phases[0], phases[1]), std::max(phases[2], phases[3]));
+    }
+}
+
+namespace level_kernels
+{
+    BlockLevels measure_float_scalar(const float* samples, int nb_samples, int stride)
+    {
+        return measure_scalar(samples, nb_samples, stride, 1.0f);
+    }
+
+    BlockLevels measure_s16_scalar(const int16_t* samples, int nb_samples, int stride)
+    {
+        return measure_scalar(samples, nb_samples, stride, s16_scale);
+    }
+
+    BlockLevels measure_s32_scalar(const int32_t* samples, int nb_samples, int stride)
+    {
+        return measure_scalar(samples, nb_samples, stride, s32_scale);
+    }
+
+    /*the vector loops stop short of the last partial vector, the scalar kernel picks up the rest*/
+    BlockLevels measure_float(const float* samples, int nb_samples)
+    {
+        int done {};
+        BlockLevels levels = measure_float_vector(samples, nb_samples, done);
+        return merge(levels, measure_float_scalar(samples + done, nb_samples - done, 1));
+    }
+
+    BlockLevels measure_s16(const int16_t* samples, int nb_samples)
+    {
+        int done {};
+        BlockLevels levels = measure_s16_vector(samples, nb_samples, done);
+        return merge(levels, measure_s16_scalar(samples + done, nb_samples - done, 1));
+    }
+
+    BlockLevels measure_s32(const int32_t* samples, int nb_samples)
+    {
+        int done {};
+        BlockLevels levels = measure_s32_vector(samples, nb_samples, done);
+        return merge(levels, measure_s32_scalar(samples + done, nb_samples - done, 1));
+    }
+
+    const char* instruction_set()
+    {
+#if defined(LEVEL_METER_SSE2)
+        return "sse2";
+#elif defined(LEVEL_METER_NEON)
+        return "neon";
+#else
+        return "scalar";
+#endif
+    }
+}
+
+template <typename T>
+float TruePeakFilter::process(const T* samples, int nb_samples, int stride, float scale)
+{
+    float peak {};
+    for (int i = 0; i < nb_samples; i++)
+    {
+        m_position = m_position == 0 ? TRUE_PEAK_TAPS_PER_PHASE - 1 : m_position - 1;
+        float sample = samples[i * stride] * scale;
+        m_history[m_position] = sample;
+        m_history[m_position + TRUE_PEAK_TAPS_PER_PHASE] = sample;
+
+        /*newest sample first, matching tap 0 of each phase*/
+        peak = std::max(peak, interpolated_peak(m_history.data() + m_position));
+    }
+    return peak;
+}
+
+template float TruePeakFilter::process<float>(const float*, int, int, float);
+template float TruePeakFilter::process<int16_t>(const int16_t*, int, int, float);
+template float TruePeakFilter::process<int32_t>(const int32_t*, int, int, float);
+
+void TruePeakFilter::reset()
+{
+    m_history.fill(0);
+    m_position = 0;
+}
+
+void LevelMeter::measure(const uint8_t* const* data, int channels, int nb_samples, MeterSampleFormats format, bool planar)
+{
+    channels = std::min(channels, MAX_METER_CHANNELS);
+    bool measure_true_peak = true_peak() && !true_peak_suspended();
+    std::array<BlockLevels, MAX_METER_CHANNELS> levels {};
+    std::array<float, MAX_METER_CHANNELS> true_peaks {};
+    uint32_t clipped {};
+
+    for (int channel = 0; channel < channels; channel++)
+    {
+        /*packed samples are measured a channel at a time with a stride, planar ones get the vector kernels*/
+        const uint8_t* plane = planar ? data[channel] : data[0];
+        int stride = planar ? 1 : channels;
+        TruePeakFilter& filter = m_true_peak_filters[channel];
+
+        switch (+format)
+        {
+            case +MeterSampleFormats::s16:
+            {
+                const int16_t* samples = reinterpret_cast<const int16_t*>(plane) + (planar ? 0 : channel);
+                levels[channel] = planar ? level_kernels::measure_s16(samples, nb_samples) :
+                                           level_kernels::measure_s16_scalar(samples, nb_samples, stride);
+                if (measure_true_peak)
+                    true_peaks[channel] = filter.process(samples, nb_samples, stride, s16_scale);
+                break;
+            }
+            case +MeterSampleFormats::s32:
+            {
+                const int32_t* samples = reinterpret_cast<const int32_t*>(plane) + (planar ? 0 : channel);
+                levels[channel] = planar ? level_kernels::measure_s32(samples, nb_samples) :
+                                           level_kernels::measure_s32_scalar(samples, nb_samples, stride);
+                if (measure_true_peak)
+                    true_peaks[channel] = filter.process(samples, nb_samples, stride, s32_scale);
+                break;
+            }
+            case +MeterSampleFormats::flt:
+            {
+                const float* samples = reinterpret_cast<const float*>(plane) + (planar ? 0 : channel);
+                levels[channel] = planar ? level_kernels::measure_float(samples, nb_samples) :
+                                           level_kernels::measure_float_scalar(samples, nb_samples, stride);
+                if (measure_true_peak)
+                    true_peaks[channel] = filter.process(samples, nb_samples, stride, 1.0f);
+                break;
+            }
+        }
+        clipped += levels[channel].clipped;
+    }
+
+    /*seqlock: readers retry if the sequence is odd or changes while they copy*/
+    uint32_t sequence = m_sequence.load(std::memory_order_relaxed);
+    m_sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    m_channels.store(channels, std::memory_order_relaxed);
+    for (int channel = 0; channel < channels; channel++)
+    {
+        float rms = nb_samples ? static_cast<float>(std::sqrt(levels[channel].sum_squares / nb_samples)) : 0;
+        m_peak[channel].store(levels[channel].peak, std::memory_order_relaxed);
+        m_rms[channel].store(rms, std::memory_order_relaxed);
+        /*the oversampled signal can't be quieter than the samples it was made from*/
+        m_true_peak[channel].store(measure_true_peak ? std::max(true_peaks[channel], levels[channel].peak) : 0,
+                                   std::memory_order_relaxed);
+    }
+    m_clipped.store(m_clipped.load(std::memory_order_relaxed) + clipped, std::memory_order_relaxed);
+    m_frames.store(m_frames.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    m_sequence.store(sequence + 2, std::memory_order_release);
+}
+
+LevelSnapshot LevelMeter::snapshot() const
+{
+    LevelSnapshot snapshot {};
+    while (true)
+    {
+        uint32_t before = m_sequence.load(std::memory_order_acquire);
+        if (before & 1)
+            continue;
+
+        snapshot.channels = m_channels.load(std::memory_order_relaxed);
+        for (int channel = 0; channel < MAX_METER_CHANNELS; channel++)
+        {
+            snapshot.peak[channel] = m_peak[channel].load(std::memory_order_relaxed);
+            snapshot.rms[channel] = m_rms[channel].load(std::memory_order_relaxed);
+            snapshot.true_peak[channel] = m_true_peak[channel].load(std::memory_order_relaxed);
+        }
+        snapshot.clipped = m_clipped.load(std::memory_order_relaxed);
+        snapshot.frames = m_frames.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_sequence.load(std::memory_order_relaxed) == before)
+            return snapshot;
+    }
+}
+
+double level_to_dbfs(float level)
+{
+    if (level <= 0)
+        return METER_FLOOR_DBFS;
+    return std::max(METER_FLOOR_DBFS, 20 * std::log10(static_cast<double>(level)));
+}
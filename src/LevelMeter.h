@@ -0,0 +1,141 @@
+/*
+* Peak, RMS and (optionally) true peak level meters.
+*
+* The kernels are vectorised with SSE2 on x86 and NEON on ARM, with a scalar fallback, and
+* measure planar data directly (packed data is measured one channel at a time with a stride).
+* Each meter is written by one thread, once per frame, and publishes its readings through a
+* seqlock so any number of readers (the control API) can take consistent snapshots at any rate
+* without ever blocking the writer.
+*
+* True peak uses 4x oversampling with a 48 tap polyphase interpolator as described in
+* ITU-R BS.1770 (the four phases of each tap are computed together in one vector), it still
+* costs over thirty times as much as the rest of the meter so it is off unless enabled.
+*
+* Deliberately independent of FFmpeg so the kernels can be benchmarked on their own
+* (bench/level_meter.cpp), see meter_frame() for measuring an AVFrame.
+*/
+
+#ifndef LEVELMETER_H
+#define LEVELMETER_H
+
+#include<array>
+#include<atomic>
+#include<cstdint>
+#include<type_traits>
+
+#define MAX_METER_CHANNELS 8
+/*the vector interpolators compute all the phases of a tap at once, so this has to stay 4*/
+#define TRUE_PEAK_OVERSAMPLING 4
+#define TRUE_PEAK_TAPS_PER_PHASE 12
+/*samples at or above this fraction of full scale are counted as clipped*/
+#define CLIP_THRESHOLD 0.99997f
+/*reported for silence, a little below the noise floor of 24 bit audio*/
+#define METER_FLOOR_DBFS -144.0
+
+enum class MeterSampleFormats {s16, s32, flt};
+
+/*overload the unary + operator to cast the enum class MeterSampleFormats
+* to int for e.g. switch statements*/
+constexpr auto operator+(MeterSampleFormats f) noexcept
+{
+    return static_cast<std::underlying_type_t<MeterSampleFormats>>(f);
+}
+
+/*levels of one channel over one block of samples, full scale is 1*/
+struct BlockLevels
+{
+    float peak {};
+    double sum_squares {};
+    uint32_t clipped {};
+};
+
+/*the kernels, stride is in samples, the vectorised versions need contiguous (stride 1) samples*/
+namespace level_kernels
+{
+    BlockLevels measure_float_scalar(const float* samples, int nb_samples, int stride);
+    BlockLevels measure_s16_scalar(const int16_t* samples, int nb_samples, int stride);
+    BlockLevels measure_s32_scalar(const int32_t* samples, int nb_samples, int stride);
+
+    BlockLevels measure_float(const float* samples, int nb_samples);
+    BlockLevels measure_s16(const int16_t* samples, int nb_samples);
+    BlockLevels measure_s32(const int32_t* samples, int nb_samples);
+
+    /*"sse2", "neon" or "scalar"*/
+    const char* instruction_set();
+}
+
+/*4x oversampling interpolator for one channel, keeps its history between blocks*/
+class TruePeakFilter
+{
+    private:
+        /*each sample is written twice so the newest TRUE_PEAK_TAPS_PER_PHASE are always contiguous*/
+        std::array<float, 2 * TRUE_PEAK_TAPS_PER_PHASE> m_history {};
+        int m_position {};
+
+    public:
+        /*returns the largest magnitude of the oversampled signal over the block*/
+        template <typename T>
+        float process(const T* samples, int nb_samples, int stride, float scale);
+
+        void reset();
+};
+
+struct LevelSnapshot
+{
+    int channels {};
+    std::array<float, MAX_METER_CHANNELS> peak {};
+    std::array<float, MAX_METER_CHANNELS> rms {};
+    /*zero unless true peak metering is enabled*/
+    std::array<float, MAX_METER_CHANNELS> true_peak {};
+    uint64_t clipped {};
+    uint64_t frames {};
+};
+
+class LevelMeter
+{
+    private:
+        /*odd while the writer is part way through publishing*/
+        std::atomic<uint32_t> m_sequence {};
+        std::atomic<int> m_channels {};
+        std::array<std::atomic<float>, MAX_METER_CHANNELS> m_peak {};
+        std::array<std::atomic<float>, MAX_METER_CHANNELS> m_rms {};
+        std::array<std::atomic<float>, MAX_METER_CHANNELS> m_true_peak {};
+        std::atomic<uint64_t> m_clipped {};
+        std::atomic<uint64_t> m_frames {};
+
+        /*writer only*/
+        std::atomic<bool> m_true_peak_enabled {false};
+        std::atomic<bool> m_true_peak_suspended {false};
+        std::array<TruePeakFilter, MAX_METER_CHANNELS> m_true_peak_filters {};
+
+    public:
+        /*data holds one pointer per channel if planar, otherwise one pointer to interleaved samples*/
+        void measure(const uint8_t* const* data, int channels, int nb_samples, MeterSampleFormats format, bool planar);
+
+        /*a consistent copy of the latest readings, never blocks the writer*/
+        LevelSnapshot snapshot() const;
+
+        void set_true_peak(bool enabled) {m_true_peak_enabled.store(enabled, std::memory_order_relaxed);}
+
+        bool true_peak() const {return m_true_peak_enabled.load(std::memory_order_relaxed);}
+
+        /*skips true peak while suspended whatever set_true_peak() said, for the quality governor*/
+        void suspend_true_peak(bool suspended) {m_true_peak_suspended.store(suspended, std::memory_order_relaxed);}
+
+        bool true_peak_suspended() const {return m_true_peak_suspended.load(std::memory_order_relaxed);}
+};
+
+/*the meters on the streaming pipeline: the playing source, a source being crossfaded to and the output*/
+struct LevelMeters
+{
+    LevelMeter playing {};
+    LevelMeter incoming {};
+    LevelMeter output {};
+};
+
+extern LevelMeters level_meters;
+
+/*linear level to dBFS, METER_FLOOR_DBFS for silence*/
+double level_to_dbfs(float level);
+
+#endif
@@ -0,0 +1,237 @@
+#include "Limiter.h"
+
+#include<algorithm>
+#include<cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include<emmintrin.h>
+#define LIMITER_SSE2
+#elif defined(__aarch64__)
+/*32 bit NEON has no vector division*/
+#include<arm_neon.h>
+#define LIMITER_NEON
+#endif
+
+namespace
+{
+    /*the gains aim a hair under the ceiling so float rounding can't take a sample over it*/
+    constexpr float ceiling_margin = 0.99999f;
+}
+
+namespace limiter_kernels
+{
+    void required_gains_scalar(const float* const* channels, int nb_channels, int nb_samples, int stride, float ceiling, float* gains)
+    {
+        for (int i = 0; i < nb_samples; i++)
+        {
+            float peak {};
+            for (int channel = 0; channel < nb_channels; channel++)
+                peak = std::max(peak, std::fabs(channels[channel][i * stride]));
+            gains[i] = peak > ceiling ? ceiling / peak : 1.0f;
+        }
+    }
+
+    void delay_and_scale_scalar(float* samples, float* delay_line, const float* gains, int nb_samples, int stride)
+    {
+        for (int i = 0; i < nb_samples; i++)
+        {
+            float delayed = delay_line[i];
+            delay_line[i] = samples[i * stride];
+            samples[i * stride] = delayed * gains[i];
+        }
+    }
+
+    /*the vector loops stop short of the last partial vector, the scalar kernel picks up the rest*/
+    void required_gains(const float* const* channels, int nb_channels, int nb_samples, float ceiling, float* gains)
+    {
+        int done {};
+#if defined(LIMITER_SSE2)
+        const __m128 magnitude_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        const __m128 ceilings = _mm_set1_ps(ceiling);
+        const __m128 ones = _mm_set1_ps(1.0f);
+        for (; done + 4 <= nb_samples; done += 4)
+        {
+            __m128 peak = _mm_setzero_ps();
+            for (int channel = 0; channel < nb_channels; channel++)
+                peak = _mm_max_ps(peak, _mm_and_ps(_mm_loadu_ps(channels[channel] + done), magnitude_mask));
+            /*silence divides to infinity, which the minimum turns into unity gain*/
+            _mm_storeu_ps(gains + done, _mm_min_ps(ones, _mm_div_ps(ceilings, peak)));
+        }
+#elif defined(LIMITER_NEON)
+        const float32x4_t ceilings = vdupq_n_f32(ceiling);
+        const float32x4_t ones = vdupq_n_f32(1.0f);
+        for (; done + 4 <= nb_samples; done += 4)
+        {
+            float32x4_t peak = vdupq_n_f32(0);
+            for (int channel = 0; channel < nb_channels; channel++)
+                peak = vmaxq_f32(peak, vabsq_f32(vld1q_f32(channels[channel] + done)));
+            vst1q_f32(gains + done, vminq_f32(ones, vdivq_f32(ceilings, peak)));
+        }
+#endif
+        if (done == nb_samples)
+            return;
+
+        std::array<const float*, LIMITER_MAX_CHANNELS> rest {};
+        const int rest_channels = std::min<int>(nb_channels, rest.size());
+        for (int channel = 0; channel < rest_channels; channel++)
+            rest[channel] = channels[channel] + done;
+        required_gains_scalar(rest.data(), rest_channels, nb_samples - done, 1, ceiling, gains + done);
+    }
+
+    void delay_and_scale(float* samples, float* delay_line, const float* gains, int nb_samples)
+    {
+        int done {};
+#if defined(LIMITER_SSE2)
+        for (; done + 4 <= nb_samples; done += 4)
+        {
+            __m128 delayed = _mm_loadu_ps(delay_line + done);
+            _mm_storeu_ps(delay_line + done, _mm_loadu_ps(samples + done));
+            _mm_storeu_ps(samples + done, _mm_mul_ps(delayed, _mm_loadu_ps(gains + done)));
+        }
+#elif defined(LIMITER_NEON)
+        for (; done + 4 <= nb_samples; done += 4)
+        {
+            float32x4_t delayed = vld1q_f32(delay_line + done);
+            vst1q_f32(delay_line + done, vld1q_f32(samples + done));
+            vst1q_f32(samples + done, vmulq_f32(delayed, vld1q_f32(gains + done)));
+        }
+#endif
+        delay_and_scale_scalar(samples + done, delay_line + done, gains + done, nb_samples - done, 1);
+    }
+
+    const char* instruction_set()
+    {
+#if defined(LIMITER_SSE2)
+        return "sse2";
+#elif defined(LIMITER_NEON)
+        return "neon";
+#else
+        return "scalar";
+#endif
+    }
+}
+
+void Limiter::configure(const LimiterSettings& settings, int sample_rate, int channels)
+{
+    m_channels = std::min(channels, LIMITER_MAX_CHANNELS);
+    m_enabled = settings.enabled && m_channels > 0 && sample_rate > 0;
+    m_ceiling = static_cast<float>(std::pow(10.0, std::min(0.0, settings.ceiling_dbfs) / 20)) * ceiling_margin;
+
+    const double lookahead_ms = std::min<double>(LIMITER_MAX_LOOKAHEAD_MS, settings.lookahead_ms);
+    m_delay = std::max(1, static_cast<int>(std::lround(lookahead_ms * sample_rate / 1000)));
+    const double release_samples = std::max(1.0, settings.release_ms * sample_rate / 1000);
+    m_release = static_cast<float>(1 - std::exp(-1 / release_samples));
+
+    m_delay_line.assign(static_cast<std::size_t>(m_channels) * m_delay, 0);
+    m_min_gains.assign(m_delay + 1, 1);
+    m_min_samples.assign(m_delay + 1, 0);
+    m_average_ring.assign(m_delay + 1, 1);
+    reset();
+}
+
+void Limiter::reset()
+{
+    std::fill(m_delay_line.begin(), m_delay_line.end(), 0.0f);
+    m_delay_position = 0;
+    m_min_front = 0;
+    m_min_size = 0;
+    m_sample = 0;
+    m_envelope = 1;
+    std::fill(m_average_ring.begin(), m_average_ring.end(), 1.0f);
+    m_average_position = 0;
+    m_average_sum = static_cast<double>(m_average_ring.size());
+    m_last_reduction_db = 0;
+}
+
+void Limiter::smooth_gains(int nb_samples)
+{
+    const int window = m_delay + 1;
+    float smallest_gain {1};
+
+    for (int i = 0; i < nb_samples; i++)
+    {
+        /*the smallest required gain in the window, from a queue of increasing gains*/
+        if (m_min_size && m_min_samples[m_min_front] <= m_sample - window)
+        {
+            m_min_front = (m_min_front + 1) % window;
+            m_min_size--;
+        }
+        const float required = m_gains[i];
+        while (m_min_size && m_min_gains[(m_min_front + m_min_size - 1) % window] >= required)
+            m_min_size--;
+        const int back = (m_min_front + m_min_size) % window;
+        m_min_gains[back] = required;
+        m_min_samples[back] = m_sample;
+        m_min_size++;
+
+        /*never above the held minimum, so the average can't be either once the peak is reached*/
+        m_envelope = std::min(m_min_gains[m_min_front], m_envelope + (1 - m_envelope) * m_release);
+
+        m_average_sum += m_envelope - m_average_ring[m_average_position];
+        m_average_ring[m_average_position] = m_envelope;
+        m_average_position++;
+        /*resum once per lap so rounding in the running sum can't build up*/
+        if (m_average_position == window)
+        {
+            m_average_position = 0;
+            m_average_sum = 0;
+            for (float envelope : m_average_ring)
+                m_average_sum += envelope;
+        }
+
+        const float gain = std::min(1.0f, static_cast<float>(m_average_sum / window));
+        m_gains[i] = gain;
+        smallest_gain = std::min(smallest_gain, gain);
+        m_limited_samples += gain < 1;
+        m_sample++;
+    }
+
+    if (smallest_gain < 1)
+        m_last_reduction_db = std::max(m_last_reduction_db, static_cast<float>(-20 * std::log10(smallest_gain)));
+}
+
+void Limiter::process_chunk(float* const* channels, int nb_channels, int nb_samples, int stride)
+{
+    if (stride == 1)
+        limiter_kernels::required_gains(channels, nb_channels, nb_samples, m_ceiling, m_gains.data());
+    else
+        limiter_kernels::required_gains_scalar(channels, nb_channels, nb_samples, stride, m_ceiling, m_gains.data());
+    smooth_gains(nb_samples);
+
+    /*each channel's ring in the pieces between its end and the end of the chunk*/
+    for (int channel = 0; channel < nb_channels; channel++)
+    {
+        float* delay_line = m_delay_line.data() + static_cast<std::size_t>(channel) * m_delay;
+        int position = m_delay_position;
+        int done {};
+        while (done < nb_samples)
+        {
+            const int length = std::min(nb_samples - done, m_delay - position);
+            if (stride == 1)
+                limiter_kernels::delay_and_scale(channels[channel] + done, delay_line + position, m_gains.data() + done, length);
+            else
+                limiter_kernels::delay_and_scale_scalar(channels[channel] + done * stride, delay_line + position,
+                                                        m_gains.data() + done, length, stride);
+            done += length;
+            position = (position + length) % m_delay;
+        }
+    }
+    m_delay_position = (m_delay_position + nb_samples) % m_delay;
+}
+
+void Limiter::process(float* const* channels, int nb_channels, int nb_samples, int stride)
+{
+    m_last_reduction_db = 0;
+    if (!m_enabled)
+        return;
+
+    /*channels beyond those configured pass through undelayed*/
+    nb_channels = std::min(nb_channels, m_channels);
+    std::array<float*, LIMITER_MAX_CHANNELS> chunk {};
+    for (int done = 0; done < nb_samples; done += LIMITER_CHUNK_SAMPLES)
+    {
+        for (int channel = 0; channel < nb_channels; channel++)
+            chunk[channel] = channels[channel] + static_cast<std::ptrdiff_t>(done) * stride;
+        process_chunk(chunk.data(), nb_channels, std::min(LIMITER_CHUNK_SAMPLES, nb_samples - done), stride);
+    }
+}
@@ -0,0 +1,112 @@
+/*
+* A lookahead brickwall limiter for the output bus.
+*
+* The output is delayed by the lookahead (a constant latency) so the gain can start coming down
+* before a peak arrives: the gain each sample needs to stay under the ceiling is held at its
+* minimum over the lookahead window and then averaged over the same window, which ramps the gain
+* down smoothly and still reaches the required gain by the time the peak leaves the delay line,
+* so no sample is ever louder than the ceiling. After a peak the gain recovers exponentially with
+* the release time.
+*
+* The per sample required gain (the largest magnitude across the channels against the ceiling) and
+* the delay line (one preallocated ring per channel) are vectorised with SSE2 on x86 and NEON on ARM
+* for planar float samples, packed float samples take a scalar path with a stride. The window
+* minimum, release and average are sequential and stay scalar. Everything is allocated by
+* configure(), process() never allocates.
+*
+* Independent of FFmpeg so it can be benchmarked on its own (bench/limiter.cpp), see limit_frame()
+* for limiting an AVFrame.
+*/
+
+#ifndef LIMITER_H
+#define LIMITER_H
+
+#include<array>
+#include<cstdint>
+#include<vector>
+
+/*samples whose gain is computed at a time, frames larger than this are limited in pieces*/
+#define LIMITER_CHUNK_SAMPLES 1024
+#define LIMITER_MAX_LOOKAHEAD_MS 50
+#define LIMITER_MAX_CHANNELS 8
+
+/*the optional "limiter" section of the config*/
+struct LimiterSettings
+{
+    bool enabled {true};
+    double ceiling_dbfs {-1};
+    /*the latency the limiter adds*/
+    double lookahead_ms {5};
+    double release_ms {150};
+};
+
+/*the kernels, stride is in samples, the vectorised versions need contiguous (stride 1) samples*/
+namespace limiter_kernels
+{
+    /*gains[i] = min(1, ceiling / the largest magnitude of sample i across the channels)*/
+    void required_gains_scalar(const float* const* channels, int nb_channels, int nb_samples, int stride, float ceiling, float* gains);
+    void required_gains(const float* const* channels, int nb_channels, int nb_samples, float ceiling, float* gains);
+
+    /*swaps nb_samples of one channel with the delay line, scaling what comes out by gains*/
+    void delay_and_scale_scalar(float* samples, float* delay_line, const float* gains, int nb_samples, int stride);
+    void delay_and_scale(float* samples, float* delay_line, const float* gains, int nb_samples);
+
+    /*"sse2", "neon" or "scalar"*/
+    const char* instruction_set();
+}
+
+class Limiter
+{
+    private:
+        bool m_enabled {false};
+        float m_ceiling {1};
+        int m_channels {};
+        /*the lookahead in samples, the window is one sample longer*/
+        int m_delay {};
+        float m_release {};
+        /*m_delay samples per channel, one channel after another*/
+        std::vector<float> m_delay_line {};
+        int m_delay_position {};
+        /*monotonic queue of the smallest required gains in the window, a ring of window length*/
+        std::vector<float> m_min_gains {};
+        std::vector<int64_t> m_min_samples {};
+        int m_min_front {};
+        int m_min_size {};
+        int64_t m_sample {};
+        float m_envelope {1};
+        /*the envelope over the window, averaged with a running sum*/
+        std::vector<float> m_average_ring {};
+        int m_average_position {};
+        double m_average_sum {};
+        alignas(16) std::array<float, LIMITER_CHUNK_SAMPLES> m_gains {};
+        float m_last_reduction_db {};
+        uint64_t m_limited_samples {};
+
+        /*turns the required gains of a chunk into the gains applied*/
+        void smooth_gains(int nb_samples);
+
+        void process_chunk(float* const* channels, int nb_channels, int nb_samples, int stride);
+
+    public:
+        /*allocates the delay line and windows, clears any previous state*/
+        void configure(const LimiterSettings& settings, int sample_rate, int channels);
+
+        /*empties the delay line and releases the gain*/
+        void reset();
+
+        /*limits nb_samples of each channel in place, delayed by latency_samples().
+        * channels holds a pointer to each channel's first sample, stride is 1 for planar data or the
+        * channel count for packed data*/
+        void process(float* const* channels, int nb_channels, int nb_samples, int stride);
+
+        bool enabled() const {return m_enabled;}
+
+        int latency_samples() const {return m_enabled ? m_delay : 0;}
+
+        /*the most the gain was reduced in the last call to process(), 0 if it wasn't*/
+        float last_reduction_db() const {return m_last_reduction_db;}
+
+        uint64_t limited_samples() const {return m_limited_samples;}
+};
+
+#endif
@@ -0,0 +1,113 @@
+/*
+* Bounded lock-free queue (Dmitry Vyukov's array based design).
+*
+* Any number of threads may push and pop concurrently; neither operation ever blocks or
+* allocates, a push onto a full queue or a pop from an empty one simply returns false.
+* Each cell carries a sequence number which tells a producer whether the cell is free
+* and a consumer whether it has been filled, so the only contended operation is one
+* compare-exchange on the enqueue (or dequeue) position.
+*
+* T is copied in and out of the cells so it should be small and trivially copyable,
+* e.g. a struct holding an enum and a pointer.
+*/
+
+#ifndef LOCKFREEQUEUE_H
+#define LOCKFREEQUEUE_H
+
+#include<atomic>
+#include<cstddef>
+#include<cstdint>
+#include<type_traits>
+
+template <typename T, std::size_t Capacity>
+class LockFreeQueue
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "LockFreeQueue capacity must be a power of two");
+    static_assert(std::is_trivially_copyable<T>::value, "LockFreeQueue elements must be trivially copyable");
+
+    private:
+        struct Cell
+        {
+            std::atomic<std::size_t> sequence;
+            T data;
+        };
+
+        /*keep the two positions on separate cache lines so producers and the consumer don't false share*/
+        alignas(64) Cell m_cells[Capacity];
+        alignas(64) std::atomic<std::size_t> m_enqueue_position {0};
+        alignas(64) std::atomic<std::size_t> m_dequeue_position {0};
+
+    public:
+        LockFreeQueue()
+        {
+            for (std::size_t i = 0; i < Capacity; i++)
+                m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        LockFreeQueue(const LockFreeQueue&) = delete;
+        LockFreeQueue& operator= (const LockFreeQueue&) = delete;
+
+        /*returns false if the queue is full*/
+        bool push(const T& value)
+        {
+            Cell* cell;
+            std::size_t position = m_enqueue_position.load(std::memory_order_relaxed);
+            while (true)
+            {
+                cell = &m_cells[position & (Capacity - 1)];
+                std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+                if (difference == 0)
+                {
+                    if (m_enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if (difference < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    position = m_enqueue_position.load(std::memory_order_relaxed);
+                }
+            }
+
+            cell->data = value;
+            /*publishes the data to the consumer which acquires the sequence*/
+            cell->sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        /*returns false if the queue is empty*/
+        bool pop(T& value)
+        {
+            Cell* cell;
+            std::size_t position = m_dequeue_position.load(std::memory_order_relaxed);
+            while (true)
+            {
+                cell = &m_cells[position & (Capacity - 1)];
+                std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+                if (difference == 0)
+                {
+                    if (m_dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if (difference < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    position = m_dequeue_position.load(std::memory_order_relaxed);
+                }
+            }
+
+            value = cell->data;
+            /*hands the cell back to the producers one lap later*/
+            cell->sequence.store(position + Capacity, std::memory_order_release);
+            return true;
+        }
+};
+
+#endif
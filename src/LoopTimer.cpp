@@ -0,0 +1,174 @@
+#include "LoopTimer.h"
+
+#include<algorithm>
+#include<cmath>
+#include<iomanip>
+
+LoopTimer loop_timer {};
+
+namespace
+{
+    /*per thread accumulation of the stage times of the current iteration*/
+    thread_local bool timing_attached = false;
+    thread_local std::array<std::chrono::steady_clock::duration, +LoopStages::number_of_stages> pending_durations {};
+    thread_local unsigned pending_stages {};
+}
+
+const char* loop_stage_name(LoopStages stage)
+{
+    switch (stage)
+    {
+        case LoopStages::decode:
+            return "decode";
+        case LoopStages::resample:
+            return "resample";
+        case LoopStages::filter:
+            return "filter";
+        case LoopStages::mix:
+            return "mix";
+        case LoopStages::loudness:
+            return "loudness";
+        case LoopStages::limiter:
+            return "limiter";
+        case LoopStages::encode:
+            return "encode";
+        case LoopStages::mux:
+            return "mux";
+        case LoopStages::sleep_lateness:
+            return "sleep lateness";
+        default:
+            return "unknown";
+    }
+}
+
+void LatencyHistogram::record(std::chrono::nanoseconds duration)
+{
+    uint64_t ns = duration.count() > 0 ? static_cast<uint64_t>(duration.count()) : 0;
+    uint64_t us = ns / 1000;
+
+    /*bucket index is the number of bits needed to represent the duration in microseconds*/
+    int bucket = 0;
+    while (us && bucket < number_of_buckets - 1)
+    {
+        us >>= 1;
+        bucket++;
+    }
+
+    m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_total_ns.fetch_add(ns, std::memory_order_relaxed);
+
+    uint64_t max = m_max_ns.load(std::memory_order_relaxed);
+    while (ns > max && !m_max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+    {
+    }
+}
+
+void LatencyHistogram::reset()
+{
+    for (auto& bucket : m_buckets)
+        bucket.store(0, std::memory_order_relaxed);
+    m_count.store(0, std::memory_order_relaxed);
+    m_total_ns.store(0, std::memory_order_relaxed);
+    m_max_ns.store(0, std::memory_order_relaxed);
+}
+
+double LatencyHistogram::mean_us() const
+{
+    uint64_t count = m_count.load(std::memory_order_relaxed);
+    if (!count)
+        return 0;
+    return m_total_ns.load(std::memory_order_relaxed) / 1e3 / count;
+}
+
+uint64_t LatencyHistogram::percentile_us(double percentile) const
+{
+    uint64_t count = m_count.load(std::memory_order_relaxed);
+    if (!count)
+        return 0;
+
+    /*the largest recorded value is a tighter bound than the top of its bucket*/
+    uint64_t largest_us = static_cast<uint64_t>(std::ceil(max_us()));
+    uint64_t target = static_cast<uint64_t>(std::ceil(percentile / 100.0 * count));
+    uint64_t seen {};
+    for (int i = 0; i < number_of_buckets; i++)
+    {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen >= target)
+            return std::min(bucket_upper_bound_us(i), largest_us);
+    }
+    return largest_us;
+}
+
+void LoopTimer::attach_to_this_thread()
+{
+    timing_attached = true;
+    pending_durations.fill(std::chrono::steady_clock::duration::zero());
+    pending_stages = 0;
+}
+
+bool LoopTimer::attached()
+{
+    return timing_attached;
+}
+
+void LoopTimer::add(LoopStages stage, std::chrono::steady_clock::duration duration)
+{
+    pending_durations[+stage] += duration;
+    pending_stages |= 1u << +stage;
+}
+
+void LoopTimer::end_iteration(bool deadline_missed)
+{
+    if (!timing_attached)
+        return;
+
+    for (int i = 0; i < +LoopStages::number_of_stages; i++)
+    {
+        if (pending_stages & (1u << i))
+        {
+            m_histograms[i].record(std::chrono::duration_cast<std::chrono::nanoseconds>(pending_durations[i]));
+            pending_durations[i] = std::chrono::steady_clock::duration::zero();
+        }
+    }
+    pending_stages = 0;
+
+    m_iterations.fetch_add(1, std::memory_order_relaxed);
+    if (deadline_missed)
+        m_deadline_misses.fetch_add(1, std::memory_order_relaxed);
+}
+
+void LoopTimer::reset()
+{
+    for (auto& histogram : m_histograms)
+        histogram.reset();
+    m_iterations.store(0, std::memory_order_relaxed);
+    m_deadline_misses.store(0, std::memory_order_relaxed);
+}
+
+void LoopTimer::dump(std::ostream& stream) const
+{
+    std::ios_base::fmtflags stream_flags {stream.flags()};
+    std::streamsize stream_precision {stream.precision()};
+    stream << "loop iterations: " << iterations() << ", deadline misses: " << deadline_misses() << '\n';
+    stream << std::left << std::setw(16) << "stage (us)" << std::right
+           << std::setw(10) << "count" << std::setw(10) << "mean"
+           << std::setw(10) << "p50" << std::setw(10) << "p90"
+           << std::setw(10) << "p99" << std::setw(10) << "p99.9"
+           << std::setw(10) << "max" << '\n';
+
+    for (int i = 0; i < +LoopStages::number_of_stages; i++)
+    {
+        const LatencyHistogram& histogram = m_histograms[i];
+        stream << std::left << std::setw(16) << loop_stage_name(static_cast<LoopStages>(i)) << std::right
+               << std::setw(10) << histogram.count()
+               << std::setw(10) << std::fixed << std::setprecision(1) << histogram.mean_us()
+               << std::setw(10) << histogram.percentile_us(50)
+               << std::setw(10) << histogram.percentile_us(90)
+               << std::setw(10) << histogram.percentile_us(99)
+               << std::setw(10) << histogram.percentile_us(99.9)
+               << std::setw(10) << histogram.max_us() << '\n';
+    }
+    stream.flags(stream_flags);
+    stream.precision(stream_precision);
+}
@@ -0,0 +1,132 @@
+/*
+* Per-iteration timing of the audio loop.
+*
+* Each stage of the loop (decode, resample, filter graphs, mix, loudness normalisation, the output
+* limiter, encode, mux and the lateness of the sleep at the end of the loop) is timed with a
+* ScopedStageTimer. Times are summed over one iteration of the loop and committed to a fixed bucket
+* histogram when the iteration ends, so that a stage which runs several times per output frame
+* (e.g. decoding several small input frames) is recorded as a single value.
+*
+* Only the thread which called LoopTimer::attach_to_this_thread() records anything, all
+* other threads pay one thread_local load per timer. Histograms are plain relaxed atomics
+* so they can be read from the control thread while the audio thread is writing.
+*/
+
+#ifndef LOOPTIMER_H
+#define LOOPTIMER_H
+
+#include<atomic>
+#include<array>
+#include<chrono>
+#include<cstdint>
+#include<ostream>
+#include<type_traits>
+
+enum class LoopStages {decode, resample, filter, mix, loudness, limiter, encode, mux, sleep_lateness, number_of_stages};
+
+/*overload the unary + operator to cast the enum class LoopStages
+* to int for e.g. array indexing*/
+constexpr auto operator+(LoopStages s) noexcept
+{
+    return static_cast<std::underlying_type_t<LoopStages>>(s);
+}
+
+const char* loop_stage_name(LoopStages stage);
+
+/*histogram with power of two bucket widths, bucket 0 holds durations below 1us,
+* bucket i holds durations in [2^(i-1), 2^i) microseconds*/
+class LatencyHistogram
+{
+    public:
+        static constexpr int number_of_buckets = 32;
+
+    private:
+        std::array<std::atomic<uint64_t>, number_of_buckets> m_buckets {};
+        std::atomic<uint64_t> m_count {};
+        std::atomic<uint64_t> m_total_ns {};
+        std::atomic<uint64_t> m_max_ns {};
+
+    public:
+        void record(std::chrono::nanoseconds duration);
+
+        void reset();
+
+        uint64_t count() const {return m_count.load(std::memory_order_relaxed);}
+
+        uint64_t bucket_count(int bucket) const {return m_buckets[bucket].load(std::memory_order_relaxed);}
+
+        /*upper bound of the bucket in microseconds*/
+        static uint64_t bucket_upper_bound_us(int bucket) {return uint64_t{1} << bucket;}
+
+        double mean_us() const;
+
+        double max_us() const {return m_max_ns.load(std::memory_order_relaxed) / 1e3;}
+
+        uint64_t total_ns() const {return m_total_ns.load(std::memory_order_relaxed);}
+
+        /*returns the upper bound (in microseconds) of the bucket containing the requested percentile*/
+        uint64_t percentile_us(double percentile) const;
+};
+
+class LoopTimer
+{
+    private:
+        std::array<LatencyHistogram, +LoopStages::number_of_stages> m_histograms {};
+        std::atomic<uint64_t> m_iterations {};
+        std::atomic<uint64_t> m_deadline_misses {};
+
+    public:
+        /*only the calling thread will record stage times from now on*/
+        void attach_to_this_thread();
+
+        /*true if the calling thread is the one being timed*/
+        static bool attached();
+
+        /*accumulate time spent in a stage during the current iteration*/
+        static void add(LoopStages stage, std::chrono::steady_clock::duration duration);
+
+        /*commit the stage times accumulated during this iteration to the histograms*/
+        void end_iteration(bool deadline_missed);
+
+        void reset();
+
+        uint64_t iterations() const {return m_iterations.load(std::memory_order_relaxed);}
+
+        uint64_t deadline_misses() const {return m_deadline_misses.load(std::memory_order_relaxed);}
+
+        const LatencyHistogram& histogram(LoopStages stage) const {return m_histograms[+stage];}
+
+        /*prints a table of per stage latency percentiles*/
+        void dump(std::ostream& stream) const;
+};
+
+/*times the enclosing scope and adds it to the current iteration of the loop timer*/
+class ScopedStageTimer
+{
+    private:
+        LoopStages m_stage;
+        bool m_active;
+        std::chrono::steady_clock::time_point m_start {};
+
+    public:
+        explicit ScopedStageTimer(LoopStages stage):
+            m_stage {stage},
+            m_active {LoopTimer::attached()}
+        {
+            if (m_active)
+                m_start = std::chrono::steady_clock::now();
+        }
+
+        ~ScopedStageTimer()
+        {
+            if (m_active)
+                LoopTimer::add(m_stage, std::chrono::steady_clock::now() - m_start);
+        }
+
+        ScopedStageTimer(const ScopedStageTimer&) = delete;
+        ScopedStageTimer& operator= (const ScopedStageTimer&) = delete;
+};
+
+extern LoopTimer loop_timer;
+
+#endif
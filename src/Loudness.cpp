@@ -0,0 +1,304 @@
+#include "Loudness.h"
+
+#include<algorithm>
+#include<cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include<emmintrin.h>
+#define LOUDNESS_SSE2
+#elif defined(__aarch64__)
+/*32 bit NEON has no double precision vectors*/
+#include<arm_neon.h>
+#define LOUDNESS_NEON
+#endif
+
+LoudnessSettings loudness_settings {};
+
+namespace
+{
+    constexpr float s16_scale = 1.0f / 32768.0f;
+    constexpr float s32_scale = 1.0f / 2147483648.0f;
+    /*filter state below this is flushed to zero at the end of a sub-block, long before it could become denormal*/
+    constexpr double state_floor = 1e-30;
+
+    /*one sample of two channels*/
+#if defined(LOUDNESS_SSE2)
+    using Pair = __m128d;
+
+    inline Pair pair_of(double first, double second) {return _mm_set_pd(second, first);}
+    inline Pair pair_splat(double value) {return _mm_set1_pd(value);}
+    inline Pair pair_add(Pair a, Pair b) {return _mm_add_pd(a, b);}
+    inline Pair pair_sub(Pair a, Pair b) {return _mm_sub_pd(a, b);}
+    inline Pair pair_mul(Pair a, Pair b) {return _mm_mul_pd(a, b);}
+    inline void pair_store(double* out, Pair pair) {_mm_storeu_pd(out, pair);}
+#elif defined(LOUDNESS_NEON)
+    using Pair = float64x2_t;
+
+    inline Pair pair_of(double first, double second) {return vsetq_lane_f64(second, vdupq_n_f64(first), 1);}
+    inline Pair pair_splat(double value) {return vdupq_n_f64(value);}
+    inline Pair pair_add(Pair a, Pair b) {return vaddq_f64(a, b);}
+    inline Pair pair_sub(Pair a, Pair b) {return vsubq_f64(a, b);}
+    inline Pair pair_mul(Pair a, Pair b) {return vmulq_f64(a, b);}
+    inline void pair_store(double* out, Pair pair) {vst1q_f64(out, pair);}
+#else
+    struct Pair
+    {
+        double first, second;
+    };
+
+    inline Pair pair_of(double first, double second) {return {first, second};}
+    inline Pair pair_splat(double value) {return {value, value};}
+    inline Pair pair_add(Pair a, Pair b) {return {a.first + b.first, a.second + b.second};}
+    inline Pair pair_sub(Pair a, Pair b) {return {a.first - b.first, a.second - b.second};}
+    inline Pair pair_mul(Pair a, Pair b) {return {a.first * b.first, a.second * b.second};}
+    inline void pair_store(double* out, Pair pair) {out[0] = pair.first; out[1] = pair.second;}
+#endif
+
+    double power_to_lufs(double power)
+    {
+        return power > 0 ? -0.691 + 10 * std::log10(power) : METER_FLOOR_DBFS;
+    }
+}
+
+KWeighting k_weighting_for_rate(int sample_rate)
+{
+    /*the BS.1770 filters are specified at 48kHz, these are the analogue prototypes they were
+    * made from (as derived for libebur128) bilinear transformed at the actual rate*/
+    const double pi = 3.14159265358979323846;
+    KWeighting filter {};
+
+    double f0 = 1681.974450955533;
+    double gain_db = 3.999843853973347;
+    double q = 0.7071752369554196;
+    double k = std::tan(pi * f0 / sample_rate);
+    double vh = std::pow(10.0, gain_db / 20);
+    double vb = std::pow(vh, 0.4996667741545416);
+    double a0 = 1 + k / q + k * k;
+    filter.shelf = {(vh + vb * k / q + k * k) / a0, 2 * (k * k - vh) / a0, (vh - vb * k / q + k * k) / a0,
+                    2 * (k * k - 1) / a0, (1 - k / q + k * k) / a0};
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = std::tan(pi * f0 / sample_rate);
+    a0 = 1 + k / q + k * k;
+    filter.high_pass = {1, -2, 1, 2 * (k * k - 1) / a0, (1 - k / q + k * k) / a0};
+    return filter;
+}
+
+void LoudnessMeter::configure(int sample_rate, int channels, const std::array<double, MAX_METER_CHANNELS>& weights)
+{
+    m_filter = k_weighting_for_rate(sample_rate);
+    m_channels = std::min(channels, MAX_METER_CHANNELS);
+    m_weights = weights;
+    m_subblock_samples = std::max(1, sample_rate * LOUDNESS_SUBBLOCK_MS / 1000);
+    reset();
+}
+
+void LoudnessMeter::reset()
+{
+    for (auto& state : m_state)
+        state.fill(0);
+    m_subblock_energy.fill(0);
+    m_subblock_position = 0;
+    m_subblock_power.fill(0);
+    m_subblocks = 0;
+    m_gated_power.fill(0);
+    m_gated_blocks.fill(0);
+    m_total_gated_blocks = 0;
+    m_momentary = m_short_term = m_integrated = m_relative_gate = METER_FLOOR_DBFS;
+}
+
+template <typename T>
+void LoudnessMeter::filter_pair(const T* first, const T* second, int stride, int nb_samples, float scale,
+                                int first_channel, int second_channel)
+{
+    const BiquadCoefficients& shelf = m_filter.shelf;
+    const BiquadCoefficients& high_pass = m_filter.high_pass;
+    const Pair shelf_b0 = pair_splat(shelf.b0), shelf_b1 = pair_splat(shelf.b1), shelf_b2 = pair_splat(shelf.b2);
+    const Pair shelf_a1 = pair_splat(shelf.a1), shelf_a2 = pair_splat(shelf.a2);
+    /*the high pass numerator is 1, -2, 1*/
+    const Pair minus_two = pair_splat(-2), high_pass_a1 = pair_splat(high_pass.a1), high_pass_a2 = pair_splat(high_pass.a2);
+
+    std::array<double, 4>& first_state = m_state[first_channel];
+    std::array<double, 4>& second_state = m_state[second_channel];
+    Pair s1 = pair_of(first_state[0], second_state[0]);
+    Pair s2 = pair_of(first_state[1], second_state[1]);
+    Pair h1 = pair_of(first_state[2], second_state[2]);
+    Pair h2 = pair_of(first_state[3], second_state[3]);
+    Pair energy = pair_splat(0);
+
+    /*transposed direct form II, the shelf feeding the high pass*/
+    for (int i = 0; i < nb_samples; i++)
+    {
+        Pair x = pair_of(first[i * stride] * scale, second[i * stride] * scale);
+        Pair y = pair_add(pair_mul(shelf_b0, x), s1);
+        s1 = pair_add(pair_sub(pair_mul(shelf_b1, x), pair_mul(shelf_a1, y)), s2);
+        s2 = pair_sub(pair_mul(shelf_b2, x), pair_mul(shelf_a2, y));
+        Pair z = pair_add(y, h1);
+        h1 = pair_add(pair_sub(pair_mul(minus_two, y), pair_mul(high_pass_a1, z)), h2);
+        h2 = pair_sub(y, pair_mul(high_pass_a2, z));
+        energy = pair_add(energy, pair_mul(z, z));
+    }
+
+    alignas(16) double lanes[2];
+    alignas(16) double state[4][2];
+    pair_store(state[0], s1);
+    pair_store(state[1], s2);
+    pair_store(state[2], h1);
+    pair_store(state[3], h2);
+    pair_store(lanes, energy);
+    for (int i = 0; i < 4; i++)
+        first_state[i] = state[i][0];
+    m_subblock_energy[first_channel] += lanes[0];
+    /*an odd channel out is filtered alongside itself*/
+    if (second_channel != first_channel)
+    {
+        for (int i = 0; i < 4; i++)
+            second_state[i] = state[i][1];
+        m_subblock_energy[second_channel] += lanes[1];
+    }
+}
+
+void LoudnessMeter::measure(const uint8_t* const* data, int channels, int nb_samples, MeterSampleFormats format, bool planar)
+{
+    const int stride = planar ? 1 : channels;
+    channels = std::min(channels, m_channels);
+    int done {};
+    if (!m_subblock_samples)
+        return;
+
+    /*in pieces which end on sub-block boundaries*/
+    while (done < nb_samples)
+    {
+        const int length = std::min(nb_samples - done, m_subblock_samples - m_subblock_position);
+        for (int channel = 0; channel < channels; channel += 2)
+        {
+            const int second = std::min(channel + 1, channels - 1);
+            const uint8_t* first_plane = planar ? data[channel] : data[0];
+            const uint8_t* second_plane = planar ? data[second] : data[0];
+            const int first_offset = (planar ? 0 : channel) + done * stride;
+            const int second_offset = (planar ? 0 : second) + done * stride;
+
+            switch (+format)
+            {
+                case +MeterSampleFormats::s16:
+                    filter_pair(reinterpret_cast<const int16_t*>(first_plane) + first_offset,
+                                reinterpret_cast<const int16_t*>(second_plane) + second_offset,
+                                stride, length, s16_scale, channel, second);
+                    break;
+                case +MeterSampleFormats::s32:
+                    filter_pair(reinterpret_cast<const int32_t*>(first_plane) + first_offset,
+                                reinterpret_cast<const int32_t*>(second_plane) + second_offset,
+                                stride, length, s32_scale, channel, second);
+                    break;
+                case +MeterSampleFormats::flt:
+                    filter_pair(reinterpret_cast<const float*>(first_plane) + first_offset,
+                                reinterpret_cast<const float*>(second_plane) + second_offset,
+                                stride, length, 1.0f, channel, second);
+                    break;
+            }
+        }
+
+        done += length;
+        m_subblock_position += length;
+        if (m_subblock_position == m_subblock_samples)
+            finish_subblock();
+    }
+}
+
+void LoudnessMeter::finish_subblock()
+{
+    double power {};
+    for (int channel = 0; channel < m_channels; channel++)
+    {
+        power += m_weights[channel] * m_subblock_energy[channel] / m_subblock_samples;
+        m_subblock_energy[channel] = 0;
+        for (double& state : m_state[channel])
+            if (std::fabs(state) < state_floor)
+                state = 0;
+    }
+    m_subblock_position = 0;
+    m_subblock_power[m_subblocks % LOUDNESS_SHORT_TERM_SUBBLOCKS] = power;
+    m_subblocks++;
+
+    /*the mean power of the newest sub-blocks*/
+    auto window_power = [this](uint64_t length)
+    {
+        length = std::min<uint64_t>(length, m_subblocks);
+        double sum {};
+        for (uint64_t i = 1; i <= length; i++)
+            sum += m_subblock_power[(m_subblocks - i) % LOUDNESS_SHORT_TERM_SUBBLOCKS];
+        return sum / length;
+    };
+
+    m_short_term = power_to_lufs(window_power(LOUDNESS_SHORT_TERM_SUBBLOCKS));
+    if (m_subblocks < LOUDNESS_MOMENTARY_SUBBLOCKS)
+        return;
+
+    /*every sub-block completes a 400ms gating block overlapping the last by 75%*/
+    const double block_power = window_power(LOUDNESS_MOMENTARY_SUBBLOCKS);
+    m_momentary = power_to_lufs(block_power);
+    if (m_momentary <= LOUDNESS_ABSOLUTE_GATE_LUFS)
+        return;
+
+    const int bin = std::min(LOUDNESS_HISTOGRAM_BINS - 1,
+                             static_cast<int>((m_momentary - LOUDNESS_ABSOLUTE_GATE_LUFS) * LOUDNESS_HISTOGRAM_BINS_PER_LU));
+    m_gated_power[bin] += block_power;
+    m_gated_blocks[bin]++;
+    m_total_gated_blocks++;
+    update_integrated();
+}
+
+void LoudnessMeter::update_integrated()
+{
+    double power {};
+    for (double bin_power : m_gated_power)
+        power += bin_power;
+    m_relative_gate = power_to_lufs(power / m_total_gated_blocks) + LOUDNESS_RELATIVE_GATE_LU;
+
+    /*the blocks above the relative gate, from the bin it falls in*/
+    const int first_bin = std::max(0, static_cast<int>((m_relative_gate - LOUDNESS_ABSOLUTE_GATE_LUFS) * LOUDNESS_HISTOGRAM_BINS_PER_LU));
+    double gated_power {};
+    uint64_t gated_blocks {};
+    for (int bin = first_bin; bin < LOUDNESS_HISTOGRAM_BINS; bin++)
+    {
+        gated_power += m_gated_power[bin];
+        gated_blocks += m_gated_blocks[bin];
+    }
+    m_integrated = gated_blocks ? power_to_lufs(gated_power / gated_blocks) : METER_FLOOR_DBFS;
+}
+
+void LoudnessNormaliser::configure(const LoudnessSettings& settings)
+{
+    m_settings = settings;
+    m_gain_db = 0;
+    m_estimated = false;
+}
+
+double LoudnessNormaliser::update(const LoudnessMeter& meter, int nb_samples, int sample_rate)
+{
+    if (!m_settings.enabled)
+        return 0;
+
+    double loudness {};
+    if (meter.gated_blocks() >= LOUDNESS_SETTLE_BLOCKS)
+        loudness = meter.integrated();
+    else if (meter.subblocks() >= LOUDNESS_MOMENTARY_SUBBLOCKS && meter.short_term() > LOUDNESS_ABSOLUTE_GATE_LUFS)
+        loudness = meter.short_term();
+    /*nothing but silence so far*/
+    else
+        return m_gain_db;
+
+    const double wanted_db = std::min(m_settings.max_gain_db, std::max(-m_settings.max_cut_db, m_settings.target_lufs - loudness));
+    if (!m_estimated)
+    {
+        m_gain_db = wanted_db;
+        m_estimated = true;
+        return m_gain_db;
+    }
+
+    /*first order smoothing, the same time constant whatever the frame size*/
+    const double smoothing_samples = std::max(1.0, m_settings.smoothing_seconds * sample_rate);
+    m_gain_db += (wanted_db - m_gain_db) * (1 - std::exp(-nb_samples / smoothing_samples));
+    return m_gain_db;
+}
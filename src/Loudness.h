@@ -0,0 +1,146 @@
+/*
+* Incremental EBU R128 / ITU-R BS.1770 loudness metering and a gain stage normalising to a target.
+*
+* LoudnessMeter K-weights every channel (the BS.1770 high shelf and high pass biquads, with
+* coefficients recomputed for the sample rate as libebur128 does), sums the weighted mean squares
+* of the channels over 100ms sub-blocks and from those gives the momentary (400ms), short-term (3s)
+* and gated integrated loudness. The filters run in double precision on pairs of channels at once
+* (one SSE2 or AArch64 NEON vector per pair, a scalar fallback elsewhere), so a stereo source is one
+* pass over its samples. Integrated loudness keeps a histogram of the 400ms block loudnesses above
+* the absolute gate in 0.1 LU bins, so it is updated in constant time and memory however long the
+* source plays, to within the bin width of the relative gate.
+*
+* LoudnessNormaliser turns the readings into a gain: the integrated loudness once a few seconds
+* have been gated, the short-term loudness before that, held while the source is below the
+* absolute gate (silence isn't boosted), limited and smoothed so it moves gently.
+*
+* Like LevelMeter this is independent of FFmpeg, see loudness_frame() for measuring an AVFrame.
+* Both are used by the one thread which owns the InputStream they belong to.
+*/
+
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include "LevelMeter.h"
+
+#include<array>
+#include<cstdint>
+
+#define LOUDNESS_SUBBLOCK_MS 100
+/*sub-blocks in the momentary (400ms) and short-term (3s) windows*/
+#define LOUDNESS_MOMENTARY_SUBBLOCKS 4
+#define LOUDNESS_SHORT_TERM_SUBBLOCKS 30
+#define LOUDNESS_ABSOLUTE_GATE_LUFS -70.0
+#define LOUDNESS_RELATIVE_GATE_LU -10.0
+/*0.1 LU bins from the absolute gate up to +10 LUFS*/
+#define LOUDNESS_HISTOGRAM_BINS 800
+#define LOUDNESS_HISTOGRAM_BINS_PER_LU 10
+/*gated 400ms blocks (one per sub-block) before the normaliser trusts the integrated loudness*/
+#define LOUDNESS_SETTLE_BLOCKS 30
+
+/*a biquad's coefficients normalised so a0 is 1*/
+struct BiquadCoefficients
+{
+    double b0 {1}, b1 {}, b2 {};
+    double a1 {}, a2 {};
+};
+
+/*the two stages of the BS.1770 K-weighting filter at one sample rate*/
+struct KWeighting
+{
+    BiquadCoefficients shelf {};
+    BiquadCoefficients high_pass {};
+};
+
+KWeighting k_weighting_for_rate(int sample_rate);
+
+class LoudnessMeter
+{
+    private:
+        KWeighting m_filter {};
+        int m_channels {};
+        /*BS.1770 channel weights, 0 for channels which aren't counted (LFE)*/
+        std::array<double, MAX_METER_CHANNELS> m_weights {};
+        /*the state of both biquads of each channel*/
+        std::array<std::array<double, 4>, MAX_METER_CHANNELS> m_state {};
+        /*sum of squares of each channel's K-weighted samples in the current sub-block*/
+        std::array<double, MAX_METER_CHANNELS> m_subblock_energy {};
+        int m_subblock_samples {};
+        int m_subblock_position {};
+        /*weighted mean square of the latest sub-blocks, a ring*/
+        std::array<double, LOUDNESS_SHORT_TERM_SUBBLOCKS> m_subblock_power {};
+        uint64_t m_subblocks {};
+        /*400ms blocks above the absolute gate by loudness, their power summed and counted*/
+        std::array<double, LOUDNESS_HISTOGRAM_BINS> m_gated_power {};
+        std::array<uint32_t, LOUDNESS_HISTOGRAM_BINS> m_gated_blocks {};
+        uint64_t m_total_gated_blocks {};
+        double m_momentary {METER_FLOOR_DBFS};
+        double m_short_term {METER_FLOOR_DBFS};
+        double m_integrated {METER_FLOOR_DBFS};
+        double m_relative_gate {METER_FLOOR_DBFS};
+
+        template <typename T>
+        void filter_pair(const T* first, const T* second, int stride, int nb_samples, float scale,
+                         int first_channel, int second_channel);
+
+        void finish_subblock();
+
+        void update_integrated();
+
+    public:
+        /*weights holds the weight of each channel, clears any previous measurement*/
+        void configure(int sample_rate, int channels, const std::array<double, MAX_METER_CHANNELS>& weights);
+
+        /*forgets everything measured, keeping the configuration*/
+        void reset();
+
+        /*data holds one pointer per channel if planar, otherwise one pointer to interleaved samples*/
+        void measure(const uint8_t* const* data, int channels, int nb_samples, MeterSampleFormats format, bool planar);
+
+        /*in LUFS, METER_FLOOR_DBFS until there is something to report*/
+        double momentary() const {return m_momentary;}
+        double short_term() const {return m_short_term;}
+        double integrated() const {return m_integrated;}
+        /*the relative gate the integrated loudness was last computed with*/
+        double relative_gate() const {return m_relative_gate;}
+
+        /*100ms sub-blocks measured, and 400ms blocks counted towards the integrated loudness*/
+        uint64_t subblocks() const {return m_subblocks;}
+        uint64_t gated_blocks() const {return m_total_gated_blocks;}
+};
+
+/*the optional "loudness" section of the config*/
+struct LoudnessSettings
+{
+    bool enabled {false};
+    double target_lufs {-23};
+    /*the most a quiet source is boosted and a loud one cut*/
+    double max_gain_db {12};
+    double max_cut_db {24};
+    /*time constant of the gain following the measured loudness*/
+    double smoothing_seconds {3};
+};
+
+/*read when each source is opened, set from the config at startup*/
+extern LoudnessSettings loudness_settings;
+
+class LoudnessNormaliser
+{
+    private:
+        LoudnessSettings m_settings {};
+        double m_gain_db {};
+        bool m_estimated {false};
+
+    public:
+        void configure(const LoudnessSettings& settings);
+
+        /*the gain in dB to reach at the end of the next nb_samples, 0 if normalisation is disabled.
+        * the first reading is taken straight away, sources are normally faded in while it settles*/
+        double update(const LoudnessMeter& meter, int nb_samples, int sample_rate);
+
+        double gain_db() const {return m_gain_db;}
+
+        bool enabled() const {return m_settings.enabled;}
+};
+
+#endif
@@ -0,0 +1,345 @@
+#include "Metrics.h"
+#include "LoopTimer.h"
+#include "FramePool.h"
+#include "ResamplerCache.h"
+#include "DecoderPool.h"
+#include "FilterGraph.h"
+
+#include<cerrno>
+#include<cstring>
+#include<iostream>
+#include<sstream>
+
+#include<arpa/inet.h>
+#include<netinet/in.h>
+#include<poll.h>
+#include<sys/socket.h>
+#include<unistd.h>
+
+MetricsRegistry metrics_registry {};
+
+PipelineMetrics pipeline_metrics {metrics_registry};
+
+Counter& MetricsRegistry::add_counter(const std::string& name, const std::string& help,
+                                      const std::string& labels, double scale)
+{
+    std::lock_guard<std::mutex> lock (m_mtx);
+    m_counters.emplace_back();
+    m_entries.push_back({name, help, labels, scale, &m_counters.back(), nullptr});
+    return m_counters.back();
+}
+
+Gauge& MetricsRegistry::add_gauge(const std::string& name, const std::string& help,
+                                  const std::string& labels, double scale)
+{
+    std::lock_guard<std::mutex> lock (m_mtx);
+    m_gauges.emplace_back();
+    m_entries.push_back({name, help, labels, scale, nullptr, &m_gauges.back()});
+    return m_gauges.back();
+}
+
+void MetricsRegistry::add_collector(Collector collector)
+{
+    std::lock_guard<std::mutex> lock (m_mtx);
+    m_collectors.push_back(std::move(collector));
+}
+
+void MetricsRegistry::render(std::ostream& stream) const
+{
+    std::lock_guard<std::mutex> lock (m_mtx);
+    const std::string* previous_name {};
+
+    for (const Entry& entry : m_entries)
+    {
+        /*metrics sharing a name (with different labels) are registered one after another and share one header*/
+        if (!previous_name || *previous_name != entry.name)
+        {
+            stream << "# HELP " << entry.name << ' ' << entry.help << '\n';
+            stream << "# TYPE " << entry.name << ' ' << (entry.counter ? "counter" : "gauge") << '\n';
+        }
+        previous_name = &entry.name;
+
+        stream << entry.name;
+        if (!entry.labels.empty())
+            stream << '{' << entry.labels << '}';
+        stream << ' ';
+
+        /*unscaled values are written as integers so large counters keep every digit*/
+        if (entry.counter && entry.scale == 1)
+            stream << entry.counter->value() << '\n';
+        else if (entry.counter)
+            stream << entry.counter->value() * entry.scale << '\n';
+        else if (entry.scale == 1)
+            stream << entry.gauge->value() << '\n';
+        else
+            stream << entry.gauge->value() * entry.scale << '\n';
+    }
+
+    for (const Collector& collector : m_collectors)
+        collector(stream);
+}
+
+/*exports the LoopTimer stage histograms as one Prometheus histogram labelled by stage*/
+void render_loop_timer(std::ostream& stream)
+{
+    stream << "# HELP fondue_loop_stage_seconds time spent in each stage of the audio loop per output frame\n";
+    stream << "# TYPE fondue_loop_stage_seconds histogram\n";
+    for (int stage = 0; stage < +LoopStages::number_of_stages; stage++)
+    {
+        const LatencyHistogram& histogram {loop_timer.histogram(static_cast<LoopStages>(stage))};
+        const char* name {loop_stage_name(static_cast<LoopStages>(stage))};
+        uint64_t cumulative {};
+        for (int bucket = 0; bucket < LatencyHistogram::number_of_buckets; bucket++)
+        {
+            cumulative += histogram.bucket_count(bucket);
+            stream << "fondue_loop_stage_seconds_bucket{stage=\"" << name << "\",le=\""
+                   << LatencyHistogram::bucket_upper_bound_us(bucket) / 1e6 << "\"} " << cumulative << '\n';
+        }
+        stream << "fondue_loop_stage_seconds_bucket{stage=\"" << name << "\",le=\"+Inf\"} " << histogram.count() << '\n';
+        stream << "fondue_loop_stage_seconds_sum{stage=\"" << name << "\"} " << histogram.total_ns() / 1e9 << '\n';
+        stream << "fondue_loop_stage_seconds_count{stage=\"" << name << "\"} " << histogram.count() << '\n';
+    }
+
+    stream << "# HELP fondue_loop_iterations_total output frames produced by the audio loop\n";
+    stream << "# TYPE fondue_loop_iterations_total counter\n";
+    stream << "fondue_loop_iterations_total " << loop_timer.iterations() << '\n';
+}
+
+/*the frame pool keeps its own counts, they're read when rendering rather than mirrored into gauges*/
+void render_frame_pool(std::ostream& stream)
+{
+    const FramePoolStats stats {frame_pool.stats()};
+    stream << "# HELP fondue_frame_pool_requests_total audio buffers drawn from the frame pool\n";
+    stream << "# TYPE fondue_frame_pool_requests_total counter\n";
+    stream << "fondue_frame_pool_requests_total{result=\"hit\"} " << stats.hits << '\n';
+    stream << "fondue_frame_pool_requests_total{result=\"miss\"} " << stats.misses << '\n';
+    stream << "# HELP fondue_frame_pool_resident_bytes bytes allocated by the frame pool, in use or idle\n";
+    stream << "# TYPE fondue_frame_pool_resident_bytes gauge\n";
+    stream << "fondue_frame_pool_resident_bytes " << stats.resident_bytes << '\n';
+    stream << "# HELP fondue_frame_pool_resident_buffers buffers allocated by the frame pool, in use or idle\n";
+    stream << "# TYPE fondue_frame_pool_resident_buffers gauge\n";
+    stream << "fondue_frame_pool_resident_buffers " << stats.resident_buffers << '\n';
+}
+
+void render_resampler_cache(std::ostream& stream)
+{
+    const ResamplerCacheStats stats {resampler_cache.stats()};
+    stream << "# HELP fondue_resampler_cache_requests_total resampler contexts requested when opening sources\n";
+    stream << "# TYPE fondue_resampler_cache_requests_total counter\n";
+    stream << "fondue_resampler_cache_requests_total{result=\"hit\"} " << stats.hits << '\n';
+    stream << "fondue_resampler_cache_requests_total{result=\"miss\"} " << stats.misses << '\n';
+    stream << "# HELP fondue_resampler_cache_idle initialised resampler contexts waiting to be reused\n";
+    stream << "# TYPE fondue_resampler_cache_idle gauge\n";
+    stream << "fondue_resampler_cache_idle " << stats.idle << '\n';
+}
+
+/*filter chains are written into label values, which can't hold raw quotes, backslashes or newlines*/
+std::string escape_label_value(const std::string& value)
+{
+    std::string escaped {};
+    for (char c : value)
+    {
+        if (c == '\\' || c == '"')
+            escaped.push_back('\\');
+        if (c == '\n')
+            escaped += "\\n";
+        else
+            escaped.push_back(c);
+    }
+    return escaped;
+}
+
+/*processing time and frames per filter chain, labelled by the chain*/
+void render_filter_graphs(std::ostream& stream)
+{
+    const std::vector<FilterChainStats> chains {filter_graph_cache.stats()};
+    if (chains.empty())
+        return;
+
+    stream << "# HELP fondue_filter_graph_seconds_total time spent filtering in the graphs built from a filter chain\n";
+    stream << "# TYPE fondue_filter_graph_seconds_total counter\n";
+    for (const FilterChainStats& chain : chains)
+        stream << "fondue_filter_graph_seconds_total{chain=\"" << escape_label_value(chain.chain) << "\"} " << chain.processing_ns / 1e9 << '\n';
+    stream << "# HELP fondue_filter_graph_frames_total frames out of the graphs built from a filter chain\n";
+    stream << "# TYPE fondue_filter_graph_frames_total counter\n";
+    for (const FilterChainStats& chain : chains)
+        stream << "fondue_filter_graph_frames_total{chain=\"" << escape_label_value(chain.chain) << "\"} " << chain.frames << '\n';
+    stream << "# HELP fondue_filter_graph_builds_total filter graphs built rather than reused from the cache\n";
+    stream << "# TYPE fondue_filter_graph_builds_total counter\n";
+    for (const FilterChainStats& chain : chains)
+        stream << "fondue_filter_graph_builds_total{chain=\"" << escape_label_value(chain.chain) << "\"} " << chain.builds << '\n';
+}
+
+void render_decoder_pool(std::ostream& stream)
+{
+    const DecoderPoolStats stats {decoder_pool.stats()};
+    stream << "# HELP fondue_decoder_pool_requests_total decoders requested when opening sources\n";
+    stream << "# TYPE fondue_decoder_pool_requests_total counter\n";
+    stream << "fondue_decoder_pool_requests_total{result=\"hit\"} " << stats.hits << '\n';
+    stream << "fondue_decoder_pool_requests_total{result=\"miss\"} " << stats.misses << '\n';
+    stream << "# HELP fondue_decoder_pool_idle opened decoders waiting to be reused\n";
+    stream << "# TYPE fondue_decoder_pool_idle gauge\n";
+    stream << "fondue_decoder_pool_idle " << stats.idle_decoders << '\n';
+}
+
+PipelineMetrics::PipelineMetrics(MetricsRegistry& registry):
+    frames_written {registry.add_counter("fondue_output_frames_total", "frames sent to the encoder")},
+    samples_written {registry.add_counter("fondue_output_samples_total", "samples sent to the encoder")},
+    packets_written {registry.add_counter("fondue_output_packets_total", "encoded packets written to the output")},
+    bytes_written {registry.add_counter("fondue_output_bytes_total", "encoded bytes written to the output")},
+    output_errors {registry.add_counter("fondue_output_errors_total", "errors encoding or writing output packets")},
+    underruns {registry.add_counter("fondue_underruns_total", "output frames produced later than they were due")},
+    source_failures {registry.add_counter("fondue_source_failures_total",
+                                          "sources which failed while playing and were replaced by a default source")},
+    crossfades {registry.add_counter("fondue_crossfades_total", "crossfades completed")},
+    crossfade_failures {registry.add_counter("fondue_crossfade_failures_total",
+                                             "crossfades abandoned because the incoming source failed")},
+    crossfade_us {registry.add_counter("fondue_crossfade_seconds_total", "wall clock time spent crossfading", "", 1e-6)},
+    last_crossfade_us {registry.add_gauge("fondue_last_crossfade_seconds", "wall clock duration of the last crossfade", "", 1e-6)},
+    playing_fifo_depth {registry.add_gauge("fondue_fifo_depth_samples", "samples queued in a source's output queue",
+                                           "source=\"playing\"")},
+    incoming_fifo_depth {registry.add_gauge("fondue_fifo_depth_samples", "samples queued in a source's output queue",
+                                            "source=\"incoming\"")},
+    output_gain_millibels {registry.add_gauge("fondue_output_gain_db", "output gain", "", 1e-2)},
+    output_filter_silent_frames {registry.add_counter("fondue_output_filter_silent_frames_total",
+                                                      "output frames written as silence while the output filters filled a frame")},
+    output_filter_failures {registry.add_counter("fondue_output_filter_failures_total",
+                                                 "output filter graphs removed after an error, the output continues unfiltered")},
+    source_opens {registry.add_counter("fondue_source_opens_total", "sources opened which provided a first frame")},
+    source_open_us {registry.add_counter("fondue_source_open_seconds_total",
+                                         "wall clock time from opening a source to its first output frame", "", 1e-6)},
+    last_source_open_us {registry.add_gauge("fondue_last_source_open_seconds",
+                                            "wall clock time from opening the last source to its first output frame", "", 1e-6)},
+    source_probes {registry.add_counter("fondue_source_probes_total", "background source health checks", "result=\"ok\"")},
+    source_probe_failures {registry.add_counter("fondue_source_probes_total", "background source health checks",
+                                                "result=\"failed\"")},
+    dead_air {registry.add_gauge("fondue_dead_air", "1 while the playing source has been below the dead air threshold too long")},
+    failovers {registry.add_counter("fondue_failovers_total", "switches to a backup source after dead air or a source failure")},
+    failbacks {registry.add_counter("fondue_failbacks_total", "switches back to the primary source once it recovered")},
+    momentary_centilufs {registry.add_gauge("fondue_loudness_lufs", "loudness of the playing source before normalisation",
+                                            "window=\"momentary\"", 1e-2)},
+    short_term_centilufs {registry.add_gauge("fondue_loudness_lufs", "loudness of the playing source before normalisation",
+                                             "window=\"short-term\"", 1e-2)},
+    integrated_centilufs {registry.add_gauge("fondue_loudness_lufs", "loudness of the playing source before normalisation",
+                                             "window=\"integrated\"", 1e-2)},
+    loudness_gain_millibels {registry.add_gauge("fondue_loudness_gain_db", "gain normalising the playing source's loudness", "", 1e-2)},
+    limiter_reduction_millibels {registry.add_gauge("fondue_limiter_gain_reduction_db",
+                                                    "the most the output limiter reduced the gain of the last frame", "", 1e-2)},
+    limited_samples {registry.add_counter("fondue_limited_samples_total", "output samples the limiter turned down")},
+    quality_level {registry.add_gauge("fondue_quality_level",
+                                      "quality steps the governor has applied because the audio thread fell behind")},
+    quality_step_downs {registry.add_counter("fondue_quality_transitions_total", "quality governor level changes",
+                                             "direction=\"down\"")},
+    quality_step_ups {registry.add_counter("fondue_quality_transitions_total", "quality governor level changes",
+                                           "direction=\"up\"")}
+{
+    registry.add_collector(render_loop_timer);
+    registry.add_collector(render_frame_pool);
+    registry.add_collector(render_resampler_cache);
+    registry.add_collector(render_decoder_pool);
+    registry.add_collector(render_filter_graphs);
+}
+
+MetricsServer::MetricsServer(const MetricsRegistry& registry, int port):
+    m_registry {registry}
+{
+    m_listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_listen_fd < 0)
+        throw "Metrics: could not create socket";
+
+    int reuse = 1;
+    setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    /*loopback only, put a reverse proxy in front to scrape from elsewhere*/
+    struct sockaddr_in address {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(m_listen_fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0 ||
+        listen(m_listen_fd, 16) < 0)
+    {
+        close(m_listen_fd);
+        throw "Metrics: could not listen on the metrics port";
+    }
+}
+
+MetricsServer::~MetricsServer()
+{
+    stop();
+    if (m_listen_fd >= 0)
+        close(m_listen_fd);
+}
+
+void MetricsServer::start()
+{
+    m_thread = std::thread {&MetricsServer::run, this};
+}
+
+void MetricsServer::stop()
+{
+    m_stop = true;
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void MetricsServer::run()
+{
+    while (!m_stop)
+    {
+        /*wake up regularly to notice stop()*/
+        struct pollfd listen_poll {m_listen_fd, POLLIN, 0};
+        if (poll(&listen_poll, 1, 200) <= 0)
+            continue;
+
+        int client_fd = accept4(m_listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client_fd < 0)
+            continue;
+        serve_client(client_fd);
+        close(client_fd);
+    }
+}
+
+void MetricsServer::serve_client(int client_fd)
+{
+    /*a scraper sends a small GET request, read until the end of the headers or give up after a second*/
+    std::string request {};
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192)
+    {
+        struct pollfd client_poll {client_fd, POLLIN, 0};
+        if (poll(&client_poll, 1, 1000) <= 0)
+            return;
+        ssize_t nread = read(client_fd, buffer, sizeof(buffer));
+        if (nread <= 0)
+            return;
+        request.append(buffer, nread);
+    }
+
+    std::ostringstream body {};
+    std::string status {"200 OK"};
+    if (request.compare(0, 4, "GET ") == 0)
+        m_registry.render(body);
+    else
+        status = "405 Method Not Allowed";
+
+    std::string body_string {body.str()};
+    std::ostringstream response {};
+    response << "HTTP/1.1 " << status << "\r\n"
+             << "Content-Type: text/plain; version=0.0.4\r\n"
+             << "Content-Length: " << body_string.size() << "\r\n"
+             << "Connection: close\r\n\r\n"
+             << body_string;
+
+    std::string response_string {response.str()};
+    std::size_t written {};
+    while (written < response_string.size())
+    {
+        ssize_t ret = send(client_fd, response_string.data() + written, response_string.size() - written, MSG_NOSIGNAL);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return;
+        written += ret;
+    }
+}
@@ -0,0 +1,174 @@
+/*
+* Metrics for the streaming pipeline, exported in the Prometheus text format.
+*
+* Counters and gauges are single relaxed atomics: updating one from the audio thread is one
+* atomic add or store, with no locks and no allocation. All metrics are registered once at
+* startup (names, help text and labels live in the registry, never in the hot path) and the
+* registry renders them on demand, along with the per stage loop timing histograms from
+* LoopTimer.
+*
+* MetricsServer answers HTTP GET requests on a loopback port with the rendered metrics, one
+* request at a time on its own thread.
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include<atomic>
+#include<cstdint>
+#include<deque>
+#include<functional>
+#include<mutex>
+#include<ostream>
+#include<string>
+#include<thread>
+#include<vector>
+
+#define DEFAULT_METRICS_PORT 9464
+
+class Counter
+{
+    private:
+        std::atomic<uint64_t> m_value {};
+
+    public:
+        void add(uint64_t amount = 1) {m_value.fetch_add(amount, std::memory_order_relaxed);}
+
+        uint64_t value() const {return m_value.load(std::memory_order_relaxed);}
+};
+
+class Gauge
+{
+    private:
+        std::atomic<int64_t> m_value {};
+
+    public:
+        void set(int64_t value) {m_value.store(value, std::memory_order_relaxed);}
+
+        void add(int64_t amount) {m_value.fetch_add(amount, std::memory_order_relaxed);}
+
+        int64_t value() const {return m_value.load(std::memory_order_relaxed);}
+};
+
+class MetricsRegistry
+{
+    public:
+        /*writes extra samples (e.g. histograms kept elsewhere) during render()*/
+        using Collector = std::function<void(std::ostream&)>;
+
+    private:
+        struct Entry
+        {
+            std::string name;
+            std::string help;
+            std::string labels;
+            /*multiplies the stored integer, e.g. 1e-6 to export microseconds as seconds*/
+            double scale;
+            const Counter* counter;
+            const Gauge* gauge;
+        };
+
+        /*deques so references handed out stay valid as more metrics are registered*/
+        std::deque<Counter> m_counters {};
+        std::deque<Gauge> m_gauges {};
+        std::vector<Entry> m_entries {};
+        std::vector<Collector> m_collectors {};
+        mutable std::mutex m_mtx;
+
+    public:
+        /*labels are written as is e.g. source="playing"*/
+        Counter& add_counter(const std::string& name, const std::string& help,
+                             const std::string& labels = "", double scale = 1);
+
+        Gauge& add_gauge(const std::string& name, const std::string& help,
+                         const std::string& labels = "", double scale = 1);
+
+        void add_collector(Collector collector);
+
+        /*writes every metric in the Prometheus text exposition format*/
+        void render(std::ostream& stream) const;
+};
+
+extern MetricsRegistry metrics_registry;
+
+/*the metrics updated by the streaming pipeline*/
+struct PipelineMetrics
+{
+    Counter& frames_written;
+    Counter& samples_written;
+    Counter& packets_written;
+    Counter& bytes_written;
+    Counter& output_errors;
+    /*loop iterations which didn't finish before their frame was due*/
+    Counter& underruns;
+    /*sources that failed while playing and were replaced by a default source*/
+    Counter& source_failures;
+    Counter& crossfades;
+    Counter& crossfade_failures;
+    Counter& crossfade_us;
+    Gauge& last_crossfade_us;
+    /*samples waiting in the output sized queue of the playing and incoming sources*/
+    Gauge& playing_fifo_depth;
+    Gauge& incoming_fifo_depth;
+    Gauge& output_gain_millibels;
+    /*frames written as silence because the output filters hadn't produced one*/
+    Counter& output_filter_silent_frames;
+    /*output filter graphs taken out of the path after an error*/
+    Counter& output_filter_failures;
+    /*time from opening a source to its first output frame*/
+    Counter& source_opens;
+    Counter& source_open_us;
+    Gauge& last_source_open_us;
+    /*background health checks of sources which aren't playing*/
+    Counter& source_probes;
+    Counter& source_probe_failures;
+    /*1 while the playing source has dead air*/
+    Gauge& dead_air;
+    Counter& failovers;
+    /*switches back to the primary once it recovered*/
+    Counter& failbacks;
+    /*the playing source's loudness in hundredths of a LU and the gain normalising it*/
+    Gauge& momentary_centilufs;
+    Gauge& short_term_centilufs;
+    Gauge& integrated_centilufs;
+    Gauge& loudness_gain_millibels;
+    /*the most the output limiter turned the last frame down and the samples it has turned down*/
+    Gauge& limiter_reduction_millibels;
+    Counter& limited_samples;
+    /*the quality governor's level (0 is full quality) and its steps down and back up*/
+    Gauge& quality_level;
+    Counter& quality_step_downs;
+    Counter& quality_step_ups;
+
+    PipelineMetrics(MetricsRegistry& registry);
+};
+
+extern PipelineMetrics pipeline_metrics;
+
+/*serves the rendered registry over HTTP on a loopback port*/
+class MetricsServer
+{
+    private:
+        const MetricsRegistry& m_registry;
+        int m_listen_fd {-1};
+        std::atomic<bool> m_stop {false};
+        std::thread m_thread;
+
+        void run();
+        void serve_client(int client_fd);
+
+    public:
+        /*binds 127.0.0.1:port, throws a const char* exception on failure*/
+        MetricsServer(const MetricsRegistry& registry, int port);
+
+        ~MetricsServer();
+
+        MetricsServer(const MetricsServer&) = delete;
+        MetricsServer& operator= (const MetricsServer&) = delete;
+
+        void start();
+
+        void stop();
+};
+
+#endif
@@ -1,5 +1,16 @@
 #include "Fonduempeg.h"
 
+namespace
+{
+    /*the number of samples in every frame the sources make for this encoder, as InputStream::alloc_frame works it out*/
+    int output_frame_size(const AVCodecContext& output_codec_ctx)
+    {
+        if (output_codec_ctx.codec && (output_codec_ctx.codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE))
+            return DEFAULT_FRAME_SIZE;
+        return output_codec_ctx.frame_size;
+    }
+}
+
 OutputStream::OutputStream(std::string destination_url, AVDictionary* output_options, 
             int sample_rate, int bit_rate):
 
@@ -66,8 +77,20 @@ OutputStream::OutputStream(std::string destination_url, AVDictionary* output_opt
    
         int i;
 
-        m_output_codec_context->sample_fmt  =output_codec->sample_fmts ?
+        /*prefer a float format, so everything upstream of the encoder (the mix, the gains and the
+        * limiter) can go over full scale without clipping, the limiter brings it back under*/
+        m_output_codec_context->sample_fmt = output_codec->sample_fmts ?
             output_codec->sample_fmts[0] : AV_SAMPLE_FMT_FLTP;
+        for (i = 0; output_codec->sample_fmts && output_codec->sample_fmts[i] != AV_SAMPLE_FMT_NONE; i++)
+        {
+            if (output_codec->sample_fmts[i] == AV_SAMPLE_FMT_FLTP)
+            {
+                m_output_codec_context->sample_fmt = AV_SAMPLE_FMT_FLTP;
+                break;
+            }
+            if (output_codec->sample_fmts[i] == AV_SAMPLE_FMT_FLT)
+                m_output_codec_context->sample_fmt = AV_SAMPLE_FMT_FLT;
+        }
         m_output_codec_context->bit_rate    = m_bit_rate;
         m_output_codec_context->sample_rate = DEFAULT_SAMPLE_RATE;
         if (output_codec->supported_samplerates) 
@@ -82,6 +105,18 @@ OutputStream::OutputStream(std::string destination_url, AVDictionary* output_opt
         av_channel_layout_copy(&m_output_codec_context->ch_layout, &default_channel_layout);
         m_audio_stream->time_base = (AVRational){ 1, m_output_codec_context->sample_rate };
  
+        /*encoders which accept our own packet buffers (AV_CODEC_CAP_DR1) get them from a pool,
+        * so encoding a frame doesn't allocate a fresh buffer for every packet*/
+        if (output_codec->capabilities & AV_CODEC_CAP_DR1)
+        {
+            m_packet_pool = av_buffer_pool_init(OUTPUT_PACKET_POOL_BYTES, NULL);
+            if (m_packet_pool)
+            {
+                m_output_codec_context->opaque = m_packet_pool;
+                m_output_codec_context->get_encoder_buffer = pooled_encoder_buffer;
+            }
+        }
+
         /* Some formats want stream headers to be separate. */
         if (m_output_format_context->oformat->flags & AVFMT_GLOBALHEADER)
         {
@@ -129,6 +164,19 @@ OutputStream::OutputStream(std::string destination_url, AVDictionary* output_opt
         fprintf(stderr, "Error occurred when opening output file\n");
     }
 
+    /*the frames the output filters need, allocated now so swapping filters in never allocates on the audio thread*/
+    m_filtered_frame.reset(av_frame_alloc());
+    m_bus_frame.reset(av_frame_alloc());
+    if (m_bus_frame && m_output_codec_context && output_frame_size(*m_output_codec_context))
+    {
+        m_bus_frame->format = m_output_codec_context->sample_fmt;
+        m_bus_frame->sample_rate = m_output_codec_context->sample_rate;
+        av_channel_layout_copy(&m_bus_frame->ch_layout, &m_output_codec_context->ch_layout);
+        m_bus_frame->nb_samples = output_frame_size(*m_output_codec_context);
+        if (frame_pool.get_buffer(m_bus_frame.get()) < 0)
+            fprintf(stderr, "Could not allocate the output filters' frame\n");
+    }
+
 }
 
 
@@ -143,31 +191,169 @@ OutputStream::~OutputStream()
     avformat_free_context(m_output_format_context);
     avcodec_free_context(&m_output_codec_context);
     av_packet_free(&m_pkt);
+    /*the pool is freed once the last packet taken from it has been released*/
+    av_buffer_pool_uninit(&m_packet_pool);
+}
+
+int pooled_encoder_buffer(AVCodecContext* codec_context, AVPacket* pkt, int flags)
+{
+    if (pkt->size + AV_INPUT_BUFFER_PADDING_SIZE > OUTPUT_PACKET_POOL_BYTES)
+        return avcodec_default_get_encoder_buffer(codec_context, pkt, flags);
+
+    pkt->buf = av_buffer_pool_get(static_cast<AVBufferPool*>(codec_context->opaque));
+    if (!pkt->buf)
+        return AVERROR(ENOMEM);
+    pkt->data = pkt->buf->data;
+    return 0;
 }
 
 int OutputStream::write_frame(InputStream& source)
 {
     /*ensure this.m_frame stores the address of the same frame as source.m_frame*/
     m_frame = source.get_frame();
+    /*the quality governor bypasses the filters when the audio thread falls behind*/
+    if (m_filter_graph && !quality_governor.degraded(QualitySteps::filters))
+        m_frame = filter_frame(m_frame);
     /*make sure the frame has the correct pts [performance time stamp]*/
     m_frame->pts = av_rescale_q(m_samples_count, (AVRational){1, m_output_codec_context->sample_rate},
                                 m_output_codec_context->time_base);
     m_samples_count += m_frame -> nb_samples;
+    pipeline_metrics.frames_written.add();
+    pipeline_metrics.samples_written.add(m_frame->nb_samples);
+
+    if (m_gain != 1 || m_applied_gain != 1)
+    {
+        apply_gain(m_frame, m_applied_gain, m_gain);
+        m_applied_gain = m_gain;
+    }
+    if (m_limiter.enabled())
+    {
+        ScopedStageTimer limiter_timer {LoopStages::limiter};
+        limit_frame(m_limiter, m_frame);
+        pipeline_metrics.limiter_reduction_millibels.set(std::lround(m_limiter.last_reduction_db() * 100));
+        pipeline_metrics.limited_samples.add(m_limiter.limited_samples() - m_limited_samples);
+        m_limited_samples = m_limiter.limited_samples();
+    }
+    meter_frame(level_meters.output, m_frame);
+
+    return encode_frame(m_frame);
+}
+
+AVFrame* OutputStream::filter_frame(AVFrame* frame)
+{
+    ScopedStageTimer filter_timer {LoopStages::filter};
+    FONDUE_TRACE_SPAN("output filter graph");
+    av_frame_unref(m_filtered_frame.get());
+
+    /*the source keeps its frame, the graph gets another reference to the same buffers*/
+    int ret = m_filter_graph->send(frame, true);
+    if (ret >= 0)
+        ret = m_filter_graph->receive(m_filtered_frame.get());
+
+    if (ret >= 0)
+    {
+        /*the gain and the limiter work in place. a filter which passed the source's buffers straight through
+        * (e.g. anull) leaves them shared, they're copied into the sink's own frame rather than reallocated*/
+        AVFrame* filtered = m_filtered_frame.get();
+        if (av_frame_is_writable(filtered))
+            return filtered;
+        if (m_bus_frame->buf[0] && filtered->nb_samples <= output_frame_size(*m_output_codec_context)
+            && av_frame_make_writable(m_bus_frame.get()) >= 0)
+        {
+            m_bus_frame->nb_samples = filtered->nb_samples;
+            if (av_frame_copy(m_bus_frame.get(), filtered) >= 0)
+            {
+                av_frame_unref(filtered);
+                return m_bus_frame.get();
+            }
+        }
+        if (av_frame_make_writable(filtered) >= 0)
+            return filtered;
+    }
+    else if (ret != AVERROR(EAGAIN))
+    {
+        /*a graph which fails won't recover, the output goes on unfiltered and the graph is handed back to
+        * the control side (see take_failed_filter_graph())*/
+        pipeline_metrics.output_filter_failures.add();
+        m_failed_filter_graph = std::move(m_filter_graph);
+        m_filter_error = ret;
+        return frame;
+    }
+
+    /*the filters are still filling their first frame, silence keeps the output clock going*/
+    pipeline_metrics.output_filter_silent_frames.add();
+    if (!m_bus_frame->buf[0] || av_frame_make_writable(m_bus_frame.get()) < 0)
+        return frame;
+    m_bus_frame->nb_samples = std::min(frame->nb_samples, output_frame_size(*m_output_codec_context));
+    av_samples_set_silence(m_bus_frame->extended_data, 0, m_bus_frame->nb_samples, m_bus_frame->ch_layout.nb_channels,
+                           static_cast<AVSampleFormat>(m_bus_frame->format));
+    return m_bus_frame.get();
+}
+
+CachedFilterGraph OutputStream::take_failed_filter_graph(int& error)
+{
+    error = m_filter_error;
+    return std::move(m_failed_filter_graph);
+}
+
+CachedFilterGraph OutputStream::set_filter_graph(CachedFilterGraph filter_graph)
+{
+    std::swap(m_filter_graph, filter_graph);
+    return filter_graph;
+}
+
+CachedFilterGraph output_filter_graph(const std::string& chain, const AVCodecContext& output_codec_ctx)
+{
+    return filter_graph_cache.acquire(chain, output_codec_ctx.ch_layout, output_codec_ctx.sample_rate, output_codec_ctx.sample_fmt,
+                                      output_frame_size(output_codec_ctx));
+}
 
-    m_ret = avcodec_send_frame(m_output_codec_context, m_frame);
+void OutputStream::set_limiter(const LimiterSettings& settings)
+{
+    const AVSampleFormat format = m_output_codec_context->sample_fmt;
+    if (settings.enabled && av_get_packed_sample_fmt(format) != AV_SAMPLE_FMT_FLT)
+    {
+        std::cout << "limiter: the encoder takes " << av_get_sample_fmt_name(format)
+                  << " samples, only float samples can be limited, limiter off\n";
+        m_limiter.configure(LimiterSettings {false}, m_output_codec_context->sample_rate, 0);
+        return;
+    }
+
+    m_limiter.configure(settings, m_output_codec_context->sample_rate, m_output_codec_context->ch_layout.nb_channels);
+    if (m_limiter.enabled())
+        std::cout << "limiter: ceiling " << settings.ceiling_dbfs << " dBFS, adds " << m_limiter.latency_samples()
+                  << " samples (" << 1000.0 * m_limiter.latency_samples() / m_output_codec_context->sample_rate
+                  << " ms) of latency\n";
+}
+
+int OutputStream::encode_frame(AVFrame* frame)
+{
+    {
+        ScopedStageTimer encode_timer {LoopStages::encode};
+        FONDUE_TRACE_SPAN("avcodec_send_frame");
+        FONDUE_ALLOC_SCOPE(AllocScopes::libav);
+        m_ret = avcodec_send_frame(m_output_codec_context, frame);
+    }
 
     if (m_ret < 0) 
     {
+        pipeline_metrics.output_errors.add();
         fprintf(stderr, "Error sending a frame to the encoder: %s\n",
                 av_error_to_string(m_ret));
     }
 
     while (m_ret >= 0) 
     {
-        m_ret = avcodec_receive_packet(m_output_codec_context, m_pkt);
+        {
+            ScopedStageTimer encode_timer {LoopStages::encode};
+            FONDUE_TRACE_SPAN("avcodec_receive_packet");
+            FONDUE_ALLOC_SCOPE(AllocScopes::libav);
+            m_ret = avcodec_receive_packet(m_output_codec_context, m_pkt);
+        }
         if (m_ret == AVERROR(EAGAIN) || m_ret == AVERROR_EOF)
             break;
         else if (m_ret < 0) {
+            pipeline_metrics.output_errors.add();
             fprintf(stderr, "Error encoding a frame: %s\n", av_error_to_string(m_ret));
         }
  
@@ -175,12 +361,21 @@ int OutputStream::write_frame(InputStream& source)
         av_packet_rescale_ts(m_pkt, m_output_codec_context->time_base, m_audio_stream->time_base);
         m_pkt->stream_index = m_audio_stream->index;
  
+        pipeline_metrics.packets_written.add();
+        pipeline_metrics.bytes_written.add(m_pkt->size);
+
         /* Write the compressed frame to the media file. */
-        m_ret = av_interleaved_write_frame(m_output_format_context, m_pkt);
+        {
+            ScopedStageTimer mux_timer {LoopStages::mux};
+            FONDUE_TRACE_SPAN("av_interleaved_write_frame");
+            FONDUE_ALLOC_SCOPE(AllocScopes::libav);
+            m_ret = av_interleaved_write_frame(m_output_format_context, m_pkt);
+        }
         /* pkt is now blank (av_interleaved_write_frame() takes ownership of
          * its contents and resets pkt), so that no unreferencing is necessary.
          * This would be different if one used av_write_frame(). */
         if (m_ret < 0) {
+            pipeline_metrics.output_errors.add();
             fprintf(stderr, "Error while writing output packet: %s\n", av_error_to_string(m_ret));
         }
     }
@@ -191,6 +386,14 @@ int OutputStream::write_frame(InputStream& source)
 
 void OutputStream::finish_streaming()
 {
+    /*drain any samples still buffered in the encoder and finish the container*/
+    encode_frame(NULL);
+    m_ret = av_write_trailer(m_output_format_context);
+    if (m_ret < 0)
+    {
+        fprintf(stderr, "Error writing the trailer: %s\n", av_error_to_string(m_ret));
+    }
+
     if (!(m_output_format->flags & AVFMT_NOFILE))
         /* Close the output file. */
         avio_closep(&m_output_format_context->pb);
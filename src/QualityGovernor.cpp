@@ -0,0 +1,115 @@
+#include "QualityGovernor.h"
+#include "LevelMeter.h"
+
+#include<algorithm>
+
+QualityGovernor quality_governor {};
+
+namespace
+{
+    const std::array<const char*, +QualitySteps::number_of_steps> step_names {"true peak", "resampler", "filters"};
+}
+
+const char* quality_step_name(QualitySteps step)
+{
+    return step_names[+step];
+}
+
+bool parse_quality_step(const std::string& name, QualitySteps& step)
+{
+    for (std::size_t i = 0; i < step_names.size(); i++)
+    {
+        if (name == step_names[i])
+        {
+            step = static_cast<QualitySteps>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void QualityGovernor::configure(const QualityGovernorSettings& settings)
+{
+    m_settings = settings;
+    m_settings.window_frames = std::max(1, m_settings.window_frames);
+    m_settings.misses_to_step_down = std::max(1, m_settings.misses_to_step_down);
+    m_settings.recovery_windows = std::max(1, m_settings.recovery_windows);
+
+    /*each step once, in the order first given*/
+    std::vector<QualitySteps> steps {};
+    uint32_t configured {};
+    for (QualitySteps step : m_settings.steps)
+    {
+        if (!(configured & (1u << +step)))
+            steps.push_back(step);
+        configured |= 1u << +step;
+    }
+    m_settings.steps = steps;
+
+    m_frames = 0;
+    m_misses = 0;
+    m_load_sum = 0;
+    m_good_windows = 0;
+    m_enabled.store(m_settings.enabled && !steps.empty(), std::memory_order_relaxed);
+    m_configured.store(enabled() ? configured : 0, std::memory_order_relaxed);
+    m_max_level.store(static_cast<int>(steps.size()), std::memory_order_relaxed);
+    apply_level(0);
+}
+
+void QualityGovernor::apply_level(int level)
+{
+    uint32_t degraded {};
+    for (int i = 0; i < level; i++)
+        degraded |= 1u << +m_settings.steps[i];
+    m_degraded.store(degraded, std::memory_order_relaxed);
+    m_level.store(level, std::memory_order_relaxed);
+
+    const bool suspend_true_peak = degraded & (1u << +QualitySteps::true_peak);
+    level_meters.playing.suspend_true_peak(suspend_true_peak);
+    level_meters.incoming.suspend_true_peak(suspend_true_peak);
+    level_meters.output.suspend_true_peak(suspend_true_peak);
+}
+
+QualityTransitions QualityGovernor::end_frame(double load, bool deadline_missed)
+{
+    if (!enabled())
+        return QualityTransitions::none;
+
+    m_frames++;
+    m_misses += deadline_missed;
+    m_load_sum += load;
+    if (m_frames < m_settings.window_frames)
+        return QualityTransitions::none;
+
+    const double window_load = m_load_sum / m_frames;
+    const int window_misses = m_misses;
+    m_frames = 0;
+    m_misses = 0;
+    m_load_sum = 0;
+    m_window_load.store(static_cast<float>(window_load), std::memory_order_relaxed);
+    m_window_misses.store(window_misses, std::memory_order_relaxed);
+
+    const int current_level = level();
+    if (window_misses >= m_settings.misses_to_step_down || 1 - window_load < m_settings.min_margin)
+    {
+        m_good_windows = 0;
+        if (current_level == max_level())
+            return QualityTransitions::none;
+        apply_level(current_level + 1);
+        m_step_downs.fetch_add(1, std::memory_order_relaxed);
+        return QualityTransitions::step_down;
+    }
+
+    if (window_misses || 1 - window_load <= m_settings.recovery_margin)
+    {
+        m_good_windows = 0;
+        return QualityTransitions::none;
+    }
+    if (current_level == 0 || ++m_good_windows < m_settings.recovery_windows)
+        return QualityTransitions::none;
+
+    m_good_windows = 0;
+    apply_level(current_level - 1);
+    m_step_ups.fetch_add(1, std::memory_order_relaxed);
+    return QualityTransitions::step_up;
+}
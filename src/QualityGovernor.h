@@ -0,0 +1,124 @@
+/*
+* Trades quality for CPU time when the audio thread can't keep up with realtime.
+*
+* The audio thread reports every output frame's load (the time its work took as a fraction of the
+* frame's duration) and whether it missed its deadline. The governor looks at windows of
+* window_frames frames: a window with misses_to_step_down misses or more, or whose mean margin
+* (1 - load) is below min_margin, steps quality down one level. Stepping back up takes
+* recovery_windows windows in a row with no misses and a mean margin above recovery_margin, so
+* the level doesn't toggle while the load hovers around the limit.
+*
+* Each level below full quality applies the next of the configured steps, in order, and stepping
+* up undoes the last one applied:
+* true peak: the level meters stop true peak metering, the most expensive part of metering.
+* resampler: sources which change sample rate switch to a fast profile resampler, acquired when
+* they were opened (see ResamplerProfiles.h), one frame after the step so it takes over warm. The
+* context switched away from is reset off the audio thread (see AudioChannel).
+* filters: the sources' and the output's filter graphs are bypassed (see FilterGraph.h).
+*
+* The governor is written by the audio thread only, from fondue_sleep(), and read by any: the
+* pipeline checks degraded() for its steps every frame, and the control thread logs transitions
+* and reports the governor's state. It never allocates or locks once configured.
+*/
+
+#ifndef QUALITYGOVERNOR_H
+#define QUALITYGOVERNOR_H
+
+#include<array>
+#include<atomic>
+#include<cstdint>
+#include<string>
+#include<type_traits>
+#include<vector>
+
+#define DEFAULT_GOVERNOR_WINDOW_FRAMES 50
+#define DEFAULT_GOVERNOR_MISSES_TO_STEP_DOWN 2
+#define DEFAULT_GOVERNOR_MIN_MARGIN 0.05
+#define DEFAULT_GOVERNOR_RECOVERY_MARGIN 0.4
+#define DEFAULT_GOVERNOR_RECOVERY_WINDOWS 10
+
+enum class QualitySteps {true_peak, resampler, filters, number_of_steps};
+
+/*overload the unary + operator to cast the enum class QualitySteps
+* to int for e.g. bit masks*/
+constexpr auto operator+(QualitySteps s) noexcept
+{
+    return static_cast<std::underlying_type_t<QualitySteps>>(s);
+}
+
+enum class QualityTransitions {none, step_down, step_up};
+
+const char* quality_step_name(QualitySteps step);
+
+/*false and step untouched if name isn't one of the step names*/
+bool parse_quality_step(const std::string& name, QualitySteps& step);
+
+struct QualityGovernorSettings
+{
+    bool enabled {false};
+    int window_frames {DEFAULT_GOVERNOR_WINDOW_FRAMES};
+    int misses_to_step_down {DEFAULT_GOVERNOR_MISSES_TO_STEP_DOWN};
+    double min_margin {DEFAULT_GOVERNOR_MIN_MARGIN};
+    double recovery_margin {DEFAULT_GOVERNOR_RECOVERY_MARGIN};
+    int recovery_windows {DEFAULT_GOVERNOR_RECOVERY_WINDOWS};
+    /*applied in this order stepping down, each at most once*/
+    std::vector<QualitySteps> steps {QualitySteps::true_peak, QualitySteps::resampler, QualitySteps::filters};
+};
+
+class QualityGovernor
+{
+    private:
+        /*writer only*/
+        QualityGovernorSettings m_settings {};
+        int m_frames {};
+        int m_misses {};
+        double m_load_sum {};
+        int m_good_windows {};
+
+        /*read by anyone*/
+        std::atomic<bool> m_enabled {false};
+        /*bit masks of QualitySteps, those configured and those in force*/
+        std::atomic<uint32_t> m_configured {};
+        std::atomic<uint32_t> m_degraded {};
+        std::atomic<int> m_level {};
+        std::atomic<int> m_max_level {};
+        std::atomic<uint64_t> m_step_downs {};
+        std::atomic<uint64_t> m_step_ups {};
+        std::atomic<float> m_window_load {};
+        std::atomic<int> m_window_misses {};
+
+        void apply_level(int level);
+
+    public:
+        /*before the audio thread starts, and before sources are opened so they can prepare their steps*/
+        void configure(const QualityGovernorSettings& settings);
+
+        /*called by the audio thread at the end of every realtime output frame*/
+        QualityTransitions end_frame(double load, bool deadline_missed);
+
+        bool enabled() const {return m_enabled.load(std::memory_order_relaxed);}
+
+        /*whether the step can ever be applied, i.e. a source needs to prepare for it*/
+        bool configured(QualitySteps step) const {return m_configured.load(std::memory_order_relaxed) & (1u << +step);}
+
+        /*whether the step is in force now*/
+        bool degraded(QualitySteps step) const {return m_degraded.load(std::memory_order_relaxed) & (1u << +step);}
+
+        /*0 is full quality, each level above it one more step applied*/
+        int level() const {return m_level.load(std::memory_order_relaxed);}
+
+        int max_level() const {return m_max_level.load(std::memory_order_relaxed);}
+
+        uint64_t step_downs() const {return m_step_downs.load(std::memory_order_relaxed);}
+
+        uint64_t step_ups() const {return m_step_ups.load(std::memory_order_relaxed);}
+
+        /*the mean load and the deadline misses of the last complete window*/
+        float window_load() const {return m_window_load.load(std::memory_order_relaxed);}
+
+        int window_misses() const {return m_window_misses.load(std::memory_order_relaxed);}
+};
+
+extern QualityGovernor quality_governor;
+
+#endif
@@ -0,0 +1,170 @@
+#include "Realtime.h"
+
+#include<algorithm>
+#include<cerrno>
+#include<cstdlib>
+#include<cstring>
+#include<iostream>
+#include<map>
+#include<mutex>
+
+#include<alloca.h>
+#include<malloc.h>
+#include<pthread.h>
+#include<sched.h>
+#include<sys/mman.h>
+
+namespace
+{
+    struct AppliedSettings
+    {
+        ThreadSettings settings {};
+        ThreadSettingsStatus status {};
+    };
+
+    std::mutex status_mtx;
+    std::map<std::string, AppliedSettings> applied_settings {};
+    bool memory_locked = false;
+
+    void prefault_stack(std::size_t bytes)
+    {
+        if (!bytes)
+            return;
+        /*volatile so the compiler can't optimise the writes away*/
+        volatile unsigned char* stack = static_cast<volatile unsigned char*>(alloca(bytes));
+        for (std::size_t i = 0; i < bytes; i += 4096)
+            stack[i] = 0;
+    }
+}
+
+SchedulingPolicies scheduling_policy_from_string(const std::string& policy)
+{
+    if (policy == "normal" || policy == "other")
+        return SchedulingPolicies::normal;
+    if (policy == "fifo")
+        return SchedulingPolicies::fifo;
+    if (policy == "rr" || policy == "round robin")
+        return SchedulingPolicies::round_robin;
+    throw "Realtime: unknown scheduling policy, expected normal, fifo or rr";
+}
+
+const char* scheduling_policy_name(SchedulingPolicies policy)
+{
+    switch (+policy)
+    {
+        case +SchedulingPolicies::fifo:
+            return "SCHED_FIFO";
+        case +SchedulingPolicies::round_robin:
+            return "SCHED_RR";
+        default:
+            return "SCHED_OTHER";
+    }
+}
+
+ThreadSettingsStatus apply_thread_settings(const ThreadSettings& settings, const std::string& thread_name)
+{
+    ThreadSettingsStatus status {};
+    pthread_t thread = pthread_self();
+
+    if (settings.policy != SchedulingPolicies::normal)
+    {
+        int policy = settings.policy == SchedulingPolicies::fifo ? SCHED_FIFO : SCHED_RR;
+        struct sched_param param {};
+        int min_priority = sched_get_priority_min(policy);
+        int max_priority = sched_get_priority_max(policy);
+        param.sched_priority = std::min(std::max(settings.priority, min_priority), max_priority);
+
+        int ret = pthread_setschedparam(thread, policy, &param);
+        if (ret == 0)
+        {
+            status.scheduling_applied = true;
+        }
+        else
+        {
+            std::cerr << thread_name << " thread: could not set " << scheduling_policy_name(settings.policy)
+                      << " priority " << param.sched_priority << ": " << std::strerror(ret)
+                      << ", continuing with normal scheduling\n";
+        }
+    }
+
+    if (!settings.cpus.empty())
+    {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        for (int cpu : settings.cpus)
+        {
+            if (cpu >= 0 && cpu < CPU_SETSIZE)
+                CPU_SET(cpu, &cpu_set);
+        }
+
+        int ret = pthread_setaffinity_np(thread, sizeof(cpu_set), &cpu_set);
+        if (ret == 0)
+        {
+            status.affinity_applied = true;
+        }
+        else
+        {
+            std::cerr << thread_name << " thread: could not set cpu affinity: " << std::strerror(ret)
+                      << ", thread may run on any cpu\n";
+        }
+    }
+
+    prefault_stack(settings.prefault_stack_bytes);
+
+    std::lock_guard<std::mutex> lock (status_mtx);
+    applied_settings[thread_name] = AppliedSettings {settings, status};
+    return status;
+}
+
+bool lock_process_memory(std::size_t prefault_heap_bytes)
+{
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    {
+        std::cerr << "could not lock process memory: " << std::strerror(errno)
+                  << ", page faults may occur while streaming\n";
+        return false;
+    }
+
+    /*keep freed memory in the heap rather than returning it to the OS so the
+    * pages faulted in below stay available to later allocations*/
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    if (prefault_heap_bytes)
+    {
+        unsigned char* heap = static_cast<unsigned char*>(std::malloc(prefault_heap_bytes));
+        if (heap)
+        {
+            for (std::size_t i = 0; i < prefault_heap_bytes; i += 4096)
+                heap[i] = 0;
+            std::free(heap);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock (status_mtx);
+    memory_locked = true;
+    return true;
+}
+
+void print_realtime_status(std::ostream& stream)
+{
+    std::lock_guard<std::mutex> lock (status_mtx);
+    stream << "memory locked: " << (memory_locked ? "yes" : "no") << '\n';
+    for (const auto& [name, applied] : applied_settings)
+    {
+        stream << name << " thread: " << scheduling_policy_name(applied.settings.policy);
+        if (applied.settings.policy != SchedulingPolicies::normal)
+        {
+            stream << " priority " << applied.settings.priority
+                   << (applied.status.scheduling_applied ? " (applied)" : " (failed)");
+        }
+        if (!applied.settings.cpus.empty())
+        {
+            stream << ", cpus";
+            for (int cpu : applied.settings.cpus)
+                stream << ' ' << cpu;
+            stream << (applied.status.affinity_applied ? " (applied)" : " (failed)");
+        }
+        stream << '\n';
+    }
+}
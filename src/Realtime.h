@@ -0,0 +1,74 @@
+/*
+* Helpers for running the audio (and other latency sensitive) threads with realtime
+* scheduling, CPU affinity and locked memory.
+*
+* Everything here degrades gracefully: if the process lacks the privileges
+* (CAP_SYS_NICE / CAP_IPC_LOCK or a suitable RLIMIT_RTPRIO / RLIMIT_MEMLOCK) a warning
+* is printed and the thread carries on with normal scheduling.
+*/
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include<cstddef>
+#include<ostream>
+#include<string>
+#include<type_traits>
+#include<vector>
+
+#define DEFAULT_REALTIME_PRIORITY 70
+#define DEFAULT_PREFAULT_STACK_BYTES (512 * 1024)
+#define DEFAULT_PREFAULT_HEAP_BYTES (16 * 1024 * 1024)
+
+enum class SchedulingPolicies {normal, fifo, round_robin};
+
+/*overload the unary + operator to cast the enum class SchedulingPolicies
+* to int for e.g. switch statements*/
+constexpr auto operator+(SchedulingPolicies p) noexcept
+{
+    return static_cast<std::underlying_type_t<SchedulingPolicies>>(p);
+}
+
+/*parses "normal", "fifo" or "rr", throws a const char* exception otherwise*/
+SchedulingPolicies scheduling_policy_from_string(const std::string& policy);
+
+const char* scheduling_policy_name(SchedulingPolicies policy);
+
+struct ThreadSettings
+{
+    SchedulingPolicies policy {SchedulingPolicies::normal};
+    int priority {DEFAULT_REALTIME_PRIORITY};
+    /*cpus the thread may run on, empty means any*/
+    std::vector<int> cpus {};
+    /*bytes of stack to touch when the thread starts*/
+    std::size_t prefault_stack_bytes {DEFAULT_PREFAULT_STACK_BYTES};
+};
+
+/*what was actually achieved when applying ThreadSettings*/
+struct ThreadSettingsStatus
+{
+    bool scheduling_applied {false};
+    bool affinity_applied {false};
+};
+
+struct RealtimeSettings
+{
+    ThreadSettings audio_thread {};
+    /*mlockall current and future pages*/
+    bool lock_memory {false};
+    /*bytes of heap to touch at startup so later allocations don't page fault*/
+    std::size_t prefault_heap_bytes {DEFAULT_PREFAULT_HEAP_BYTES};
+};
+
+/*applies the scheduling policy, priority and affinity to the calling thread
+* and touches its stack, failures are reported on stderr and leave the thread as it was*/
+ThreadSettingsStatus apply_thread_settings(const ThreadSettings& settings, const std::string& thread_name);
+
+/*locks all current and future pages of the process into RAM and pre-faults a chunk of heap,
+* returns false if the memory could not be locked*/
+bool lock_process_memory(std::size_t prefault_heap_bytes);
+
+/*one line summary of the realtime setup of the audio thread, for comparing deadline misses*/
+void print_realtime_status(std::ostream& stream);
+
+#endif
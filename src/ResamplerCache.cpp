@@ -0,0 +1,166 @@
+#include "ResamplerCache.h"
+
+#include<tuple>
+
+extern "C"
+{
+#include <libavutil/opt.h>
+}
+
+ResamplerCache resampler_cache {};
+
+namespace
+{
+    std::string describe_layout(const AVChannelLayout& layout)
+    {
+        char description[128] {};
+        if (av_channel_layout_describe(&layout, description, sizeof(description)) < 0)
+            return std::to_string(layout.nb_channels) + " channels";
+        return description;
+    }
+}
+
+void ResamplerReturner::operator()(SwrContext* swr_ctx) const
+{
+    if (cache)
+        cache->release(conversion, swr_ctx);
+    else
+        swr_free(&swr_ctx);
+}
+
+bool ResamplerCache::Key::operator< (const Key& other) const
+{
+    return std::tie(in_layout, in_rate, in_format, out_layout, out_rate, out_format, quality)
+         < std::tie(other.in_layout, other.in_rate, other.in_format, other.out_layout, other.out_rate, other.out_format, other.quality);
+}
+
+ResamplerCache::~ResamplerCache()
+{
+    for (Conversion& conversion : m_conversions)
+    {
+        av_channel_layout_uninit(&conversion.in_layout);
+        av_channel_layout_uninit(&conversion.out_layout);
+    }
+}
+
+CachedResampler ResamplerCache::acquire(const AVChannelLayout& in_layout, int in_rate, AVSampleFormat in_format,
+                                        const AVChannelLayout& out_layout, int out_rate, AVSampleFormat out_format,
+                                        const std::string& quality)
+{
+    const Key key {describe_layout(in_layout), in_rate, in_format, describe_layout(out_layout), out_rate, out_format, quality};
+    std::size_t index {};
+    {
+        std::lock_guard<std::mutex> lock (m_mtx);
+        auto found = m_index.find(key);
+        if (found == m_index.end())
+        {
+            index = m_conversions.size();
+            m_conversions.emplace_back();
+            Conversion& conversion = m_conversions.back();
+            av_channel_layout_copy(&conversion.in_layout, &in_layout);
+            conversion.in_rate = in_rate;
+            conversion.in_format = in_format;
+            av_channel_layout_copy(&conversion.out_layout, &out_layout);
+            conversion.out_rate = out_rate;
+            conversion.out_format = out_format;
+            conversion.quality = quality;
+            conversion.idle.reserve(RESAMPLER_CACHE_MAX_IDLE);
+            m_index.emplace(key, index);
+        }
+        else
+        {
+            index = found->second;
+        }
+
+        std::vector<ResamplerHandle>& idle = m_conversions[index].idle;
+        if (!idle.empty())
+        {
+            m_hits.fetch_add(1, std::memory_order_relaxed);
+            SwrContext* swr_ctx = idle.back().release();
+            idle.pop_back();
+            return CachedResampler {swr_ctx, ResamplerReturner {this, index}};
+        }
+    }
+
+    /*build a new one outside the lock, this is the slow part*/
+    m_misses.fetch_add(1, std::memory_order_relaxed);
+    ResamplerHandle swr_ctx {swr_alloc()};
+    if (!swr_ctx)
+        throw "Resampler cache: could not allocate a resampler context";
+
+    av_opt_set_chlayout  (swr_ctx.get(), "in_chlayout",       &in_layout,      0);
+    av_opt_set_int       (swr_ctx.get(), "in_sample_rate",     in_rate,    0);
+    av_opt_set_sample_fmt(swr_ctx.get(), "in_sample_fmt",      in_format,     0);
+    av_opt_set_chlayout  (swr_ctx.get(), "out_chlayout",      &out_layout,      0);
+    av_opt_set_int       (swr_ctx.get(), "out_sample_rate",    out_rate,    0);
+    av_opt_set_sample_fmt(swr_ctx.get(), "out_sample_fmt",     out_format,     0);
+    if (!quality.empty() && av_set_options_string(swr_ctx.get(), quality.c_str(), "=", ":") < 0)
+        throw "Resampler cache: invalid resampler quality options";
+
+    if (swr_init(swr_ctx.get()) < 0)
+        throw "Resampler cache: failed to initialise the resampler context";
+
+    return CachedResampler {swr_ctx.release(), ResamplerReturner {this, index}};
+}
+
+void ResamplerCache::release(std::size_t conversion, SwrContext* swr_ctx)
+{
+    /*drops the buffered samples, the filter bank is kept since nothing it depends on has changed*/
+    ResamplerHandle context {swr_ctx};
+    if (swr_init(context.get()) < 0)
+        return;
+
+    std::lock_guard<std::mutex> lock (m_mtx);
+    std::vector<ResamplerHandle>& idle = m_conversions[conversion].idle;
+    if (idle.size() < RESAMPLER_CACHE_MAX_IDLE)
+        idle.push_back(std::move(context));
+}
+
+void ResamplerCache::clear()
+{
+    std::lock_guard<std::mutex> lock (m_mtx);
+    for (Conversion& conversion : m_conversions)
+        conversion.idle.clear();
+}
+
+ResamplerCacheStats ResamplerCache::stats() const
+{
+    ResamplerCacheStats stats {};
+    stats.hits = m_hits.load(std::memory_order_relaxed);
+    stats.misses = m_misses.load(std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock (m_mtx);
+    stats.conversions = m_conversions.size();
+    for (const Conversion& conversion : m_conversions)
+        stats.idle += conversion.idle.size();
+    return stats;
+}
+
+void prime_resampler(SwrContext* swr_ctx, int nb_samples)
+{
+    AVChannelLayout in_chlayout{}, out_chlayout{};
+    AVSampleFormat in_sample_fmt{}, out_sample_fmt{};
+    av_opt_get_chlayout(swr_ctx, "in_chlayout", 0, &in_chlayout);
+    av_opt_get_sample_fmt(swr_ctx, "in_sample_fmt", 0, &in_sample_fmt);
+    av_opt_get_chlayout(swr_ctx, "out_chlayout", 0, &out_chlayout);
+    av_opt_get_sample_fmt(swr_ctx, "out_sample_fmt", 0, &out_sample_fmt);
+
+    uint8_t** input {};
+    uint8_t** output {};
+    const int output_samples = swr_get_out_samples(swr_ctx, nb_samples);
+    if (av_samples_alloc_array_and_samples(&input, NULL, in_chlayout.nb_channels, nb_samples, in_sample_fmt, 0) >= 0
+        && av_samples_alloc_array_and_samples(&output, NULL, out_chlayout.nb_channels, output_samples, out_sample_fmt, 0) >= 0)
+    {
+        av_samples_set_silence(input, 0, nb_samples, in_chlayout.nb_channels, in_sample_fmt);
+        swr_convert(swr_ctx, output, output_samples, (const uint8_t**)input, nb_samples);
+    }
+
+    if (input)
+        av_freep(&input[0]);
+    av_freep(&input);
+    if (output)
+        av_freep(&output[0]);
+    av_freep(&output);
+    av_channel_layout_uninit(&in_chlayout);
+    av_channel_layout_uninit(&out_chlayout);
+}
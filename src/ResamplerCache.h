@@ -0,0 +1,124 @@
+/*
+* A cache of initialised resampler contexts.
+*
+* swr_init works out the resampling filter bank from the formats and quality options, which is the
+* expensive part of opening a source. Contexts are kept by their conversion (input and output channel
+* layout, sample rate and sample format) and quality options, and a context handed back is reset
+* with swr_init: on a context whose parameters haven't changed it keeps the filter bank and only
+* clears the buffered samples. Opening another source with the same formats, or the white noise
+* fallback replacing a failed source, then starts from a ready context rather than from scratch.
+*
+* acquire() returns a CachedResampler, a std::unique_ptr whose deleter hands the context back.
+* Only a few idle contexts are kept per conversion, any more are freed.
+*/
+
+#ifndef RESAMPLERCACHE_H
+#define RESAMPLERCACHE_H
+
+extern "C"
+{
+#include <libavutil/channel_layout.h>
+#include <libavutil/samplefmt.h>
+#include <libswresample/swresample.h>
+}
+
+#include<atomic>
+#include<cstdint>
+#include<deque>
+#include<map>
+#include<memory>
+#include<mutex>
+#include<string>
+#include<vector>
+
+#include "AVHandles.h"
+
+/*idle contexts kept per conversion, more than the sources normally open with the same formats*/
+#define RESAMPLER_CACHE_MAX_IDLE 4
+
+class ResamplerCache;
+
+/*hands a context back to the cache it came from*/
+struct ResamplerReturner
+{
+    ResamplerCache* cache {};
+    std::size_t conversion {};
+
+    void operator()(SwrContext* swr_ctx) const;
+};
+
+using CachedResampler = std::unique_ptr<SwrContext, ResamplerReturner>;
+
+struct ResamplerCacheStats
+{
+    uint64_t hits {};
+    uint64_t misses {};
+    std::size_t conversions {};
+    std::size_t idle {};
+};
+
+class ResamplerCache
+{
+    private:
+        struct Key
+        {
+            std::string in_layout;
+            int in_rate;
+            int in_format;
+            std::string out_layout;
+            int out_rate;
+            int out_format;
+            std::string quality;
+
+            bool operator< (const Key& other) const;
+        };
+
+        struct Conversion
+        {
+            AVChannelLayout in_layout {};
+            int in_rate {};
+            AVSampleFormat in_format {};
+            AVChannelLayout out_layout {};
+            int out_rate {};
+            AVSampleFormat out_format {};
+            std::string quality {};
+            /*capacity RESAMPLER_CACHE_MAX_IDLE, handing a context back never allocates*/
+            std::vector<ResamplerHandle> idle {};
+        };
+
+        std::deque<Conversion> m_conversions {};
+        std::map<Key, std::size_t> m_index {};
+        std::atomic<uint64_t> m_hits {};
+        std::atomic<uint64_t> m_misses {};
+        mutable std::mutex m_mtx;
+
+        friend struct ResamplerReturner;
+        void release(std::size_t conversion, SwrContext* swr_ctx);
+
+    public:
+        ResamplerCache() = default;
+
+        ~ResamplerCache();
+
+        ResamplerCache(const ResamplerCache&) = delete;
+        ResamplerCache& operator= (const ResamplerCache&) = delete;
+
+        /*an initialised context converting between the two formats, quality is a list of swresample
+        * options e.g. "filter_size=32:phase_shift=10". throws a const char* exception on failure*/
+        CachedResampler acquire(const AVChannelLayout& in_layout, int in_rate, AVSampleFormat in_format,
+                                const AVChannelLayout& out_layout, int out_rate, AVSampleFormat out_format,
+                                const std::string& quality = "");
+
+        /*frees every idle context, the ones in use go back to the cache as usual*/
+        void clear();
+
+        ResamplerCacheStats stats() const;
+};
+
+extern ResamplerCache resampler_cache;
+
+/*runs nb_samples of silence through the resampler so the buffers it allocates on first use are
+* allocated now rather than on the audio thread, leaves the resampler's delay (silence) behind*/
+void prime_resampler(SwrContext* swr_ctx, int nb_samples);
+
+#endif
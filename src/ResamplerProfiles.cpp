@@ -0,0 +1,78 @@
+#include "ResamplerProfiles.h"
+
+#include<array>
+#include<iostream>
+
+extern "C"
+{
+#include <libavutil/channel_layout.h>
+#include <libavutil/opt.h>
+#include <libswresample/swresample.h>
+}
+
+#include "AVHandles.h"
+
+ResamplerProfiles default_resampler_profile {ResamplerProfiles::standard};
+
+namespace
+{
+    const std::array<const char*, +ResamplerProfiles::number_of_profiles> profile_names {"fast", "standard", "high", "soxr"};
+
+    /*filter_size is the filter's length in input samples either side and phase_shift the log2 of its
+    * number of phases, cutoff is the passband edge as a fraction of the lower nyquist frequency*/
+    const std::array<std::string, +ResamplerProfiles::number_of_profiles> profile_options
+    {
+        "filter_size=8:phase_shift=6:linear_interp=1:cutoff=0.9",
+        "",
+        "filter_size=64:phase_shift=12:linear_interp=1:cutoff=0.97:kaiser_beta=12",
+        "resampler=soxr:precision=28"
+    };
+}
+
+const char* resampler_profile_name(ResamplerProfiles profile)
+{
+    return profile_names[+profile];
+}
+
+bool parse_resampler_profile(const std::string& name, ResamplerProfiles& profile)
+{
+    for (std::size_t i = 0; i < profile_names.size(); i++)
+    {
+        if (name == profile_names[i])
+        {
+            profile = static_cast<ResamplerProfiles>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const std::string& resampler_profile_options(ResamplerProfiles profile)
+{
+    if (profile == ResamplerProfiles::soxr && !soxr_available())
+        return profile_options[+ResamplerProfiles::high];
+    return profile_options[+profile];
+}
+
+bool soxr_available()
+{
+    static const bool available = []
+    {
+        ResamplerHandle swr_ctx {swr_alloc()};
+        if (!swr_ctx)
+            return false;
+        AVChannelLayout stereo = AV_CHANNEL_LAYOUT_STEREO;
+        av_opt_set_chlayout  (swr_ctx.get(), "in_chlayout",     &stereo,            0);
+        av_opt_set_int       (swr_ctx.get(), "in_sample_rate",   44100,             0);
+        av_opt_set_sample_fmt(swr_ctx.get(), "in_sample_fmt",    AV_SAMPLE_FMT_FLTP, 0);
+        av_opt_set_chlayout  (swr_ctx.get(), "out_chlayout",    &stereo,            0);
+        av_opt_set_int       (swr_ctx.get(), "out_sample_rate",  48000,             0);
+        av_opt_set_sample_fmt(swr_ctx.get(), "out_sample_fmt",   AV_SAMPLE_FMT_FLTP, 0);
+        /*swr_init is what fails for an engine FFmpeg wasn't built with*/
+        const bool initialised = av_opt_set(swr_ctx.get(), "resampler", "soxr", 0) >= 0 && swr_init(swr_ctx.get()) >= 0;
+        if (!initialised)
+            std::cout << "resampler: FFmpeg was built without soxr, the soxr profile uses high instead\n";
+        return initialised;
+    }();
+    return available;
+}
@@ -0,0 +1,47 @@
+/*
+* Named resampler quality profiles, turned into the swresample options the resampler cache takes.
+*
+* fast is a short filter with linear interpolation between few phases, for a Raspberry Pi running
+* several sources. standard is swresample's defaults, which every source used before there were
+* profiles. high is a longer, steeper filter with more phases, for the offline render where there's
+* time to spare. soxr uses the SoX resampler engine at its very high quality setting, when FFmpeg
+* was built with it, and high otherwise.
+*
+* Only sources which change sample rate are affected: a source at the output rate is only remixed
+* and converted, which is the same for every profile. The default profile comes from the "resampler
+* profile" of the stream settings (or of an offline render script), a source prompt can choose its
+* own with -resampler. fondue_resampler_bench measures the cost and the THD+N of each profile on
+* common conversions.
+*/
+
+#ifndef RESAMPLERPROFILES_H
+#define RESAMPLERPROFILES_H
+
+#include<string>
+#include<type_traits>
+
+enum class ResamplerProfiles {fast, standard, high, soxr, number_of_profiles};
+
+/*overload the unary + operator to cast the enum class ResamplerProfiles
+* to int for e.g. array indexing*/
+constexpr auto operator+(ResamplerProfiles p) noexcept
+{
+    return static_cast<std::underlying_type_t<ResamplerProfiles>>(p);
+}
+
+/*the profile sources use unless their prompt says otherwise*/
+extern ResamplerProfiles default_resampler_profile;
+
+const char* resampler_profile_name(ResamplerProfiles profile);
+
+/*false and profile untouched if name isn't one of the profile names*/
+bool parse_resampler_profile(const std::string& name, ResamplerProfiles& profile);
+
+/*the swresample options for the profile, for ResamplerCache::acquire. soxr falls back to high
+* (saying so once) if FFmpeg wasn't built with it*/
+const std::string& resampler_profile_options(ResamplerProfiles profile);
+
+/*whether swresample can use the SoX resampler engine, checked once*/
+bool soxr_available();
+
+#endif
@@ -0,0 +1,196 @@
+#include "Scheduler.h"
+
+#include<algorithm>
+#include<cstdio>
+#include<ctime>
+#include<iomanip>
+#include<sstream>
+
+using json = nlohmann::json;
+
+Scheduler::Scheduler(AudioChannel& channel, const OutputStream& sink, SourceOpener open_source):
+    m_channel {channel},
+    m_sink {sink},
+    m_open_source {std::move(open_source)}
+{
+}
+
+Scheduler::~Scheduler()
+{
+    stop();
+}
+
+void Scheduler::start()
+{
+    m_thread = std::thread {&Scheduler::run, this};
+}
+
+void Scheduler::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock (m_mtx);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+uint64_t Scheduler::add(const std::string& source, std::chrono::system_clock::time_point at, bool daily)
+{
+    uint64_t id {};
+    {
+        std::lock_guard<std::mutex> lock (m_mtx);
+        id = m_next_id++;
+        std::string time_of_day {};
+        if (daily)
+        {
+            const std::time_t at_time = std::chrono::system_clock::to_time_t(at);
+            struct tm local_time {};
+            localtime_r(&at_time, &local_time);
+            char buffer[16] {};
+            std::strftime(buffer, sizeof(buffer), "%H:%M:%S", &local_time);
+            time_of_day = buffer;
+        }
+        m_switches.push_back({id, source, at, daily, time_of_day});
+    }
+    m_cv.notify_all();
+    return id;
+}
+
+bool Scheduler::remove(uint64_t id)
+{
+    std::lock_guard<std::mutex> lock (m_mtx);
+    auto found = std::find_if(m_switches.begin(), m_switches.end(), [id](const ScheduledSwitch& s){return s.id == id;});
+    if (found == m_switches.end())
+        return false;
+    m_switches.erase(found);
+    return true;
+}
+
+json Scheduler::list() const
+{
+    std::lock_guard<std::mutex> lock (m_mtx);
+    std::vector<ScheduledSwitch> switches {m_switches};
+    std::sort(switches.begin(), switches.end(), [](const ScheduledSwitch& a, const ScheduledSwitch& b){return a.at < b.at;});
+
+    json list = json::array();
+    for (const ScheduledSwitch& scheduled : switches)
+    {
+        std::time_t at = std::chrono::system_clock::to_time_t(scheduled.at);
+        struct tm local_time {};
+        localtime_r(&at, &local_time);
+        std::ostringstream at_string {};
+        at_string << std::put_time(&local_time, "%Y-%m-%d %H:%M:%S");
+
+        list.push_back({{"id", scheduled.id}, {"source", scheduled.source}, {"at", at_string.str()},
+                        {"daily", scheduled.daily}, {"lead seconds", lead_time(scheduled.source)}});
+    }
+    return list;
+}
+
+void Scheduler::record_startup_latency(const std::string& source, double seconds)
+{
+    std::lock_guard<std::mutex> lock (m_mtx);
+    auto latency = m_startup_latency.find(source);
+    if (latency == m_startup_latency.end())
+    {
+        m_startup_latency[source] = seconds;
+        return;
+    }
+    /*jump straight up to a slower open, only come down slowly after a fast one*/
+    latency->second = std::max(seconds, 0.9 * latency->second + 0.1 * seconds);
+}
+
+double Scheduler::lead_time(const std::string& source) const
+{
+    auto latency = m_startup_latency.find(source);
+    double startup = latency == m_startup_latency.end() ? DEFAULT_STARTUP_LATENCY_SECONDS : latency->second;
+    return startup + SCHEDULE_PREWARM_MARGIN_SECONDS;
+}
+
+int64_t Scheduler::output_sample_at(std::chrono::system_clock::time_point at) const
+{
+    std::chrono::duration<double> until = at - std::chrono::system_clock::now();
+    return m_sink.get_samples_written() + std::llround(until.count() * m_sink.get_output_codec_context().sample_rate);
+}
+
+void Scheduler::run()
+{
+    std::unique_lock<std::mutex> lock (m_mtx);
+    while (!m_stop)
+    {
+        if (m_switches.empty())
+        {
+            m_cv.wait(lock, [this]{return m_stop || !m_switches.empty();});
+            continue;
+        }
+
+        auto next = std::min_element(m_switches.begin(), m_switches.end(),
+                                     [](const ScheduledSwitch& a, const ScheduledSwitch& b){return a.at < b.at;});
+        auto open_at = next->at - std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                                    std::chrono::duration<double>(lead_time(next->source)));
+        if (std::chrono::system_clock::now() < open_at)
+        {
+            /*woken early by a change to the schedule, re-evaluate which switch is next*/
+            m_cv.wait_until(lock, open_at);
+            continue;
+        }
+
+        ScheduledSwitch due {*next};
+        /*from the wall clock so it stays at the same local time across a daylight saving change*/
+        if (next->daily)
+            next->at = next_time_of_day(next->time_of_day, next->at);
+        else
+            m_switches.erase(next);
+        lock.unlock();
+
+        try
+        {
+            auto start = std::chrono::steady_clock::now();
+            std::unique_ptr<InputStream> source {m_open_source(due.source)};
+            std::chrono::duration<double> startup = std::chrono::steady_clock::now() - start;
+            record_startup_latency(due.source, startup.count());
+
+            if (std::chrono::system_clock::now() > due.at)
+                std::cout << "scheduled switch to " << due.source << ": source took " << startup.count()
+                          << " s to open, switching late\n";
+            m_channel.switch_source(std::move(source), due.source, output_sample_at(due.at));
+        }
+        catch (const char* exception)
+        {
+            std::cout << "scheduled switch to " << due.source << " failed: " << exception << '\n';
+        }
+
+        lock.lock();
+    }
+}
+
+std::chrono::system_clock::time_point Scheduler::next_time_of_day(const std::string& time_of_day,
+                                                                  std::chrono::system_clock::time_point after)
+{
+    int hours {}, minutes {}, seconds {};
+    int fields = std::sscanf(time_of_day.c_str(), "%d:%d:%d", &hours, &minutes, &seconds);
+    if (fields < 2 || hours < 0 || hours > 23 || minutes < 0 || minutes > 59 || seconds < 0 || seconds > 59)
+        throw "schedule: expected a time of day as HH:MM or HH:MM:SS";
+
+    std::time_t from = std::chrono::system_clock::to_time_t(after);
+    struct tm day {};
+    localtime_r(&from, &day);
+
+    /*mktime works out the offset for each day, and normalises its copy, so the time of day is set afresh*/
+    std::time_t at {};
+    for (int days = 0; days <= 1; days++)
+    {
+        struct tm local_time {day};
+        local_time.tm_mday += days;
+        local_time.tm_hour = hours;
+        local_time.tm_min = minutes;
+        local_time.tm_sec = seconds;
+        local_time.tm_isdst = -1;
+        at = std::mktime(&local_time);
+        if (at > from)
+            break;
+    }
+    return std::chrono::system_clock::from_time_t(at);
+}
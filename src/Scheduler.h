@@ -0,0 +1,103 @@
+/*
+* Timed source switches.
+*
+* Each scheduled switch names a source and a wall clock time. The scheduler thread opens the
+* source ahead of that time, early enough to cover the source's measured startup latency
+* (the slowest recent open, decaying towards typical values) plus a margin, then hands it to
+* the audio thread with the output sample the time corresponds to. The audio thread pre-rolls
+* the source and starts the crossfade at exactly that sample.
+*
+* Daily switches (e.g. from the "schedule" section of the config) are rescheduled for the
+* next day as soon as they have been handed over, at the same local time of day (not 24 hours on,
+* which would drift by an hour across a daylight saving change).
+*/
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "AudioChannel.h"
+#include <nlohmann/json.hpp>
+#include<chrono>
+#include<condition_variable>
+#include<functional>
+#include<memory>
+#include<mutex>
+#include<string>
+#include<thread>
+#include<unordered_map>
+#include<vector>
+
+/*assumed until a source has been opened at least once*/
+#define DEFAULT_STARTUP_LATENCY_SECONDS 5.0
+/*extra time allowed on top of the measured startup latency*/
+#define SCHEDULE_PREWARM_MARGIN_SECONDS 2.0
+
+struct ScheduledSwitch
+{
+    uint64_t id {};
+    std::string source {};
+    std::chrono::system_clock::time_point at {};
+    /*repeats at the same time every day*/
+    bool daily {false};
+    /*the local "HH:MM:SS" a daily switch repeats at*/
+    std::string time_of_day {};
+};
+
+class Scheduler
+{
+    public:
+        /*opens the named source, throws a const char* exception on failure*/
+        using SourceOpener = std::function<std::unique_ptr<InputStream>(const std::string& name)>;
+
+    private:
+        AudioChannel& m_channel;
+        const OutputStream& m_sink;
+        SourceOpener m_open_source;
+
+        mutable std::mutex m_mtx;
+        std::condition_variable m_cv;
+        std::vector<ScheduledSwitch> m_switches {};
+        uint64_t m_next_id {1};
+        std::unordered_map<std::string, double> m_startup_latency {};
+        bool m_stop {false};
+        std::thread m_thread;
+
+        void run();
+
+        /*seconds before its start time a source should be opened, call with m_mtx held*/
+        double lead_time(const std::string& source) const;
+
+        /*the output sample which will be written at the given wall clock time*/
+        int64_t output_sample_at(std::chrono::system_clock::time_point at) const;
+
+    public:
+        Scheduler(AudioChannel& channel, const OutputStream& sink, SourceOpener open_source);
+
+        ~Scheduler();
+
+        Scheduler(const Scheduler&) = delete;
+        Scheduler& operator= (const Scheduler&) = delete;
+
+        void start();
+
+        void stop();
+
+        /*returns the id of the new scheduled switch*/
+        uint64_t add(const std::string& source, std::chrono::system_clock::time_point at, bool daily);
+
+        /*returns false if there was no such scheduled switch*/
+        bool remove(uint64_t id);
+
+        /*every scheduled switch in start time order, with the lead time each source will be opened with*/
+        nlohmann::json list() const;
+
+        /*folds the time a source took to open and provide audio into its startup latency estimate*/
+        void record_startup_latency(const std::string& source, double seconds);
+
+        /*the next occurrence of a local time of day "HH:MM" or "HH:MM:SS" after a time (now by default), throws a
+        * const char* exception if malformed*/
+        static std::chrono::system_clock::time_point next_time_of_day(const std::string& time_of_day,
+                                    std::chrono::system_clock::time_point after = std::chrono::system_clock::now());
+};
+
+#endif
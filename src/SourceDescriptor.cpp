@@ -0,0 +1,232 @@
+#include "SourceDescriptor.h"
+
+#include<cctype>
+#include<cerrno>
+#include<cstdlib>
+#include<unordered_set>
+
+extern "C"
+{
+#include <libavutil/channel_layout.h>
+}
+
+namespace
+{
+    /*"-5" is a value, not an option*/
+    /*returns false unless the whole of text is an integer*/
+    bool parse_integer(const std::string& text, int64_t& value)
+    {
+        if (text.empty())
+            return false;
+        char* end {};
+        errno = 0;
+        long long parsed = std::strtoll(text.c_str(), &end, 10);
+        if (errno || *end)
+            return false;
+        value = parsed;
+        return true;
+    }
+
+    /*true if the prompt names its url with -i or as an argument which no option takes as its value*/
+    bool has_url_argument(const std::vector<std::string>& tokens)
+    {
+        for (std::size_t i = 0; i < tokens.size(); i++)
+        {
+            if (!is_prompt_option(tokens[i]) || tokens[i] == "-i")
+                return true;
+            if (takes_prompt_value(tokens, i, tokens.size()))
+                i++;
+        }
+        return false;
+    }
+}
+
+bool is_prompt_option(const std::string& token)
+{
+    return token.size() > 1 && token[0] == '-' && !std::isdigit(static_cast<unsigned char>(token[1])) && token[1] != '.';
+}
+
+bool is_prompt_flag(const std::string& name)
+{
+    /*ffmpeg's valueless options, which would otherwise swallow a url written after them*/
+    static const std::unordered_set<std::string> flags {
+        "re", "y", "n", "nostdin", "hide_banner", "nostats", "stats", "autoexit", "copyts", "shortest",
+        "vn", "an", "sn", "dn", "ignore_unknown", "benchmark"};
+    return flags.count(name) != 0;
+}
+
+bool takes_prompt_value(const std::vector<std::string>& tokens, std::size_t i, std::size_t end)
+{
+    return i + 1 < end && !is_prompt_option(tokens[i + 1]) && !is_prompt_flag(tokens[i].substr(1));
+}
+
+std::vector<std::string> tokenize_prompt(const std::string& prompt)
+{
+    std::vector<std::string> tokens {};
+    std::string token {};
+    /*distinguishes an empty quoted argument ('') from no argument*/
+    bool in_token = false;
+
+    for (std::size_t i = 0; i < prompt.size(); i++)
+    {
+        const char c = prompt[i];
+        if (std::isspace(static_cast<unsigned char>(c)))
+        {
+            if (in_token)
+                tokens.push_back(std::move(token));
+            token.clear();
+            in_token = false;
+        }
+        else if (c == '\'')
+        {
+            std::size_t end = prompt.find('\'', i + 1);
+            if (end == std::string::npos)
+                throw "Input: unterminated ' in source prompt";
+            token.append(prompt, i + 1, end - i - 1);
+            in_token = true;
+            i = end;
+        }
+        else if (c == '"')
+        {
+            for (i++; i < prompt.size() && prompt[i] != '"'; i++)
+            {
+                /*only the characters which mean something inside double quotes can be escaped*/
+                if (prompt[i] == '\\' && i + 1 < prompt.size() && (prompt[i + 1] == '"' || prompt[i + 1] == '\\'))
+                    i++;
+                token.push_back(prompt[i]);
+            }
+            if (i == prompt.size())
+                throw "Input: unterminated \" in source prompt";
+            in_token = true;
+        }
+        else if (c == '\\')
+        {
+            if (++i == prompt.size())
+                throw "Input: source prompt ends with a \\";
+            token.push_back(prompt[i]);
+            in_token = true;
+        }
+        else
+        {
+            token.push_back(c);
+            in_token = true;
+        }
+    }
+    if (in_token)
+        tokens.push_back(std::move(token));
+    return tokens;
+}
+
+SourceDescriptor::SourceDescriptor(std::string prompt):
+    m_prompt {std::move(prompt)}
+{
+    try
+    {
+        compile();
+    }
+    catch (const char* exception)
+    {
+        m_error = exception;
+        m_options.reset();
+    }
+}
+
+void SourceDescriptor::compile()
+{
+    const std::vector<std::string> tokens {tokenize_prompt(m_prompt)};
+    AVDictionary* options {};
+
+    /*without -i or a bare url, an unknown valueless option has taken the url as its value: the last argument is the url*/
+    std::size_t end {tokens.size()};
+    if (!has_url_argument(tokens) && !tokens.empty() && !is_prompt_option(tokens.back()))
+        m_url = tokens[--end];
+
+    try
+    {
+        for (std::size_t i = 0; i < end; i++)
+        {
+            if (!is_prompt_option(tokens[i]))
+            {
+                /*a prompt without -i is just the url, with or without options around it*/
+                if (!m_url.empty())
+                    throw "Input: more than one url in source prompt";
+                m_url = tokens[i];
+                continue;
+            }
+
+            const std::string name {tokens[i].substr(1)};
+            std::string value {"1"};
+            if (takes_prompt_value(tokens, i, end))
+                value = tokens[++i];
+
+            int64_t number {};
+            if (name == "i")
+            {
+                if (!m_url.empty())
+                    throw "Input: more than one url in source prompt";
+                m_url = value;
+            }
+            else if (name == "f")
+            {
+                m_input_format = av_find_input_format(value.c_str());
+                if (!m_input_format)
+                    throw "Input: unknown input format in source prompt";
+            }
+            else if (name == "ar")
+            {
+                if (!parse_integer(value, number) || number <= 0)
+                    throw "Input: invalid -ar in source prompt";
+                av_dict_set(&options, "sample_rate", value.c_str(), AV_DICT_DONT_OVERWRITE);
+            }
+            else if (name == "ac")
+            {
+                if (!parse_integer(value, number) || number <= 0)
+                    throw "Input: invalid -ac in source prompt";
+                AVChannelLayout layout {};
+                av_channel_layout_default(&layout, static_cast<int>(number));
+                char description[64] {};
+                if (av_channel_layout_describe(&layout, description, sizeof(description)) >= 0)
+                    av_dict_set(&options, "ch_layout", description, AV_DICT_DONT_OVERWRITE);
+                av_channel_layout_uninit(&layout);
+            }
+            else if (name == "af" || name == "filter:a")
+            {
+                if (value == "1")
+                    throw "Input: -af needs a filter chain in source prompt";
+                m_filters = value;
+            }
+            else if (name == "resampler")
+            {
+                ResamplerProfiles profile {};
+                if (!parse_resampler_profile(value, profile))
+                    throw "Input: unknown -resampler profile in source prompt";
+                m_resampler_profile = profile;
+                m_has_resampler_profile = true;
+            }
+            else if (name == "c:a" || name == "codec:a" || name == "acodec")
+            {
+                m_decoder = avcodec_find_decoder_by_name(value.c_str());
+                if (!m_decoder)
+                    throw "Input: unknown decoder in source prompt";
+            }
+            else
+            {
+                av_dict_set(&options, name.c_str(), value.c_str(), 0);
+            }
+        }
+    }
+    catch (const char*)
+    {
+        av_dict_free(&options);
+        throw;
+    }
+
+    m_options.reset(options);
+    if (m_url.empty())
+        throw "Input: source prompt has no url";
+}
+
+SourceDescriptorPtr compile_source_descriptor(const std::string& prompt)
+{
+    return std::make_shared<const SourceDescriptor>(prompt);
+}
@@ -0,0 +1,117 @@
+/*
+* Source prompts compiled once into immutable descriptors.
+*
+* A source prompt is written like the input half of an ffmpeg command line, e.g.
+* "-f pulse -ar 48000 -ac 2 -i default" or "-i 'http://radio.example/live stream.mp3'". Parsing it
+* (tokenizing, looking up the input format and decoder, building the options dictionary) happens
+* once when the source is added to the config, not on every switch: ConfigStore keeps a
+* SourceDescriptor next to every prompt and InputStream opens a source straight from one.
+*
+* Prompts are split into arguments like a shell would: whitespace separates them, '...' quotes
+* everything up to the next ', "..." quotes with backslash escapes and a backslash outside quotes
+* escapes the next character. An option is a "-" followed by a name, it takes the next argument as
+* its value unless that is another option, in which case it's a flag set to "1". The url is the
+* value of -i or, for prompts without -i, the one argument which isn't an option or a value.
+*
+* -f, -i, -ar, -ac, -c:a (or -acodec), -af (or -filter:a) and -resampler are handled by fondue, -ar
+* and -ac become the demuxer's sample_rate and ch_layout options the way ffmpeg passes them to raw
+* inputs, -c:a names the decoder to use rather than the one FFmpeg picks for the stream's codec, -af
+* is a filter chain the source's audio goes through once it is in the output format (see
+* FilterGraph.h) and -resampler names the resampler profile converting it there (see
+* ResamplerProfiles.h). Every other option, -probesize and -analyzeduration included, is handed to
+* avformat_open_input as is.
+*
+* A prompt which can't be compiled still gives a descriptor, one which isn't valid() and whose
+* error() is thrown when a source is opened from it, so a bad prompt in the config fails the same
+* way a source which can't be reached does.
+*/
+
+#ifndef SOURCEDESCRIPTOR_H
+#define SOURCEDESCRIPTOR_H
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/dict.h>
+}
+
+#include<cstdint>
+#include<memory>
+#include<string>
+#include<vector>
+
+#include "AVHandles.h"
+#include "ResamplerProfiles.h"
+
+/*splits a prompt into arguments, throws a const char* exception for an unterminated quote or trailing backslash*/
+std::vector<std::string> tokenize_prompt(const std::string& prompt);
+
+/*true for an argument which is an option name ("-f") rather than a value, negative numbers are values*/
+bool is_prompt_option(const std::string& token);
+
+/*true for an option name (without the "-") which never takes a value, like re or nostdin*/
+bool is_prompt_flag(const std::string& name);
+
+/*true if the option at tokens[i] takes tokens[i + 1] as its value, looking no further than end*/
+bool takes_prompt_value(const std::vector<std::string>& tokens, std::size_t i, std::size_t end);
+
+class SourceDescriptor
+{
+    private:
+        std::string m_prompt;
+        std::string m_url {};
+        const AVInputFormat* m_input_format {};
+        DictionaryHandle m_options {};
+        const AVCodec* m_decoder {};
+        std::string m_filters {};
+        ResamplerProfiles m_resampler_profile {};
+        bool m_has_resampler_profile {};
+        /*a string literal, null if the prompt compiled*/
+        const char* m_error {};
+
+        void compile();
+
+    public:
+        /*never throws, check valid()*/
+        explicit SourceDescriptor(std::string prompt);
+
+        SourceDescriptor(const SourceDescriptor&) = delete;
+        SourceDescriptor& operator= (const SourceDescriptor&) = delete;
+
+        bool valid() const {return !m_error;}
+
+        const char* error() const {return m_error;}
+
+        const std::string& prompt() const {return m_prompt;}
+
+        const std::string& url() const {return m_url;}
+
+        /*null to let FFmpeg guess from the url and the data*/
+        const AVInputFormat* input_format() const {return m_input_format;}
+
+        /*true for a capture device input format (alsa, pulse, v4l2...), which may not open twice at once*/
+        bool capture_device() const
+        {
+            return m_input_format && m_input_format->priv_class && AV_IS_INPUT_DEVICE(m_input_format->priv_class->category);
+        }
+
+        /*copy before handing to avformat_open_input, which consumes what it recognises*/
+        const AVDictionary* options() const {return m_options.get();}
+
+        /*the -c:a decoder, null to let FFmpeg pick the decoder for the stream's codec*/
+        const AVCodec* decoder() const {return m_decoder;}
+
+        /*the -af filter chain, empty for none*/
+        const std::string& filters() const {return m_filters;}
+
+        /*the -resampler profile, the default profile at the time of asking for a prompt without one*/
+        ResamplerProfiles resampler_profile() const {return m_has_resampler_profile ? m_resampler_profile : default_resampler_profile;}
+};
+
+/*shared so a source being opened keeps its descriptor even if the config drops it meanwhile*/
+using SourceDescriptorPtr = std::shared_ptr<const SourceDescriptor>;
+
+SourceDescriptorPtr compile_source_descriptor(const std::string& prompt);
+
+#endif
@@ -0,0 +1,283 @@
+#include "SourceProber.h"
+
+#include<algorithm>
+#include<cmath>
+
+using json = nlohmann::json;
+
+SourceProber::SourceProber(ConfigStore& config_store, const AVCodecContext& output_codec_ctx, ProberSettings settings):
+    m_config_store {config_store},
+    m_output_codec_ctx {output_codec_ctx},
+    m_settings {std::move(settings)}
+{
+}
+
+SourceProber::~SourceProber()
+{
+    stop();
+}
+
+void SourceProber::start()
+{
+    if (!m_settings.enabled || m_settings.workers <= 0)
+        return;
+
+    for (int i = 0; i < m_settings.workers; i++)
+        m_workers.emplace_back(&SourceProber::work, this);
+    m_round_thread = std::thread {&SourceProber::run_rounds, this};
+}
+
+void SourceProber::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock (m_mtx);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    /*workers part way through a probe finish it first, at worst after the probe timeout*/
+    if (m_round_thread.joinable())
+        m_round_thread.join();
+    for (std::thread& worker : m_workers)
+    {
+        if (worker.joinable())
+            worker.join();
+    }
+}
+
+void SourceProber::enqueue(const std::string& name)
+{
+    if (std::find(m_settings.exclude.begin(), m_settings.exclude.end(), name) != m_settings.exclude.end())
+        return;
+    if (m_queued.insert(name).second)
+        m_queue.push_back(name);
+}
+
+void SourceProber::probe_soon(const std::string& name)
+{
+    {
+        std::lock_guard<std::mutex> lock (m_mtx);
+        enqueue(name);
+    }
+    m_cv.notify_all();
+}
+
+void SourceProber::run_rounds()
+{
+    std::unique_lock<std::mutex> lock (m_mtx);
+    while (!m_stop)
+    {
+        if (std::chrono::steady_clock::now() < m_next_round)
+        {
+            m_cv.wait_until(lock, m_next_round);
+            continue;
+        }
+
+        /*read the config without holding the lock the workers need*/
+        lock.unlock();
+        json sources {m_config_store.sources()};
+        std::string active_source {m_config_store.active_source()};
+        lock.lock();
+
+        for (auto item = sources.begin(); item != sources.end(); ++item)
+        {
+            if (item.key() != active_source)
+                enqueue(item.key());
+        }
+        /*forget sources which have been deleted*/
+        for (auto result = m_results.begin(); result != m_results.end(); )
+        {
+            if (!sources.contains(result->first))
+                result = m_results.erase(result);
+            else
+                ++result;
+        }
+        for (auto device = m_devices.begin(); device != m_devices.end(); )
+        {
+            if (!sources.contains(*device))
+                device = m_devices.erase(device);
+            else
+                ++device;
+        }
+        m_next_round = std::chrono::steady_clock::now() + std::chrono::seconds(m_settings.interval_seconds);
+        m_cv.notify_all();
+    }
+}
+
+void SourceProber::work()
+{
+    std::unique_lock<std::mutex> lock (m_mtx);
+    while (true)
+    {
+        m_cv.wait(lock, [this]{return m_stop || !m_queue.empty();});
+        if (m_stop)
+            return;
+
+        std::string name {std::move(m_queue.front())};
+        m_queue.pop_front();
+        lock.unlock();
+
+        SourceDescriptorPtr descriptor {m_config_store.find_descriptor(name)};
+        /*the active source is already open on the audio thread, opening it again may fail (or steal a device)*/
+        const bool device {descriptor && descriptor->capture_device() && !m_settings.probe_devices};
+        const bool skip {!descriptor || device || m_config_store.active_source() == name};
+        SourceHealth result {};
+        if (!skip)
+            result = probe(*descriptor);
+
+        lock.lock();
+        /*removed from the queued set only now, so a source isn't probed twice at once*/
+        m_queued.erase(name);
+        if (device)
+            m_devices.insert(name);
+        else
+            m_devices.erase(name);
+        if (skip)
+            continue;
+
+        const SourceHealth& previous {m_results[name]};
+        result.probes = previous.probes + 1;
+        result.consecutive_failures = result.ok ? 0 : previous.consecutive_failures + 1;
+        m_results[name] = std::move(result);
+    }
+}
+
+SourceHealth SourceProber::probe(const SourceDescriptor& descriptor) const
+{
+    SourceHealth result {};
+    result.checked_at = std::chrono::system_clock::now();
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::seconds(m_settings.timeout_seconds);
+
+    try
+    {
+        InputStream source {descriptor, m_output_codec_ctx, SourceTimingModes::freetime, DefaultSourceModes::silence, deadline};
+        LevelMeter meter {};
+        float peak {};
+        double sum_squares {};
+
+        for (int frame = 0; frame <= m_settings.frames; frame++)
+        {
+            source.get_one_output_frame();
+            if (frame == 0)
+                result.open_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            meter_frame(meter, source.get_frame());
+            const LevelSnapshot levels {meter.snapshot()};
+            float frame_rms {};
+            for (int channel = 0; channel < levels.channels; channel++)
+            {
+                peak = std::max(peak, levels.peak[channel]);
+                frame_rms = std::max(frame_rms, levels.rms[channel]);
+            }
+            sum_squares += static_cast<double>(frame_rms) * frame_rms;
+        }
+
+        result.ok = true;
+        result.peak_dbfs = level_to_dbfs(peak);
+        result.rms_dbfs = level_to_dbfs(static_cast<float>(std::sqrt(sum_squares / (m_settings.frames + 1))));
+        pipeline_metrics.source_probes.add();
+    }
+    catch (const char* exception)
+    {
+        result.error = std::chrono::steady_clock::now() >= deadline ? "timed out" : exception;
+        pipeline_metrics.source_probe_failures.add();
+    }
+    return result;
+}
+
+bool SourceProber::probes(const std::string& name) const
+{
+    if (std::find(m_settings.exclude.begin(), m_settings.exclude.end(), name) != m_settings.exclude.end())
+        return false;
+    SourceDescriptorPtr descriptor {m_config_store.find_descriptor(name)};
+    return !descriptor || !descriptor->capture_device() || m_settings.probe_devices;
+}
+
+bool SourceProber::health(const std::string& name, SourceHealth& health) const
+{
+    std::lock_guard<std::mutex> lock (m_mtx);
+    auto result = m_results.find(name);
+    if (result == m_results.end())
+        return false;
+    health = result->second;
+    return true;
+}
+
+json SourceProber::status() const
+{
+    json sources {m_config_store.sources()};
+    std::string active_source {m_config_store.active_source()};
+    auto now = std::chrono::system_clock::now();
+
+    json status = json::object();
+    std::lock_guard<std::mutex> lock (m_mtx);
+    for (auto item = sources.begin(); item != sources.end(); ++item)
+    {
+        const std::string& name {item.key()};
+        json entry = json::object();
+        if (name == active_source)
+        {
+            /*not probed while on air, its health is what the audio thread is playing*/
+            const LevelSnapshot levels {level_meters.playing.snapshot()};
+            float peak {}, rms {};
+            for (int channel = 0; channel < levels.channels; channel++)
+            {
+                peak = std::max(peak, levels.peak[channel]);
+                rms = std::max(rms, levels.rms[channel]);
+            }
+            entry = {{"state", "active"}, {"peak dbfs", level_to_dbfs(peak)}, {"rms dbfs", level_to_dbfs(rms)}};
+        }
+
+        auto result = m_results.find(name);
+        if (result == m_results.end())
+        {
+            if (name != active_source && m_devices.count(name))
+                entry["state"] = "device, not probed";
+            else if (name != active_source)
+                entry["state"] = m_queued.count(name) ? "queued" : "unknown";
+            status[name] = entry;
+            continue;
+        }
+
+        const SourceHealth& health {result->second};
+        if (name != active_source)
+        {
+            entry["state"] = health.ok ? "ok" : "failed";
+            entry["peak dbfs"] = health.peak_dbfs;
+            entry["rms dbfs"] = health.rms_dbfs;
+        }
+        if (!health.ok)
+            entry["error"] = health.error;
+        entry["open seconds"] = health.open_seconds;
+        entry["age seconds"] = std::chrono::duration<double>(now - health.checked_at).count();
+        entry["probes"] = health.probes;
+        entry["consecutive failures"] = health.consecutive_failures;
+        status[name] = entry;
+    }
+    return status;
+}
+
+ProberSettings prober_settings_from_config(const json& config)
+{
+    ProberSettings settings {};
+    if (!config.contains("probing"))
+        return settings;
+
+    const json& probing {config["probing"]};
+    try
+    {
+        settings.enabled = probing.value("enabled", settings.enabled);
+        settings.interval_seconds = std::max(1, probing.value("interval seconds", settings.interval_seconds));
+        settings.workers = probing.value("workers", settings.workers);
+        settings.timeout_seconds = std::max(1, probing.value("timeout seconds", settings.timeout_seconds));
+        settings.frames = std::max(0, probing.value("frames", settings.frames));
+        settings.exclude = probing.value("exclude", settings.exclude);
+        settings.probe_devices = probing.value("probe devices", settings.probe_devices);
+    }
+    catch (const json::exception& exception)
+    {
+        std::cout << "probing: " << exception.what() << ", using the defaults\n";
+        return ProberSettings {};
+    }
+    return settings;
+}
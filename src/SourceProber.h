@@ -0,0 +1,127 @@
+/*
+* Background health checks of every configured source.
+*
+* Every interval the prober queues each source in the config (other than the one on air, which
+* the audio thread is already reading) and a small fixed pool of worker threads works through
+* the queue concurrently: each probe opens the source from its compiled descriptor, decodes a
+* few output frames and measures their level, giving up at the probe timeout through the
+* source's IO interrupt callback so a dead stream can't hold a worker for longer. The latest
+* result for each source is cached with the time it was taken, so switching decisions and
+* failover can read fresh health without opening anything.
+*
+* Sources added or changed (through the control API or by editing the config) are probed
+* straight away rather than waiting for the next round. Settings come from the optional
+* "probing" section of the config, e.g.
+* {"interval seconds": 60, "workers": 2, "timeout seconds": 10, "exclude": ["usb soundcard"]}
+* where "exclude" lists sources which mustn't be opened twice. Sources read through a capture device
+* input format (alsa, pulse, v4l2...) are never probed unless "probe devices" is true, opening the
+* device a second time would fail or take it from the audio thread when it is switched to.
+*/
+
+#ifndef SOURCEPROBER_H
+#define SOURCEPROBER_H
+
+#include "Fonduempeg.h"
+#include "ConfigStore.h"
+#include <nlohmann/json.hpp>
+#include<chrono>
+#include<condition_variable>
+#include<deque>
+#include<mutex>
+#include<string>
+#include<thread>
+#include<unordered_map>
+#include<unordered_set>
+#include<vector>
+
+#define DEFAULT_PROBE_INTERVAL_SECONDS 60
+#define DEFAULT_PROBE_WORKERS 2
+/*output frames decoded and metered by each probe, after the first*/
+#define DEFAULT_PROBE_FRAMES 8
+
+struct ProberSettings
+{
+    bool enabled {true};
+    int interval_seconds {DEFAULT_PROBE_INTERVAL_SECONDS};
+    int workers {DEFAULT_PROBE_WORKERS};
+    int timeout_seconds {DEFAULT_TIMEOUT};
+    int frames {DEFAULT_PROBE_FRAMES};
+    std::vector<std::string> exclude {};
+    bool probe_devices {false};
+};
+
+/*the outcome of the latest probe of one source*/
+struct SourceHealth
+{
+    bool ok {false};
+    /*why the probe failed, empty if it succeeded*/
+    std::string error {};
+    /*from starting to open the source to its first output frame*/
+    double open_seconds {};
+    /*loudest channel over the probed frames*/
+    double peak_dbfs {METER_FLOOR_DBFS};
+    double rms_dbfs {METER_FLOOR_DBFS};
+    std::chrono::system_clock::time_point checked_at {};
+    uint64_t probes {};
+    uint64_t consecutive_failures {};
+};
+
+class SourceProber
+{
+    private:
+        ConfigStore& m_config_store;
+        const AVCodecContext& m_output_codec_ctx;
+        ProberSettings m_settings;
+
+        mutable std::mutex m_mtx;
+        std::condition_variable m_cv;
+        /*sources waiting for a worker, each at most once*/
+        std::deque<std::string> m_queue {};
+        std::unordered_set<std::string> m_queued {};
+        std::unordered_map<std::string, SourceHealth> m_results {};
+        /*capture device sources found by the workers and left alone*/
+        std::unordered_set<std::string> m_devices {};
+        std::chrono::steady_clock::time_point m_next_round {};
+        bool m_stop {false};
+        std::thread m_round_thread;
+        std::vector<std::thread> m_workers {};
+
+        void run_rounds();
+        void work();
+
+        /*opens, decodes and meters one source, never throws*/
+        SourceHealth probe(const SourceDescriptor& descriptor) const;
+
+        /*call with m_mtx held*/
+        void enqueue(const std::string& name);
+
+    public:
+        SourceProber(ConfigStore& config_store, const AVCodecContext& output_codec_ctx, ProberSettings settings);
+
+        ~SourceProber();
+
+        SourceProber(const SourceProber&) = delete;
+        SourceProber& operator= (const SourceProber&) = delete;
+
+        /*starts the workers and the first round, does nothing if probing is disabled*/
+        void start();
+
+        void stop();
+
+        /*probes a source as soon as a worker is free, e.g. after it was added or changed*/
+        void probe_soon(const std::string& name);
+
+        /*false for a source which is never probed: excluded, or a capture device (unless "probe devices")*/
+        bool probes(const std::string& name) const;
+
+        /*the latest result for a source, false if it hasn't been probed*/
+        bool health(const std::string& name, SourceHealth& health) const;
+
+        /*every source in the config with its latest result, the active source shows the playing levels*/
+        nlohmann::json status() const;
+};
+
+/*settings from the optional "probing" section of the config*/
+ProberSettings prober_settings_from_config(const nlohmann::json& config);
+
+#endif
@@ -0,0 +1,223 @@
+#include "Trace.h"
+
+#include<algorithm>
+#include<ctime>
+#include<fstream>
+#include<iomanip>
+#include<iostream>
+
+Tracer tracer {};
+
+namespace
+{
+    thread_local TraceRing* thread_ring {};
+
+    /*keeps the json valid whatever a span or thread is called*/
+    void write_json_string(std::ostream& stream, const std::string& string)
+    {
+        stream << '"';
+        for (char c : string)
+        {
+            if (c == '"' || c == '\\')
+                stream << '\\' << c;
+            else if (static_cast<unsigned char>(c) < 0x20)
+                stream << ' ';
+            else
+                stream << c;
+        }
+        stream << '"';
+    }
+}
+
+void TraceRing::copy(std::vector<TraceEvent>& events) const
+{
+    uint64_t end = m_written.load(std::memory_order_acquire);
+    uint64_t begin = end > TRACE_RING_CAPACITY ? end - TRACE_RING_CAPACITY : 0;
+    std::size_t first = events.size();
+
+    for (uint64_t index = begin; index < end; index++)
+    {
+        const Record& record = m_records[index & (TRACE_RING_CAPACITY - 1)];
+        events.push_back({record.name.load(std::memory_order_relaxed), record.start_ns.load(std::memory_order_relaxed),
+                          record.duration_ns.load(std::memory_order_relaxed)});
+    }
+
+    /*the writer may have lapped the start of the copy, it can also be part way through
+    * overwriting the record after those it has published*/
+    uint64_t after = m_written.load(std::memory_order_acquire);
+    uint64_t valid_from = after + 1 > TRACE_RING_CAPACITY ? after + 1 - TRACE_RING_CAPACITY : 0;
+    if (valid_from > begin)
+    {
+        std::size_t overwritten = std::min<uint64_t>(valid_from - begin, end - begin);
+        events.erase(events.begin() + first, events.begin() + first + overwritten);
+    }
+}
+
+Tracer::~Tracer()
+{
+    stop_dump_thread();
+}
+
+void Tracer::trace_this_thread(const std::string& thread_name)
+{
+    if (thread_ring)
+        return;
+
+    std::lock_guard<std::mutex> lock (m_mtx);
+    auto ring = std::make_shared<TraceRing>(thread_name, static_cast<int>(m_rings.size()) + 1);
+    m_rings.push_back(ring);
+    thread_ring = ring.get();
+}
+
+TraceRing* Tracer::this_thread_ring()
+{
+    return thread_ring;
+}
+
+void Tracer::write_chrome_json(const std::string& path) const
+{
+    std::vector<std::shared_ptr<TraceRing>> rings {};
+    {
+        std::lock_guard<std::mutex> lock (m_mtx);
+        rings = m_rings;
+    }
+
+    std::ofstream file {path};
+    if (!file)
+        throw "Trace: could not open the trace file for writing";
+
+    file << std::fixed << std::setprecision(3);
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    std::vector<TraceEvent> events {};
+
+    for (const auto& ring : rings)
+    {
+        if (!first)
+            file << ",\n";
+        first = false;
+        file << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << ring->thread_id()
+             << ", \"args\": {\"name\": ";
+        write_json_string(file, ring->thread_name());
+        file << "}}";
+
+        events.clear();
+        ring->copy(events);
+        for (const TraceEvent& event : events)
+        {
+            /*complete events, timestamps in microseconds*/
+            file << ",\n{\"name\": ";
+            write_json_string(file, event.name ? event.name : "unknown");
+            file << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << ring->thread_id()
+                 << ", \"ts\": " << event.start_ns / 1e3 << ", \"dur\": " << event.duration_ns / 1e3 << '}';
+        }
+    }
+    file << "\n]}\n";
+
+    if (!file)
+        throw "Trace: could not write the trace file";
+}
+
+double Tracer::calibrate()
+{
+    const int spans = 100000;
+    /*a private ring so calibration doesn't fill the real ones with noise*/
+    auto ring = std::make_unique<TraceRing>("calibration", 0);
+    TraceRing* previous_ring = thread_ring;
+    thread_ring = ring.get();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < spans; i++)
+    {
+        TraceSpan span {"calibration"};
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    thread_ring = previous_ring;
+
+    m_span_cost_ns = elapsed.count() / spans;
+    if (m_span_cost_ns > TRACE_MAX_SPAN_OVERHEAD_NS)
+    {
+        std::cout << "tracing disabled: one span costs " << m_span_cost_ns << " ns, over the "
+                  << TRACE_MAX_SPAN_OVERHEAD_NS << " ns budget\n";
+        set_enabled(false);
+    }
+    return m_span_cost_ns;
+}
+
+void Tracer::start_dump_thread(const std::string& directory)
+{
+    m_directory = directory;
+    m_stop = false;
+    m_dump_thread = std::thread {&Tracer::dump_on_request, this};
+}
+
+void Tracer::stop_dump_thread()
+{
+    m_stop = true;
+    if (m_dump_thread.joinable())
+        m_dump_thread.join();
+}
+
+void Tracer::dump_on_request()
+{
+    auto last_dump = std::chrono::steady_clock::now() - std::chrono::seconds(TRACE_AUTO_DUMP_INTERVAL_SECONDS);
+
+    while (!m_stop)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (!m_dump_requested.exchange(false, std::memory_order_relaxed))
+            continue;
+        if (std::chrono::steady_clock::now() - last_dump < std::chrono::seconds(TRACE_AUTO_DUMP_INTERVAL_SECONDS))
+            continue;
+
+        /*the rings hold the last few seconds so the glitch is still in them*/
+        std::string path {m_directory + "/fondue-trace-" + std::to_string(std::time(nullptr)) + ".json"};
+        try
+        {
+            write_chrome_json(path);
+            m_dumps++;
+            std::cout << "deadline missed, trace written to " << path << '\n';
+        }
+        catch (const char* exception)
+        {
+            std::cout << exception << '\n';
+        }
+        last_dump = std::chrono::steady_clock::now();
+    }
+}
+
+void Tracer::print_stats(std::ostream& stream, uint64_t frames, double frame_duration_ms) const
+{
+#ifndef FONDUE_ENABLE_TRACING
+    stream << "tracing not compiled in, build with -DFONDUE_TRACING=ON\n";
+#endif
+
+    std::vector<std::shared_ptr<TraceRing>> rings {};
+    {
+        std::lock_guard<std::mutex> lock (m_mtx);
+        rings = m_rings;
+    }
+
+    std::ios_base::fmtflags stream_flags {stream.flags()};
+    std::streamsize stream_precision {stream.precision()};
+    stream << std::fixed << std::setprecision(1);
+    stream << "tracing " << (enabled() ? "on" : "off") << ", " << m_span_cost_ns << " ns per span, "
+           << m_dumps.load() << " automatic dumps\n";
+
+    for (const auto& ring : rings)
+    {
+        stream << ring->thread_name() << ": " << ring->written() << " spans";
+        if (ring->thread_name() == "audio" && frames)
+        {
+            double spans_per_frame = static_cast<double>(ring->written()) / frames;
+            double overhead_us = spans_per_frame * m_span_cost_ns / 1e3;
+            stream << ", " << spans_per_frame << " per frame, ~" << overhead_us << " us per frame ("
+                   << std::setprecision(3) << 100 * overhead_us / (frame_duration_ms * 1e3) << "% of the frame)"
+                   << std::setprecision(1);
+        }
+        stream << '\n';
+    }
+
+    stream.flags(stream_flags);
+    stream.precision(stream_precision);
+}
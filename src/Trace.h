@@ -0,0 +1,186 @@
+/*
+* Trace spans around the individual FFmpeg calls in the audio path, for finding out which call
+* caused a glitch.
+*
+* FONDUE_TRACE_SPAN("name") times the rest of the enclosing scope and writes one record into a
+* ring buffer owned by the calling thread: a single writer, no locks and no allocation. Only
+* threads which have called Tracer::trace_this_thread() record anything, so short lived threads
+* don't each get a ring. The rings can be dumped at any time (by command, or automatically soon
+* after the audio loop misses a deadline) as Chrome trace event JSON, which chrome://tracing and
+* ui.perfetto.dev both open.
+*
+* Spans compile to nothing unless fondue is built with FONDUE_ENABLE_TRACING (cmake
+* -DFONDUE_TRACING=ON). When enabled the cost of one span is measured at startup and tracing is
+* switched off if it exceeds TRACE_MAX_SPAN_OVERHEAD_NS; trace-stats reports the measured cost
+* per output frame.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include<array>
+#include<atomic>
+#include<chrono>
+#include<cstdint>
+#include<memory>
+#include<mutex>
+#include<ostream>
+#include<string>
+#include<thread>
+#include<vector>
+
+/*records kept per thread, a power of two*/
+#define TRACE_RING_CAPACITY 16384
+/*tracing is switched off if a span costs more than this*/
+#define TRACE_MAX_SPAN_OVERHEAD_NS 1000
+/*deadline misses trigger at most one automatic dump in this interval*/
+#define TRACE_AUTO_DUMP_INTERVAL_SECONDS 30
+#define DEFAULT_TRACE_DIRECTORY "/tmp"
+
+#ifdef FONDUE_ENABLE_TRACING
+#define FONDUE_TRACE_CONCAT_(a, b) a##b
+#define FONDUE_TRACE_CONCAT(a, b) FONDUE_TRACE_CONCAT_(a, b)
+#define FONDUE_TRACE_SPAN(name) TraceSpan FONDUE_TRACE_CONCAT(trace_span_, __LINE__) {name}
+#define FONDUE_TRACE_DEADLINE_MISSED() tracer.request_dump()
+#else
+#define FONDUE_TRACE_SPAN(name) do {} while (0)
+#define FONDUE_TRACE_DEADLINE_MISSED() do {} while (0)
+#endif
+
+/*a copy of one record taken while dumping*/
+struct TraceEvent
+{
+    const char* name;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+};
+
+/*fixed size ring of span records written by one thread and read by the dumping thread*/
+class TraceRing
+{
+    private:
+        struct Record
+        {
+            std::atomic<const char*> name {};
+            std::atomic<uint64_t> start_ns {};
+            std::atomic<uint64_t> duration_ns {};
+        };
+
+        std::array<Record, TRACE_RING_CAPACITY> m_records {};
+        std::atomic<uint64_t> m_written {};
+        std::string m_thread_name;
+        int m_thread_id;
+
+    public:
+        TraceRing(std::string thread_name, int thread_id):
+            m_thread_name {std::move(thread_name)},
+            m_thread_id {thread_id}
+        {
+        }
+
+        /*called only by the owning thread*/
+        void record(const char* name, uint64_t start_ns, uint64_t duration_ns)
+        {
+            uint64_t index = m_written.load(std::memory_order_relaxed);
+            Record& record = m_records[index & (TRACE_RING_CAPACITY - 1)];
+            record.name.store(name, std::memory_order_relaxed);
+            record.start_ns.store(start_ns, std::memory_order_relaxed);
+            record.duration_ns.store(duration_ns, std::memory_order_relaxed);
+            m_written.store(index + 1, std::memory_order_release);
+        }
+
+        /*copies the records still in the ring, skipping any overwritten while copying*/
+        void copy(std::vector<TraceEvent>& events) const;
+
+        uint64_t written() const {return m_written.load(std::memory_order_relaxed);}
+
+        const std::string& thread_name() const {return m_thread_name;}
+
+        int thread_id() const {return m_thread_id;}
+};
+
+class Tracer
+{
+    private:
+        mutable std::mutex m_mtx;
+        std::vector<std::shared_ptr<TraceRing>> m_rings {};
+        std::atomic<bool> m_enabled {true};
+        std::atomic<bool> m_dump_requested {false};
+        std::atomic<uint64_t> m_dumps {};
+        double m_span_cost_ns {};
+        const std::chrono::steady_clock::time_point m_epoch {std::chrono::steady_clock::now()};
+
+        /*automatic dumps*/
+        std::string m_directory {DEFAULT_TRACE_DIRECTORY};
+        std::atomic<bool> m_stop {false};
+        std::thread m_dump_thread;
+
+        void dump_on_request();
+
+    public:
+        ~Tracer();
+
+        /*give the calling thread a ring so its spans are recorded, call before it starts realtime work*/
+        void trace_this_thread(const std::string& thread_name);
+
+        /*the calling thread's ring or null if it isn't traced*/
+        static TraceRing* this_thread_ring();
+
+        bool enabled() const {return m_enabled.load(std::memory_order_relaxed);}
+
+        void set_enabled(bool enabled) {m_enabled.store(enabled, std::memory_order_relaxed);}
+
+        uint64_t now_ns() const
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_epoch).count();
+        }
+
+        /*asks the dump thread to write a trace soon, safe to call from the audio thread*/
+        void request_dump() {m_dump_requested.store(true, std::memory_order_relaxed);}
+
+        /*writes every ring as Chrome trace event JSON, throws a const char* exception on failure*/
+        void write_chrome_json(const std::string& path) const;
+
+        /*measures the cost of one span and switches tracing off if it is over budget, returns the cost in ns*/
+        double calibrate();
+
+        /*start writing a trace to directory whenever a dump has been requested*/
+        void start_dump_thread(const std::string& directory);
+
+        void stop_dump_thread();
+
+        /*spans recorded per thread, measured cost per span and the resulting overhead per output frame
+        * of the thread named "audio", given the number of frames it has produced and their duration*/
+        void print_stats(std::ostream& stream, uint64_t frames, double frame_duration_ms) const;
+};
+
+extern Tracer tracer;
+
+/*times the enclosing scope, use through FONDUE_TRACE_SPAN so it compiles away when tracing is disabled*/
+class TraceSpan
+{
+    private:
+        const char* m_name;
+        TraceRing* m_ring;
+        uint64_t m_start_ns {};
+
+    public:
+        explicit TraceSpan(const char* name):
+            m_name {name},
+            m_ring {tracer.enabled() ? Tracer::this_thread_ring() : nullptr}
+        {
+            if (m_ring)
+                m_start_ns = tracer.now_ns();
+        }
+
+        ~TraceSpan()
+        {
+            if (m_ring)
+                m_ring->record(m_name, m_start_ns, tracer.now_ns() - m_start_ns);
+        }
+
+        TraceSpan(const TraceSpan&) = delete;
+        TraceSpan& operator= (const TraceSpan&) = delete;
+};
+
+#endif
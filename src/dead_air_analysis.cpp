@@ -0,0 +1,166 @@
+#include "fondue.h"
+#include<iomanip>
+
+/*
+* Dead air analysis mode: runs a recorded fixture through the dead air detector as fast as it decodes
+* and compares what the detector found with the silences marked in the fixture, so thresholds can be
+* tuned (and regressions caught) against real recordings rather than live on air.
+*
+* example fixture:
+* {
+*     "prompt": "-i fixtures/desk_muted_at_90s.wav",
+*     "silences": [[90, 400]],
+*     "failover": {"threshold dbfs": -50, "silence seconds": 10},
+*     "max latency seconds": 12
+* }
+* "silences" are the [start, end] seconds of the stretches that should count as dead air, "failover"
+* takes the same dead air settings as the config. Each marked silence at least "silence seconds" long
+* must be detected, its latency is the time from the start of the silence to the detection. Any
+* detection starting outside a marked silence is a false positive. The analysis fails (exit code 1)
+* on a missed silence, a false positive, or a latency over "max latency seconds" if that is given.
+*/
+
+/*an mp3 frame at the rate of the usual mp3 output, what the realtime detector sees*/
+#define ANALYSIS_FRAME_SIZE 1152
+#define ANALYSIS_SAMPLE_RATE 44100
+
+int analyse_dead_air(const std::string& fixture_path)
+{
+    json fixture = json::object();
+    try
+    {
+        fixture = open_config_file(fixture_path);
+    }
+    catch (const json::exception& exception)
+    {
+        std::cout << "analyse: could not read fixture: " << exception.what() << '\n';
+        return 1;
+    }
+    if (!fixture.contains("prompt"))
+    {
+        std::cout << "analyse: fixture needs a \"prompt\"\n";
+        return 1;
+    }
+
+    std::vector<std::pair<double, double>> silences {};
+    try
+    {
+        for (const json& silence : fixture.value("silences", json::array()))
+            silences.emplace_back(silence.at(0).get<double>(), silence.at(1).get<double>());
+    }
+    catch (const json::exception& exception)
+    {
+        std::cout << "analyse: \"silences\" should be [start, end] pairs of seconds: " << exception.what() << '\n';
+        return 1;
+    }
+    const DeadAirSettings settings {failover_settings_from_config(fixture, "").dead_air};
+
+    /*what InputStream converts the fixture to, as it would for an encoder. allocated by FFmpeg, sizeof(AVCodecContext)
+    * isn't part of its ABI*/
+    CodecContextHandle output_codec_handle {avcodec_alloc_context3(NULL)};
+    if (!output_codec_handle)
+    {
+        std::cout << "analyse: could not allocate a codec context\n";
+        return 1;
+    }
+    AVCodecContext& output_codec_ctx {*output_codec_handle};
+    output_codec_ctx.sample_fmt = AV_SAMPLE_FMT_FLTP;
+    output_codec_ctx.sample_rate = fixture.value("sample rate", ANALYSIS_SAMPLE_RATE);
+    output_codec_ctx.frame_size = ANALYSIS_FRAME_SIZE;
+    av_channel_layout_default(&output_codec_ctx.ch_layout, 2);
+    const int sample_rate {output_codec_ctx.sample_rate};
+
+    std::unique_ptr<InputStream> source {};
+    try
+    {
+        SourceDescriptor descriptor {fixture["prompt"].get<std::string>()};
+        source = std::make_unique<InputStream>(descriptor, output_codec_ctx, SourceTimingModes::freetime, DefaultSourceModes::silence);
+    }
+    catch (const char* exception)
+    {
+        std::cout << "analyse: " << exception << '\n';
+        return 1;
+    }
+
+    DeadAirDetector detector {};
+    detector.configure(settings, sample_rate, ANALYSIS_FRAME_SIZE);
+    LevelMeter meter {};
+    /*start and end (seconds) of each stretch the detector reported dead air*/
+    std::vector<std::pair<double, double>> detections {};
+    int64_t position {};
+
+    while (true)
+    {
+        try
+        {
+            source->get_one_output_frame();
+        }
+        /*the end of the fixture*/
+        catch (const char*)
+        {
+            break;
+        }
+        const AVFrame* frame {source->get_frame()};
+        position += frame->nb_samples;
+        meter_frame(meter, frame);
+        const bool was_dead_air {detector.dead_air()};
+        const bool dead_air {detector.process(meter.snapshot(), frame->nb_samples)};
+        const double now {static_cast<double>(position) / sample_rate};
+        if (dead_air && !was_dead_air)
+            detections.emplace_back(now, now);
+        if (dead_air)
+            detections.back().second = now;
+    }
+    const double duration {static_cast<double>(position) / sample_rate};
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "analyse: " << duration << " s analysed, threshold " << settings.threshold_dbfs << " dBFS, window "
+              << settings.window_seconds << " s, dead air after " << settings.trigger_seconds << " s\n";
+
+    /*a detection belongs to a silence if it starts inside it, or within a window of its end*/
+    auto inside = [&](double at, const std::pair<double, double>& silence)
+    {
+        return at >= silence.first && at <= silence.second + settings.window_seconds;
+    };
+
+    int missed {}, false_positives {};
+    double worst_latency {};
+    for (const auto& silence : silences)
+    {
+        auto detection = std::find_if(detections.begin(), detections.end(),
+                                      [&](const std::pair<double, double>& d){return inside(d.first, silence);});
+        const bool expected {silence.second - silence.first >= settings.trigger_seconds};
+        std::cout << "silence " << silence.first << " - " << silence.second << " s: ";
+        if (detection == detections.end())
+        {
+            std::cout << (expected ? "missed\n" : "not detected (shorter than the trigger)\n");
+            missed += expected;
+            continue;
+        }
+        const double latency {detection->first - silence.first};
+        worst_latency = std::max(worst_latency, latency);
+        std::cout << "detected after " << latency << " s\n";
+    }
+
+    for (const auto& detection : detections)
+    {
+        if (std::none_of(silences.begin(), silences.end(), [&](const std::pair<double, double>& s){return inside(detection.first, s);}))
+        {
+            std::cout << "false positive: " << detection.first << " - " << detection.second << " s\n";
+            false_positives++;
+        }
+    }
+
+    std::cout << "analyse: " << detections.size() << " detections, " << missed << " missed, " << false_positives
+              << " false positives (" << (duration > 0 ? false_positives * 3600 / duration : 0) << " per hour)";
+    if (!silences.empty())
+        std::cout << ", worst latency " << worst_latency << " s";
+    std::cout << '\n';
+
+    if (fixture.contains("max latency seconds") && worst_latency > fixture["max latency seconds"].get<double>())
+    {
+        std::cout << "analyse: latency over the " << fixture["max latency seconds"].get<double>() << " s allowed\n";
+        return 1;
+    }
+    return missed || false_positives ? 1 : 0;
+}
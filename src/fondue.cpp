@@ -1,290 +1,847 @@
-#include "Fonduempeg.h"
-#include <nlohmann/json.hpp>
+#include "fondue.h"
+#include "ControlServer.h"
+#include<ctime>
 #include<fstream>
-#include<vector>
+#include<sstream>
+#include<poll.h>
+#include<unistd.h>
 
-#define PATH_TO_CONFIG_FILE "/home/icradio/fondue/config_files/config.json"
-
-using json = nlohmann::json;
-
-std::mutex new_source_mtx;
-
-
-void continue_streaming (InputStream& source, InputStream& new_source, OutputStream& sink, 
-                         std::chrono::_V2::steady_clock::time_point& end_time, ControlFlags& flags);
-InputStream&& crossfade (InputStream& source, InputStream& new_source, 
-                        OutputStream& sink, std::chrono::_V2::steady_clock::time_point& end_time, ControlFlags& flags);
-void audio_processing (InputStream &source, InputStream &new_source, 
-                        OutputStream &sink, ControlFlags& flags);
-void audio_processing (InputStream &source, InputStream &new_source, 
-                        OutputStream &sink, ControlFlags& flags);
-void control (InputStream &new_source, const AVCodecContext& 
-                        output_codec_ctx, ControlFlags& flags);
-bool find_and_remove(std::string& command, const std::string& substring);
-
-std::vector<std::string> split_command_on_whitespace(const std::string& command);
-
-json open_config_file(const std::string& file_path);
-
-void write_config_file(const json& config, const std::string& file_path);
+int main (int argc, char* argv[])
+{
+    /*fondue render [script.json]: faster than realtime render to a file, no control thread*/
+    if (argc == 3 && std::string{argv[1]} == "render")
+    {
+        avdevice_register_all();
+        return offline_render(argv[2]);
+    }
 
-void source_startup_timeout(InputStream& input, FFMPEGString& prompt, const AVCodecContext& output_codec_ctx, 
-                            SourceTimingModes& timing_mode, DefaultSourceModes& source_mode, int timeout_time);
+    /*fondue analyse [fixture.json]: run a recording through the dead air detector and score it*/
+    if (argc == 3 && std::string{argv[1]} == "analyse")
+    {
+        avdevice_register_all();
+        return analyse_dead_air(argv[2]);
+    }
 
+    /*fondue loudness [input prompt]: measure a source's loudness, to compare with ffmpeg -af ebur128*/
+    if (argc == 3 && std::string{argv[1]} == "loudness")
+    {
+        avdevice_register_all();
+        return analyse_loudness(argv[2]);
+    }
 
-int main ()
-{
+    /*fondue --config [path]: use another config file, e.g. one written by the stream harness*/
+    std::string config_path {PATH_TO_CONFIG_FILE};
+    if (argc == 3 && std::string{argv[1]} == "--config")
+        config_path = argv[2];
  
-    json config = json::object();
-    config = open_config_file(PATH_TO_CONFIG_FILE);
-    
+    /*before the config is loaded, source prompts naming a device format are compiled as they're read*/
     avdevice_register_all();
+    ConfigStore config_store {config_path};
+    json config = config_store.snapshot();
+    RealtimeSettings realtime_settings {realtime_settings_from_config(config)};
+    /*read by every source as it's opened, the default source included*/
+    loudness_from_config(config);
+    resampler_profile_from_config(config["stream settings"], ResamplerProfiles::standard);
+    /*before any source is opened, sources prepare for the steps it may take*/
+    quality_governor.configure(quality_governor_settings_from_config(config));
+
+    /*lock memory before any streams are opened so their buffers are locked too*/
+    if (realtime_settings.lock_memory)
+        lock_process_memory(realtime_settings.prefault_heap_bytes);
+    
     std::string default_source_name {config["stream settings"]["default source"]};
-    FFMPEGString input_prompt{config["sources"][default_source_name]};
+    SourceDescriptorPtr input_descriptor {config_store.find_descriptor(default_source_name)};
     FFMPEGString output_prompt{config["stream settings"]["output"]};
     
     
     OutputStream sink{output_prompt};
-    InputStream source {};
-    InputStream new_source{};
-    ControlFlags flags{};
+    sink.set_limiter(limiter_settings_from_config(config));
+    output_filter_from_config(config["stream settings"], sink);
+    std::unique_ptr<InputStream> source {};
+    AudioChannel channel {};
+    channel.provide_fallbacks(sink.get_output_codec_context(), SourceTimingModes::realtime);
     
     try
     {    
-        source = InputStream {input_prompt, sink.get_output_codec_context(),
-                                        SourceTimingModes::realtime, DefaultSourceModes::white_noise};
+        if (!input_descriptor)
+            throw "default source doesn't exist";
+        source = std::make_unique<InputStream>(*input_descriptor, sink.get_output_codec_context(),
+                                        SourceTimingModes::realtime, DefaultSourceModes::white_noise);
     }
     catch (const char* exception)
     {
         std::cout<<exception<<": failed to correctly access input, switching to default source\n";
-        source = InputStream {sink.get_output_codec_context(), DefaultSourceModes::white_noise};
+        source = std::make_unique<InputStream>(sink.get_output_codec_context(), DefaultSourceModes::white_noise);
     }
     
-    std::thread audioThread(audio_processing, std::ref(source), std::ref(new_source), std::ref(sink), std::ref(flags));
-    std::thread controlThread(control, std::ref(new_source), std::ref(sink.get_output_codec_context()), std::ref(flags));
+#ifdef FONDUE_ENABLE_TRACING
+    std::cout << "tracing enabled, " << tracer.calibrate() << " ns per span\n";
+    tracer.start_dump_thread(config.contains("tracing") ? config["tracing"].value("directory", std::string{DEFAULT_TRACE_DIRECTORY})
+                                                        : std::string{DEFAULT_TRACE_DIRECTORY});
+#endif
+
+    metering_from_config(config);
+
+    /*sized for the output frames the audio thread meters, before it starts*/
+    FailoverSettings failover_settings {failover_settings_from_config(config, default_source_name)};
+    dead_air_detector.configure(failover_settings.dead_air, sink.get_output_codec_context().sample_rate,
+                                source->get_frame()->nb_samples);
+
+    /*the audio thread owns the source from here on, it is only ever replaced through the channel*/
+    std::thread audioThread(audio_processing, std::move(source), std::ref(sink), std::ref(channel), 
+                            std::cref(realtime_settings.audio_thread));
+
+    Scheduler scheduler {channel, sink, [&](const std::string& name)
+    {
+        return open_named_source(name, config_store, sink.get_output_codec_context());
+    }};
+    schedule_from_config(config, scheduler);
+    scheduler.start();
+
+    /*health checks of the sources which aren't playing, sources added or edited by hand are checked straight away*/
+    SourceProber prober {config_store, sink.get_output_codec_context(), prober_settings_from_config(config)};
+    config_store.set_on_sources_changed([&](const std::vector<std::string>& changed)
+    {
+        for (const std::string& name : changed)
+            prober.probe_soon(name);
+    });
+    prober.start();
+
+    /*crossfades to a backup when the playing source goes quiet or fails, and back once the primary recovers*/
+    FailoverManager failover {channel, config_store, prober, [&](const std::string& name)
+    {
+        return open_named_source(name, config_store, sink.get_output_codec_context());
+    }, failover_settings};
+    failover.start();
+
+    /*commands from stdin and the control socket all run one at a time on the executor's thread*/
+    CommandExecutor executor {[&](const json& request)
+    {
+        return execute_command(request, config_store, channel, scheduler, prober, failover, sink.get_output_codec_context());
+    }};
+
+    std::unique_ptr<ControlServer> control_server {};
+    try
+    {
+        control_server = std::make_unique<ControlServer>(control_server_settings_from_config(config), executor);
+        control_server->start();
+    }
+    catch (const char* exception)
+    {
+        std::cout << exception << ": continuing with stdin control only\n";
+    }
+
+    std::unique_ptr<MetricsServer> metrics_server {};
+    int metrics_port {config.contains("metrics") ? config["metrics"].value("port", DEFAULT_METRICS_PORT) : 0};
+    if (metrics_port > 0)
+    {
+        try
+        {
+            metrics_server = std::make_unique<MetricsServer>(metrics_registry, metrics_port);
+            metrics_server->start();
+        }
+        catch (const char* exception)
+        {
+            std::cout << exception << ": continuing without metrics\n";
+        }
+    }
+
+    config_store.watch();
+    std::thread controlThread(control, std::ref(executor), std::ref(channel), std::ref(config_store));
 
     audioThread.join();
     controlThread.join();
 
+    /*finish any queued commands before the server their responses go to is destroyed*/
+    scheduler.stop();
+    failover.stop();
+    executor.stop();
+    config_store.set_on_sources_changed({});
+    prober.stop();
+    control_server.reset();
+    metrics_server.reset();
+    collect_audio_events(channel, config_store);
+
     return 0;
 }
 
 
 
-void audio_processing (InputStream &source, InputStream &new_source, 
-                        OutputStream &sink, ControlFlags& flags)
+void audio_processing (std::unique_ptr<InputStream> source, OutputStream &sink, 
+                        AudioChannel& channel, const ThreadSettings& thread_settings)
 {
+    apply_thread_settings(thread_settings, "audio");
     std::chrono::_V2::steady_clock::time_point end_time = std::chrono::steady_clock::now();
+    loop_timer.attach_to_this_thread();
+    tracer.trace_this_thread("audio");
+    alloc_accounting.account_this_thread("audio");
 
-    while (!flags.stop)
+    while (!channel.stopping())
     {
-        if (flags.normal_streaming)
+        channel.service(sink);
+        if (!channel.switch_due(switch_horizon(*source, sink)))
         {
-            continue_streaming(source, new_source, sink, end_time, flags);
+            continue_streaming(source, sink, end_time, channel);
             continue;
         }            
-        else 
-        {  
-            std::lock_guard<std::mutex> lock (new_source_mtx);
-            source = crossfade(source, new_source, sink, end_time, flags);
-            flags.normal_streaming = true;
-        }    
+        
+        uint64_t switch_id {};
+        int64_t start_sample {}, actual_start_sample {};
+        std::unique_ptr<InputStream> new_source {channel.take_pending(switch_id, start_sample)};
+        bool success = crossfade(source, *new_source, sink, end_time, channel, start_sample, actual_start_sample);
+        if (success)
+        {
+            source.swap(new_source);
+            dead_air_detector.reset();
+        }
+        /*hand whichever source is no longer playing back to the control side to be destroyed*/
+        channel.finish_switch(switch_id, success, std::move(new_source), start_sample, actual_start_sample);
     }    
     sink.finish_streaming();
+    print_realtime_status(std::cout);
+    loop_timer.dump(std::cout);
+    if (AllocAccounting::compiled_in())
+        alloc_accounting.print_stats(std::cout);
 }
 
-void control(InputStream &new_source, const AVCodecContext& output_codec_ctx, ControlFlags& flags)
+/*reads text commands from stdin and runs them through the executor until streaming stops,
+* also collects the sources the audio thread has finished with*/
+void control(CommandExecutor& executor, AudioChannel& channel, ConfigStore& config_store)
 {
-    
-    SourceTimingModes timing_mode = SourceTimingModes::freetime; 
-    DefaultSourceModes source_mode = DefaultSourceModes::white_noise;
     std::string command {};
+    bool stdin_open = true;
 
-    while (!flags.stop)
+    while (!channel.stopping())
     {
-        std::getline(std::cin, command);
-
-        //kill
-        if (command == "kill")
+        collect_audio_events(channel, config_store);
+        if (!stdin_open)
         {
-            flags.stop = true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            continue;
         }
-        //list-sources
-        else if (command == "list-sources")
+
+        /*wait for input with a timeout so a kill received over the control socket also ends this thread*/
+        if (std::cin.rdbuf()->in_avail() <= 0)
         {
-            json config = json::object(); 
-            config = open_config_file(PATH_TO_CONFIG_FILE);
-            for (auto item = config["sources"].begin(); item != config["sources"].end(); ++item)
-            {
-                std::cout << item.key() << " : " << item.value() << '\n';
-            }
+            struct pollfd stdin_poll {STDIN_FILENO, POLLIN, 0};
+            if (poll(&stdin_poll, 1, 200) <= 0)
+                continue;
         }
-        // add-source [source name] [source url]
-        else if (find_and_remove(command, "add-source "))
+
+        if (!std::getline(std::cin, command))
         {
-            std::vector<std::string> source_vector {split_command_on_whitespace(command)};
-            json config = json::object(); 
-            config = open_config_file(PATH_TO_CONFIG_FILE);
-            config ["sources"][source_vector[0]] = source_vector[1];
-            write_config_file(config, PATH_TO_CONFIG_FILE);
+            std::cout << "stdin closed, use the control socket to control streaming\n";
+            stdin_open = false;
+            continue;
         }
 
-        //delete-source [source name]
-        else if (find_and_remove(command, "delete-source "))
+        if (command.empty())
+            continue;
+
+        json response {executor.execute(request_from_text_command(command))};
+        print_response(response);
+    }    
+}
+
+/*destroys the sources the audio thread has retired, records the outcome of finished switches and logs quality changes*/
+void collect_audio_events(AudioChannel& channel, ConfigStore& config_store)
+{
+    for (const FinishedSwitch& finished : channel.collect_events())
+    {
+        switch (+finished.result)
         {
-            json config = json::object();
-            config = open_config_file(PATH_TO_CONFIG_FILE);
-            if (find_and_remove(command, "\""))
-            {
-                size_t position = command.find("\"");
-                command=command.substr(0, position);
-            }
-            if (config["sources"].contains(command))
-            {
-                config["sources"].erase(command);
-                write_config_file(config, PATH_TO_CONFIG_FILE);
-            }
-            else
-            {
-                std::cout << "requested source doesn't exist, no sources deleted\n";
-            }
+            case +AudioEventTypes::switch_complete:
+                config_store.set_active_source(finished.name);
+                std::cout << "now streaming from " << finished.name;
+                if (finished.scheduled)
+                    std::cout << ", crossfade started " << finished.error_samples << " samples from its scheduled time";
+                std::cout << '\n';
+                break;
+            case +AudioEventTypes::switch_failed:
+                std::cout << "crossfade to " << finished.name << " failed, still streaming from the previous source\n";
+                break;
+            case +AudioEventTypes::switch_superseded:
+                std::cout << "switch to " << finished.name << " superseded by a later request\n";
+                break;
         }
+    }
+    log_quality_transitions();
+}
+
+/*says whenever the quality governor has changed level since the last call, control thread only*/
+void log_quality_transitions()
+{
+    static uint64_t logged_step_downs {}, logged_step_ups {};
+    const uint64_t step_downs {quality_governor.step_downs()}, step_ups {quality_governor.step_ups()};
+    if (step_downs == logged_step_downs && step_ups == logged_step_ups)
+        return;
 
-        //test-source [source name]
-        else if (find_and_remove(command, "test-source "))
+    /*several windows can end between two calls, say how many steps were taken each way*/
+    std::cout << "quality: " << step_downs - logged_step_downs << " step(s) down, " << step_ups - logged_step_ups
+              << " step(s) up, now level " << quality_governor.level() << " of " << quality_governor.max_level() << " ("
+              << quality_governor.window_misses() << " deadline misses, "
+              << std::lround(quality_governor.window_load() * 100) << "% load in the last window)";
+    for (int step = 0; step < +QualitySteps::number_of_steps; step++)
+    {
+        if (quality_governor.degraded(static_cast<QualitySteps>(step)))
+            std::cout << ", " << quality_step_name(static_cast<QualitySteps>(step)) << " degraded";
+    }
+    std::cout << '\n';
+    logged_step_downs = step_downs;
+    logged_step_ups = step_ups;
+}
+
+/*runs one control request and returns the response, called on the CommandExecutor thread
+* so only one command (from stdin or any socket client) runs at a time*/
+json execute_command(const json& request, ConfigStore& config_store, AudioChannel& channel, 
+                    Scheduler& scheduler, SourceProber& prober, FailoverManager& failover, 
+                    const AVCodecContext& output_codec_ctx)
+{
+    SourceTimingModes timing_mode = SourceTimingModes::realtime; 
+    DefaultSourceModes source_mode = DefaultSourceModes::white_noise;
+    std::string command {request.value("command", std::string{})};
+    json response = {{"ok", true}};
+
+    //ping
+    if (command == "ping")
+    {
+    }
+    //kill
+    else if (command == "kill")
+    {
+        channel.stop();
+        response["message"] = "stopping";
+    }
+    //list-sources
+    else if (command == "list-sources")
+    {
+        response["sources"] = config_store.sources();
+    }
+    //add-source {"source": name, "prompt": input prompt}
+    else if (command == "add-source")
+    {
+        config_store.set_source(request.at("source"), request.at("prompt"));
+        prober.probe_soon(request.at("source"));
+        response["message"] = "source added";
+    }
+    //delete-source {"source": name}
+    else if (command == "delete-source")
+    {
+        if (config_store.erase_source(request.at("source")))
         {
-            json config = json::object();
-            config = open_config_file(PATH_TO_CONFIG_FILE);
-            if (find_and_remove(command, "\""))
-            {
-                size_t position = command.find("\"");
-                command=command.substr(0, position);
-            }
-            if (config["stream settings"]["active source"] == command)
-            {
-                std::cout<<"source currently in use\n";
-                std::cout<<"source not tested\n";
-                goto end;
-            }
-            if (config["sources"].contains(command))
+            response["message"] = "source deleted";
+        }
+        else
+        {
+            response = {{"ok", false}, {"message", "requested source doesn't exist, no sources deleted"}};
+        }
+    }
+    //test-source {"source": name}
+    else if (command == "test-source")
+    {
+        std::string name {request.at("source")};
+        SourceDescriptorPtr descriptor {};
+        if (config_store.active_source() == name)
+        {
+            response = {{"ok", false}, {"message", "source currently in use, source not tested"}};
+        }
+        else if ((descriptor = config_store.find_descriptor(name)))
+        {
+            std::unique_ptr<InputStream> test_input {};
+            try
             {
-                FFMPEGString prompt {config["sources"][command]};
-                InputStream test_input {};
-                try
-                {
-                    source_startup_timeout(test_input, prompt, output_codec_ctx, timing_mode, source_mode, DEFAULT_TIMEOUT);
-                }
-                catch (const char* exception)
-                {
-                    std::cout << exception <<'\n';
-                }
-                            
+                if (source_startup_timeout(test_input, descriptor, output_codec_ctx, timing_mode, source_mode, DEFAULT_TIMEOUT))
+                    response["message"] = "source tested successfully";
+                else
+                    response = {{"ok", false}, {"message", "source failed to provide audio"}};
             }
-            else
+            catch (const char* exception)
             {
-                std::cout << "requested source doesn't exist, no sources tested\n";
+                response = {{"ok", false}, {"message", exception}};
             }
+        }
+        else
+        {
+            response = {{"ok", false}, {"message", "requested source doesn't exist, no sources tested"}};
+        }
+    }
+    //use-source {"source": name}
+    else if (command == "use-source")
+    {
+        std::string name {request.at("source")};
+        try
+        {
+            auto start = std::chrono::steady_clock::now();
+            std::unique_ptr<InputStream> temp_input {open_named_source(name, config_store, output_codec_ctx)};
+            std::chrono::duration<double> startup = std::chrono::steady_clock::now() - start;
+            scheduler.record_startup_latency(name, startup.count());
+            response["switch"] = channel.switch_source(std::move(temp_input), name);
+            response["message"] = "source initialised successfully, crossfading";
+        }
+        catch (const char* exception)
+        {
+            response = {{"ok", false}, {"message", exception}};
+        }
+    }
+    //source-status
+    else if (command == "source-status")
+    {
+        response["source status"] = prober.status();
+        response["failover"] = failover.status();
+    }
+    //active-source
+    else if (command == "active-source")
+    {
+        response["active source"] = config_store.active_source();
+    }
+    //schedule-source {"source": name, "at": "HH:MM[:SS]" or "in seconds": delay, "daily": bool}
+    else if (command == "schedule-source")
+    {
+        std::string name {request.at("source")};
+        if (!config_store.contains_source(name))
+            throw "requested source doesn't exist, nothing scheduled";
+
+        std::chrono::system_clock::time_point at {};
+        if (request.contains("in seconds"))
+            at = std::chrono::system_clock::now() + std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                    std::chrono::duration<double>(request["in seconds"].get<double>()));
+        else
+            at = Scheduler::next_time_of_day(request.at("at"));
 
-            end:
-            ;   
+        response["scheduled"] = scheduler.add(name, at, request.value("daily", false));
+        response["message"] = "switch scheduled";
+    }
+    //list-schedule
+    else if (command == "list-schedule")
+    {
+        response["schedule"] = scheduler.list();
+    }
+    //unschedule {"id": scheduled switch id}
+    else if (command == "unschedule")
+    {
+        if (scheduler.remove(request.at("id")))
+            response["message"] = "scheduled switch removed";
+        else
+            response = {{"ok", false}, {"message", "no scheduled switch with that id"}};
+    }
+    //trace-dump {"path": file to write, optional}
+    else if (command == "trace-dump")
+    {
+        std::string path {request.value("path", std::string{DEFAULT_TRACE_DIRECTORY} + "/fondue-trace-" 
+                                                + std::to_string(std::time(nullptr)) + ".json")};
+        tracer.write_chrome_json(path);
+        response["message"] = "trace written to " + path;
+    }
+    //trace-stats
+    else if (command == "trace-stats")
+    {
+        std::ostringstream report {};
+        tracer.print_stats(report, loop_timer.iterations(), sink_frame_duration_ms(output_codec_ctx));
+        response["report"] = report.str();
+    }
+    //gain {"db": gain in dB}
+    else if (command == "gain")
+    {
+        double gain_db {request.at("db")};
+        channel.set_gain(static_cast<float>(std::pow(10.0, gain_db / 20)));
+        pipeline_metrics.output_gain_millibels.set(std::llround(gain_db * 100));
+        response["message"] = "gain set";
+    }
+    //levels
+    else if (command == "levels")
+    {
+        response["levels"] = {{"playing", levels_to_json(level_meters.playing.snapshot())},
+                              {"incoming", levels_to_json(level_meters.incoming.snapshot())},
+                              {"output", levels_to_json(level_meters.output.snapshot())}};
+        response["loudness"] = {{"momentary lufs", pipeline_metrics.momentary_centilufs.value() / 100.0},
+                                {"short-term lufs", pipeline_metrics.short_term_centilufs.value() / 100.0},
+                                {"integrated lufs", pipeline_metrics.integrated_centilufs.value() / 100.0},
+                                {"gain db", pipeline_metrics.loudness_gain_millibels.value() / 100.0},
+                                {"normalising", loudness_settings.enabled}};
+    }
+    //alloc-stats
+    else if (command == "alloc-stats")
+    {
+        std::ostringstream report {};
+        alloc_accounting.print_stats(report);
+        response["report"] = report.str();
+        response["steady state allocations"] = alloc_accounting.steady_state_allocations();
+    }
+    //frame-pool-stats
+    else if (command == "frame-pool-stats")
+    {
+        std::ostringstream report {};
+        frame_pool.print_stats(report);
+        const FramePoolStats stats {frame_pool.stats()};
+        response["report"] = report.str();
+        response["hit rate"] = stats.hit_rate();
+        response["resident bytes"] = stats.resident_bytes;
+    }
+    //output-filter {"chain": filter chain, empty to remove the output filters}
+    else if (command == "output-filter")
+    {
+        std::string chain {request.value("chain", std::string{})};
+        try
+        {
+            /*built here, the audio thread only swaps it in*/
+            channel.set_output_filter(chain.empty() ? CachedFilterGraph {} : output_filter_graph(chain, output_codec_ctx));
+            response["message"] = chain.empty() ? "output filters removed" : "output filters set";
         }
+        catch (const char* exception)
+        {
+            response = {{"ok", false}, {"message", exception}};
+        }
+    }
+    //filter-stats
+    else if (command == "filter-stats")
+    {
+        std::ostringstream report {};
+        response["filter graphs"] = json::array();
+        for (const FilterChainStats& chain : filter_graph_cache.stats())
+        {
+            const double us_per_frame = chain.frames ? chain.processing_ns / 1e3 / chain.frames : 0;
+            response["filter graphs"].push_back({{"chain", chain.chain}, {"builds", chain.builds}, {"reuses", chain.reuses},
+                                                 {"frames", chain.frames}, {"us per frame", us_per_frame}});
+            report << chain.chain << ": built " << chain.builds << ", reused " << chain.reuses << ", " << chain.frames
+                   << " frames, " << us_per_frame << " us per frame\n";
+        }
+        if (response["filter graphs"].empty())
+            report << "no filter graphs\n";
+        response["report"] = report.str();
+    }
+    //quality-status
+    else if (command == "quality-status")
+    {
+        response["enabled"] = quality_governor.enabled();
+        response["level"] = quality_governor.level();
+        response["max level"] = quality_governor.max_level();
+        response["degraded"] = json::array();
+        for (int step = 0; step < +QualitySteps::number_of_steps; step++)
+        {
+            if (quality_governor.degraded(static_cast<QualitySteps>(step)))
+                response["degraded"].push_back(quality_step_name(static_cast<QualitySteps>(step)));
+        }
+        response["window load"] = quality_governor.window_load();
+        response["window deadline misses"] = quality_governor.window_misses();
+        response["step downs"] = quality_governor.step_downs();
+        response["step ups"] = quality_governor.step_ups();
+    }
+    //timing-stats
+    else if (command == "timing-stats")
+    {
+        std::ostringstream report {};
+        print_realtime_status(report);
+        loop_timer.dump(report);
+        response["report"] = report.str();
+    }
+    else
+    {
+        response = {{"ok", false}, {"message", "unknown command"}, {"usage", usage_text()}};
+    }
+
+    return response;
+}
+
+/*converts a line typed on stdin into the equivalent json request*/
+json request_from_text_command(std::string command)
+{
+    json request = json::object();
 
-        //use-source [source name]
-        else if (find_and_remove(command, "use-source "))
+    // add-source [source name] [source url]
+    if (find_and_remove(command, "add-source "))
+    {
+        std::vector<std::string> source_vector {split_command_on_whitespace(command)};
+        request["command"] = "add-source";
+        if (source_vector.size() >= 2)
         {
-            json config = json::object();
-            config = open_config_file(PATH_TO_CONFIG_FILE);
-            if (find_and_remove(command, "\""))
-            {
-                size_t position = command.find("\"");
-                command=command.substr(0, position);
-            }
-            if (config["sources"].contains(command))
+            request["source"] = source_vector[0];
+            request["prompt"] = source_vector[1];
+        }
+    }
+    //delete-source [source name]
+    else if (find_and_remove(command, "delete-source "))
+    {
+        request["command"] = "delete-source";
+        request["source"] = remove_quotes(command);
+    }
+    //test-source [source name]
+    else if (find_and_remove(command, "test-source "))
+    {
+        request["command"] = "test-source";
+        request["source"] = remove_quotes(command);
+    }
+    //use-source [source name]
+    else if (find_and_remove(command, "use-source "))
+    {
+        request["command"] = "use-source";
+        request["source"] = remove_quotes(command);
+    }
+    //schedule-source [HH:MM[:SS] or +seconds] [source name]
+    else if (find_and_remove(command, "schedule-source "))
+    {
+        std::vector<std::string> schedule_vector {split_command_on_whitespace(command)};
+        request["command"] = "schedule-source";
+        if (schedule_vector.size() >= 2)
+        {
+            if (find_and_remove(schedule_vector[0], "+"))
             {
-                FFMPEGString prompt {config["sources"][command]};
-                InputStream temp_input {};
                 try
                 {
-                    source_startup_timeout(temp_input, prompt, output_codec_ctx, timing_mode, source_mode, DEFAULT_TIMEOUT);
-                    new_source = std::move(temp_input);
-                    flags.normal_streaming = false;
-                    std::cout << "source initialised successfully \n";
-                    config["stream settings"]["active source"] = command;
-                    write_config_file(config, PATH_TO_CONFIG_FILE);    
+                    request["in seconds"] = std::stod(schedule_vector[0]);
                 }
-                catch (const char* exception)
+                catch (const std::exception&)
                 {
-                    std::cout << exception <<'\n';
                 }
-                 
             }
             else
             {
-                std::cout << "requested source doesn't exist\n";
+                request["at"] = schedule_vector[0];
             }
+            request["source"] = schedule_vector[1];
         }
-        //active-source
-        else if (command == "active-source")
+    }
+    //trace-dump [path]
+    else if (find_and_remove(command, "trace-dump "))
+    {
+        request["command"] = "trace-dump";
+        request["path"] = remove_quotes(command);
+    }
+    //unschedule [id]
+    else if (find_and_remove(command, "unschedule "))
+    {
+        request["command"] = "unschedule";
+        try
         {
-            json config = json::object();
-            config = open_config_file(PATH_TO_CONFIG_FILE);
-            std::cout << config["stream settings"]["active source"] << '\n';
+            request["id"] = std::stoull(command);
         }
-
-        else
+        catch (const std::exception&)
+        {
+        }
+    }
+    //output-filter [filter chain], nothing to remove the output filters
+    else if (find_and_remove(command, "output-filter"))
+    {
+        request["command"] = "output-filter";
+        command.erase(0, command.find_first_not_of(' '));
+        request["chain"] = remove_quotes(command);
+    }
+    //gain [gain in dB]
+    else if (find_and_remove(command, "gain "))
+    {
+        request["command"] = "gain";
+        try
+        {
+            request["db"] = std::stod(command);
+        }
+        catch (const std::exception&)
         {
-            std::cout << "Usage: \nkill: end streaming\n";
-            std::cout << "list-sources: list saved audio source names and input prompts\n";
-            std::cout << "add-source [source name] [input prompt]: save a new source\n";
-            std::cout << "delete-source [source name]: delete a source\n";
-            std::cout << "test-source [source name]: verify a source can be opened and can provide audio\n";
-            std::cout << "load-source [source name]: begin decoding samples from a source ahead of crossfading\n";
-            std::cout << "use-source [source name]: switch to streaming from this source\n";
-            std::cout << "active-source: return the name of the source currently in use\n";
         }
+    }
+    //commands without arguments
+    else
+    {
+        request["command"] = command;
+    }
 
-    }    
+    return request;
 }
 
+/*prints a response to stdout in the same format the text commands have always used*/
+void print_response(const json& response)
+{
+    if (response.contains("sources"))
+    {
+        for (auto item = response["sources"].begin(); item != response["sources"].end(); ++item)
+        {
+            std::cout << item.key() << " : " << item.value() << '\n';
+        }
+    }
+    if (response.contains("active source"))
+    {
+        std::cout << response["active source"] << '\n';
+    }
+    if (response.contains("schedule"))
+    {
+        for (const json& scheduled : response["schedule"])
+        {
+            std::cout << scheduled["id"] << ": " << scheduled["at"].get<std::string>() << " " << scheduled["source"]
+                      << (scheduled["daily"].get<bool>() ? " (daily)" : "") << ", opened " 
+                      << scheduled["lead seconds"].get<double>() << " s ahead\n";
+        }
+    }
+    if (response.contains("source status"))
+    {
+        for (auto item = response["source status"].begin(); item != response["source status"].end(); ++item)
+        {
+            const json& status {item.value()};
+            std::cout << item.key() << ": " << status["state"].get<std::string>();
+            if (status.contains("error"))
+                std::cout << " (" << status["error"].get<std::string>() << ")";
+            if (status.contains("peak dbfs"))
+                std::cout << ", peak " << status["peak dbfs"].get<double>() << " dBFS, rms " << status["rms dbfs"].get<double>() << " dBFS";
+            if (status.contains("open seconds"))
+                std::cout << ", opens in " << status["open seconds"].get<double>() << " s, checked "
+                          << status["age seconds"].get<double>() << " s ago";
+            std::cout << '\n';
+        }
+    }
+    if (response.contains("failover"))
+    {
+        const json& failover {response["failover"]};
+        std::cout << "dead air: " << (failover["dead air"].get<bool>() ? "yes" : "no") << ", "
+                  << failover["silent seconds"].get<double>() << " s below threshold, window rms "
+                  << failover["window rms dbfs"].get<double>() << " dBFS";
+        if (failover["enabled"].get<bool>())
+            std::cout << ", failover from " << failover["primary"].get<std::string>() << " to " << failover["backups"].dump();
+        if (!failover["last event"].get<std::string>().empty())
+            std::cout << ", last: " << failover["last event"].get<std::string>();
+        std::cout << '\n';
+    }
+    if (response.contains("levels"))
+    {
+        for (auto meter = response["levels"].begin(); meter != response["levels"].end(); ++meter)
+        {
+            std::cout << meter.key() << ": peak";
+            for (const json& peak : meter.value()["peak dbfs"])
+                std::cout << ' ' << peak.get<double>();
+            std::cout << " dBFS, rms";
+            for (const json& rms : meter.value()["rms dbfs"])
+                std::cout << ' ' << rms.get<double>();
+            std::cout << " dBFS";
+            if (meter.value().contains("true peak dbfs"))
+            {
+                std::cout << ", true peak";
+                for (const json& true_peak : meter.value()["true peak dbfs"])
+                    std::cout << ' ' << true_peak.get<double>();
+                std::cout << " dBTP";
+            }
+            std::cout << ", " << meter.value()["clipped samples"] << " clipped samples\n";
+        }
+    }
+    if (response.contains("loudness"))
+    {
+        const json& loudness {response["loudness"]};
+        std::cout << "playing loudness: momentary " << loudness["momentary lufs"].get<double>() << " LUFS, short-term "
+                  << loudness["short-term lufs"].get<double>() << " LUFS, integrated " << loudness["integrated lufs"].get<double>()
+                  << " LUFS";
+        if (loudness["normalising"].get<bool>())
+            std::cout << ", normalising gain " << loudness["gain db"].get<double>() << " dB";
+        std::cout << '\n';
+    }
+    if (response.contains("report"))
+    {
+        std::cout << response["report"].get<std::string>();
+    }
+    if (response.contains("usage"))
+    {
+        std::cout << response["usage"].get<std::string>();
+    }
+    else if (response.contains("message"))
+    {
+        std::cout << response["message"].get<std::string>() << '\n';
+    }
+}
 
+std::string usage_text()
+{
+    std::string usage {"Usage: \nkill: end streaming\n"};
+    usage += "list-sources: list saved audio source names and input prompts\n";
+    usage += "add-source [source name] [input prompt]: save a new source\n";
+    usage += "delete-source [source name]: delete a source\n";
+    usage += "test-source [source name]: verify a source can be opened and can provide audio\n";
+    usage += "load-source [source name]: begin decoding samples from a source ahead of crossfading\n";
+    usage += "use-source [source name]: switch to streaming from this source\n";
+    usage += "active-source: return the name of the source currently in use\n";
+    usage += "source-status: print the latest background health check of every source, dead air and failover state\n";
+    usage += "schedule-source [HH:MM[:SS] or +seconds] [source name]: crossfade to a source at an exact time\n";
+    usage += "list-schedule: list scheduled switches\n";
+    usage += "unschedule [id]: remove a scheduled switch\n";
+    usage += "gain [dB]: set the output gain, 0 for unity\n";
+    usage += "trace-dump [path]: write the recent trace spans as chrome trace json (path optional)\n";
+    usage += "trace-stats: print trace span counts and tracing overhead per frame\n";
+    usage += "levels: print peak and rms levels per channel of the playing and incoming sources and the output, and the playing source's loudness\n";
+    usage += "timing-stats: print per stage audio loop latency histograms and deadline misses\n";
+    usage += "alloc-stats: print heap allocations per output frame of the audio thread (needs -DFONDUE_ALLOC_ACCOUNTING=ON)\n";
+    usage += "frame-pool-stats: print the audio frame buffer pool's hit rate and resident memory\n";
+    usage += "output-filter [filter chain]: filter the output e.g. acompressor, nothing to remove the output filters\n";
+    usage += "filter-stats: print the processing time per frame of every filter chain\n";
+    usage += "quality-status: print the quality governor's level and the steps it has taken\n";
+    usage += "the same commands are accepted as json over the control socket e.g. {\"command\": \"use-source\", \"source\": \"rtmp\"}\n";
+    return usage;
+}
 
+/*strips a pair of double quotes from around a source name*/
+std::string remove_quotes(std::string name)
+{
+    if (find_and_remove(name, "\""))
+    {
+        size_t position = name.find("\"");
+        name = name.substr(0, position);
+    }
+    return name;
+}
 
 /* takes data from one source and sends it to the output url*/
-void continue_streaming (InputStream& source, InputStream& new_source, OutputStream& sink, 
-                         std::chrono::_V2::steady_clock::time_point& end_time, ControlFlags& flags)
+void continue_streaming (std::unique_ptr<InputStream>& source, OutputStream& sink, 
+                         std::chrono::_V2::steady_clock::time_point& end_time, AudioChannel& channel)
 {
-    while (flags.normal_streaming && !flags.stop)
+    while (!channel.switch_due(switch_horizon(*source, sink)) && !channel.stopping())
     {
+        channel.service(sink);
+        channel.service_resamplers(*source);
+        channel.pre_roll();
         try
         {
-            source.get_one_output_frame();
-            sink.write_frame(source);
-            source.sleep(end_time);        
+            source->get_one_output_frame();
+            meter_frame(level_meters.playing, source->get_frame());
+            publish_loudness(*source);
+            pipeline_metrics.dead_air.set(dead_air_detector.process(level_meters.playing.snapshot(), source->get_frame()->nb_samples));
+            pipeline_metrics.playing_fifo_depth.set(source->get_queue_size());
+            sink.write_frame(*source);
+            source->sleep(end_time);        
         }
 
         catch (const char* exception)
         {
+            pipeline_metrics.source_failures.add();
             std::cout<<exception<<": changing to default source\n";
-            source = InputStream {sink.get_output_codec_context(), DefaultSourceModes::white_noise};
+            std::unique_ptr<InputStream> failed {channel.take_fallback(DefaultSourceModes::white_noise, sink.get_output_codec_context(),
+                                                                       source->get_timing_mode())};
+            source.swap(failed);
+            /*closing the failed source can block, it is destroyed on the control side*/
+            channel.retire_failed(std::move(failed));
+            dead_air_detector.reset();
         }   
     }    
 }
 
+/*the output sample before which a waiting switch has to start crossfading, leaves time to write out
+* whatever the outgoing source still has queued before the fade begins*/
+int64_t switch_horizon(InputStream& source, const OutputStream& sink)
+{
+    return sink.get_samples_written() + SWITCH_LOOKAHEAD_FRAMES * source.get_frame()->nb_samples;
+}
+
 /*takes data from the current and incoming sources, crossfades them and sends data to the output URL. 
-* returns a (rvalue) reference to the incoming stream if the crossfade completes successfully 
-* or a (rvalue) reference to the valid stream (immeadiately) in case of any errors*/
-InputStream&& crossfade (InputStream& source, InputStream& new_source, 
-                        OutputStream& sink, std::chrono::_V2::steady_clock::time_point& end_time, ControlFlags& flags)
+* the fade starts at start_sample on the output clock (or straight away if negative) and the sample 
+* it actually started at is stored in actual_start_sample.
+* returns true if the crossfade completes, the caller then swaps the incoming source in, or false
+* (immediately) if the incoming source fails. an outgoing source which fails is replaced in place by the
+* channel's silent fallback*/
+bool crossfade (std::unique_ptr<InputStream>& source, InputStream& new_source, OutputStream& sink, 
+                std::chrono::_V2::steady_clock::time_point& end_time, AudioChannel& channel,
+                int64_t start_sample, int64_t& actual_start_sample)
 {
-    int fade_time_remaining = DEFAULT_FADE_MS;
-    const int fade_time = DEFAULT_FADE_MS;
+    const int fade_samples = DEFAULT_FADE_MS * sink.get_output_codec_context().sample_rate / 1000;
+    int fade_samples_remaining = fade_samples;
+    actual_start_sample = -1;
+    auto fade_start_time = std::chrono::steady_clock::now();
     try
     {
-        source.flush_resampler();
-        while (source.empty_queue())
+        while (source->empty_queue())
         {
-            sink.write_frame(source);
-            source.sleep(end_time);
+            sink.write_frame(*source);
+            source->sleep(end_time);
         }
         new_source.clear_queue();
     }
@@ -292,60 +849,65 @@ InputStream&& crossfade (InputStream& source, InputStream& new_source,
     {
         std::cout<<exception<<'\n';
     }
-    
-    try
-    {
-        source.resample_queue(sink.get_output_codec_context().sample_fmt, AV_SAMPLE_FMT_FLTP);
-        source.init_crossfade();
-        new_source.init_crossfade();
-    }
-
-    catch (const char* exception)
-    {
-        std::cout<<exception<<": crossfading failed\n";
-        source.end_crossfade();
-        return std::move(source);
-    }
        
-    while (fade_time_remaining > 0 && !flags.stop)
+    /*samples of the outgoing source alone still to be written before the fade starts*/
+    int64_t start_delay = start_sample < 0 ? 0 : std::max<int64_t>(0, start_sample - sink.get_samples_written());
+    actual_start_sample = sink.get_samples_written() + start_delay;
+
+    while (fade_samples_remaining > 0 && !channel.stopping())
     {
+        /*gain changes apply straight away, switches requested now wait for this crossfade to finish*/
+        channel.service(sink);
+        channel.service_resamplers(*source);
+        channel.service_resamplers(new_source);
+
         /*attempt to decode new input frame*/
         try
         {
             new_source.get_one_output_frame();
+            meter_frame(level_meters.incoming, new_source.get_frame());
         }
 
         /*if incoming source fails, stop crossfading and return the old source*/
         catch(const char* exception)
         {
+            pipeline_metrics.crossfade_failures.add();
+            pipeline_metrics.incoming_fifo_depth.set(0);
             std::cout<<"new source: "<<exception<<": crossfading failed \n";
-            source.clear_queue();
-            source.end_crossfade();
-            return std::move(source);
+            return false;
         }
         
         /*attempt to decode input frame and crossfade together*/
         try
         {
-            source.crossfade_frame (new_source.get_frame(), fade_time_remaining, fade_time);
+            source->crossfade_frame (new_source.get_frame(), fade_samples_remaining, fade_samples, start_delay);
+            pipeline_metrics.playing_fifo_depth.set(source->get_queue_size());
+            pipeline_metrics.incoming_fifo_depth.set(new_source.get_queue_size());
         }
 
         /*if outgoing source fails, replace it with a silent source and continue crossfading*/
         catch (const char* exception)
         {
+            pipeline_metrics.source_failures.add();
             std::cout<<"outgoing source: "<<exception<<": switching to default source for remaining fade duration\n";
-            source = InputStream(sink.get_output_codec_context(), DefaultSourceModes::silence);
+            std::unique_ptr<InputStream> failed {channel.take_fallback(DefaultSourceModes::silence, sink.get_output_codec_context(),
+                                                                       source->get_timing_mode())};
+            source.swap(failed);
+            channel.retire_failed(std::move(failed));
             continue;
         }
 
-        sink.write_frame(source);
-        source.sleep(end_time);
+        sink.write_frame(*source);
+        source->sleep(end_time);
     }
 
-    new_source.flush_resampler();
-    new_source.resample_queue(AV_SAMPLE_FMT_FLTP, sink.get_output_codec_context().sample_fmt);
-    new_source.end_crossfade();
-    return std::move(new_source);
+    std::chrono::microseconds fade_duration = std::chrono::duration_cast<std::chrono::microseconds>(
+                                                std::chrono::steady_clock::now() - fade_start_time);
+    pipeline_metrics.crossfades.add();
+    pipeline_metrics.crossfade_us.add(fade_duration.count());
+    pipeline_metrics.last_crossfade_us.set(fade_duration.count());
+    pipeline_metrics.incoming_fifo_depth.set(0);
+    return true;
 }
 
 /*returns true if the substring is at the beginning of the command, then removes the substring from the command*/
@@ -394,35 +956,70 @@ std::vector<std::string> split_command_on_whitespace(const std::string& command)
     return res;
 }
 
-/*open the config file and parse it as a json object*/
-json open_config_file(const std::string& file_path)
+/*reads the optional "control" section of the config e.g. {"socket": "/tmp/fondue.sock", "tcp port": 8000}*/
+ControlServerSettings control_server_settings_from_config(const json& config)
 {
-    std::ifstream file {file_path};
-    json config = json::object();
-    config = json::parse(file);
-    return config;
+    ControlServerSettings settings {};
+    if (!config.contains("control"))
+        return settings;
+
+    settings.socket_path = config["control"].value("socket", settings.socket_path);
+    settings.tcp_port = config["control"].value("tcp port", settings.tcp_port);
+    return settings;
 }
 
+/*reads the optional "realtime" section of the config, missing keys keep their defaults*/
+RealtimeSettings realtime_settings_from_config(const json& config)
+{
+    RealtimeSettings settings {};
+    if (!config.contains("realtime"))
+        return settings;
 
+    const json& realtime = config["realtime"];
+    if (realtime.contains("audio thread"))
+        settings.audio_thread = thread_settings_from_config(realtime["audio thread"]);
+    settings.lock_memory = realtime.value("lock memory", settings.lock_memory);
+    settings.prefault_heap_bytes = realtime.value("prefault heap bytes", settings.prefault_heap_bytes);
+    return settings;
+}
 
-void write_config_file(const json& config, const std::string& file_path)
+/*reads the scheduling settings of one thread e.g. {"policy": "fifo", "priority": 70, "cpus": [3]}*/
+ThreadSettings thread_settings_from_config(const json& thread_config)
 {
-    std::ofstream file {file_path};
-    file << config.dump(1, '\t');
+    ThreadSettings settings {};
+    try
+    {
+        settings.policy = scheduling_policy_from_string(thread_config.value("policy", std::string{"normal"}));
+    }
+    catch (const char* exception)
+    {
+        std::cout << exception << '\n';
+    }
+    settings.priority = thread_config.value("priority", settings.priority);
+    settings.cpus = thread_config.value("cpus", settings.cpus);
+    settings.prefault_stack_bytes = thread_config.value("prefault stack bytes", settings.prefault_stack_bytes);
+    return settings;
 }
 
-/*opens the source resource and decodes one frame. Returns true on success or false on failure*/
-bool source_startup(InputStream& input, FFMPEGString& prompt, const AVCodecContext& output_codec_ctx, 
-                            SourceTimingModes& timing_mode, DefaultSourceModes& source_mode)
+/*opens the source resource and decodes one frame, giving up at io_deadline. Returns true on success or false on failure*/
+bool source_startup(std::unique_ptr<InputStream>& input, const SourceDescriptor& descriptor, const AVCodecContext& output_codec_ctx, 
+                            SourceTimingModes& timing_mode, DefaultSourceModes& source_mode,
+                            std::chrono::steady_clock::time_point io_deadline)
 {
     try
     {
-        input = InputStream{prompt, output_codec_ctx, timing_mode, source_mode};
+        auto open_start = std::chrono::steady_clock::now();
+        input = std::make_unique<InputStream>(descriptor, output_codec_ctx, timing_mode, source_mode, io_deadline);
         std::cout << "source initialised successfully \n";
         try 
         {
-            input.get_one_output_frame();
-            std::cout << "data accessed successfully \n";
+            input->get_one_output_frame();
+            auto open_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - open_start);
+            pipeline_metrics.source_opens.add();
+            pipeline_metrics.source_open_us.add(open_time.count());
+            pipeline_metrics.last_source_open_us.set(open_time.count());
+            std::cout << "data accessed successfully, " << open_time.count() / 1000.0 << " ms from open to first frame ("
+                      << (input->decoder_reused() ? "pooled" : "new") << " decoder)\n";
         }
         catch (const char* exception)
         {
@@ -439,22 +1036,227 @@ bool source_startup(InputStream& input, FFMPEGString& prompt, const AVCodecConte
     return true;
 }
 
-/*tries to open and access the source resource, gives up after timeout_time seconds by throwing a const char* exception*/
-void source_startup_timeout(InputStream& input, FFMPEGString& prompt, const AVCodecContext& output_codec_ctx, 
+/*tries to open and access the source resource, gives up after timeout_time seconds by throwing a const char* exception
+* returns true if a frame of audio was decoded. The timeout interrupts FFmpeg's blocking IO through the source's
+* interrupt callback, so nothing is left running in the background once it has passed*/
+bool source_startup_timeout(std::unique_ptr<InputStream>& input, SourceDescriptorPtr descriptor, const AVCodecContext& output_codec_ctx, 
                             SourceTimingModes& timing_mode, DefaultSourceModes& source_mode, int timeout_time)
 {
-    std::packaged_task<bool(InputStream&, FFMPEGString&, const AVCodecContext&, SourceTimingModes&, DefaultSourceModes&)> startup (source_startup);
-    auto future = startup.get_future();
-    std::thread thr(std::move(startup), std::ref(input), std::ref(prompt), std::ref(output_codec_ctx), std::ref(timing_mode), std::ref(source_mode));
-    std::chrono::duration<int> timeout {timeout_time};
-    if (future.wait_for(timeout) != std::future_status::timeout)
-    {
-        thr.join();
-        auto value = future.get();
-    } 
-    else
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout_time);
+    if (source_startup(input, *descriptor, output_codec_ctx, timing_mode, source_mode, deadline))
     {
-        thr.detach();
+        /*the source streams from here on, its reads mustn't time out*/
+        input->set_io_deadline({});
+        return true;
+    }
+    if (std::chrono::steady_clock::now() >= deadline)
         throw "timeout: could not access data from source in a sensible timescale";
-    } 
-}
\ No newline at end of file
+    return false;
+}
+
+/*opens a source from the config and decodes its first frame, throws a const char* exception on failure*/
+std::unique_ptr<InputStream> open_named_source(const std::string& name, ConfigStore& config_store, 
+                                               const AVCodecContext& output_codec_ctx)
+{
+    SourceTimingModes timing_mode = SourceTimingModes::realtime; 
+    DefaultSourceModes source_mode = DefaultSourceModes::white_noise;
+    SourceDescriptorPtr descriptor {config_store.find_descriptor(name)};
+    if (!descriptor)
+        throw "requested source doesn't exist";
+
+    std::unique_ptr<InputStream> input {};
+    if (!source_startup_timeout(input, descriptor, output_codec_ctx, timing_mode, source_mode, DEFAULT_TIMEOUT))
+        throw "source failed to provide audio";
+    return input;
+}
+
+/*adds the daily switches in the optional "schedule" section of the config e.g. [{"at": "14:00", "source": "news"}]*/
+void schedule_from_config(const json& config, Scheduler& scheduler)
+{
+    if (!config.contains("schedule"))
+        return;
+
+    for (const json& item : config["schedule"])
+    {
+        try
+        {
+            scheduler.add(item.at("source"), Scheduler::next_time_of_day(item.at("at")), true);
+        }
+        catch (const char* exception)
+        {
+            std::cout << exception << '\n';
+        }
+        catch (const json::exception& exception)
+        {
+            std::cout << "schedule: " << exception.what() << '\n';
+        }
+    }
+}
+
+/*duration of one output frame in milliseconds*/
+double sink_frame_duration_ms(const AVCodecContext& output_codec_ctx)
+{
+    int frame_size = output_codec_ctx.frame_size > 0 ? output_codec_ctx.frame_size : DEFAULT_FRAME_SIZE;
+    return 1000.0 * frame_size / output_codec_ctx.sample_rate;
+}
+
+/*one meter's readings in dBFS, one entry per channel*/
+json levels_to_json(const LevelSnapshot& snapshot)
+{
+    json levels = {{"peak dbfs", json::array()}, {"rms dbfs", json::array()},
+                   {"clipped samples", snapshot.clipped}, {"frames", snapshot.frames}};
+    for (int channel = 0; channel < snapshot.channels; channel++)
+    {
+        levels["peak dbfs"].push_back(level_to_dbfs(snapshot.peak[channel]));
+        levels["rms dbfs"].push_back(level_to_dbfs(snapshot.rms[channel]));
+    }
+    if (level_meters.output.true_peak() && !level_meters.output.true_peak_suspended())
+    {
+        levels["true peak dbfs"] = json::array();
+        for (int channel = 0; channel < snapshot.channels; channel++)
+            levels["true peak dbfs"].push_back(level_to_dbfs(snapshot.true_peak[channel]));
+    }
+    return levels;
+}
+
+/*true peak metering is off unless the optional "metering" section of the config has "true peak": true*/
+void metering_from_config(const json& config)
+{
+    bool true_peak {config.contains("metering") && config["metering"].value("true peak", false)};
+    level_meters.playing.set_true_peak(true_peak);
+    level_meters.incoming.set_true_peak(true_peak);
+    level_meters.output.set_true_peak(true_peak);
+}
+
+/*normalisation is off unless the config has a "loudness" section e.g. {"target lufs": -23}*/
+void loudness_from_config(const json& config)
+{
+    if (!config.contains("loudness"))
+        return;
+
+    const json& loudness {config["loudness"]};
+    try
+    {
+        LoudnessSettings settings {};
+        settings.enabled = loudness.value("enabled", true);
+        settings.target_lufs = loudness.value("target lufs", settings.target_lufs);
+        settings.max_gain_db = std::max(0.0, loudness.value("max gain db", settings.max_gain_db));
+        settings.max_cut_db = std::max(0.0, loudness.value("max cut db", settings.max_cut_db));
+        settings.smoothing_seconds = std::max(0.0, loudness.value("smoothing seconds", settings.smoothing_seconds));
+        loudness_settings = settings;
+    }
+    catch (const json::exception& exception)
+    {
+        std::cout << "loudness: " << exception.what() << ", normalisation disabled\n";
+    }
+}
+
+/*the limiter is on unless the config's "limiter" section says otherwise e.g. {"ceiling dbfs": -1, "lookahead ms": 5}*/
+LimiterSettings limiter_settings_from_config(const json& config)
+{
+    LimiterSettings settings {};
+    if (!config.contains("limiter"))
+        return settings;
+
+    const json& limiter {config["limiter"]};
+    try
+    {
+        settings.enabled = limiter.value("enabled", settings.enabled);
+        settings.ceiling_dbfs = std::min(0.0, limiter.value("ceiling dbfs", settings.ceiling_dbfs));
+        settings.lookahead_ms = std::max(0.0, limiter.value("lookahead ms", settings.lookahead_ms));
+        settings.release_ms = std::max(1.0, limiter.value("release ms", settings.release_ms));
+    }
+    catch (const json::exception& exception)
+    {
+        std::cout << "limiter: " << exception.what() << ", using the defaults\n";
+        settings = LimiterSettings {};
+    }
+    return settings;
+}
+
+/*the optional "resampler profile" of the stream settings e.g. "fast", fallback without one or for one which isn't a profile*/
+void resampler_profile_from_config(const json& settings, ResamplerProfiles fallback)
+{
+    default_resampler_profile = fallback;
+    try
+    {
+        const std::string name {settings.value("resampler profile", std::string{resampler_profile_name(fallback)})};
+        if (!parse_resampler_profile(name, default_resampler_profile))
+            std::cout << "resampler profile \"" << name << "\" isn't fast, standard, high or soxr, using "
+                      << resampler_profile_name(fallback) << '\n';
+    }
+    catch (const json::exception& exception)
+    {
+        std::cout << "resampler profile: " << exception.what() << ", using " << resampler_profile_name(fallback) << '\n';
+    }
+    /*says so at startup rather than when the first source opens if soxr isn't there*/
+    if (default_resampler_profile == ResamplerProfiles::soxr)
+        soxr_available();
+}
+
+/*the quality governor is off unless the config has a "quality governor" section e.g. {"steps": ["true peak", "resampler"]}*/
+QualityGovernorSettings quality_governor_settings_from_config(const json& config)
+{
+    QualityGovernorSettings settings {};
+    if (!config.contains("quality governor"))
+        return settings;
+
+    const json& governor {config["quality governor"]};
+    try
+    {
+        settings.enabled = governor.value("enabled", true);
+        settings.window_frames = governor.value("window frames", settings.window_frames);
+        settings.misses_to_step_down = governor.value("misses to step down", settings.misses_to_step_down);
+        settings.min_margin = governor.value("min margin", settings.min_margin);
+        settings.recovery_margin = std::max(settings.min_margin, governor.value("recovery margin", settings.recovery_margin));
+        settings.recovery_windows = governor.value("recovery windows", settings.recovery_windows);
+        if (governor.contains("steps"))
+        {
+            settings.steps.clear();
+            for (const std::string& name : governor["steps"].get<std::vector<std::string>>())
+            {
+                QualitySteps step {};
+                if (parse_quality_step(name, step))
+                    settings.steps.push_back(step);
+                else
+                    std::cout << "quality governor: no step called \"" << name << "\", ignoring it\n";
+            }
+        }
+    }
+    catch (const json::exception& exception)
+    {
+        std::cout << "quality governor: " << exception.what() << ", governor disabled\n";
+        settings = QualityGovernorSettings {};
+    }
+    return settings;
+}
+
+/*the optional "output filter" of the stream settings, a filter chain for the output e.g. "acompressor", call before streaming starts*/
+void output_filter_from_config(const json& stream_settings, OutputStream& sink)
+{
+    std::string chain {};
+    try
+    {
+        chain = stream_settings.value("output filter", std::string{});
+        if (!chain.empty())
+            sink.set_filter_graph(output_filter_graph(chain, sink.get_output_codec_context()));
+    }
+    catch (const json::exception& exception)
+    {
+        std::cout << "output filter: " << exception.what() << ", streaming without output filters\n";
+    }
+    catch (const char* exception)
+    {
+        std::cout << "output filter \"" << chain << "\": " << exception << ", streaming without output filters\n";
+    }
+}
+
+/*the playing source's loudness and normalising gain, for the metrics and the levels command*/
+void publish_loudness(const InputStream& source)
+{
+    const LoudnessMeter& meter {source.get_loudness_meter()};
+    pipeline_metrics.momentary_centilufs.set(std::lround(100 * meter.momentary()));
+    pipeline_metrics.short_term_centilufs.set(std::lround(100 * meter.short_term()));
+    pipeline_metrics.integrated_centilufs.set(std::lround(100 * meter.integrated()));
+    pipeline_metrics.loudness_gain_millibels.set(std::lround(100 * source.get_loudness_gain_db()));
+}
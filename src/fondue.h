@@ -0,0 +1,103 @@
+/*
+* Declarations shared between the parts of the fondue application: the realtime
+* streaming/ control threads in fondue.cpp and the offline render mode.
+*/
+
+#ifndef FONDUE_H
+#define FONDUE_H
+
+#include "Fonduempeg.h"
+#include "Realtime.h"
+#include "ConfigStore.h"
+#include "AudioChannel.h"
+#include "Scheduler.h"
+#include "SourceProber.h"
+#include "Failover.h"
+#include <nlohmann/json.hpp>
+#include<string>
+#include<vector>
+
+#define PATH_TO_CONFIG_FILE "/home/icradio/fondue/config_files/config.json"
+/*a switch due within this many frames of the output clock starts its crossfade now*/
+#define SWITCH_LOOKAHEAD_FRAMES 2
+
+using json = nlohmann::json;
+
+void continue_streaming (std::unique_ptr<InputStream>& source, OutputStream& sink, 
+                         std::chrono::_V2::steady_clock::time_point& end_time, AudioChannel& channel);
+bool crossfade (std::unique_ptr<InputStream>& source, InputStream& new_source, OutputStream& sink, 
+                std::chrono::_V2::steady_clock::time_point& end_time, AudioChannel& channel,
+                int64_t start_sample, int64_t& actual_start_sample);
+int64_t switch_horizon(InputStream& source, const OutputStream& sink);
+void audio_processing (std::unique_ptr<InputStream> source, OutputStream &sink, 
+                        AudioChannel& channel, const ThreadSettings& thread_settings);
+class CommandExecutor;
+struct ControlServerSettings;
+
+void control (CommandExecutor& executor, AudioChannel& channel, ConfigStore& config_store);
+json execute_command(const json& request, ConfigStore& config_store, AudioChannel& channel, 
+                    Scheduler& scheduler, SourceProber& prober, FailoverManager& failover, 
+                    const AVCodecContext& output_codec_ctx);
+void collect_audio_events(AudioChannel& channel, ConfigStore& config_store);
+void log_quality_transitions();
+json request_from_text_command(std::string command);
+void print_response(const json& response);
+std::string usage_text();
+std::string remove_quotes(std::string name);
+bool find_and_remove(std::string& command, const std::string& substring);
+
+std::vector<std::string> split_command_on_whitespace(const std::string& command);
+
+RealtimeSettings realtime_settings_from_config(const json& config);
+
+ThreadSettings thread_settings_from_config(const json& thread_config);
+
+ControlServerSettings control_server_settings_from_config(const json& config);
+
+/*opens a source from the config and decodes its first frame, throws a const char* exception on failure*/
+std::unique_ptr<InputStream> open_named_source(const std::string& name, ConfigStore& config_store, 
+                                               const AVCodecContext& output_codec_ctx);
+
+/*duration of one output frame in milliseconds*/
+double sink_frame_duration_ms(const AVCodecContext& output_codec_ctx);
+
+/*adds the daily switches in the optional "schedule" section of the config e.g. [{"at": "14:00", "source": "news"}]*/
+void schedule_from_config(const json& config, Scheduler& scheduler);
+
+/*one meter's readings in dBFS, one entry per channel*/
+json levels_to_json(const LevelSnapshot& snapshot);
+
+/*true peak metering is off unless the optional "metering" section of the config has "true peak": true*/
+void metering_from_config(const json& config);
+
+/*loudness normalisation is off unless the config has a "loudness" section e.g. {"target lufs": -23}*/
+void loudness_from_config(const json& config);
+
+/*sets the default resampler profile from the optional "resampler profile" of the stream settings, fallback without one*/
+void resampler_profile_from_config(const json& settings, ResamplerProfiles fallback);
+
+/*filters the output with the "output filter" of the stream settings, if there is one*/
+void output_filter_from_config(const json& stream_settings, OutputStream& sink);
+
+/*the output limiter's settings from the optional "limiter" section of the config, the limiter is on without one*/
+LimiterSettings limiter_settings_from_config(const json& config);
+
+/*the quality governor's settings from the optional "quality governor" section of the config, off without one*/
+QualityGovernorSettings quality_governor_settings_from_config(const json& config);
+
+/*sets the loudness metrics from the playing source*/
+void publish_loudness(const InputStream& source);
+
+bool source_startup_timeout(std::unique_ptr<InputStream>& input, SourceDescriptorPtr descriptor, const AVCodecContext& output_codec_ctx, 
+                            SourceTimingModes& timing_mode, DefaultSourceModes& source_mode, int timeout_time);
+
+/*renders a script of source switches to a file as fast as possible, returns the process exit code*/
+int offline_render(const std::string& script_path);
+
+/*scores the dead air detector against a recording with its silences marked, returns the process exit code*/
+int analyse_dead_air(const std::string& fixture_path);
+
+/*prints the integrated loudness of a source as the sources measure it while streaming, returns the process exit code*/
+int analyse_loudness(const std::string& prompt);
+
+#endif
@@ -0,0 +1,125 @@
+#include "fondue.h"
+#include<iomanip>
+
+/*
+* Loudness analysis mode: decodes a source as fast as it will go through the same loudness meter
+* the sources use while streaming and prints its integrated loudness, to check the meter against
+* FFmpeg's, e.g.
+*
+*     fondue loudness "-i recording.wav"
+*     ffmpeg -nostats -i recording.wav -af ebur128 -f null -
+*
+* The source is measured at its own sample rate and channel layout (as the ebur128 filter would),
+* without normalisation. Also prints the gain that would normalise it to the "loudness" target of
+* the config (-23 LUFS without one) and what measuring it cost.
+*/
+
+/*the source's first audio stream's sample rate and channel layout*/
+bool probe_source_format(const SourceDescriptor& descriptor, int& sample_rate, AVChannelLayout& ch_layout)
+{
+    AVFormatContext* format_ctx {};
+    AVDictionary* options {};
+    av_dict_copy(&options, descriptor.options(), 0);
+    int ret = avformat_open_input(&format_ctx, descriptor.url().c_str(), descriptor.input_format(), &options);
+    av_dict_free(&options);
+    FormatContextHandle format_handle {format_ctx};
+    if (ret < 0 || avformat_find_stream_info(format_ctx, NULL) < 0)
+        return false;
+
+    int stream_index = av_find_best_stream(format_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    if (stream_index < 0)
+        return false;
+    const AVCodecParameters* parameters {format_ctx->streams[stream_index]->codecpar};
+    sample_rate = parameters->sample_rate;
+    return sample_rate > 0 && av_channel_layout_copy(&ch_layout, &parameters->ch_layout) >= 0;
+}
+
+int analyse_loudness(const std::string& prompt)
+{
+    LoudnessSettings target {};
+    try
+    {
+        json config = open_config_file(PATH_TO_CONFIG_FILE);
+        if (config.contains("loudness"))
+            target.target_lufs = config["loudness"].value("target lufs", target.target_lufs);
+    }
+    /*no config, the default target*/
+    catch (const json::exception&)
+    {
+    }
+    /*measure the source as it is*/
+    loudness_settings.enabled = false;
+
+    SourceDescriptor descriptor {prompt};
+    if (!descriptor.valid())
+    {
+        std::cout << "loudness: " << descriptor.error() << '\n';
+        return 1;
+    }
+
+    /*allocated by FFmpeg, sizeof(AVCodecContext) isn't part of its ABI. freeing it frees the channel layout*/
+    CodecContextHandle output_codec_handle {avcodec_alloc_context3(NULL)};
+    if (!output_codec_handle)
+    {
+        std::cout << "loudness: could not allocate a codec context\n";
+        return 1;
+    }
+    AVCodecContext& output_codec_ctx {*output_codec_handle};
+    output_codec_ctx.sample_fmt = AV_SAMPLE_FMT_FLTP;
+    /*the sources' output frame size, without one they hand out empty frames and never decode*/
+    output_codec_ctx.frame_size = DEFAULT_FRAME_SIZE;
+    if (!probe_source_format(descriptor, output_codec_ctx.sample_rate, output_codec_ctx.ch_layout))
+    {
+        std::cout << "loudness: couldn't find an audio stream in the source\n";
+        return 1;
+    }
+
+    std::unique_ptr<InputStream> source {};
+    try
+    {
+        source = std::make_unique<InputStream>(descriptor, output_codec_ctx, SourceTimingModes::freetime, DefaultSourceModes::silence);
+    }
+    catch (const char* exception)
+    {
+        std::cout << "loudness: " << exception << '\n';
+        return 1;
+    }
+
+    loop_timer.attach_to_this_thread();
+    loop_timer.reset();
+    int64_t samples {};
+    double max_momentary {METER_FLOOR_DBFS}, max_short_term {METER_FLOOR_DBFS};
+    while (true)
+    {
+        try
+        {
+            source->get_one_output_frame();
+        }
+        /*the end of the source*/
+        catch (const char*)
+        {
+            break;
+        }
+        samples += source->get_frame()->nb_samples;
+        max_momentary = std::max(max_momentary, source->get_loudness_meter().momentary());
+        max_short_term = std::max(max_short_term, source->get_loudness_meter().short_term());
+        loop_timer.end_iteration(false);
+    }
+
+    const LoudnessMeter& meter {source->get_loudness_meter()};
+    const double duration = static_cast<double>(samples) / output_codec_ctx.sample_rate;
+    const double loudness_seconds = loop_timer.histogram(LoopStages::loudness).total_ns() / 1e9;
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "loudness: " << duration << " s at " << output_codec_ctx.sample_rate << " Hz, "
+              << output_codec_ctx.ch_layout.nb_channels << " channels\n";
+    std::cout << "    I:         " << std::setw(6) << meter.integrated() << " LUFS\n";
+    std::cout << "    Threshold: " << std::setw(6) << meter.relative_gate() << " LUFS\n";
+    std::cout << "    max momentary " << max_momentary << " LUFS, max short-term " << max_short_term << " LUFS\n";
+    if (meter.gated_blocks())
+        std::cout << "    gain to " << target.target_lufs << " LUFS: " << target.target_lufs - meter.integrated() << " dB\n";
+    std::cout << std::setprecision(3) << "    metering took " << 1e3 * loudness_seconds << " ms, "
+              << (duration > 0 ? 100 * loudness_seconds / duration : 0) << "% of a core in realtime\n";
+
+    return 0;
+}
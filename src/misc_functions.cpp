@@ -1,11 +1,14 @@
 #include"Fonduempeg.h"
+#include<algorithm>
+#include<limits>
 
 
 
 
 char* av_error_to_string(int error_code)
 {
-    char a[AV_ERROR_MAX_STRING_SIZE] = { 0 };
+    /*one buffer per thread, the message has to outlive this function and mustn't need an allocation*/
+    thread_local char a[AV_ERROR_MAX_STRING_SIZE] = { 0 };
     return av_make_error_string(a, AV_ERROR_MAX_STRING_SIZE, error_code);
 }
 
@@ -26,12 +29,208 @@ struct timespec get_timespec_from_ticks(int ticks)
 * assumes the iteration start time is equal to the end time of the previous iteration*/
 void fondue_sleep(std::chrono::_V2::steady_clock::time_point &end_time, const std::chrono::duration<double> &loop_duration, const SourceTimingModes &timing_mode)
 {
-    
+    bool deadline_missed = false;
+
     if (timing_mode == SourceTimingModes::realtime)
     {
-        std::chrono::duration<double> sleep_time = loop_duration - (std::chrono::steady_clock::now() - end_time);
-        std::this_thread::sleep_for(sleep_time);
+        std::chrono::duration<double> work_time = std::chrono::steady_clock::now() - end_time;
+        std::chrono::duration<double> sleep_time = loop_duration - work_time;
+        /*the work in this iteration took longer than the frame it produced*/
+        deadline_missed = sleep_time.count() < 0;
+        if (deadline_missed)
+        {
+            pipeline_metrics.underruns.add();
+            FONDUE_TRACE_DEADLINE_MISSED();
+        }
+
+        const QualityTransitions transition = quality_governor.end_frame(work_time / loop_duration, deadline_missed);
+        if (transition != QualityTransitions::none)
+        {
+            (transition == QualityTransitions::step_down ? pipeline_metrics.quality_step_downs : pipeline_metrics.quality_step_ups).add();
+            pipeline_metrics.quality_level.set(quality_governor.level());
+        }
+        {
+            FONDUE_TRACE_SPAN("sleep");
+            std::this_thread::sleep_for(sleep_time);
+        }
+
+        if (LoopTimer::attached())
+        {
+            /*how late the thread woke up relative to the end of the loop period*/
+            std::chrono::duration<double> lateness = (std::chrono::steady_clock::now() - end_time) - loop_duration;
+            if (lateness.count() > 0)
+                LoopTimer::add(LoopStages::sleep_lateness, std::chrono::duration_cast<std::chrono::steady_clock::duration>(lateness));
+            else
+                LoopTimer::add(LoopStages::sleep_lateness, std::chrono::steady_clock::duration::zero());
+        }
     }
     
     end_time = std::chrono::steady_clock::now();
+    loop_timer.end_iteration(deadline_missed);
+    AllocAccounting::end_frame();
+}
+
+/*scales nb_samples samples of one channel, stride is 1 for planar or the channel count for packed data*/
+template <typename T>
+void scale_samples(T* samples, int nb_samples, int stride, float start_gain, float gain_increment)
+{
+    float gain = start_gain;
+    for (int i = 0; i < nb_samples; i++)
+    {
+        samples[i * stride] = static_cast<T>(samples[i * stride] * gain);
+        gain += gain_increment;
+    }
+}
+
+/*as above for integer samples, saturating instead of wrapping around*/
+template <typename T, typename Wide>
+void scale_integer_samples(T* samples, int nb_samples, int stride, float start_gain, float gain_increment)
+{
+    float gain = start_gain;
+    for (int i = 0; i < nb_samples; i++)
+    {
+        Wide scaled = static_cast<Wide>(std::lrint(samples[i * stride] * static_cast<double>(gain)));
+        scaled = std::min<Wide>(std::max<Wide>(scaled, std::numeric_limits<T>::min()), std::numeric_limits<T>::max());
+        samples[i * stride] = static_cast<T>(scaled);
+        gain += gain_increment;
+    }
+}
+
+/*unsigned 8 bit samples are offset by 128*/
+void scale_u8_samples(uint8_t* samples, int nb_samples, int stride, float start_gain, float gain_increment)
+{
+    float gain = start_gain;
+    for (int i = 0; i < nb_samples; i++)
+    {
+        long scaled = std::lrint((samples[i * stride] - 128) * gain) + 128;
+        samples[i * stride] = static_cast<uint8_t>(std::min(std::max(scaled, 0L), 255L));
+        gain += gain_increment;
+    }
+}
+
+void apply_gain(AVFrame* frame, float start_gain, float end_gain)
+{
+    const int nb_channels = frame->ch_layout.nb_channels;
+    const AVSampleFormat format = static_cast<AVSampleFormat>(frame->format);
+    const bool planar = av_sample_fmt_is_planar(format);
+    /*planar frames have one plane per channel, packed frames interleave every channel in data[0]*/
+    const int planes = planar ? nb_channels : 1;
+    const int channels_per_plane = planar ? 1 : nb_channels;
+    const float gain_increment = frame->nb_samples ? (end_gain - start_gain) / frame->nb_samples : 0;
+
+    for (int plane = 0; plane < planes; plane++)
+    {
+        for (int channel = 0; channel < channels_per_plane; channel++)
+        {
+            switch (av_get_packed_sample_fmt(format))
+            {
+                case AV_SAMPLE_FMT_U8:
+                    scale_u8_samples(frame->data[plane] + channel, frame->nb_samples, channels_per_plane, start_gain, gain_increment);
+                    break;
+                case AV_SAMPLE_FMT_S16:
+                    scale_integer_samples<int16_t, int32_t>(reinterpret_cast<int16_t*>(frame->data[plane]) + channel, 
+                                                            frame->nb_samples, channels_per_plane, start_gain, gain_increment);
+                    break;
+                case AV_SAMPLE_FMT_S32:
+                    scale_integer_samples<int32_t, int64_t>(reinterpret_cast<int32_t*>(frame->data[plane]) + channel, 
+                                                            frame->nb_samples, channels_per_plane, start_gain, gain_increment);
+                    break;
+                case AV_SAMPLE_FMT_FLT:
+                    scale_samples(reinterpret_cast<float*>(frame->data[plane]) + channel, 
+                                  frame->nb_samples, channels_per_plane, start_gain, gain_increment);
+                    break;
+                case AV_SAMPLE_FMT_DBL:
+                    scale_samples(reinterpret_cast<double*>(frame->data[plane]) + channel, 
+                                  frame->nb_samples, channels_per_plane, start_gain, gain_increment);
+                    break;
+                default:
+                    /*64 bit integer samples aren't produced by any encoder fondue supports*/
+                    break;
+            }
+        }
+    }
+}
+
+void meter_frame(LevelMeter& meter, const AVFrame* frame)
+{
+    FONDUE_TRACE_SPAN("meter_frame");
+    const AVSampleFormat format = static_cast<AVSampleFormat>(frame->format);
+    const bool planar = av_sample_fmt_is_planar(format);
+
+    switch (av_get_packed_sample_fmt(format))
+    {
+        case AV_SAMPLE_FMT_S16:
+            meter.measure(frame->data, frame->ch_layout.nb_channels, frame->nb_samples, MeterSampleFormats::s16, planar);
+            break;
+        case AV_SAMPLE_FMT_S32:
+            meter.measure(frame->data, frame->ch_layout.nb_channels, frame->nb_samples, MeterSampleFormats::s32, planar);
+            break;
+        case AV_SAMPLE_FMT_FLT:
+            meter.measure(frame->data, frame->ch_layout.nb_channels, frame->nb_samples, MeterSampleFormats::flt, planar);
+            break;
+        default:
+            break;
+    }
+}
+
+void loudness_frame(LoudnessMeter& meter, const AVFrame* frame)
+{
+    const AVSampleFormat format = static_cast<AVSampleFormat>(frame->format);
+    const bool planar = av_sample_fmt_is_planar(format);
+
+    switch (av_get_packed_sample_fmt(format))
+    {
+        case AV_SAMPLE_FMT_S16:
+            meter.measure(frame->data, frame->ch_layout.nb_channels, frame->nb_samples, MeterSampleFormats::s16, planar);
+            break;
+        case AV_SAMPLE_FMT_S32:
+            meter.measure(frame->data, frame->ch_layout.nb_channels, frame->nb_samples, MeterSampleFormats::s32, planar);
+            break;
+        case AV_SAMPLE_FMT_FLT:
+            meter.measure(frame->data, frame->ch_layout.nb_channels, frame->nb_samples, MeterSampleFormats::flt, planar);
+            break;
+        default:
+            break;
+    }
+}
+
+void limit_frame(Limiter& limiter, AVFrame* frame)
+{
+    if (!limiter.enabled() || av_get_packed_sample_fmt(static_cast<AVSampleFormat>(frame->format)) != AV_SAMPLE_FMT_FLT)
+        return;
+
+    FONDUE_TRACE_SPAN("limit_frame");
+    const bool planar = av_sample_fmt_is_planar(static_cast<AVSampleFormat>(frame->format));
+    const int nb_channels = std::min(frame->ch_layout.nb_channels, LIMITER_MAX_CHANNELS);
+    std::array<float*, LIMITER_MAX_CHANNELS> channels {};
+    /*planar frames have a plane per channel, packed frames interleave them in the first*/
+    for (int channel = 0; channel < nb_channels; channel++)
+        channels[channel] = planar ? reinterpret_cast<float*>(frame->extended_data[channel])
+                                   : reinterpret_cast<float*>(frame->extended_data[0]) + channel;
+    limiter.process(channels.data(), nb_channels, frame->nb_samples, planar ? 1 : frame->ch_layout.nb_channels);
+}
+
+std::array<double, MAX_METER_CHANNELS> loudness_channel_weights(const AVChannelLayout& layout)
+{
+    std::array<double, MAX_METER_CHANNELS> weights {};
+    for (int channel = 0; channel < std::min(layout.nb_channels, MAX_METER_CHANNELS); channel++)
+    {
+        switch (av_channel_layout_channel_from_index(&layout, channel))
+        {
+            case AV_CHAN_LOW_FREQUENCY:
+            case AV_CHAN_LOW_FREQUENCY_2:
+                weights[channel] = 0;
+                break;
+            case AV_CHAN_SIDE_LEFT:
+            case AV_CHAN_SIDE_RIGHT:
+            case AV_CHAN_BACK_LEFT:
+            case AV_CHAN_BACK_RIGHT:
+                weights[channel] = 1.41;
+                break;
+            default:
+                weights[channel] = 1;
+                break;
+        }
+    }
+    return weights;
 }
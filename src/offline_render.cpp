@@ -0,0 +1,257 @@
+#include "fondue.h"
+#include<algorithm>
+#include<iomanip>
+
+/*
+* Offline render mode: runs a script of source selections and crossfades against (file) sources
+* with SourceTimingModes::freetime so nothing sleeps, and writes the result to a file as fast as
+* the CPU allows. Useful as a reproducible benchmark of the whole decode->mix->encode path.
+*
+* example script:
+* {
+*     "output": "-f mp3 render.mp3",
+*     "duration seconds": 60,
+*     "events": [
+*         {"at seconds": 0, "source": "test input home"},
+*         {"at seconds": 20, "source": "test input 2 home"},
+*         {"at seconds": 40, "prompt": "-i /home/icradio/audio_sources/alt_theme.mp3"}
+*     ],
+*     "max steady state allocations": 0
+* }
+* "source" names are looked up in the "sources" section of the config file, "prompt" is used as is.
+* Switches go through the AudioChannel as the realtime ones do: each event is opened and requested
+* at "requested at seconds" (its "at seconds" without one) for a crossfade starting at exactly "at
+* seconds", or with "scheduled": false for one starting as soon as it is requested, like use-source.
+* The render fails (exit code 1) if a switch is superseded and never played.
+* A "loudness" section normalises the sources as the config's does, to hear the crossfades between them,
+* and a "limiter" section configures the output limiter as the config's does. "output filter" filters
+* the output as the config's stream settings do, sources' prompts can have their own -af. "resampler profile"
+* is the sources' resampler profile (see ResamplerProfiles.h), high without one.
+* With "max steady state allocations" the render fails (exit code 1) if fondue's own code makes more
+* heap allocations than that once warmed up, opening the sources aside; this needs a build with
+* -DFONDUE_ALLOC_ACCOUNTING=ON.
+*/
+
+struct RenderEvent
+{
+    int64_t at_sample {};
+    /*when the source is opened and the switch handed to the audio channel*/
+    int64_t requested_sample {};
+    bool scheduled {true};
+    std::string name {};
+    std::string prompt {};
+};
+
+/*reads the events from the script, resolving source names against the config file*/
+std::vector<RenderEvent> render_events_from_script(const json& script, int sample_rate)
+{
+    std::vector<RenderEvent> events {};
+    std::unique_ptr<ConfigStore> config_store {};
+
+    for (const json& item : script["events"])
+    {
+        RenderEvent event {};
+        event.at_sample = static_cast<int64_t>(item.value("at seconds", 0.0) * sample_rate);
+        event.requested_sample = static_cast<int64_t>(item.value("requested at seconds", item.value("at seconds", 0.0)) * sample_rate);
+        event.scheduled = item.value("scheduled", true);
+        if (item.contains("prompt"))
+        {
+            event.prompt = item["prompt"];
+            event.name = event.prompt;
+        }
+        else
+        {
+            if (!config_store)
+                config_store = std::make_unique<ConfigStore>(PATH_TO_CONFIG_FILE);
+            event.name = item["source"];
+            if (!config_store->find_source(event.name, event.prompt))
+                throw "render: script refers to a source which isn't in the config file";
+        }
+        events.push_back(event);
+    }
+
+    /*the first event is the source the render starts with, the others are handed over in the order they're requested*/
+    std::stable_sort(events.begin(), events.end(),
+                    [](const RenderEvent& a, const RenderEvent& b){return a.at_sample < b.at_sample;});
+    std::stable_sort(events.begin() + 1, events.end(),
+                    [](const RenderEvent& a, const RenderEvent& b){return a.requested_sample < b.requested_sample;});
+    return events;
+}
+
+/*opens a source for rendering, falls back to silence (not white noise) so renders stay reproducible*/
+std::unique_ptr<InputStream> open_render_source(const RenderEvent& event, const AVCodecContext& output_codec_ctx)
+{
+    try
+    {
+        SourceDescriptor descriptor {event.prompt};
+        return std::make_unique<InputStream>(descriptor, output_codec_ctx, SourceTimingModes::freetime, DefaultSourceModes::silence);
+    }
+    catch (const char* exception)
+    {
+        std::cout << event.name << ": " << exception << ": rendering silence instead\n";
+        return std::make_unique<InputStream>(output_codec_ctx, DefaultSourceModes::silence, SourceTimingModes::freetime);
+    }
+}
+
+/*prints the switches the audio channel has finished, returns how many were superseded*/
+int report_render_switches(const std::vector<FinishedSwitch>& finished, int sample_rate)
+{
+    int superseded {};
+    for (const FinishedSwitch& result : finished)
+    {
+        if (result.result == AudioEventTypes::switch_superseded)
+        {
+            std::cout << "render: switch to " << result.name << " superseded\n";
+            superseded++;
+        }
+        else if (result.result == AudioEventTypes::switch_complete && result.scheduled && result.error_samples)
+        {
+            std::cout << "render: crossfade to " << result.name << " started " << result.error_samples
+                      << " samples (" << static_cast<double>(result.error_samples) / sample_rate << " s) from its scheduled time\n";
+        }
+    }
+    return superseded;
+}
+
+int offline_render(const std::string& script_path)
+{
+    json script = json::object();
+    try
+    {
+        script = open_config_file(script_path);
+    }
+    catch (const json::exception& exception)
+    {
+        std::cout << "render: could not read script: " << exception.what() << '\n';
+        return 1;
+    }
+
+    if (!script.contains("output") || !script.contains("events") || script["events"].empty())
+    {
+        std::cout << "render: script needs an \"output\" prompt and at least one entry in \"events\"\n";
+        return 1;
+    }
+
+    loudness_from_config(script);
+    /*the render has time to spare, its sources are resampled at high quality unless the script says otherwise*/
+    resampler_profile_from_config(script, ResamplerProfiles::high);
+    FFMPEGString output_prompt {script["output"]};
+    OutputStream sink {output_prompt};
+    sink.set_limiter(limiter_settings_from_config(script));
+    output_filter_from_config(script, sink);
+    const AVCodecContext& output_codec_ctx {sink.get_output_codec_context()};
+    const int sample_rate {output_codec_ctx.sample_rate};
+
+    std::vector<RenderEvent> events {};
+    try
+    {
+        events = render_events_from_script(script, sample_rate);
+    }
+    catch (const char* exception)
+    {
+        std::cout << exception << '\n';
+        return 1;
+    }
+
+    double duration_seconds = script.value("duration seconds", 0.0);
+    int64_t total_samples = duration_seconds > 0 ? static_cast<int64_t>(duration_seconds * sample_rate)
+                                                 : events.back().at_sample + DEFAULT_FADE_MS * sample_rate / 1000;
+
+    const bool check_allocations {script.contains("max steady state allocations")};
+    if (check_allocations && !AllocAccounting::compiled_in())
+    {
+        std::cout << "render: \"max steady state allocations\" needs a build with -DFONDUE_ALLOC_ACCOUNTING=ON\n";
+        return 1;
+    }
+
+    AudioChannel channel {};
+    channel.provide_fallbacks(output_codec_ctx, SourceTimingModes::freetime);
+    std::unique_ptr<InputStream> source {open_render_source(events.front(), output_codec_ctx)};
+    std::size_t next_event = 1;
+    int superseded {};
+
+    loop_timer.reset();
+    loop_timer.attach_to_this_thread();
+    alloc_accounting.account_this_thread("render");
+    auto start_time = std::chrono::steady_clock::now();
+    std::chrono::_V2::steady_clock::time_point end_time = start_time;
+
+    while (sink.get_samples_written() < total_samples)
+    {
+        /*the realtime fondue opens sources on the control thread, only the crossfade itself is the audio path*/
+        while (next_event < events.size() && events[next_event].requested_sample < switch_horizon(*source, sink))
+        {
+            FONDUE_ALLOC_SCOPE(AllocScopes::setup);
+            const RenderEvent& event {events[next_event++]};
+            std::cout << "render: " << std::fixed << std::setprecision(3) << static_cast<double>(event.requested_sample) / sample_rate
+                      << " s: switch to " << event.name << " requested";
+            if (event.scheduled)
+                std::cout << " for " << static_cast<double>(event.at_sample) / sample_rate << " s";
+            std::cout << '\n';
+            try
+            {
+                channel.switch_source(open_render_source(event, output_codec_ctx), event.name, event.scheduled ? event.at_sample : -1);
+            }
+            catch (const char* exception)
+            {
+                std::cout << "render: " << exception << '\n';
+            }
+        }
+
+        channel.service(sink);
+        /*crossfade to the next source, a scheduled one starting at exactly its start time on the output clock*/
+        if (channel.switch_due(switch_horizon(*source, sink)))
+        {
+            uint64_t switch_id {};
+            int64_t start_sample {}, actual_start_sample {};
+            std::unique_ptr<InputStream> new_source {channel.take_pending(switch_id, start_sample)};
+            const bool success {crossfade(source, *new_source, sink, end_time, channel, start_sample, actual_start_sample)};
+            if (success)
+                source.swap(new_source);
+            channel.finish_switch(switch_id, success, std::move(new_source), start_sample, actual_start_sample);
+
+            FONDUE_ALLOC_SCOPE(AllocScopes::setup);
+            /*destroys the retired sources and replaces the fallbacks*/
+            superseded += report_render_switches(channel.collect_events(), sample_rate);
+            continue;
+        }
+
+        try
+        {
+            source->get_one_output_frame();
+            sink.write_frame(*source);
+            source->sleep(end_time);
+        }
+        catch (const char* exception)
+        {
+            FONDUE_ALLOC_SCOPE(AllocScopes::setup);
+            std::cout << "render: " << exception << ": rendering silence until the next event\n";
+            source = std::make_unique<InputStream>(output_codec_ctx, DefaultSourceModes::silence, SourceTimingModes::freetime);
+        }
+    }
+
+    sink.finish_streaming();
+    superseded += report_render_switches(channel.collect_events(), sample_rate);
+    std::chrono::duration<double> wall_time = std::chrono::steady_clock::now() - start_time;
+    double rendered_seconds = static_cast<double>(sink.get_samples_written()) / sample_rate;
+
+    std::cout << "render: " << std::fixed << std::setprecision(3) << rendered_seconds << " s of audio in "
+              << wall_time.count() << " s (" << std::setprecision(1) << rendered_seconds / wall_time.count()
+              << "x realtime)\n";
+    loop_timer.dump(std::cout);
+
+    if (AllocAccounting::compiled_in())
+        alloc_accounting.print_stats(std::cout);
+    if (superseded)
+    {
+        std::cout << "render: " << superseded << " switches superseded and never played\n";
+        return 1;
+    }
+    if (check_allocations && alloc_accounting.steady_state_allocations() > script["max steady state allocations"].get<uint64_t>())
+    {
+        std::cout << "render: " << alloc_accounting.steady_state_allocations() << " steady state allocations, at most "
+                  << script["max steady state allocations"].get<uint64_t>() << " allowed\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,139 @@
+/*
+* Drives DeadAirDetector with generated blocks of silence, tone and noise, measured by a LevelMeter
+* the way the audio thread measures the playing source, and checks when it declares and clears dead
+* air: silence and a noise floor under the threshold are detected between trigger_seconds and
+* trigger_seconds plus a window after they start, a tone or noise above the threshold never is, a
+* level between the threshold and threshold + hysteresis doesn't change the state, one live channel
+* of a stereo pair keeps the source live and reset() forgets the silence.
+*
+* usage: fondue_dead_air_test, exits 1 if a check fails
+*/
+
+#include "../src/DeadAirDetector.h"
+
+#include<cmath>
+#include<cstdint>
+#include<iostream>
+#include<string>
+#include<vector>
+
+const int frame_size = 1152;
+const int sample_rate = 44100;
+const double pi = 3.14159265358979323846;
+
+enum class Blocks {silence, tone, noise};
+
+class Signal
+{
+    private:
+        DeadAirDetector& m_detector;
+        LevelMeter m_meter {};
+        std::vector<std::vector<float>> m_planes {2, std::vector<float>(frame_size)};
+        int64_t m_position {};
+        uint32_t m_noise {12345};
+
+    public:
+        explicit Signal(DeadAirDetector& detector): m_detector {detector} {}
+
+        double seconds() const {return static_cast<double>(m_position) / sample_rate;}
+
+        /*feeds seconds of the block type at dbfs (RMS) on the given channels, returns the time dead air
+        * was first declared, or a negative number if it wasn't*/
+        double feed(Blocks type, double seconds, double dbfs = 0, int live_channels = 2)
+        {
+            double declared {-1};
+            const double rms = std::pow(10.0, dbfs / 20);
+            const int64_t end = m_position + static_cast<int64_t>(seconds * sample_rate);
+            while (m_position < end)
+            {
+                for (int channel = 0; channel < 2; channel++)
+                {
+                    for (int i = 0; i < frame_size; i++)
+                    {
+                        float sample {};
+                        if (channel < live_channels && type == Blocks::tone)
+                            sample = static_cast<float>(rms * std::sqrt(2.0) * std::sin(2 * pi * 997 * (m_position + i) / sample_rate));
+                        else if (channel < live_channels && type == Blocks::noise)
+                        {
+                            /*uniform in [-1, 1) has an RMS of 1/sqrt(3)*/
+                            m_noise = m_noise * 1664525 + 1013904223;
+                            sample = static_cast<float>(rms * std::sqrt(3.0) * (m_noise / 2147483648.0 - 1));
+                        }
+                        m_planes[channel][i] = sample;
+                    }
+                }
+                const uint8_t* data[2] {reinterpret_cast<const uint8_t*>(m_planes[0].data()),
+                                        reinterpret_cast<const uint8_t*>(m_planes[1].data())};
+                m_meter.measure(data, 2, frame_size, MeterSampleFormats::flt, true);
+                m_position += frame_size;
+                const bool was_dead_air {m_detector.dead_air()};
+                if (m_detector.process(m_meter.snapshot(), frame_size) && !was_dead_air && declared < 0)
+                    declared = this->seconds();
+            }
+            return declared;
+        }
+};
+
+int failures {};
+
+void check(bool passed, const std::string& description)
+{
+    std::cout << (passed ? "ok   " : "FAIL ") << description << '\n';
+    failures += !passed;
+}
+
+int main()
+{
+    DeadAirSettings settings {};
+    settings.threshold_dbfs = -50;
+    settings.hysteresis_db = 6;
+    settings.window_seconds = 1;
+    settings.trigger_seconds = 10;
+    const double frame_seconds = static_cast<double>(frame_size) / sample_rate;
+    /*the latest a silence may be declared, it has to fill the window first*/
+    const double latest = settings.trigger_seconds + settings.window_seconds + 2 * frame_seconds;
+
+    DeadAirDetector detector {};
+    detector.configure(settings, sample_rate, frame_size);
+    Signal signal {detector};
+
+    check(signal.feed(Blocks::tone, 30, -20) < 0, "a -20 dBFS tone is never dead air");
+    check(signal.feed(Blocks::tone, 30, -40) < 0, "a -40 dBFS tone is never dead air");
+    check(signal.feed(Blocks::noise, 30, -30) < 0, "-30 dBFS noise is never dead air");
+
+    double start = signal.seconds();
+    double declared = signal.feed(Blocks::silence, 8);
+    check(declared < 0, "8 s of silence is shorter than the trigger");
+    declared = signal.feed(Blocks::silence, 7);
+    check(declared >= start + settings.trigger_seconds && declared <= start + latest,
+          "silence is declared between the trigger and the trigger plus a window (after "
+          + std::to_string(declared - start) + " s)");
+    check(detector.dead_air() && detector.detections() == 1, "dead air holds while the silence lasts");
+
+    signal.feed(Blocks::tone, settings.window_seconds + 2 * frame_seconds, -20);
+    check(!detector.dead_air(), "a tone ends the dead air within a window");
+
+    start = signal.seconds();
+    declared = signal.feed(Blocks::noise, 15, -60);
+    check(declared >= start + settings.trigger_seconds && declared <= start + latest,
+          "a -60 dBFS noise floor is dead air (after " + std::to_string(declared - start) + " s)");
+
+    /*between the threshold and the threshold plus the hysteresis neither starts nor ends a silence*/
+    signal.feed(Blocks::noise, 5, -47);
+    check(detector.dead_air(), "-47 dBFS noise doesn't end dead air (hysteresis)");
+    signal.feed(Blocks::noise, 3, -30);
+    check(!detector.dead_air(), "-30 dBFS noise ends it");
+    check(signal.feed(Blocks::noise, 30, -47) < 0, "-47 dBFS noise doesn't start dead air");
+
+    check(signal.feed(Blocks::tone, 30, -20, 1) < 0, "one live channel of a stereo pair is never dead air");
+
+    signal.feed(Blocks::silence, 9);
+    detector.reset();
+    start = signal.seconds();
+    declared = signal.feed(Blocks::silence, 15);
+    check(declared >= start + settings.trigger_seconds, "reset() forgets the silence so far");
+    check(detector.detections() == 3, "three detections counted (" + std::to_string(detector.detections()) + ")");
+
+    std::cout << (failures ? "dead air detector: FAILED\n" : "dead air detector: passed\n");
+    return failures ? 1 : 0;
+}
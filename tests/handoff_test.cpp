@@ -0,0 +1,146 @@
+/*
+* Runs the ownership handoffs AudioChannel makes, with plain heap objects standing in for sources so it
+* builds and runs without FFmpeg: two control threads hand objects to an audio thread through the command
+* queue, the audio thread keeps the newest as pending (superseding the one waiting), plays it by writing
+* to it every frame and retires the one it replaces through the event queue, takes fallbacks out of an
+* atomic slot which the collecting thread refills, and that thread destroys whatever comes back.
+* Every object must be destroyed exactly once, by the collecting thread, after the audio thread is done with
+* it. Built with the sanitizer in FONDUE_SANITIZER this is the address and thread sanitizer check of the
+* handoff itself, render_switches covers it with real sources.
+*
+* usage: fondue_handoff_test, exits 1 if an object leaked or was destroyed twice
+*/
+
+#include "../src/LockFreeQueue.h"
+
+#include<atomic>
+#include<cstdint>
+#include<iostream>
+#include<thread>
+
+const int switches_per_thread = 20000;
+const int frames_per_switch = 3;
+const uint32_t alive = 0x5eed5eed;
+
+std::atomic<int64_t> created {};
+std::atomic<int64_t> destroyed {};
+
+/*written by the audio thread while it plays, read and destroyed by a control thread*/
+struct Source
+{
+    uint32_t canary {alive};
+    uint64_t frames {};
+    Source() {created.fetch_add(1, std::memory_order_relaxed);}
+    ~Source()
+    {
+        if (canary != alive)
+            std::cout << "FAIL destroyed a source twice or a stray pointer\n";
+        canary = 0;
+        destroyed.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+enum class Events {retired, superseded};
+
+struct Command {Source* source;};
+struct Event {Events type; Source* source;};
+
+LockFreeQueue<Command, 64> commands {};
+LockFreeQueue<Event, 64> events {};
+std::atomic<Source*> fallback_slot {};
+std::atomic<bool> stop {false};
+std::atomic<bool> audio_done {false};
+
+/*the audio thread's side: pending switch, playing source, fallback on every 7th frame*/
+void audio_thread()
+{
+    Source* playing {new Source};
+    Source* pending {};
+    uint64_t frame {};
+    while (!stop.load(std::memory_order_acquire))
+    {
+        Command command {};
+        while (commands.pop(command))
+        {
+            if (pending)
+            {
+                while (!events.push({Events::superseded, pending}))
+                    std::this_thread::yield();
+            }
+            pending = command.source;
+        }
+
+        playing->frames++;
+        if (pending && ++frame % frames_per_switch == 0)
+        {
+            while (!events.push({Events::retired, playing}))
+                std::this_thread::yield();
+            playing = pending;
+            pending = nullptr;
+        }
+        /*the playing source fails and the fallback stands in, as in continue_streaming*/
+        if (frame % 7 == 0)
+        {
+            Source* fallback {fallback_slot.exchange(nullptr, std::memory_order_acq_rel)};
+            if (fallback)
+            {
+                while (!events.push({Events::retired, playing}))
+                    std::this_thread::yield();
+                playing = fallback;
+            }
+        }
+    }
+    while (!events.push({Events::retired, playing}))
+        std::this_thread::yield();
+    if (pending)
+    {
+        while (!events.push({Events::superseded, pending}))
+            std::this_thread::yield();
+    }
+    audio_done.store(true, std::memory_order_release);
+}
+
+/*collect_events(): destroys what came back and refills the fallback slot, only ever on one thread*/
+void collect()
+{
+    Event event {};
+    while (events.pop(event))
+        delete event.source;
+    if (!fallback_slot.load(std::memory_order_acquire))
+        fallback_slot.store(new Source, std::memory_order_release);
+}
+
+/*switch_source(): hands over a new source, which belongs to the audio thread once pushed*/
+void control_thread()
+{
+    for (int i = 0; i < switches_per_thread; i++)
+    {
+        Source* source {new Source};
+        while (!commands.push({source}))
+            std::this_thread::yield();
+    }
+}
+
+int main()
+{
+    std::thread audio {audio_thread};
+    std::thread control_a {control_thread};
+    std::thread control_b {control_thread};
+
+    std::atomic<int> control_done {};
+    std::thread joiner {[&]{control_a.join(); control_b.join(); control_done.store(1, std::memory_order_release);}};
+    while (!control_done.load(std::memory_order_acquire))
+        collect();
+    joiner.join();
+    stop.store(true, std::memory_order_release);
+    while (!audio_done.load(std::memory_order_acquire))
+        collect();
+    audio.join();
+    collect();
+    delete fallback_slot.exchange(nullptr);
+
+    const bool passed {created.load() == destroyed.load() && created.load() > 2 * switches_per_thread};
+    std::cout << created.load() << " sources created, " << destroyed.load() << " destroyed\n"
+              << (passed ? "handoff: passed\n" : "handoff: FAILED\n");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,328 @@
+#include "StandInServers.h"
+
+#include<algorithm>
+#include<cerrno>
+#include<cmath>
+
+#include<arpa/inet.h>
+#include<netinet/in.h>
+#include<poll.h>
+#include<sys/socket.h>
+#include<sys/time.h>
+#include<unistd.h>
+
+namespace
+{
+    /*a loopback listening socket, on a free port if port is 0, returns the fd and sets port to the bound port*/
+    int listen_on_loopback(int& port, int receive_buffer_bytes)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return -1;
+
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        /*accepted sockets inherit the receive buffer size, it has to be set before listen()*/
+        if (receive_buffer_bytes > 0)
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer_bytes, sizeof(receive_buffer_bytes));
+
+        struct sockaddr_in address {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<uint16_t>(port));
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+
+        if (bind(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0 || listen(fd, 16) < 0
+            || getsockname(fd, reinterpret_cast<struct sockaddr*>(&address), &length) < 0)
+        {
+            close(fd);
+            return -1;
+        }
+        port = ntohs(address.sin_port);
+        return fd;
+    }
+
+    /*waits up to timeout_ms for a connection, -1 if there wasn't one*/
+    int accept_with_timeout(int listen_fd, int timeout_ms)
+    {
+        struct pollfd listen_poll {listen_fd, POLLIN, 0};
+        if (poll(&listen_poll, 1, timeout_ms) <= 0)
+            return -1;
+        return accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    }
+}
+
+bool in_stall(const std::vector<Stall>& stalls, double seconds)
+{
+    return std::any_of(stalls.begin(), stalls.end(), [seconds](const Stall& stall)
+    {
+        return seconds >= stall.at_seconds && seconds < stall.at_seconds + stall.duration_seconds;
+    });
+}
+
+IcecastStandIn::IcecastStandIn(int port, std::vector<Stall> stalls, std::chrono::steady_clock::time_point epoch):
+    m_port {port},
+    m_stalls {std::move(stalls)},
+    m_epoch {epoch}
+{
+    m_listen_fd = listen_on_loopback(m_port, STAND_IN_RECEIVE_BUFFER_BYTES);
+    if (m_listen_fd < 0)
+        throw "Icecast stand-in: could not listen on loopback";
+}
+
+IcecastStandIn::~IcecastStandIn()
+{
+    stop();
+    if (m_listen_fd >= 0)
+        close(m_listen_fd);
+}
+
+void IcecastStandIn::start()
+{
+    m_thread = std::thread {&IcecastStandIn::run, this};
+}
+
+void IcecastStandIn::stop()
+{
+    m_stop = true;
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+double IcecastStandIn::seconds_since_epoch() const
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_epoch).count();
+}
+
+void IcecastStandIn::run()
+{
+    /*one source client at a time, like a single icecast mount*/
+    while (!m_stop)
+    {
+        int client_fd = accept_with_timeout(m_listen_fd, 200);
+        if (client_fd < 0)
+            continue;
+        serve_client(client_fd);
+        close(client_fd);
+    }
+}
+
+void IcecastStandIn::serve_client(int client_fd)
+{
+    std::string request {};
+    char buffer[4096];
+
+    /*the request line and headers*/
+    while (request.find("\r\n\r\n") == std::string::npos)
+    {
+        struct pollfd client_poll {client_fd, POLLIN, 0};
+        if (m_stop || poll(&client_poll, 1, 200) < 0)
+            return;
+        if (!(client_poll.revents & (POLLIN | POLLHUP)))
+            continue;
+        ssize_t nread = read(client_fd, buffer, sizeof(buffer));
+        if (nread <= 0 || request.size() > 16384)
+            return;
+        request.append(buffer, nread);
+    }
+
+    std::size_t header_end = request.find("\r\n\r\n") + 4;
+    if (request.compare(0, 4, "PUT ") != 0 && request.compare(0, 7, "SOURCE ") != 0)
+    {
+        const char response[] = "HTTP/1.0 405 Method Not Allowed\r\n\r\n";
+        send(client_fd, response, sizeof(response) - 1, MSG_NOSIGNAL);
+        return;
+    }
+
+    /*icecast answers 100 Continue when the client asks for it and 200 OK otherwise*/
+    std::string response {request.find("Expect: 100-continue") != std::string::npos ?
+                          "HTTP/1.1 100 Continue\r\n\r\n" : "HTTP/1.0 200 OK\r\n\r\n"};
+    send(client_fd, response.data(), response.size(), MSG_NOSIGNAL);
+
+    {
+        std::lock_guard<std::mutex> lock (m_mtx);
+        m_request = request.substr(0, header_end);
+        m_connections++;
+        /*anything after the headers is already stream data*/
+        m_received.insert(m_received.end(), request.begin() + header_end, request.end());
+        m_arrivals.push_back({m_received.size(), seconds_since_epoch()});
+    }
+
+    while (!m_stop)
+    {
+        /*during a stall leave the data in the socket, the small buffer fills and fondue's writes block*/
+        if (in_stall(m_stalls, seconds_since_epoch()))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+
+        struct pollfd client_poll {client_fd, POLLIN, 0};
+        if (poll(&client_poll, 1, 100) <= 0)
+            continue;
+        ssize_t nread = read(client_fd, buffer, sizeof(buffer));
+        if (nread < 0 && errno == EINTR)
+            continue;
+        if (nread <= 0)
+            return;
+
+        std::lock_guard<std::mutex> lock (m_mtx);
+        m_received.insert(m_received.end(), buffer, buffer + nread);
+        m_arrivals.push_back({m_received.size(), seconds_since_epoch()});
+    }
+}
+
+std::vector<uint8_t> IcecastStandIn::received() const
+{
+    std::lock_guard<std::mutex> lock (m_mtx);
+    return m_received;
+}
+
+std::vector<Arrival> IcecastStandIn::arrivals() const
+{
+    std::lock_guard<std::mutex> lock (m_mtx);
+    return m_arrivals;
+}
+
+std::string IcecastStandIn::request() const
+{
+    std::lock_guard<std::mutex> lock (m_mtx);
+    return m_request;
+}
+
+int IcecastStandIn::connections() const
+{
+    std::lock_guard<std::mutex> lock (m_mtx);
+    return m_connections;
+}
+
+ToneFeed::ToneFeed(int port, int sample_rate, double frequency, double marker_interval,
+                   std::vector<Stall> stalls, std::chrono::steady_clock::time_point epoch):
+    m_port {port},
+    m_sample_rate {sample_rate},
+    m_frequency {frequency},
+    m_marker_interval {marker_interval},
+    m_stalls {std::move(stalls)},
+    m_epoch {epoch}
+{
+    m_listen_fd = listen_on_loopback(m_port, 0);
+    if (m_listen_fd < 0)
+        throw "Tone feed: could not listen on loopback";
+}
+
+ToneFeed::~ToneFeed()
+{
+    stop();
+    if (m_listen_fd >= 0)
+        close(m_listen_fd);
+}
+
+void ToneFeed::start()
+{
+    m_accept_thread = std::thread {&ToneFeed::accept_clients, this};
+}
+
+void ToneFeed::stop()
+{
+    m_stop = true;
+    if (m_accept_thread.joinable())
+        m_accept_thread.join();
+
+    std::lock_guard<std::mutex> lock (m_mtx);
+    for (std::thread& client_thread : m_client_threads)
+    {
+        if (client_thread.joinable())
+            client_thread.join();
+    }
+    m_client_threads.clear();
+}
+
+void ToneFeed::accept_clients()
+{
+    while (!m_stop)
+    {
+        int client_fd = accept_with_timeout(m_listen_fd, 200);
+        if (client_fd < 0)
+            continue;
+        m_connections++;
+        std::lock_guard<std::mutex> lock (m_mtx);
+        m_client_threads.emplace_back(&ToneFeed::serve_client, this, client_fd);
+    }
+}
+
+int16_t ToneFeed::sample_at(int64_t position) const
+{
+    const double pi = 3.14159265358979323846;
+    const int64_t interval_samples = std::llround(m_marker_interval * m_sample_rate);
+    const int64_t marker_samples = static_cast<int64_t>(TONE_FEED_MARKER_MS) * m_sample_rate / 1000;
+
+    /*the first marker is one interval in, see marker_time()*/
+    int64_t into_interval = position % interval_samples;
+    if (position < interval_samples || into_interval >= marker_samples)
+        return 0;
+    return static_cast<int16_t>(std::lrint(TONE_FEED_AMPLITUDE * 32767 *
+                                           std::sin(2 * pi * m_frequency * into_interval / m_sample_rate)));
+}
+
+void ToneFeed::serve_client(int client_fd)
+{
+    const int channels = 2;
+    const int64_t chunk_samples = static_cast<int64_t>(TONE_FEED_CHUNK_MS) * m_sample_rate / 1000;
+    std::vector<int16_t> chunk {};
+
+    /*time out blocked sends now and then to notice stop()*/
+    struct timeval send_timeout {0, 200000};
+    setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+
+    auto live_position = [this]()
+    {
+        return static_cast<int64_t>(std::chrono::duration<double>(std::chrono::steady_clock::now() - m_epoch).count() * m_sample_rate);
+    };
+    /*join the timeline where it is now*/
+    int64_t position = live_position();
+
+    while (!m_stop)
+    {
+        int64_t live = live_position();
+        if (in_stall(m_stalls, static_cast<double>(live) / m_sample_rate))
+        {
+            /*a stalled live source loses what it would have sent*/
+            position = live;
+            std::this_thread::sleep_for(std::chrono::milliseconds(TONE_FEED_CHUNK_MS));
+            continue;
+        }
+        if (position >= live)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(TONE_FEED_CHUNK_MS / 2));
+            continue;
+        }
+
+        int64_t nb_samples = std::min(live - position, 10 * chunk_samples);
+        chunk.resize(nb_samples * channels);
+        for (int64_t i = 0; i < nb_samples; i++)
+        {
+            int16_t sample = sample_at(position + i);
+            chunk[i * channels] = sample;
+            chunk[i * channels + 1] = sample;
+        }
+
+        /*blocking send, if fondue stops reading the feed waits like a real server's socket would*/
+        const char* data = reinterpret_cast<const char*>(chunk.data());
+        std::size_t remaining = chunk.size() * sizeof(int16_t);
+        while (remaining > 0 && !m_stop)
+        {
+            ssize_t sent = send(client_fd, data, remaining, MSG_NOSIGNAL);
+            if (sent < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+                continue;
+            if (sent <= 0)
+            {
+                close(client_fd);
+                return;
+            }
+            data += sent;
+            remaining -= sent;
+        }
+        position += nb_samples;
+    }
+    close(client_fd);
+}
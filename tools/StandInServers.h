@@ -0,0 +1,136 @@
+/*
+* Loopback stand-ins for the network ends of fondue, used by the stream harness.
+*
+* IcecastStandIn accepts the icecast source protocol (an HTTP PUT, or the legacy SOURCE method,
+* followed by the encoded stream) and records every byte with the time it arrived. A small
+* receive buffer means a stall (not reading for a while) pushes back on fondue quickly, like a
+* congested uplink would.
+*
+* ToneFeed is a live source: raw s16le stereo served over TCP in realtime, silent apart from a
+* short tone burst every marker interval. Every connection joins the same timeline (as if tuning
+* in to a radio stream), so a marker's send time is known from its index alone and every feed
+* started from the same epoch carries its markers at the same moments. A stall stops sending for a
+* while, afterwards the feed carries on from the live position rather than catching up.
+*/
+
+#ifndef STANDINSERVERS_H
+#define STANDINSERVERS_H
+
+#include<atomic>
+#include<chrono>
+#include<cstdint>
+#include<mutex>
+#include<string>
+#include<thread>
+#include<vector>
+
+/*stand-in receive buffer, small so stalls reach fondue within a second or so*/
+#define STAND_IN_RECEIVE_BUFFER_BYTES 8192
+#define TONE_FEED_MARKER_MS 50
+#define TONE_FEED_AMPLITUDE 0.5
+/*samples sent per write, paced in realtime*/
+#define TONE_FEED_CHUNK_MS 10
+
+struct Stall
+{
+    double at_seconds {};
+    double duration_seconds {};
+};
+
+/*true if seconds (since the epoch) falls inside any of the stalls*/
+bool in_stall(const std::vector<Stall>& stalls, double seconds);
+
+/*one read from the source client, end_offset is the number of bytes received once it completed*/
+struct Arrival
+{
+    std::size_t end_offset {};
+    double seconds {};
+};
+
+class IcecastStandIn
+{
+    private:
+        int m_listen_fd {-1};
+        int m_port {};
+        std::vector<Stall> m_stalls;
+        std::chrono::steady_clock::time_point m_epoch;
+        std::atomic<bool> m_stop {false};
+        std::thread m_thread;
+
+        mutable std::mutex m_mtx;
+        std::vector<uint8_t> m_received {};
+        std::vector<Arrival> m_arrivals {};
+        std::string m_request {};
+        int m_connections {};
+
+        void run();
+        void serve_client(int client_fd);
+        double seconds_since_epoch() const;
+
+    public:
+        /*listens on 127.0.0.1, port 0 picks a free port, throws a const char* exception on failure*/
+        IcecastStandIn(int port, std::vector<Stall> stalls, std::chrono::steady_clock::time_point epoch);
+
+        ~IcecastStandIn();
+
+        IcecastStandIn(const IcecastStandIn&) = delete;
+        IcecastStandIn& operator= (const IcecastStandIn&) = delete;
+
+        int port() const {return m_port;}
+
+        void start();
+
+        void stop();
+
+        /*copies of what has been received so far*/
+        std::vector<uint8_t> received() const;
+        std::vector<Arrival> arrivals() const;
+        /*the request line and headers of the most recent source client*/
+        std::string request() const;
+        int connections() const;
+};
+
+class ToneFeed
+{
+    private:
+        int m_listen_fd {-1};
+        int m_port {};
+        int m_sample_rate;
+        double m_frequency;
+        double m_marker_interval;
+        std::vector<Stall> m_stalls;
+        std::chrono::steady_clock::time_point m_epoch;
+        std::atomic<bool> m_stop {false};
+        std::thread m_accept_thread;
+        std::mutex m_mtx;
+        std::vector<std::thread> m_client_threads {};
+        std::atomic<int> m_connections {};
+
+        void accept_clients();
+        void serve_client(int client_fd);
+        /*the sample of the shared timeline at position, silent apart from the markers*/
+        int16_t sample_at(int64_t position) const;
+
+    public:
+        /*listens on 127.0.0.1, port 0 picks a free port, throws a const char* exception on failure*/
+        ToneFeed(int port, int sample_rate, double frequency, double marker_interval,
+                 std::vector<Stall> stalls, std::chrono::steady_clock::time_point epoch);
+
+        ~ToneFeed();
+
+        ToneFeed(const ToneFeed&) = delete;
+        ToneFeed& operator= (const ToneFeed&) = delete;
+
+        int port() const {return m_port;}
+
+        void start();
+
+        void stop();
+
+        int connections() const {return m_connections.load();}
+
+        /*when marker number index starts, in seconds since the epoch. the first is one interval in*/
+        double marker_time(int index) const {return (index + 1) * m_marker_interval;}
+};
+
+#endif